@@ -4,6 +4,7 @@
 
 #include <memory>
 #include <functional>
+#include <atomic>
 #include <ucontext.h>
 
 namespace HPGS{
@@ -50,10 +51,12 @@ public:
 
     /**
      * @brief 将当前协程切换到运行状态
+     * @details 协程切出后返回，YieldToHold切出的在这里设置为HOLD
      * @pre getState() != EXEC
-     * @post getState() = EXEC
+     * @return 切出时的状态(READY, HOLD, TERM, EXCEPT)。
+     *         状态为HOLD时其他线程可能已经再次切入该协程，调用者只能使用返回值，不能再修改它的状态
      */
-    void swapIn();
+    State swapIn();
 
     /**
      * @brief 切换当前协程到后台
@@ -77,6 +80,16 @@ public:
 
     State getState() const { return m_state;}
 
+    /**
+     * @brief 返回协程的截止时间(GetCurrentMs()时钟，毫秒)，0表示没有截止时间
+     */
+    uint64_t getDeadline() const { return m_deadline; }
+
+    /**
+     * @brief 设置协程的截止时间，hook的IO和sleep最多等待到该时间
+     */
+    void setDeadline(uint64_t v) { m_deadline = v; }
+
 public:
     /**
      * @brief 设置当前线程运行的协程
@@ -102,10 +115,20 @@ public:
 
     /**
      * @brief 切换到后台并设置为HOLD状态
+     * @details 切出前状态保持EXEC，上下文保存完后由swapIn设置为HOLD。
+     *          切出前已经被放回调度器的协程，调度器取任务时跳过，HOLD之后才会被执行
      * @post getState() = HOLD
      */
     static void YieldToHold();
 
+    /**
+     * @brief 切换到后台并设置为HOLD状态，切出完成后在原线程上执行cb
+     * @details cb在swapIn返回前执行，此时协程已经是HOLD，可以在cb中把它交给唤醒方，
+     *          唤醒方不会在切出完成前看到它
+     * @post getState() = HOLD
+     */
+    static void YieldToHold(std::function<void()> cb);
+
     static uint64_t TotalFibres();
 
     /**
@@ -130,10 +153,14 @@ public:
 private:
     uint64_t m_id = 0;
     uint32_t m_stacksize = 0;
-    State m_state = INIT;
+    /// 切出协程的线程和切入协程的线程可能不同
+    std::atomic<State> m_state{INIT};
+    uint64_t m_deadline = 0;        //截止时间，0表示不限制
     ucontext_t m_ctx;
     void* m_stack = nullptr;        //协程拥有的栈空间指针
     std::function<void()> m_cb;
+    /// YieldToHold(cb)切出完成后执行
+    std::function<void()> m_parked;
 };
 
 }
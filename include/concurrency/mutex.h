@@ -12,7 +12,7 @@
 #include <list>
 
 #include "noncopyable.h"
-//#include "fibre.h"
+#include "fibre.h"
 
 
 namespace HPGS{
@@ -239,6 +239,10 @@ private:
 };
 
 class Scheduler;
+/**
+ * @brief 协程信号量
+ * @details wait时计数为0则挂起当前协程(不阻塞线程)，notify时把等待的协程重新放回它的调度器
+ */
 class FibreSemaphore : Noncopyable{
 public:
     typedef Spinlock MutexType;
@@ -246,16 +250,34 @@ public:
     FibreSemaphore(size_t initail_concurrency = 0);
     ~FibreSemaphore();
 
+    /**
+     * @brief 计数大于0时减1并返回true，否则立即返回false
+     */
     bool tryWait();
+
+    /**
+     * @brief 计数大于0时减1，否则挂起当前协程直到被notify
+     * @details 协程切出完成后才加入等待队列，notify不会唤醒还在执行的协程
+     * @pre 需要在调度器的协程中调用
+     */
     void wait();
+
+    /**
+     * @brief 有等待的协程时唤醒一个，否则计数加1
+     */
     void notify();
 
     size_t getConcurrency() const { return m_concurrency; }
     void reset() { m_concurrency = 0; }
 
+private:
+    /**
+     * @brief wait的协程切出完成后加入等待队列，期间有notify则直接重新调度
+     */
+    void park(Fibre* fibre);
 private:
     MutexType m_mutex;
-    //std::list<std::pair<Scheduler*, Fibre::ptr> > m_waiters;
+    std::list<std::pair<Scheduler*, Fibre::ptr> > m_waiters;
     size_t m_concurrency;
 };
 
@@ -40,6 +40,17 @@ public:
      */
     const std::string& getName() const { return m_name; }
 
+    /**
+     * @brief 返回工作线程数量(不包括use_caller的调用线程)
+     */
+    size_t getThreadCount() const { return m_threadCount; }
+
+    /**
+     * @brief 返回第idx个工作线程的id
+     * @return 调度器未启动或idx越界返回-1
+     */
+    int getWorkerThreadId(size_t idx) const;
+
     //返回当前协程调度器
     static Scheduler* GetThis();
 
@@ -7,6 +7,8 @@
 
 #include <memory>
 #include <string>
+#include <atomic>
+#include <type_traits>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -18,11 +20,63 @@ namespace HPGS {
  * @brief 二进制数组,提供基础类型的序列化,反序列化功能
  * @details 每次写入数据时，将数据写入到链表最后一个块中，如果最后一个块不足以容纳数据，则分配一个新的块并添加到链表结尾，再写入数据。
  * ByteArray会记录当前的操作位置，每次写入数据时，该操作位置按写入大小往后偏移，如果要读取数据，则必须调用setPosition重新设置当前的操作位置。
+ * 内存块从BlockPool分配，clear()和析构时归还给BlockPool而不是系统。
+ *
+ * 流模式(setStreaming(true))下读写游标分开: 写入总是追加在数据末尾(getSize())，读取从当前位置(getPosition())开始，
+ * 不需要setPosition回绕。读完的头部节点移到链表末尾重新用于写入，长连接的收发缓冲区不会一直增长。
+ * 流模式下收发配合getWriteBuffers/commitWrite和getReadBuffers/consume使用，不需要拷贝。
+ *
+ * 节点的内存块带引用计数，slice()返回的Slice直接引用内存块而不拷贝数据。
+ * 写入被Slice引用的内存块前先复制一份(写时复制)，已经取出的Slice内容不会被之后的写入、clear()或析构改变。
+ *
+ * MapFile()返回映射文件的ByteArray: 每个节点是文件中对应位置的一段mmap，读取和slice()直接访问映射的内存。
+ * 可写模式下写入直接修改文件(不做写时复制)，扩容时文件按节点大小增长，析构时截断到getSize()。
  */
 class ByteArray {
 public:
     typedef std::shared_ptr<ByteArray> ptr;
 
+    /**
+     * @brief 引用计数的内存块，被节点和Slice共享，引用计数归零时归还BlockPool
+     */
+    struct Block {
+        /// 内存来源
+        enum Type {
+            /// BlockPool
+            POOL,
+            /// 只读文件的私有映射
+            MMAP_PRIVATE,
+            /// 可写文件的共享映射，写入直接修改文件
+            MMAP_SHARED
+        };
+
+        Block(size_t s);
+        /**
+         * @brief 引用已经映射的内存，析构时munmap
+         */
+        Block(char* p, size_t s, Type t);
+        ~Block();
+
+        static void* operator new(size_t size);
+        static void operator delete(void* p, size_t size);
+
+        void ref() { refs.fetch_add(1, std::memory_order_relaxed);}
+        void unref();
+        /**
+         * @brief 是否还被其他节点或Slice引用
+         */
+        bool shared() const { return refs.load(std::memory_order_acquire) > 1;}
+
+        /// 内存地址
+        char* ptr;
+        /// 内存大小
+        size_t size;
+        /// 引用计数
+        std::atomic<uint32_t> refs;
+        /// 内存来源
+        Type type;
+    };
+
     /**
      * @brief ByteArray的存储节点
      */
@@ -39,11 +93,24 @@ public:
         Node();
 
         /**
-         * 析构函数,释放内存
+         * @brief 使用已有的内存块构造，接管b的一个引用
+         */
+        Node(Block* b);
+
+        /**
+         * 析构函数,释放对内存块的引用
          */
         ~Node();
 
-        /// 内存块地址指针
+        /**
+         * @brief 节点对象本身也从BlockPool分配
+         */
+        static void* operator new(size_t size);
+        static void operator delete(void* p, size_t size);
+
+        /// 引用计数的内存块
+        Block* block;
+        /// 内存块地址指针(block->ptr)
         char* ptr;
         /// 下一个内存块地址
         Node* next;
@@ -51,6 +118,106 @@ public:
         size_t size;
     };
 
+    /**
+     * @brief 数据的一段连续内存(类似string_view)，只在所属的Slice存在期间有效
+     */
+    struct Span {
+        /// 数据地址
+        const char* data;
+        /// 数据长度
+        size_t size;
+
+        std::string toString() const { return std::string(data, size);}
+    };
+
+    /**
+     * @brief ByteArray中一段数据的只读视图
+     * @details 由若干(内存块, 偏移, 长度)组成，拷贝Slice只增加内存块的引用计数。
+     *          可以切分、拼接，转成iovec发送，或者按Span逐段访问
+     */
+    class Slice {
+    friend class ByteArray;
+    public:
+        Slice();
+        Slice(const Slice& other);
+        Slice(Slice&& other);
+        Slice& operator=(const Slice& other);
+        Slice& operator=(Slice&& other);
+        ~Slice();
+
+        /**
+         * @brief 返回数据长度
+         */
+        size_t size() const { return m_size;}
+
+        /**
+         * @brief 是否为空
+         */
+        bool empty() const { return m_size == 0;}
+
+        /**
+         * @brief 返回连续内存段的个数
+         */
+        size_t getSpanCount() const { return m_chunks.size();}
+
+        /**
+         * @brief 返回第idx段连续内存
+         */
+        Span getSpan(size_t idx) const;
+
+        /**
+         * @brief 数据是否在一段连续内存中(可以直接getSpan(0)访问)
+         */
+        bool isContiguous() const { return m_chunks.size() <= 1;}
+
+        /**
+         * @brief 返回[position, position + len)的子视图，不拷贝
+         * @exception 超出范围时抛出 std::out_of_range
+         */
+        Slice slice(size_t position, size_t len) const;
+
+        /**
+         * @brief 把other拼接到末尾，不拷贝
+         */
+        void append(const Slice& other);
+
+        /**
+         * @brief 从position开始拷贝size字节到buf
+         * @exception 超出范围时抛出 std::out_of_range
+         */
+        void read(void* buf, size_t size, size_t position = 0) const;
+
+        /**
+         * @brief 拷贝成std::string
+         */
+        std::string toString() const;
+
+        /**
+         * @brief 把数据保存成iovec数组
+         * @param[in] len 最多的长度
+         * @return 返回实际数据的长度
+         */
+        uint64_t getBuffers(std::vector<iovec>& buffers, uint64_t len = ~0ull) const;
+
+        /**
+         * @brief 释放所有引用
+         */
+        void clear();
+    private:
+        /**
+         * @brief 引用block中[offset, offset + size)，和上一段相邻时合并
+         */
+        void push(Block* block, size_t offset, size_t size);
+    private:
+        struct Chunk {
+            Block* block;
+            size_t offset;
+            size_t size;
+        };
+        std::vector<Chunk> m_chunks;
+        size_t m_size;
+    };
+
     /**
      * @brief 使用指定长度的内存块构造ByteArray
      * @param[in] base_size 内存块大小
@@ -62,6 +229,38 @@ public:
      */
     ~ByteArray();
 
+    /**
+     * @brief 把文件映射成ByteArray
+     * @param[in] name 文件名
+     * @param[in] writable 是否可写，可写时文件不存在则创建
+     * @param[in] chunk_size 每个节点映射的大小，向上取整到页大小
+     * @return 失败返回nullptr
+     * @details 映射后getSize()为文件大小，当前位置为0，追加数据需要先setPosition(getSize())。
+     *          可写模式下映射期间文件大小是节点大小的整数倍，析构时截断到getSize()。
+     *          映射的ByteArray不支持流模式
+     */
+    static ByteArray::ptr MapFile(const std::string& name, bool writable = false
+                                  ,size_t chunk_size = 4 * 1024 * 1024);
+
+    /**
+     * @brief 是否映射了文件
+     */
+    bool isMapped() const { return m_fd >= 0;}
+
+    /**
+     * @brief 把写入映射的数据刷到文件(msync)
+     * @param[in] async 为true时只发起写回(MS_ASYNC)，否则等待写回完成(MS_SYNC)
+     * @return 没有映射文件或只读映射时返回true
+     */
+    bool sync(bool async = false);
+
+    /**
+     * @brief 对映射中[position, position + len)的内存设置访问模式(madvise)
+     * @param[in] advice 如MADV_SEQUENTIAL(顺序扫描)、MADV_WILLNEED(预读)、MADV_DONTNEED(释放已读的页)
+     * @return 没有映射文件时返回true
+     */
+    bool advise(int advice, size_t position = 0, size_t len = ~0ull);
+
     /**
      * @brief 写入固定长度int8_t类型的数据
      * @post m_position += sizeof(value)
@@ -131,6 +330,27 @@ public:
      */
     void writeUint32 (uint32_t value);
 
+    /**
+     * @brief 批量写入无符号Varint32类型的数据
+     * @post m_position += 所有值的编码长度之和
+     *       如果m_position > m_size 则 m_size = m_position
+     */
+    void writeUint32Array(const uint32_t* values, size_t count);
+
+    /**
+     * @brief 批量写入count个定长类型(整数、float、double)的数据(大端/小端)
+     * @details 需要转换字节序时按块直接转换到节点内存中，不逐个调用writeFxxx
+     * @post m_position += sizeof(T) * count
+     *       如果m_position > m_size 则 m_size = m_position
+     */
+    template<class T>
+    void writeFixedArray(const T* values, size_t count){
+        static_assert(std::is_arithmetic<T>::value
+                && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8)
+                , "writeFixedArray only supports 1/2/4/8 bytes arithmetic types");
+        writeFixed(values, sizeof(T), count);
+    }
+
     /**
      * @brief 写入有符号Varint64类型的数据
      * @post m_position += 实际占用内存(1 ~ 10)
@@ -274,6 +494,27 @@ public:
      */
     uint32_t readUint32();
 
+    /**
+     * @brief 批量读取count个无符号Varint32类型的数据
+     * @post m_position += 所有值的编码长度之和
+     * @exception 数据不足时抛出 std::out_of_range，之前已读取的值保留在values中
+     */
+    void readUint32Array(uint32_t* values, size_t count);
+
+    /**
+     * @brief 批量读取count个定长类型(整数、float、double)的数据(大端/小端)
+     * @pre getReadSize() >= sizeof(T) * count
+     * @post m_position += sizeof(T) * count
+     * @exception 如果getReadSize() < sizeof(T) * count 抛出 std::out_of_range
+     */
+    template<class T>
+    void readFixedArray(T* values, size_t count){
+        static_assert(std::is_arithmetic<T>::value
+                && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8)
+                , "readFixedArray only supports 1/2/4/8 bytes arithmetic types");
+        readFixed(values, sizeof(T), count);
+    }
+
     /**
      * @brief 读取有符号Varint64类型的数据
      * @pre getReadSize() >= 有符号Varint64实际占用内存
@@ -370,18 +611,74 @@ public:
      */
     void read(void* buf, size_t size, size_t position) const;
 
+    /**
+     * @brief 返回[position, position + len)的只读视图，不拷贝数据
+     * @exception 如果 (m_size - position) < len 则抛出 std::out_of_range
+     */
+    Slice slice(size_t position, size_t len) const;
+
+    /**
+     * @brief 读取len字节，返回引用这段数据的视图而不是拷贝
+     * @post m_position += len
+     * @exception 如果getReadSize() < len 则抛出 std::out_of_range
+     */
+    Slice readSlice(size_t len);
+
+    /**
+     * @brief 写入Slice的数据
+     * @details 节点是定长的(按位置O(1)定位)，数据逐段拷贝到本ByteArray的节点中
+     * @post m_position += s.size(), 如果m_position > m_size 则 m_size = m_position
+     */
+    void writeSlice(const Slice& s);
+
+    /**
+     * @brief 读取len字节，返回共享这段数据内存块的ByteArray，不拷贝数据
+     * @details 返回的ByteArray节点大小相同，节点引用本ByteArray的内存块，双方之后的写入都写时复制。
+     *          返回值的位置为0，大小为len。可写映射的ByteArray写入会修改文件，这时拷贝一份
+     * @post m_position += len
+     * @exception 如果getReadSize() < len 则抛出 std::out_of_range
+     */
+    ByteArray::ptr readShared(size_t len);
+
     /**
      * @brief 返回ByteArray当前位置
      */
-    size_t getPosition() const { return m_position;}
+    size_t getPosition() const { return m_position - m_origin;}
 
     /**
-     * @brief 设置ByteArray当前位置
+     * @brief 设置ByteArray当前位置，O(1)
      * @post 如果m_position > m_size 则 m_size = m_position
-     * @exception 如果m_position > m_capacity 则抛出 std::out_of_range
+     * @exception 如果m_position > m_capacity 则抛出 std::out_of_range，
+     *            流模式下m_position > m_size 也抛出 std::out_of_range
      */
     void setPosition(size_t v);
 
+    /**
+     * @brief 设置是否为流模式
+     * @details 开启时[0, m_position)中整块读完的节点立即回收；
+     *          关闭后恢复单游标，之后的写入从m_position开始，会覆盖未读的数据
+     */
+    void setStreaming(bool v);
+
+    /**
+     * @brief 是否为流模式
+     */
+    bool isStreaming() const { return m_streaming;}
+
+    /**
+     * @brief 数据已经写入getWriteBuffers返回的内存后，提交len字节
+     * @details 普通模式下等价于setPosition(getPosition() + len)，流模式下数据末尾后移len
+     * @exception 超过容量时抛出 std::out_of_range
+     */
+    void commitWrite(size_t len);
+
+    /**
+     * @brief 丢弃(已通过getReadBuffers处理的)len字节可读数据，当前位置后移len
+     * @details 流模式下读完的头部节点被回收
+     * @exception 如果len > getReadSize() 则抛出 std::out_of_range
+     */
+    void consume(size_t len);
+
     /**
      * @brief 把ByteArray的数据写入到文件中
      * @param[in] name 文件名
@@ -435,7 +732,7 @@ public:
     /**
      * @brief 获取可读取的缓存,保存成iovec数组,从position位置开始
      * @param[out] buffers 保存可读取数据的iovec数组
-     * @param[in] len 读取数据的长度,如果len > getReadSize() 则 len = getReadSize()
+     * @param[in] len 读取数据的长度,如果len > (m_size - position) 则 len = m_size - position
      * @param[in] position 读取数据的位置
      * @return 返回实际数据的长度
      */
@@ -446,14 +743,15 @@ public:
      * @param[out] buffers 保存可写入的内存的iovec数组
      * @param[in] len 写入的长度
      * @return 返回实际的长度
-     * @post 如果(m_position + len) > m_capacity 则 m_capacity扩容N个节点以容纳len长度
+     * @post 如果(m_position + len) > m_capacity 则 m_capacity扩容N个节点以容纳len长度，
+     *       流模式下从数据末尾(m_size)开始
      */
     uint64_t getWriteBuffers(std::vector<iovec>& buffers, uint64_t len);
 
     /**
      * @brief 返回数据的长度
      */
-    size_t getSize() const { return m_size;}
+    size_t getSize() const { return m_size - m_origin;}
 
 private:
     /**
@@ -466,6 +764,56 @@ private:
      */
     size_t getCapacity() const { return m_capacity - m_position;}
 
+    /**
+     * @brief 从position(位于cur节点内)开始写入size字节，cur移动到写入结束的位置
+     */
+    void copyIn(Node*& cur, size_t position, const void* buf, size_t size);
+
+    /**
+     * @brief 写入count个elem_size字节的元素，字节序不同时转换
+     */
+    void writeFixed(const void* values, size_t elem_size, size_t count);
+
+    /**
+     * @brief 读取count个elem_size字节的元素，字节序不同时转换
+     */
+    void readFixed(void* values, size_t elem_size, size_t count);
+
+    /**
+     * @brief 当前节点剩余至少8字节时直接在节点内存上解码varint
+     * @param[in] max_len 编码的最大长度，超过时交给逐字节的慢路径
+     * @return 编码的长度，不能走快速路径时返回0且位置不变
+     */
+    size_t readVarintFast(uint64_t& value, size_t max_len);
+
+    /**
+     * @brief 创建下一个节点，映射文件时映射文件中对应的位置
+     * @exception 映射失败时抛出 std::bad_alloc
+     */
+    Node* newNode();
+
+    /**
+     * @brief 映射文件中从offset开始的一个节点
+     * @exception 映射失败时抛出 std::bad_alloc
+     */
+    Node* mapNode(size_t offset);
+
+    /**
+     * @brief 写入前确保节点的内存块没有被Slice引用，被引用时换成一份拷贝(共享映射的内存块直接写入)
+     * @param[in] start 节点的起始位置，只拷贝其中[start, m_size)的有效数据
+     */
+    void unshare(Node* node, size_t start);
+
+    /**
+     * @brief 返回position所在的节点，position等于容量时返回NULL
+     */
+    Node* nodeAt(size_t position) const;
+
+    /**
+     * @brief 流模式下把读完的头部节点移到链表末尾
+     */
+    void compact();
+
 private:
     /// 内存块的大小
     size_t m_baseSize;
@@ -475,12 +823,27 @@ private:
     size_t m_capacity;
     /// 当前数据的大小
     size_t m_size;
+    /// 数据起点在第一个节点内的偏移，只有readShared返回的ByteArray不为0。
+    /// 内部的位置都包含这个偏移，getPosition/setPosition/getSize等对外的位置从起点算起
+    size_t m_origin;
     /// 字节序,默认大端
     int8_t m_endian;
+    /// 是否为流模式
+    bool m_streaming;
     /// 第一个内存块指针
     Node* m_root;
     /// 当前操作的内存块指针
     Node* m_cur;
+    /// 流模式下数据末尾所在的内存块指针
+    Node* m_writeCur;
+    /// 按顺序保存的所有内存块指针，按位置定位节点
+    std::vector<Node*> m_nodes;
+    /// 映射的文件句柄，没有映射时为-1
+    int m_fd;
+    /// 映射是否可写
+    bool m_mapWritable;
+    /// 映射期间的文件大小
+    size_t m_mapFileSize;
 };
 
 }
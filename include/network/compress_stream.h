@@ -0,0 +1,193 @@
+/**
+ * @file compress_stream.h
+ * @brief 流式压缩(zlib/gzip, zstd, lz4)
+ */
+#ifndef __HPGS_COMPRESS_STREAM_H__
+#define __HPGS_COMPRESS_STREAM_H__
+
+#include <memory>
+#include "stream.h"
+#include "bytearray.h"
+#include "noncopyable.h"
+
+namespace HPGS {
+
+/**
+ * @brief 流式压缩/解压器
+ * @details 输入可以分多次给出，输出直接写入ByteArray节点的内存(getWriteBuffers/commitWrite)，
+ *          输入为ByteArray时按节点逐段处理，都不需要把数据拼成一整块。
+ *          zlib总是可用，zstd和lz4在编译时找到库才可用(HPGS_HAVE_ZSTD, HPGS_HAVE_LZ4)
+ */
+class Codec : Noncopyable {
+public:
+    typedef std::shared_ptr<Codec> ptr;
+
+    /// 压缩算法
+    enum Type {
+        /// zlib格式的deflate
+        ZLIB = 1,
+        /// gzip格式的deflate
+        GZIP = 2,
+        /// zstd帧格式
+        ZSTD = 3,
+        /// lz4帧格式
+        LZ4 = 4
+    };
+
+    /// 输出方式
+    enum Flush {
+        /// 压缩器可以缓存输入
+        NONE = 0,
+        /// 输出目前为止所有输入对应的数据，对端可以完整解出
+        FLUSH = 1,
+        /// 结束当前压缩流，之后的输入开始新的压缩流
+        FINISH = 2
+    };
+
+    /**
+     * @brief 编译时是否找到了type对应的库
+     */
+    static bool IsSupported(Type type);
+
+    /**
+     * @brief 创建压缩器或解压器
+     * @param[in] compress true为压缩，false为解压
+     * @param[in] level 压缩级别，-1为算法默认级别
+     * @return 不支持的算法返回nullptr
+     */
+    static Codec::ptr Create(Type type, bool compress, int level = -1);
+
+    /**
+     * @brief 压缩src中可读的数据[position, size)，不改变src的位置
+     * @return 压缩后的数据(位置为0)，失败返回nullptr
+     */
+    static ByteArray::ptr Compress(Type type, const ByteArray& src, int level = -1);
+
+    /**
+     * @brief 解压src中可读的数据[position, size)，不改变src的位置
+     * @return 解压后的数据(位置为0)，数据错误或被截断返回nullptr
+     */
+    static ByteArray::ptr Decompress(Type type, const ByteArray& src);
+
+    Codec(Type type, bool compress) : m_type(type), m_compress(compress) {}
+
+    virtual ~Codec() {}
+
+    /**
+     * @brief 处理一段输入，输出追加写入out
+     * @param[in] flush 输出方式，解压时忽略
+     * @return 成功返回0，失败(数据错误)返回-1
+     */
+    virtual int process(const void* data, size_t len, ByteArray& out, Flush flush = NONE) = 0;
+
+    /**
+     * @brief 处理in中从当前位置开始的len字节，不改变in的位置
+     */
+    int process(const ByteArray& in, size_t len, ByteArray& out, Flush flush = NONE);
+
+    /**
+     * @brief 丢弃内部状态，重新开始一个压缩流
+     */
+    virtual void reset() = 0;
+
+    Type getType() const { return m_type;}
+
+    bool isCompress() const { return m_compress;}
+
+    /**
+     * @brief 解压时是否停在一个压缩流的中间(已经输入了数据，还没有到流的结尾)
+     * @details 输入全部给完之后仍为true说明数据被截断
+     */
+    bool isInStream() const { return m_inStream;}
+protected:
+    Type m_type;
+    bool m_compress;
+    /// 解压器是否处在一个压缩流的中间
+    bool m_inStream = false;
+};
+
+/**
+ * @brief 压缩流，包装另一个Stream
+ * @details 写入的数据压缩后写到内部的流，从内部的流读到的数据解压后返回。
+ *          写入的数据可能留在压缩器中，需要对端及时收到时调用flush()，结束时调用close()写出压缩流的结尾
+ */
+class CompressStream : public Stream {
+public:
+    typedef std::shared_ptr<CompressStream> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] stream 内部的流
+     * @param[in] type 压缩算法，不支持时isValid()返回false
+     * @param[in] level 压缩级别
+     */
+    CompressStream(Stream::ptr stream, Codec::Type type, int level = -1);
+
+    /**
+     * @brief 压缩算法是否可用
+     */
+    bool isValid() const { return m_compressor && m_decompressor;}
+
+    /**
+     * @brief 读取解压后的数据
+     * @return 同Stream::read，解压数据错误或内部的流在压缩流中间结束返回-1
+     */
+    virtual int read(void* buffer, size_t length) override;
+
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 压缩后写入内部的流
+     * @return 成功返回length
+     */
+    virtual int write(const void* buffer, size_t length) override;
+
+    /**
+     * @brief 压缩ba从当前位置开始的length字节后写入内部的流，ba的位置后移
+     */
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 把压缩器中缓存的数据写到内部的流
+     * @return 成功返回0
+     */
+    int flush();
+
+    /**
+     * @brief 写出压缩流的结尾后关闭内部的流
+     */
+    virtual void close() override;
+
+    Stream::ptr getStream() const { return m_stream;}
+
+    /// 写入的原始字节数
+    uint64_t getRawWritten() const { return m_rawWritten;}
+    /// 写到内部的流的压缩后字节数
+    uint64_t getCompressedWritten() const { return m_compressedWritten;}
+private:
+    /**
+     * @brief 把m_wbuf中的压缩数据全部写到内部的流
+     */
+    int sendOut();
+
+    /**
+     * @brief m_rbuf为空时从内部的流读取并解压
+     */
+    int fill();
+private:
+    Stream::ptr m_stream;
+    Codec::ptr m_compressor;
+    Codec::ptr m_decompressor;
+    /// 待写出的压缩数据
+    ByteArray::ptr m_wbuf;
+    /// 读到的压缩数据
+    ByteArray::ptr m_cbuf;
+    /// 解压后还没有读走的数据
+    ByteArray::ptr m_rbuf;
+    uint64_t m_rawWritten;
+    uint64_t m_compressedWritten;
+};
+
+}
+
+#endif
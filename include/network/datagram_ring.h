@@ -0,0 +1,175 @@
+#ifndef __HPGS_DATAGRAM_RING_H__
+#define __HPGS_DATAGRAM_RING_H__
+
+
+#include <memory>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include "bytearray.h"
+#include "myaddress.h"
+#include "noncopyable.h"
+
+//旧版本头文件没有定义
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+
+namespace HPGS{
+
+/**
+ * @brief UDP批量收发的报文环
+ * @details 预先分配count个固定大小的槽位(ByteArray的节点，每个节点一个槽位)和对应的mmsghdr，
+ *          Socket::recvBatch/sendBatch直接在槽位上调用recvmmsg/sendmmsg，收发过程没有内存分配。
+ *          接收后每个报文的来源地址保留在槽位中，直接sendBatch就是原路回复
+ */
+class DatagramRing : Noncopyable {
+public:
+    typedef std::shared_ptr<DatagramRing> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] count 槽位个数(一次最多收发的报文数)
+     * @param[in] slot_size 每个槽位的字节数，开启UDP_GRO时需要能放下合并后的报文(最大64KB)
+     */
+    DatagramRing(size_t count = 64, size_t slot_size = 2048);
+
+    /**
+     * @brief 返回槽位个数
+     */
+    size_t getCount() const { return m_slots.size();}
+
+    /**
+     * @brief 返回槽位大小
+     */
+    size_t getSlotSize() const { return m_slotSize;}
+
+    /**
+     * @brief 返回当前的报文数
+     */
+    size_t size() const { return m_size;}
+
+    /**
+     * @brief 是否没有报文
+     */
+    bool empty() const { return m_size == 0;}
+
+    /**
+     * @brief 是否已满
+     */
+    bool full() const { return m_size == m_slots.size();}
+
+    /**
+     * @brief 清空报文
+     */
+    void clear() { m_size = 0;}
+
+    /**
+     * @brief 返回第i个报文的数据
+     */
+    const void* data(size_t i) const { return m_iovs[i].iov_base;}
+
+    /**
+     * @brief 返回第i个报文的长度
+     */
+    size_t length(size_t i) const { return m_iovs[i].iov_len;}
+
+    /**
+     * @brief 返回第i个报文的对端地址(接收时为来源，发送时为目标)
+     */
+    const sockaddr* getAddr(size_t i) const { return (const sockaddr*)&m_names[i];}
+
+    /**
+     * @brief 返回第i个报文的对端地址长度
+     */
+    socklen_t getAddrLen(size_t i) const { return m_msgs[i].msg_hdr.msg_namelen;}
+
+    /**
+     * @brief 创建第i个报文的对端地址对象(有内存分配)
+     */
+    Address::ptr getAddress(size_t i) const;
+
+    /**
+     * @brief 返回第i个报文的对端地址(值类型，没有堆分配)
+     */
+    SockAddr getSockAddr(size_t i) const { return SockAddr(getAddr(i), getAddrLen(i));}
+
+    /**
+     * @brief 返回第i个报文的分段大小
+     * @details 接收时为UDP_GRO合并前每个报文的大小(0表示没有合并)，
+     *          发送时为push指定的UDP_SEGMENT大小
+     */
+    uint16_t getSegmentSize(size_t i) const { return m_segments[i];}
+
+    /**
+     * @brief 在末尾追加一个待发送的报文(拷贝到槽位)
+     * @param[in] data 数据
+     * @param[in] len 数据长度，不能超过槽位大小
+     * @param[in] to 目标地址，已连接的socket可以为nullptr
+     * @param[in] segment_size 大于0时由内核按该大小切分成多个报文发送(UDP_SEGMENT)
+     * @return 已满或数据过长返回false
+     */
+    bool push(const void* data, size_t len, Address::ptr to = nullptr, uint16_t segment_size = 0);
+
+    /**
+     * @brief 在末尾追加一个待发送的报文
+     * @param[in] to 目标地址
+     * @param[in] to_len 目标地址长度
+     */
+    bool push(const void* data, size_t len, const sockaddr* to, socklen_t to_len, uint16_t segment_size = 0);
+
+    /**
+     * @brief 准备接收，清空报文并把所有槽位交给recvmmsg
+     * @return mmsghdr数组，长度为getCount()
+     */
+    mmsghdr* prepareRecv();
+
+    /**
+     * @brief recvmmsg返回后记录收到的报文数，解析UDP_GRO分段大小
+     */
+    void commitRecv(size_t n);
+
+    /**
+     * @brief 返回从第start个报文开始的mmsghdr，用于sendmmsg
+     */
+    mmsghdr* sendHeaders(size_t start = 0) { return &m_msgs[start];}
+private:
+    /**
+     * @brief 设置第i个mmsghdr指向槽位，控制信息缓冲区交给内核填写
+     */
+    void resetHeader(size_t i);
+
+    /**
+     * @brief 设置第i个报文发送时的UDP_SEGMENT控制信息，0表示不切分
+     */
+    void setSegmentControl(size_t i, uint16_t segment_size);
+private:
+    /// 槽位大小
+    size_t m_slotSize;
+    /// 当前的报文数
+    size_t m_size;
+    /// 槽位内存
+    ByteArray m_buffer;
+    /// 每个槽位的内存(指向m_buffer的节点)
+    std::vector<iovec> m_slots;
+    /// 每个报文的数据(长度为实际长度)
+    std::vector<iovec> m_iovs;
+    /// 每个报文的地址
+    std::vector<sockaddr_storage> m_names;
+    /// 每个报文的控制信息
+    std::vector<char> m_control;
+    /// 每个报文的分段大小
+    std::vector<uint16_t> m_segments;
+    std::vector<mmsghdr> m_msgs;
+};
+
+}
+
+#endif
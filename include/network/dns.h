@@ -0,0 +1,160 @@
+#ifndef __HPGS_DNS_H__
+#define __HPGS_DNS_H__
+
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include "myaddress.h"
+#include "mutex.h"
+#include "singleton.h"
+#include "noncopyable.h"
+
+
+namespace HPGS{
+
+/**
+ * @brief 协程化的DNS解析器
+ * @details Address::Lookup使用getaddrinfo，会阻塞工作线程且每次都访问网络。
+ *          DnsResolver通过UDP Socket向域名服务器查询(hook后等待应答时只挂起当前协程)，
+ *          AF_UNSPEC时A和AAAA两个查询同时发出。
+ *          结果按记录的TTL缓存，不存在的域名和没有该类型记录的域名按SOA的TTL做否定缓存。
+ *          解析顺序: IP字面量 > /etc/hosts > 缓存 > 域名服务器。
+ *          域名服务器默认取自/etc/resolv.conf，可以由配置dns.servers或setServers()覆盖
+ */
+class DnsResolver : Noncopyable {
+public:
+    typedef std::shared_ptr<DnsResolver> ptr;
+    typedef RWMutex RWMutexType;
+
+    /// 记录类型
+    enum Type {
+        A = 1,
+        AAAA = 28
+    };
+
+    /**
+     * @brief 构造函数，读取/etc/hosts和域名服务器
+     */
+    DnsResolver();
+
+    ~DnsResolver();
+
+    /**
+     * @brief 解析域名
+     * @param[out] result 保存解析出的地址
+     * @param[in] host 域名，例: www.baidu.com[:80]，IPv6字面量写成[::1]:80，端口只支持数字
+     * @param[in] family 协议簇(AF_INET, AF_INET6, AF_UNSPEC)
+     * @return 是否解析出了地址
+     */
+    bool lookup(std::vector<Address::ptr>& result, const std::string& host, int family = AF_INET);
+
+    /**
+     * @brief 解析域名，返回任意一个地址
+     * @return 失败返回nullptr
+     */
+    IPAddress::ptr lookupAny(const std::string& host, int family = AF_INET);
+
+    /**
+     * @brief 设置域名服务器，为空时恢复使用配置和/etc/resolv.conf
+     */
+    void setServers(const std::vector<Address::ptr>& v);
+
+    /**
+     * @brief 返回当前使用的域名服务器
+     */
+    std::vector<Address::ptr> getServers();
+
+    /**
+     * @brief 清空缓存
+     */
+    void clearCache();
+
+    /**
+     * @brief 返回缓存的条目数(包括否定缓存)
+     */
+    size_t getCacheSize();
+
+    /// 发往域名服务器的查询数
+    uint64_t getQueryCount() const { return m_queries;}
+    /// 命中缓存的次数
+    uint64_t getCacheHitCount() const { return m_cacheHits;}
+    /// 命中否定缓存的次数
+    uint64_t getNegativeHitCount() const { return m_negativeHits;}
+    /// 所有域名服务器都没有应答的次数
+    uint64_t getFailCount() const { return m_fails;}
+private:
+    /**
+     * @brief 缓存条目，addrs为空表示否定缓存
+     */
+    struct Entry {
+        std::vector<IPAddress::ptr> addrs;
+        uint64_t expire_ms = 0;
+    };
+
+    /**
+     * @brief 向域名服务器查询多个类型的记录
+     * @param[in] name 域名
+     * @param[in] types 记录类型
+     * @param[out] result 有确定应答(包括不存在)的类型的结果
+     * @return 是否所有类型都得到了确定应答
+     */
+    bool query(const std::string& name, const std::vector<uint16_t>& types
+               ,std::map<uint16_t, Entry>& result);
+
+    /**
+     * @brief 向一个域名服务器同时发出多个查询
+     * @param[in, out] types 待查询的类型，得到确定应答的类型被移除
+     * @param[in] tcp 是否使用TCP。UDP应答被截断(TC)的类型改用TCP重新查询
+     */
+    void queryServer(Address::ptr server, const std::string& name
+                     ,std::vector<uint16_t>& types, std::map<uint16_t, Entry>& result
+                     ,bool tcp = false);
+
+    /**
+     * @brief 查找缓存
+     * @return 是否命中(包括否定缓存)
+     */
+    bool findCache(const std::string& key, Entry& entry);
+
+    /**
+     * @brief 写入缓存
+     */
+    void putCache(const std::string& key, const Entry& entry);
+
+    /**
+     * @brief 读取/etc/hosts
+     */
+    void loadHosts();
+
+    /**
+     * @brief 读取/etc/resolv.conf中的域名服务器
+     */
+    static std::vector<Address::ptr> LoadResolvConf();
+private:
+    RWMutexType m_mutex;
+    /// dns.servers配置变更的监听器
+    uint64_t m_listenerId;
+    /// setServers设置的域名服务器
+    std::vector<Address::ptr> m_servers;
+    /// 配置或/etc/resolv.conf中的域名服务器
+    std::vector<Address::ptr> m_defaultServers;
+    /// /etc/hosts中的域名
+    std::unordered_map<std::string, std::vector<IPAddress::ptr> > m_hosts;
+    /// 域名/类型 -> 缓存条目
+    std::unordered_map<std::string, Entry> m_cache;
+
+    std::atomic<uint64_t> m_queries{0};
+    std::atomic<uint64_t> m_cacheHits{0};
+    std::atomic<uint64_t> m_negativeHits{0};
+    std::atomic<uint64_t> m_fails{0};
+};
+
+typedef Singleton<DnsResolver> DnsResolverMgr;
+
+}
+
+#endif
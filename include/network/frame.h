@@ -0,0 +1,92 @@
+/**
+ * @file frame.h
+ * @brief 带长度前缀的消息帧
+ */
+#ifndef __HPGS_FRAME_H__
+#define __HPGS_FRAME_H__
+
+#include <memory>
+#include <string>
+#include "bytearray.h"
+
+namespace HPGS {
+
+/**
+ * @brief 消息帧
+ * @details 帧头固定12字节，网络字节序:
+ *          | magic(2) | version(1) | flags(1) | id(4) | length(4) |，之后是length字节的消息体。
+ *          id由请求方分配，响应帧使用请求的id，同一连接上可以同时有多个未完成的请求
+ */
+class Frame {
+public:
+    typedef std::shared_ptr<Frame> ptr;
+
+    /// 帧头魔数 'HP'
+    static const uint16_t MAGIC = 0x4850;
+    /// 协议版本
+    static const uint8_t VERSION = 1;
+    /// 帧头长度
+    static const size_t HEADER_SIZE = 12;
+
+    /// 帧标志位
+    enum Flag {
+        /// 响应帧
+        RESPONSE = 0x01,
+        /// 响应的消息体是错误信息
+        ERROR = 0x02,
+        /// 请求不需要响应
+        ONEWAY = 0x04
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] body 消息体，为nullptr时创建一个空的ByteArray
+     */
+    Frame(uint32_t id = 0, uint8_t flags = 0, ByteArray::ptr body = nullptr);
+
+    uint32_t getId() const { return m_id;}
+    void setId(uint32_t v) { m_id = v;}
+
+    uint8_t getFlags() const { return m_flags;}
+    void setFlags(uint8_t v) { m_flags = v;}
+    bool hasFlag(Flag f) const { return m_flags & f;}
+
+    /**
+     * @brief 返回消息体，编码时取当前位置之后的可读数据
+     */
+    ByteArray::ptr getBody() const { return m_body;}
+    void setBody(ByteArray::ptr v) { m_body = v;}
+
+    std::string toString() const;
+private:
+    uint32_t m_id;
+    uint8_t m_flags;
+    ByteArray::ptr m_body;
+};
+
+/**
+ * @brief 消息帧编解码
+ */
+class FrameCodec {
+public:
+    /**
+     * @brief 把帧头和消息体追加写入out，不改变消息体的位置
+     */
+    static void Encode(ByteArray& out, const Frame& frame);
+
+    /**
+     * @brief 从in的当前位置解出一帧
+     * @details 数据完整时帧从in中取走(流模式下读完的节点被回收)，否则in不变，
+     *          等收到更多数据后再次调用。消息体不拷贝，和in共享内存块，从消息体的当前位置开始读
+     * @param[out] frame 解出的帧
+     * @return
+     *      @retval 1 解出一帧
+     *      @retval 0 数据不完整
+     *      @retval -1 魔数或版本不对、长度超过frame.max_body_size，连接应当关闭
+     */
+    static int Decode(ByteArray& in, Frame::ptr& frame);
+};
+
+}
+
+#endif
@@ -41,6 +41,7 @@ public:
      * @param[in] type socket类型，SOCK_STREAM, SOCK_DGRAM 等
      * @param[in] protocol 协议，IPPROTO_TCP, IPPROTO_UDP 等
      * @return 返回是否成功
+     * @attention getaddrinfo没有hook，会阻塞当前线程，协程中请使用DnsResolver
      */
     static bool Lookup(std::vector<Address::ptr>& result, const std::string& host
                       , int family = AF_INET, int type = 0, int protocol = 0);
@@ -322,11 +323,105 @@ private:
     sockaddr m_addr;
 };
 
+/**
+ * @brief 值类型的socket地址(sockaddr_storage + 长度)
+ * @details 可以直接交给accept/getpeername/recvfrom填写，复制和比较都不需要堆分配，
+ *          可以作为std::unordered_map/std::map的key。需要多态接口时用toAddress()转换
+ */
+class SockAddr {
+public:
+    SockAddr();
+
+    /**
+     * @brief 从sockaddr复制，长度超过sockaddr_storage时为空地址
+     */
+    SockAddr(const sockaddr* addr, socklen_t len);
+
+    /**
+     * @brief 从Address复制
+     */
+    explicit SockAddr(const Address& addr);
+
+    /**
+     * @brief 返回地址的最大长度，作为getpeername等的缓冲区长度
+     */
+    static socklen_t Capacity() { return sizeof(sockaddr_storage);}
+
+    const sockaddr* getAddr() const { return (const sockaddr*)&m_addr;}
+    sockaddr* getAddr() { return (sockaddr*)&m_addr;}
+    socklen_t getAddrLen() const { return m_len;}
+
+    /**
+     * @brief 设置系统调用填写后的实际长度
+     */
+    void setAddrLen(socklen_t v) { m_len = v > Capacity() ? Capacity() : v;}
+
+    /**
+     * @brief 是否为空地址
+     */
+    bool empty() const { return m_len == 0;}
+
+    /**
+     * @brief 清空
+     */
+    void clear() { m_len = 0; m_addr.ss_family = AF_UNSPEC;}
+
+    int getFamily() const { return m_len ? m_addr.ss_family : AF_UNSPEC;}
+
+    /**
+     * @brief 返回端口号，非IP地址返回0
+     */
+    uint16_t getPort() const;
+
+    /**
+     * @brief 设置端口号，非IP地址忽略
+     */
+    void setPort(uint16_t v);
+
+    /**
+     * @brief 转换成Address对象(有堆分配)，空地址返回nullptr
+     */
+    Address::ptr toAddress() const;
+
+    /**
+     * @brief 返回可读字符串，IPv4: 1.2.3.4:80，IPv6: [::1]:80
+     */
+    std::string toString() const;
+
+    /**
+     * @brief 哈希值
+     */
+    size_t hash() const;
+
+    bool operator<(const SockAddr& rhs) const;
+    bool operator==(const SockAddr& rhs) const;
+    bool operator!=(const SockAddr& rhs) const { return !(*this == rhs);}
+private:
+    sockaddr_storage m_addr;
+    socklen_t m_len;
+};
+
 /**
  * @brief 流式输出Address
  */
 std::ostream& operator<<(std::ostream& os, const Address& addr);
 
+/**
+ * @brief 流式输出SockAddr
+ */
+std::ostream& operator<<(std::ostream& os, const SockAddr& addr);
+
+}
+
+namespace std {
+
+template<>
+struct hash<HPGS::SockAddr> {
+    size_t operator()(const HPGS::SockAddr& addr) const {
+        return addr.hash();
+    }
+};
+
 }
 
 #endif
\ No newline at end of file
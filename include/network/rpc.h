@@ -0,0 +1,213 @@
+/**
+ * @file rpc.h
+ * @brief 基于消息帧的RPC，同一连接上多个请求并发(流水线)，按请求id匹配响应
+ */
+#ifndef __HPGS_RPC_H__
+#define __HPGS_RPC_H__
+
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <unordered_map>
+#include "frame.h"
+#include "tcp_server.h"
+#include "socket_stream.h"
+#include "mutex.h"
+
+namespace HPGS {
+
+/**
+ * @brief RPC调用结果
+ * @details 大于0的值是服务端处理函数返回的错误码
+ */
+enum RpcResult {
+    /// 成功
+    RPC_OK = 0,
+    /// 超时
+    RPC_TIMEOUT = -1,
+    /// 连接已关闭或发送失败
+    RPC_CLOSED = -2,
+    /// 服务端没有注册该方法
+    RPC_NOT_FOUND = -3
+};
+
+/**
+ * @brief 一条连接上的帧收发
+ * @details 多个协程可以同时调用sendFrame: 帧先编码进待发送缓冲区，当前没有协程在发送时由调用者发送，
+ *          否则交给正在发送的协程，在它的下一次写中一起发出，多个小帧合并成一次writev。
+ *          recvFrame只能由一个协程调用
+ */
+class RpcSession : public std::enable_shared_from_this<RpcSession>
+                   , Noncopyable {
+public:
+    typedef std::shared_ptr<RpcSession> ptr;
+    typedef Mutex MutexType;
+
+    RpcSession(Socket::ptr sock);
+
+    /**
+     * @brief 接收一帧
+     * @return 1 成功，0 对端关闭，-1 socket错误或协议错误
+     */
+    int recvFrame(Frame::ptr& frame);
+
+    /**
+     * @brief 发送一帧
+     * @return 0 已发送或已交给正在发送的协程，-1 连接已关闭或发送失败
+     */
+    int sendFrame(const Frame& frame);
+
+    /**
+     * @brief 关闭连接，recvFrame返回，之后的sendFrame失败
+     */
+    void close();
+
+    bool isConnected() const { return !m_closed && m_stream->isConnected();}
+
+    Socket::ptr getSocket() const { return m_stream->getSocket();}
+private:
+    SocketStream::ptr m_stream;
+    /// 收到还没有解出帧的数据
+    ByteArray::ptr m_rbuf;
+    MutexType m_mutex;
+    /// 待发送的帧
+    ByteArray::ptr m_wbuf;
+    /// 上一次发送完的缓冲区，留给下一批帧使用
+    ByteArray::ptr m_spare;
+    /// 是否有协程正在发送
+    bool m_writing;
+    std::atomic<bool> m_closed;
+};
+
+/**
+ * @brief RPC服务器
+ * @details 请求的消息体是方法名(writeStringVint)加参数，每个请求在process_worker上单独的协程中处理，
+ *          处理完立即返回响应，不等同一连接上之前的请求
+ */
+class RpcServer : public TcpServer {
+public:
+    typedef std::shared_ptr<RpcServer> ptr;
+    typedef RWMutex RWMutexType;
+
+    /**
+     * @brief 请求处理函数
+     * @param[in] request 请求参数，位置在参数开头
+     * @param[out] response 响应数据
+     * @return 0 成功，大于0的错误码原样返回给调用方，response作为错误信息
+     */
+    typedef std::function<int(ByteArray::ptr request, ByteArray::ptr response)> Handler;
+
+    RpcServer(HPGS::IOManager* worker = HPGS::IOManager::GetThis()
+              ,HPGS::IOManager* io_worker = HPGS::IOManager::GetThis()
+              ,HPGS::IOManager* accept_worker = HPGS::IOManager::GetThis());
+
+    /**
+     * @brief 注册方法，同名的覆盖
+     */
+    void addMethod(const std::string& name, Handler handler);
+
+    void delMethod(const std::string& name);
+
+    /**
+     * @brief 返回累计处理的请求数
+     */
+    uint64_t getRequestCount() const { return m_requestCount;}
+protected:
+    virtual void handleClient(Socket::ptr client) override;
+
+    /**
+     * @brief 处理一个请求并发送响应
+     */
+    void handleRequest(RpcSession::ptr session, Frame::ptr request);
+private:
+    RWMutexType m_mutex;
+    std::unordered_map<std::string, Handler> m_methods;
+    std::atomic<uint64_t> m_requestCount{0};
+};
+
+/**
+ * @brief RPC客户端
+ * @details 一条连接，多个协程可以同时call，请求按发出顺序写出，响应按id交给对应的调用者。
+ *          连接后有一个接收协程，调用close()或释放最后一个引用时关闭连接
+ */
+class RpcClient : public std::enable_shared_from_this<RpcClient>
+                  , Noncopyable {
+public:
+    typedef std::shared_ptr<RpcClient> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] iom 接收协程和超时定时器所在的调度器
+     */
+    RpcClient(IOManager* iom = IOManager::GetThis());
+
+    ~RpcClient();
+
+    /**
+     * @brief 连接服务器并启动接收协程
+     */
+    bool connect(Address::ptr addr, uint64_t timeout_ms = -1);
+
+    /**
+     * @brief 调用方法，挂起当前协程直到收到响应、超时或连接关闭
+     * @param[in] request 请求参数，取当前位置之后的可读数据，位置不变
+     * @param[out] response 响应数据(服务端返回错误码时为错误信息)
+     * @param[in] timeout_ms 超时时间，-1不超时
+     * @return RpcResult或服务端返回的错误码
+     */
+    int call(const std::string& method, ByteArray::ptr request
+             ,ByteArray::ptr& response, uint64_t timeout_ms = -1);
+
+    /**
+     * @brief 发送不需要响应的请求
+     * @return RPC_OK 或 RPC_CLOSED
+     */
+    int notify(const std::string& method, ByteArray::ptr request);
+
+    /**
+     * @brief 关闭连接，等待中的调用返回RPC_CLOSED
+     */
+    void close();
+
+    bool isConnected() const { return m_session && m_session->isConnected();}
+
+    /**
+     * @brief 返回等待响应的调用数
+     */
+    size_t getPendingCount();
+private:
+    struct Call {
+        typedef std::shared_ptr<Call> ptr;
+        FibreSemaphore sem;
+        int result = RPC_OK;
+        ByteArray::ptr response;
+    };
+
+    /**
+     * @brief 组装请求帧并发送
+     */
+    int send(const std::string& method, ByteArray::ptr request, uint32_t id, uint8_t flags);
+
+    /**
+     * @brief 接收协程，只持有连接，客户端已经析构时退出
+     */
+    static void DoRecv(std::weak_ptr<RpcClient> weak_self, RpcSession::ptr session);
+
+    /**
+     * @brief 结束id对应的调用，调用已经结束时什么也不做
+     */
+    void finish(uint32_t id, int result, ByteArray::ptr response);
+private:
+    IOManager* m_iom;
+    RpcSession::ptr m_session;
+    std::atomic<uint32_t> m_nextId{0};
+    MutexType m_mutex;
+    /// 等待响应的调用
+    std::unordered_map<uint32_t, Call::ptr> m_calls;
+    bool m_closed = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,544 @@
+/**
+ * @file serialize.h
+ * @brief 基于ByteArray的结构体序列化(编译期生成编解码)
+ */
+#ifndef __HPGS_SERIALIZE_H__
+#define __HPGS_SERIALIZE_H__
+
+#include <string>
+#include <vector>
+#include <list>
+#include <set>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include "bytearray.h"
+
+/**
+ * @brief 声明结构体参与序列化的字段，在Type所在的命名空间中使用，字段需要可以访问
+ * @details 字段按声明顺序编码，整数为Varint(有符号用zigzag)，容器先写Varint元素个数。
+ *          支持基础类型、枚举、std::string、std::pair、vector/list/set/map/unordered_set/unordered_map
+ *          以及同样声明了HPGS_SERIALIZE的嵌套结构体，最多64个字段。
+ * @code
+ * struct Point { int32_t x; int32_t y; };
+ * HPGS_SERIALIZE(Point, x, y)
+ * @endcode
+ */
+#define HPGS_SERIALIZE(Type, ...) \
+    HPGS_SERIALIZE_IMPL(Type, false, __VA_ARGS__)
+
+/**
+ * @brief 可演进的结构体，编码前加Varint长度
+ * @details 新版本只能在末尾追加字段: 旧数据缺少的字段保持默认值，新数据多出的字段被跳过
+ */
+#define HPGS_SERIALIZE_VERSIONED(Type, ...) \
+    HPGS_SERIALIZE_IMPL(Type, true, __VA_ARGS__)
+
+#define HPGS_SERIALIZE_IMPL(Type, versioned, ...) \
+    template<class Archive> \
+    inline void HPGSVisitFields(Archive& ar, Type& v) { \
+        HPGS_PP_FOR_EACH(HPGS_SERIALIZE_FIELD, __VA_ARGS__) \
+    } \
+    inline bool HPGSIsVersioned(const Type*) { return versioned;}
+
+#define HPGS_SERIALIZE_FIELD(field) ar(v.field);
+
+#define HPGS_PP_CAT(a, b) HPGS_PP_CAT_I(a, b)
+#define HPGS_PP_CAT_I(a, b) a ## b
+
+#define HPGS_PP_NARG(...) HPGS_PP_NARG_I(__VA_ARGS__, \
+    64, 63, 62, 61, 60, 59, 58, 57, 56, 55, 54, 53, 52, 51, 50, 49, \
+    48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, \
+    32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, \
+    16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define HPGS_PP_NARG_I( \
+    _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, \
+    _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, \
+    _33, _34, _35, _36, _37, _38, _39, _40, _41, _42, _43, _44, _45, _46, _47, _48, \
+    _49, _50, _51, _52, _53, _54, _55, _56, _57, _58, _59, _60, _61, _62, _63, _64, N, ...) N
+
+#define HPGS_PP_FOR_EACH(m, ...) \
+    HPGS_PP_CAT(HPGS_PP_FE_, HPGS_PP_NARG(__VA_ARGS__))(m, __VA_ARGS__)
+
+#define HPGS_PP_FE_1(m, x) m(x)
+#define HPGS_PP_FE_2(m, x, ...) m(x) HPGS_PP_FE_1(m, __VA_ARGS__)
+#define HPGS_PP_FE_3(m, x, ...) m(x) HPGS_PP_FE_2(m, __VA_ARGS__)
+#define HPGS_PP_FE_4(m, x, ...) m(x) HPGS_PP_FE_3(m, __VA_ARGS__)
+#define HPGS_PP_FE_5(m, x, ...) m(x) HPGS_PP_FE_4(m, __VA_ARGS__)
+#define HPGS_PP_FE_6(m, x, ...) m(x) HPGS_PP_FE_5(m, __VA_ARGS__)
+#define HPGS_PP_FE_7(m, x, ...) m(x) HPGS_PP_FE_6(m, __VA_ARGS__)
+#define HPGS_PP_FE_8(m, x, ...) m(x) HPGS_PP_FE_7(m, __VA_ARGS__)
+#define HPGS_PP_FE_9(m, x, ...) m(x) HPGS_PP_FE_8(m, __VA_ARGS__)
+#define HPGS_PP_FE_10(m, x, ...) m(x) HPGS_PP_FE_9(m, __VA_ARGS__)
+#define HPGS_PP_FE_11(m, x, ...) m(x) HPGS_PP_FE_10(m, __VA_ARGS__)
+#define HPGS_PP_FE_12(m, x, ...) m(x) HPGS_PP_FE_11(m, __VA_ARGS__)
+#define HPGS_PP_FE_13(m, x, ...) m(x) HPGS_PP_FE_12(m, __VA_ARGS__)
+#define HPGS_PP_FE_14(m, x, ...) m(x) HPGS_PP_FE_13(m, __VA_ARGS__)
+#define HPGS_PP_FE_15(m, x, ...) m(x) HPGS_PP_FE_14(m, __VA_ARGS__)
+#define HPGS_PP_FE_16(m, x, ...) m(x) HPGS_PP_FE_15(m, __VA_ARGS__)
+#define HPGS_PP_FE_17(m, x, ...) m(x) HPGS_PP_FE_16(m, __VA_ARGS__)
+#define HPGS_PP_FE_18(m, x, ...) m(x) HPGS_PP_FE_17(m, __VA_ARGS__)
+#define HPGS_PP_FE_19(m, x, ...) m(x) HPGS_PP_FE_18(m, __VA_ARGS__)
+#define HPGS_PP_FE_20(m, x, ...) m(x) HPGS_PP_FE_19(m, __VA_ARGS__)
+#define HPGS_PP_FE_21(m, x, ...) m(x) HPGS_PP_FE_20(m, __VA_ARGS__)
+#define HPGS_PP_FE_22(m, x, ...) m(x) HPGS_PP_FE_21(m, __VA_ARGS__)
+#define HPGS_PP_FE_23(m, x, ...) m(x) HPGS_PP_FE_22(m, __VA_ARGS__)
+#define HPGS_PP_FE_24(m, x, ...) m(x) HPGS_PP_FE_23(m, __VA_ARGS__)
+#define HPGS_PP_FE_25(m, x, ...) m(x) HPGS_PP_FE_24(m, __VA_ARGS__)
+#define HPGS_PP_FE_26(m, x, ...) m(x) HPGS_PP_FE_25(m, __VA_ARGS__)
+#define HPGS_PP_FE_27(m, x, ...) m(x) HPGS_PP_FE_26(m, __VA_ARGS__)
+#define HPGS_PP_FE_28(m, x, ...) m(x) HPGS_PP_FE_27(m, __VA_ARGS__)
+#define HPGS_PP_FE_29(m, x, ...) m(x) HPGS_PP_FE_28(m, __VA_ARGS__)
+#define HPGS_PP_FE_30(m, x, ...) m(x) HPGS_PP_FE_29(m, __VA_ARGS__)
+#define HPGS_PP_FE_31(m, x, ...) m(x) HPGS_PP_FE_30(m, __VA_ARGS__)
+#define HPGS_PP_FE_32(m, x, ...) m(x) HPGS_PP_FE_31(m, __VA_ARGS__)
+#define HPGS_PP_FE_33(m, x, ...) m(x) HPGS_PP_FE_32(m, __VA_ARGS__)
+#define HPGS_PP_FE_34(m, x, ...) m(x) HPGS_PP_FE_33(m, __VA_ARGS__)
+#define HPGS_PP_FE_35(m, x, ...) m(x) HPGS_PP_FE_34(m, __VA_ARGS__)
+#define HPGS_PP_FE_36(m, x, ...) m(x) HPGS_PP_FE_35(m, __VA_ARGS__)
+#define HPGS_PP_FE_37(m, x, ...) m(x) HPGS_PP_FE_36(m, __VA_ARGS__)
+#define HPGS_PP_FE_38(m, x, ...) m(x) HPGS_PP_FE_37(m, __VA_ARGS__)
+#define HPGS_PP_FE_39(m, x, ...) m(x) HPGS_PP_FE_38(m, __VA_ARGS__)
+#define HPGS_PP_FE_40(m, x, ...) m(x) HPGS_PP_FE_39(m, __VA_ARGS__)
+#define HPGS_PP_FE_41(m, x, ...) m(x) HPGS_PP_FE_40(m, __VA_ARGS__)
+#define HPGS_PP_FE_42(m, x, ...) m(x) HPGS_PP_FE_41(m, __VA_ARGS__)
+#define HPGS_PP_FE_43(m, x, ...) m(x) HPGS_PP_FE_42(m, __VA_ARGS__)
+#define HPGS_PP_FE_44(m, x, ...) m(x) HPGS_PP_FE_43(m, __VA_ARGS__)
+#define HPGS_PP_FE_45(m, x, ...) m(x) HPGS_PP_FE_44(m, __VA_ARGS__)
+#define HPGS_PP_FE_46(m, x, ...) m(x) HPGS_PP_FE_45(m, __VA_ARGS__)
+#define HPGS_PP_FE_47(m, x, ...) m(x) HPGS_PP_FE_46(m, __VA_ARGS__)
+#define HPGS_PP_FE_48(m, x, ...) m(x) HPGS_PP_FE_47(m, __VA_ARGS__)
+#define HPGS_PP_FE_49(m, x, ...) m(x) HPGS_PP_FE_48(m, __VA_ARGS__)
+#define HPGS_PP_FE_50(m, x, ...) m(x) HPGS_PP_FE_49(m, __VA_ARGS__)
+#define HPGS_PP_FE_51(m, x, ...) m(x) HPGS_PP_FE_50(m, __VA_ARGS__)
+#define HPGS_PP_FE_52(m, x, ...) m(x) HPGS_PP_FE_51(m, __VA_ARGS__)
+#define HPGS_PP_FE_53(m, x, ...) m(x) HPGS_PP_FE_52(m, __VA_ARGS__)
+#define HPGS_PP_FE_54(m, x, ...) m(x) HPGS_PP_FE_53(m, __VA_ARGS__)
+#define HPGS_PP_FE_55(m, x, ...) m(x) HPGS_PP_FE_54(m, __VA_ARGS__)
+#define HPGS_PP_FE_56(m, x, ...) m(x) HPGS_PP_FE_55(m, __VA_ARGS__)
+#define HPGS_PP_FE_57(m, x, ...) m(x) HPGS_PP_FE_56(m, __VA_ARGS__)
+#define HPGS_PP_FE_58(m, x, ...) m(x) HPGS_PP_FE_57(m, __VA_ARGS__)
+#define HPGS_PP_FE_59(m, x, ...) m(x) HPGS_PP_FE_58(m, __VA_ARGS__)
+#define HPGS_PP_FE_60(m, x, ...) m(x) HPGS_PP_FE_59(m, __VA_ARGS__)
+#define HPGS_PP_FE_61(m, x, ...) m(x) HPGS_PP_FE_60(m, __VA_ARGS__)
+#define HPGS_PP_FE_62(m, x, ...) m(x) HPGS_PP_FE_61(m, __VA_ARGS__)
+#define HPGS_PP_FE_63(m, x, ...) m(x) HPGS_PP_FE_62(m, __VA_ARGS__)
+#define HPGS_PP_FE_64(m, x, ...) m(x) HPGS_PP_FE_63(m, __VA_ARGS__)
+
+namespace HPGS {
+
+/**
+ * @brief 返回无符号Varint的编码长度
+ */
+inline size_t VarintSize(uint64_t v){
+    size_t len = 1;
+    while(v >= 0x80){
+        v >>= 7;
+        ++len;
+    }
+    return len;
+}
+
+/**
+ * @brief zigzag编码后的Varint长度
+ */
+inline size_t SignedVarintSize(int64_t v){
+    return VarintSize(((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+/**
+ * @brief 类型T的编解码(默认实现用于声明了HPGS_SERIALIZE的结构体)
+ */
+template<class T, class Enable = void>
+class Serializer;
+
+/**
+ * @brief 写入字段
+ */
+class SerializeWriter {
+public:
+    SerializeWriter(ByteArray& ba) : m_ba(ba) {}
+
+    template<class T>
+    void operator()(const T& v){
+        Serializer<T>::Write(m_ba, v);
+    }
+private:
+    ByteArray& m_ba;
+};
+
+/**
+ * @brief 计算字段编码后的长度
+ */
+class SerializeSizer {
+public:
+    SerializeSizer() : m_size(0) {}
+
+    template<class T>
+    void operator()(const T& v){
+        m_size += Serializer<T>::Size(v);
+    }
+
+    size_t getSize() const { return m_size;}
+private:
+    size_t m_size;
+};
+
+/**
+ * @brief 读取字段，可演进的结构体数据读完后剩下的字段保持默认值
+ */
+class SerializeReader {
+public:
+    /**
+     * @param[in] end 结构体数据结束时ByteArray剩余的可读长度
+     */
+    SerializeReader(ByteArray& ba, bool versioned, size_t end)
+        :m_ba(ba), m_versioned(versioned), m_end(end) {}
+
+    template<class T>
+    void operator()(T& v){
+        if(!m_versioned || m_ba.getReadSize() > m_end){
+            Serializer<T>::Read(m_ba, v);
+        }
+    }
+private:
+    ByteArray& m_ba;
+    bool m_versioned;
+    size_t m_end;
+};
+
+/**
+ * @brief 结构体，字段由HPGS_SERIALIZE声明
+ */
+template<class T, class Enable>
+class Serializer {
+public:
+    static void Write(ByteArray& ba, const T& v){
+        SerializeWriter writer(ba);
+        if(HPGSIsVersioned((const T*)nullptr)){
+            ba.writeUint64(BodySize(v));
+        }
+        //SerializeWriter只读取字段
+        HPGSVisitFields(writer, const_cast<T&>(v));
+    }
+
+    static void Read(ByteArray& ba, T& v){
+        if(!HPGSIsVersioned((const T*)nullptr)){
+            SerializeReader reader(ba, false, 0);
+            HPGSVisitFields(reader, v);
+            return;
+        }
+        uint64_t len = ba.readUint64();
+        if(len > ba.getReadSize()){
+            throw std::out_of_range("serialize struct len out of range");
+        }
+        size_t end = ba.getReadSize() - len;
+        SerializeReader reader(ba, true, end);
+        HPGSVisitFields(reader, v);
+        if(ba.getReadSize() < end){
+            throw std::out_of_range("serialize struct field out of range");
+        }
+        //跳过新版本追加的字段
+        ba.consume(ba.getReadSize() - end);
+    }
+
+    static size_t Size(const T& v){
+        size_t size = BodySize(v);
+        if(HPGSIsVersioned((const T*)nullptr)){
+            size += VarintSize(size);
+        }
+        return size;
+    }
+private:
+    static size_t BodySize(const T& v){
+        SerializeSizer sizer;
+        HPGSVisitFields(sizer, const_cast<T&>(v));
+        return sizer.getSize();
+    }
+};
+
+#define HPGS_SERIALIZER(type, write_fun, read_fun, size_expr) \
+    template<> \
+    class Serializer<type> { \
+    public: \
+        static void Write(ByteArray& ba, const type& v){ \
+            ba.write_fun(v); \
+        } \
+        static void Read(ByteArray& ba, type& v){ \
+            v = ba.read_fun(); \
+        } \
+        static size_t Size(const type& v){ \
+            return size_expr; \
+        } \
+    };
+
+HPGS_SERIALIZER(bool, writeFuint8, readFuint8, 1)
+HPGS_SERIALIZER(char, writeFint8, readFint8, 1)
+HPGS_SERIALIZER(int8_t, writeFint8, readFint8, 1)
+HPGS_SERIALIZER(uint8_t, writeFuint8, readFuint8, 1)
+HPGS_SERIALIZER(int16_t, writeFint16, readFint16, 2)
+HPGS_SERIALIZER(uint16_t, writeFuint16, readFuint16, 2)
+HPGS_SERIALIZER(int32_t, writeInt32, readInt32, SignedVarintSize(v))
+HPGS_SERIALIZER(uint32_t, writeUint32, readUint32, VarintSize(v))
+HPGS_SERIALIZER(int64_t, writeInt64, readInt64, SignedVarintSize(v))
+HPGS_SERIALIZER(uint64_t, writeUint64, readUint64, VarintSize(v))
+HPGS_SERIALIZER(float, writeFloat, readFloat, 4)
+HPGS_SERIALIZER(double, writeDouble, readDouble, 8)
+HPGS_SERIALIZER(std::string, writeStringVint, readStringVint, VarintSize(v.size()) + v.size())
+
+#undef HPGS_SERIALIZER
+
+/**
+ * @brief 枚举按有符号Varint编码
+ */
+template<class T>
+class Serializer<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+public:
+    static void Write(ByteArray& ba, const T& v){
+        ba.writeInt64((int64_t)v);
+    }
+    static void Read(ByteArray& ba, T& v){
+        v = (T)ba.readInt64();
+    }
+    static size_t Size(const T& v){
+        return SignedVarintSize((int64_t)v);
+    }
+};
+
+template<class A, class B>
+class Serializer<std::pair<A, B> > {
+public:
+    static void Write(ByteArray& ba, const std::pair<A, B>& v){
+        Serializer<A>::Write(ba, v.first);
+        Serializer<B>::Write(ba, v.second);
+    }
+    static void Read(ByteArray& ba, std::pair<A, B>& v){
+        Serializer<A>::Read(ba, v.first);
+        Serializer<B>::Read(ba, v.second);
+    }
+    static size_t Size(const std::pair<A, B>& v){
+        return Serializer<A>::Size(v.first) + Serializer<B>::Size(v.second);
+    }
+};
+
+/**
+ * @brief 数组元素的批量编解码，定长类型走ByteArray的批量接口，其他类型逐个编解码
+ */
+template<class T>
+inline void WriteElements(ByteArray& ba, const T* v, size_t count){
+    for(size_t i = 0; i < count; ++i){
+        Serializer<T>::Write(ba, v[i]);
+    }
+}
+
+template<class T>
+inline void ReadElements(ByteArray& ba, T* v, size_t count){
+    for(size_t i = 0; i < count; ++i){
+        Serializer<T>::Read(ba, v[i]);
+    }
+}
+
+#define XX(type) \
+    inline void WriteElements(ByteArray& ba, const type* v, size_t count){ \
+        ba.writeFixedArray(v, count); \
+    } \
+    inline void ReadElements(ByteArray& ba, type* v, size_t count){ \
+        ba.readFixedArray(v, count); \
+    }
+
+XX(char)
+XX(int8_t)
+XX(uint8_t)
+XX(int16_t)
+XX(uint16_t)
+XX(float)
+XX(double)
+#undef XX
+
+inline void WriteElements(ByteArray& ba, const uint32_t* v, size_t count){
+    ba.writeUint32Array(v, count);
+}
+
+inline void ReadElements(ByteArray& ba, uint32_t* v, size_t count){
+    ba.readUint32Array(v, count);
+}
+
+template<class T>
+class Serializer<std::vector<T> > {
+public:
+    static void Write(ByteArray& ba, const std::vector<T>& v){
+        ba.writeUint64(v.size());
+        if(!v.empty()){
+            WriteElements(ba, &v[0], v.size());
+        }
+    }
+    static void Read(ByteArray& ba, std::vector<T>& v){
+        uint64_t count = ba.readUint64();
+        //每个元素至少1字节，防止错误的长度导致分配大量内存
+        if(count > ba.getReadSize()){
+            throw std::out_of_range("serialize vector count out of range");
+        }
+        v.resize(count);
+        if(count){
+            ReadElements(ba, &v[0], count);
+        }
+    }
+    static size_t Size(const std::vector<T>& v){
+        size_t size = VarintSize(v.size());
+        for(auto& i : v){
+            size += Serializer<T>::Size(i);
+        }
+        return size;
+    }
+};
+
+/**
+ * @brief std::vector<bool>没有连续的bool数组
+ */
+template<>
+class Serializer<std::vector<bool> > {
+public:
+    static void Write(ByteArray& ba, const std::vector<bool>& v){
+        ba.writeUint64(v.size());
+        for(size_t i = 0; i < v.size(); ++i){
+            ba.writeFuint8(v[i]);
+        }
+    }
+    static void Read(ByteArray& ba, std::vector<bool>& v){
+        uint64_t count = ba.readUint64();
+        if(count > ba.getReadSize()){
+            throw std::out_of_range("serialize vector count out of range");
+        }
+        v.resize(count);
+        for(size_t i = 0; i < count; ++i){
+            v[i] = ba.readFuint8();
+        }
+    }
+    static size_t Size(const std::vector<bool>& v){
+        return VarintSize(v.size()) + v.size();
+    }
+};
+
+/**
+ * @brief 逐个编码元素的容器，Read时用insert(end(), value)逐个插入
+ */
+template<class C>
+class SequenceSerializer {
+public:
+    typedef typename C::value_type value_type;
+
+    static void Write(ByteArray& ba, const C& v){
+        ba.writeUint64(v.size());
+        for(auto& i : v){
+            Serializer<value_type>::Write(ba, i);
+        }
+    }
+    static void Read(ByteArray& ba, C& v){
+        uint64_t count = ba.readUint64();
+        if(count > ba.getReadSize()){
+            throw std::out_of_range("serialize container count out of range");
+        }
+        v.clear();
+        for(uint64_t i = 0; i < count; ++i){
+            value_type tmp;
+            Serializer<value_type>::Read(ba, tmp);
+            v.insert(v.end(), std::move(tmp));
+        }
+    }
+    static size_t Size(const C& v){
+        size_t size = VarintSize(v.size());
+        for(auto& i : v){
+            size += Serializer<value_type>::Size(i);
+        }
+        return size;
+    }
+};
+
+/**
+ * @brief 键值对容器，元素依次编码键和值
+ */
+template<class C>
+class MapSerializer {
+public:
+    typedef typename C::key_type key_type;
+    typedef typename C::mapped_type mapped_type;
+
+    static void Write(ByteArray& ba, const C& v){
+        ba.writeUint64(v.size());
+        for(auto& i : v){
+            Serializer<key_type>::Write(ba, i.first);
+            Serializer<mapped_type>::Write(ba, i.second);
+        }
+    }
+    static void Read(ByteArray& ba, C& v){
+        uint64_t count = ba.readUint64();
+        if(count > ba.getReadSize()){
+            throw std::out_of_range("serialize map count out of range");
+        }
+        v.clear();
+        for(uint64_t i = 0; i < count; ++i){
+            key_type key;
+            Serializer<key_type>::Read(ba, key);
+            Serializer<mapped_type>::Read(ba, v[key]);
+        }
+    }
+    static size_t Size(const C& v){
+        size_t size = VarintSize(v.size());
+        for(auto& i : v){
+            size += Serializer<key_type>::Size(i.first) + Serializer<mapped_type>::Size(i.second);
+        }
+        return size;
+    }
+};
+
+template<class T>
+class Serializer<std::list<T> > : public SequenceSerializer<std::list<T> > {
+};
+
+template<class T>
+class Serializer<std::set<T> > : public SequenceSerializer<std::set<T> > {
+};
+
+template<class T>
+class Serializer<std::unordered_set<T> > : public SequenceSerializer<std::unordered_set<T> > {
+};
+
+template<class K, class V>
+class Serializer<std::map<K, V> > : public MapSerializer<std::map<K, V> > {
+};
+
+template<class K, class V>
+class Serializer<std::unordered_map<K, V> > : public MapSerializer<std::unordered_map<K, V> > {
+};
+
+/**
+ * @brief 把v编码写入ba
+ */
+template<class T>
+void Serialize(ByteArray& ba, const T& v){
+    Serializer<T>::Write(ba, v);
+}
+
+/**
+ * @brief 从ba解码到v
+ * @exception 数据不足或长度错误时抛出 std::out_of_range
+ */
+template<class T>
+void Deserialize(ByteArray& ba, T& v){
+    Serializer<T>::Read(ba, v);
+}
+
+/**
+ * @brief 返回v编码后的长度
+ */
+template<class T>
+size_t SerializedSize(const T& v){
+    return Serializer<T>::Size(v);
+}
+
+}
+
+#endif
@@ -3,6 +3,9 @@
 
 
 #include <memory>
+#include <functional>
+#include <vector>
+#include <deque>
 #include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -10,6 +13,8 @@
 #include <openssl/ssl.h>
 #include "noncopyable.h"
 #include "myaddress.h"
+#include "datagram_ring.h"
+#include "mutex.h"
 
 
 namespace HPGS{
@@ -119,6 +124,17 @@ public:
      */
     void setRecvTimeout(int64_t v);
 
+    /**
+     * @brief 设置SO_REUSEPORT，需要在bind之前设置
+     * @details 多个socket可以监听同一个地址，由内核在它们之间分配新连接
+     */
+    void setReusePort(bool v);
+
+    /**
+     * @brief 是否设置了SO_REUSEPORT
+     */
+    bool isReusePort() const { return m_reusePort;}
+
     /**
      * @brief 获取socketopt @see getsockopt
      */
@@ -153,6 +169,22 @@ public:
      */
     virtual Socket::ptr accept();
 
+    /**
+     * @brief 不等待地接收一个已完成握手的连接
+     * @return 成功返回新连接的socket，没有待接收的连接或失败返回nullptr(errno为EAGAIN表示没有连接)
+     * @pre Socket 必须bind,listen,成功
+     */
+    Socket::ptr tryAccept();
+
+    /**
+     * @brief 批量接收连接
+     * @details 先等待第一个连接，然后不等待地继续接收，直到没有待接收的连接或达到max
+     * @param[out] socks 新连接追加到末尾
+     * @param[in] max 最多接收的连接数
+     * @return 本次接收的连接数
+     */
+    size_t acceptBatch(std::vector<Socket::ptr>& socks, size_t max);
+
     /**
      * @brief 绑定地址
      * @param[in] addr 地址
@@ -179,6 +211,8 @@ public:
 
     /**
      * @brief 关闭socket
+     * @details 有零拷贝发送未完成时最多等待socket.zerocopy_close_timeout毫秒，
+     *          仍未完成则只shutdown，fd和holder留到内核报告全部完成后再关闭和释放
      */
     virtual bool close();
 
@@ -232,6 +266,60 @@ public:
      */
     virtual int sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags = 0);
 
+    /**
+     * @brief 发送文件内容(sendfile，数据不经过用户态)
+     * @param[in] fd 文件fd
+     * @param[in] offset 文件偏移
+     * @param[in] length 发送的长度
+     * @return
+     *      @retval >0 发送成功对应大小的数据(可能小于length)
+     *      @retval =0 socket被关闭或文件已读完
+     *      @retval <0 socket出错
+     */
+    virtual int64_t sendFile(int fd, off_t offset, size_t length);
+
+    /**
+     * @brief 零拷贝发送(MSG_ZEROCOPY)
+     * @details 需要先setZeroCopy(true)，数据量小于socket.zerocopy_threshold或未开启时退化为send。
+     *          内核直接引用用户内存发送，holder会被保留到内核通过错误队列通知发送完成，
+     *          在此之前holder指向的数据不能修改
+     * @param[in] buffers 待发送数据的内存(iovec数组)
+     * @param[in] length 待发送数据的长度(iovec长度)
+     * @param[in] holder 持有buffers内存的对象(如ByteArray::Slice，写时复制保证数据不被修改)
+     * @param[in] flags 标志字
+     * @return 同send
+     */
+    virtual int sendZeroCopy(const iovec* buffers, size_t length, std::shared_ptr<void> holder, int flags = 0);
+
+    /**
+     * @brief 开启/关闭SO_ZEROCOPY
+     * @return 内核不支持时返回false
+     */
+    bool setZeroCopy(bool v);
+
+    /**
+     * @brief 是否开启零拷贝发送
+     */
+    bool isZeroCopy() const { return m_zeroCopy;}
+
+    /**
+     * @brief 等待所有零拷贝发送完成，释放对应的holder
+     * @details 内核的完成通知放在错误队列，fd上报告POLLERR，poll等待POLLERR期间挂起协程
+     * @param[in] timeout_ms 超时时间(毫秒)，-1一直等待
+     * @return 全部完成返回true，超时返回false
+     */
+    bool flushZeroCopy(uint64_t timeout_ms = -1);
+
+    /**
+     * @brief 返回还没有收到完成通知的零拷贝发送次数
+     */
+    size_t getZeroCopyPending() const;
+
+    /**
+     * @brief 返回内核回退为拷贝发送的零拷贝次数(如回环网卡)
+     */
+    uint64_t getZeroCopyCopied() const { return m_zcCopied;}
+
     /**
      * @brief 接受数据
      * @param[out] buffer 接收数据的内存
@@ -283,15 +371,62 @@ public:
     virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0);
 
     /**
-     * @brief 获取远端地址
+     * @brief 批量接收报文(recvmmsg)
+     * @param[in, out] ring 报文环，原有报文被清空，收到的报文从0开始存放
+     * @param[in] flags 标志字
+     * @return
+     *      @retval > 0 收到的报文数
+     *      @retval = 0 没有报文(非阻塞)
+     *      @retval < 0 socket出错
+     * @details 没有报文时挂起协程，有报文时返回当前所有已到达的(最多ring.getCount()个)
+     */
+    int recvBatch(DatagramRing& ring, int flags = 0);
+
+    /**
+     * @brief 批量发送报文环中的所有报文(sendmmsg)
+     * @param[in] ring 报文环
+     * @param[in] flags 标志字
+     * @return 发送成功的报文数，第一个报文就失败时返回-1
+     */
+    int sendBatch(DatagramRing& ring, int flags = 0);
+
+    /**
+     * @brief 设置UDP_SEGMENT(GSO)，之后每次发送的数据由内核按size切分成多个报文
+     * @param[in] size 每个报文的大小，0关闭
+     * @return 内核不支持时返回false
+     */
+    bool setUdpSegment(uint16_t size);
+
+    /**
+     * @brief 设置UDP_GRO，开启后内核把同一流的多个报文合并后交给一次接收，
+     *        合并前的报文大小通过DatagramRing::getSegmentSize获取
+     * @return 内核不支持时返回false
+     */
+    bool setUdpGro(bool v);
+
+    /**
+     * @brief 获取远端地址，第一次调用时创建Address对象
      */
     Address::ptr getRemoteAddress();
 
     /**
-     * @brief 获取本地地址
+     * @brief 获取本地地址，第一次调用时创建Address对象
      */
     Address::ptr getLocalAddress();
 
+    /**
+     * @brief 获取远端地址(值类型，没有堆分配)
+     * @details accept得到的连接由accept4直接填写，其他情况第一次调用时getpeername，失败返回空地址。
+     *          可以被多个协程同时调用，返回副本
+     */
+    SockAddr getRemoteSockAddr();
+
+    /**
+     * @brief 获取本地地址(值类型，没有堆分配)
+     * @details 第一次调用时getsockname，失败返回空地址。可以被多个协程同时调用，返回副本
+     */
+    SockAddr getLocalSockAddr();
+
     /**
      * @brief 获取协议簇
      */
@@ -365,11 +500,37 @@ protected:
      */
     void newSock();
 
+    /**
+     * @brief 读取错误队列中的零拷贝完成通知，释放已完成的holder
+     */
+    void reapZeroCopy();
+
+    /**
+     * @brief 开启零拷贝发送时的接收
+     * @details 错误队列中有完成通知时fd一直报告EPOLLERR，hook的recv在EAGAIN后等待READ会被立即唤醒，
+     *          协程空转。这里每次等待前先取走完成通知，再非阻塞接收，没有数据时poll等待可读
+     * @param[in] fn 非阻塞的原始接收调用，参数为flags
+     */
+    int recvReapZeroCopy(const std::function<int(int)>& fn, int flags);
+
     /**
      * @brief 初始化sock
      */
     virtual bool init(int sock);
 
+    /**
+     * @brief 用accept得到的fd创建同类型的socket
+     * @param[in] sock accept得到的fd
+     * @param[in] peer accept4填写的远端地址
+     * @return 初始化失败时关闭fd并返回nullptr
+     */
+    virtual Socket::ptr newAccepted(int sock, const SockAddr& peer);
+
+    /**
+     * @brief 输出已经获取到的本地和远端地址
+     */
+    void dumpAddress(std::ostream& os) const;
+
 protected:
     /// socket句柄
     int m_sock;
@@ -381,13 +542,38 @@ protected:
     int m_protocol;
     /// 是否连接
     bool m_isConnected;
+    /// 是否设置SO_REUSEPORT
+    bool m_reusePort = false;
+    /// 是否开启零拷贝发送
+    bool m_zeroCopy = false;
+    /// 保护零拷贝的序号和待完成列表，接收协程也会取完成通知
+    mutable Mutex m_zcMutex;
+    /// 下一次零拷贝发送的序号(内核从0开始按调用计数)
+    uint32_t m_zcNext = 0;
+    /// 内核回退为拷贝的次数
+    uint64_t m_zcCopied = 0;
+    /// 等待完成通知的零拷贝发送: 序号 -> 持有内存的对象
+    std::deque<std::pair<uint32_t, std::shared_ptr<void> > > m_zcPending;
+    /// 保护下面四个地址，第一次获取时才填写，可能被多个协程同时调用
+    mutable Mutex m_addrMutex;
     /// 本地地址
     HPGS::Address::ptr m_localAddress;
     /// 远端地址
     HPGS::Address::ptr m_remoteAddress;
+    /// 本地地址(值类型)，为空表示还没有获取
+    SockAddr m_localSockAddr;
+    /// 远端地址(值类型)，为空表示还没有获取
+    SockAddr m_remoteSockAddr;
 
 };
 
+/**
+ * @brief TLS socket
+ * @details 服务端的SSL_CTX由监听socket持有并共享给accept到的连接，可以整体替换实现证书热加载；
+ *          客户端共用一个SSL_CTX，按远端地址缓存会话(session id/ticket)用于复用。
+ *          accept/connect得到的连接在accept状态下不立即握手，可以调用handshake()在其他调度器上完成，
+ *          否则在第一次recv/send时握手
+ */
 class SSLSocket : public Socket {
 public:
     typedef std::shared_ptr<SSLSocket> ptr;
@@ -396,8 +582,16 @@ public:
     static SSLSocket::ptr CreateTcpSocket();
     static SSLSocket::ptr CreateTcpSocket6();
 
+    /**
+     * @brief 创建服务端SSL_CTX，开启服务端会话缓存和session ticket
+     * @param[in] cert_file 证书链文件
+     * @param[in] key_file 私钥文件
+     * @return 失败返回nullptr
+     */
+    static std::shared_ptr<SSL_CTX> CreateServerContext(const std::string& cert_file
+                                                        ,const std::string& key_file);
+
     SSLSocket(int family, int type, int protocol = 0);
-    virtual Socket::ptr accept() override;
     virtual bool bind(const Address::ptr addr) override;
     virtual bool connect(const Address::ptr addr, uint64_t timeout_ms = -1) override;
     virtual bool listen(int backlog = SOMAXCONN) override;
@@ -406,20 +600,78 @@ public:
     virtual int send(const iovec* buffer, size_t length, int flags = 0) override;
     virtual int sendTo(const void* buffer, size_t length, const Address::ptr to, int flags = 0) override;
     virtual int sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags = 0) override;
+    virtual int64_t sendFile(int fd, off_t offset, size_t length) override;
+    virtual int sendZeroCopy(const iovec* buffers, size_t length, std::shared_ptr<void> holder, int flags = 0) override;
     virtual int recv(void* buffer, size_t length, int flags = 0) override;
     virtual int recv(iovec* buffers, size_t length, int flags = 0) override;
     virtual int recvFrom(void* buffer, size_t length, Address::ptr from, int flags = 0) override;
     virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0) override;
 
+    /**
+     * @brief 加载证书，创建新的SSL_CTX替换当前的
+     * @details 已经accept的连接继续使用旧的SSL_CTX
+     */
     bool loadCertificates(const std::string& cert_file, const std::string& key_file);
+
+    /**
+     * @brief 设置SSL_CTX，之后accept的连接使用它，线程安全
+     */
+    void setContext(std::shared_ptr<SSL_CTX> ctx);
+
+    /**
+     * @brief 返回SSL_CTX，线程安全
+     */
+    std::shared_ptr<SSL_CTX> getContext() const;
+
+    /**
+     * @brief 完成TLS握手，已经完成时直接返回true
+     * @details 在hook的协程中会挂起等待IO，可以在单独的调度器上执行避免占用IO线程
+     */
+    bool handshake();
+
+    /**
+     * @brief 是否已完成握手
+     */
+    bool isHandshaked() const { return m_handshaked;}
+
+    /**
+     * @brief 本次握手是否复用了会话
+     */
+    bool isSessionReused() const;
+
+    /**
+     * @brief 发送方向是否由内核加密(kTLS)
+     * @details 开启后send/sendFile直接调用系统调用，sendFile不经过用户态
+     */
+    bool isKtlsSend() const { return m_ktlsSend;}
+
     virtual std::ostream& dump(std::ostream& os) const override;
 
 protected:
     virtual bool init(int sock) override;
+    virtual Socket::ptr newAccepted(int sock, const SockAddr& peer) override;
 
+private:
+    /**
+     * @brief 握手完成后记录状态，检查发送方向是否由内核加密
+     */
+    void onHandshaked();
+
+    /**
+     * @brief 握手在SSL_read/SSL_write中隐式完成时补记状态
+     */
+    void checkHandshaked();
 private:
     std::shared_ptr<SSL_CTX> m_ctx;
     std::shared_ptr<SSL> m_ssl;
+    /// 是否已完成握手
+    bool m_handshaked = false;
+    /// 客户端会话缓存的key(远端地址)
+    std::string m_sessionKey;
+    /// 发送方向是否由内核加密
+    bool m_ktlsSend = false;
+    /// 合并小块写的TLS记录缓冲区，sendFile读文件也用它
+    std::vector<char> m_wbuf;
 
 };
 
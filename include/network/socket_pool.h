@@ -0,0 +1,253 @@
+#ifndef __HPGS_SOCKET_POOL_H__
+#define __HPGS_SOCKET_POOL_H__
+
+
+#include <memory>
+#include <list>
+#include <deque>
+#include <map>
+#include <atomic>
+#include <functional>
+#include "socket.h"
+#include "iomanager.h"
+#include "singleton.h"
+#include "noncopyable.h"
+
+
+namespace HPGS{
+
+/**
+ * @brief 出站连接池，一个目标地址一个池
+ * @details get()优先复用空闲连接，没有空闲连接且未达到上限时新建连接，
+ *          达到上限时挂起当前协程直到有连接归还或超时。
+ *          返回的Socket::ptr析构时自动归还，已关闭或出错的连接直接丢弃。
+ *          IOManager上的循环定时器负责淘汰空闲超时的连接、检查空闲连接是否存活、补足最少空闲连接
+ */
+class SocketPool : public std::enable_shared_from_this<SocketPool>, Noncopyable {
+public:
+    typedef std::shared_ptr<SocketPool> ptr;
+    typedef Mutex MutexType;
+    /// 空闲连接的健康检查，返回false的连接被关闭
+    typedef std::function<bool(Socket::ptr)> HealthCheck;
+
+    /**
+     * @brief 构造函数
+     * @param[in] addr 目标地址
+     * @param[in] ssl 是否TLS连接
+     * @param[in] max_total 最大连接数(空闲+借出+正在连接)
+     * @param[in] min_idle 最少空闲连接数
+     * @param[in] iom 执行定时器和补充连接的IOManager
+     */
+    SocketPool(Address::ptr addr, bool ssl = false, uint32_t max_total = 64
+               ,uint32_t min_idle = 0, IOManager* iom = IOManager::GetThis());
+
+    ~SocketPool();
+
+    /**
+     * @brief 借出一个连接
+     * @param[in] timeout_ms 连接池满时的最长等待时间(毫秒)，-1一直等待
+     * @return 失败或超时返回nullptr，返回的Socket::ptr析构时归还连接
+     */
+    Socket::ptr get(uint64_t timeout_ms = -1);
+
+    /**
+     * @brief 启动定时器，补足最少空闲连接
+     * @details 不启动也可以借出连接，只是不会淘汰和检查空闲连接
+     */
+    void start();
+
+    /**
+     * @brief 停止定时器，关闭所有空闲连接，唤醒所有等待的协程
+     * @details 借出的连接归还时直接关闭
+     */
+    void stop();
+
+    /**
+     * @brief 设置空闲连接的健康检查，在定时器中对空闲连接调用
+     * @details 默认只检查对端是否已关闭
+     */
+    void setHealthCheck(HealthCheck v) { m_healthCheck = v;}
+
+    /**
+     * @brief 设置空闲超时时间(毫秒)，超过的空闲连接在保留min_idle个后被关闭
+     */
+    void setIdleTimeout(uint64_t v) { m_idleTimeout = v;}
+
+    /**
+     * @brief 设置建立连接的超时时间(毫秒)
+     */
+    void setConnectTimeout(uint64_t v) { m_connectTimeout = v;}
+
+    Address::ptr getAddress() const { return m_addr;}
+    uint32_t getMaxTotal() const { return m_maxTotal;}
+    uint32_t getMinIdle() const { return m_minIdle;}
+
+    /**
+     * @brief 返回空闲连接数
+     */
+    size_t getIdleCount();
+
+    /**
+     * @brief 返回连接总数(空闲+借出+正在连接)
+     */
+    uint32_t getTotalCount();
+
+    /**
+     * @brief 返回等待连接的协程数
+     */
+    size_t getWaiterCount();
+
+    /// 复用空闲连接的次数
+    uint64_t getHitCount() const { return m_hits;}
+    /// 新建连接的次数
+    uint64_t getMissCount() const { return m_misses;}
+    /// 复用率
+    double getHitRate() const;
+    /// 因连接池满等待的次数
+    uint64_t getWaitCount() const { return m_waits;}
+    /// 累计等待时间(微秒)
+    uint64_t getWaitTimeUs() const { return m_waitUs;}
+    /// 等待超时的次数
+    uint64_t getTimeoutCount() const { return m_timeouts;}
+    /// 建立连接失败的次数
+    uint64_t getConnectFailCount() const { return m_connectFails;}
+    /// 空闲超时或健康检查失败被关闭的连接数
+    uint64_t getEvictCount() const { return m_evicts;}
+
+    std::string toString();
+private:
+    /**
+     * @brief 等待连接的协程
+     */
+    struct Waiter {
+        typedef std::shared_ptr<Waiter> ptr;
+        /// 挂起等待的协程，唤醒方可能在它切出之前notify
+        FibreSemaphore sem;
+        /// 归还的连接
+        Socket::ptr sock;
+        /// 是否得到了新建连接的名额
+        bool slot = false;
+        /// 是否已被唤醒(归还、名额、超时或停止)
+        bool done = false;
+        bool timeout = false;
+        Timer::ptr timer;
+    };
+
+    /**
+     * @brief 空闲连接
+     */
+    struct Idle {
+        Socket::ptr sock;
+        uint64_t last_ms;
+    };
+
+    /**
+     * @brief 建立新连接，失败时释放名额
+     */
+    Socket::ptr connect();
+
+    /**
+     * @brief 包装成析构时归还的Socket::ptr
+     */
+    Socket::ptr wrap(Socket::ptr sock);
+
+    /**
+     * @brief 归还连接
+     */
+    void release(Socket::ptr sock);
+
+    /**
+     * @brief 放回空闲连接，有等待的协程时直接交给它
+     * @pre 已持有m_mutex
+     */
+    void putIdle(Socket::ptr sock, uint64_t last_ms);
+
+    /**
+     * @brief 释放一个名额，有等待的协程时交给它新建连接
+     */
+    void releaseSlot();
+
+    /**
+     * @brief 同releaseSlot
+     * @pre 已持有m_mutex
+     */
+    void releaseSlotLocked();
+
+    /**
+     * @brief 唤醒等待的协程
+     * @pre 已持有m_mutex
+     */
+    void wakeup(Waiter::ptr w);
+
+    /**
+     * @brief 定时器: 淘汰空闲连接，健康检查，补足最少空闲连接
+     */
+    void onTimer();
+
+    /**
+     * @brief 默认的健康检查，对端关闭或收到意外数据时返回false
+     */
+    bool isAlive(Socket::ptr sock);
+private:
+    Address::ptr m_addr;
+    bool m_ssl;
+    uint32_t m_maxTotal;
+    uint32_t m_minIdle;
+    IOManager* m_iom;
+    uint64_t m_idleTimeout;
+    uint64_t m_connectTimeout;
+    HealthCheck m_healthCheck;
+
+    MutexType m_mutex;
+    /// 空闲连接，最近归还的在末尾
+    std::list<Idle> m_idles;
+    std::deque<Waiter::ptr> m_waiters;
+    /// 连接总数(空闲+借出+正在连接)
+    uint32_t m_total = 0;
+    bool m_stop = false;
+    Timer::ptr m_timer;
+
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_waits{0};
+    std::atomic<uint64_t> m_waitUs{0};
+    std::atomic<uint64_t> m_timeouts{0};
+    std::atomic<uint64_t> m_connectFails{0};
+    std::atomic<uint64_t> m_evicts{0};
+};
+
+/**
+ * @brief 连接池管理，按目标地址(和是否TLS)创建连接池
+ */
+class SocketPoolManager {
+public:
+    typedef RWMutex RWMutexType;
+
+    /**
+     * @brief 获取目标地址的连接池，不存在时按配置创建并启动
+     * @param[in] addr 目标地址
+     * @param[in] ssl 是否TLS连接
+     */
+    SocketPool::ptr get(Address::ptr addr, bool ssl = false);
+
+    /**
+     * @brief 获取目标地址的连接并借出一个连接
+     */
+    Socket::ptr getSocket(Address::ptr addr, bool ssl = false, uint64_t timeout_ms = -1);
+
+    /**
+     * @brief 停止并移除所有连接池
+     */
+    void clear();
+
+    std::string toString();
+private:
+    RWMutexType m_mutex;
+    std::map<std::string, SocketPool::ptr> m_pools;
+};
+
+typedef Singleton<SocketPoolManager> SocketPoolMgr;
+
+}
+
+#endif
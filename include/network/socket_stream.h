@@ -0,0 +1,139 @@
+#ifndef __HPGS_SOCKET_STREAM_H__
+#define __HPGS_SOCKET_STREAM_H__
+
+
+#include <vector>
+#include "stream.h"
+#include "socket.h"
+
+
+namespace HPGS{
+
+/**
+ * @brief Socket流
+ * @details 小数据量的读先读满预读缓冲区，后续读直接从缓冲区返回，减少recv次数；
+ *          ByteArray的读写通过getWriteBuffers/getReadBuffers直接在节点内存上收发，
+ *          写只调用一次sendmsg。SSLSocket重载了recv/send/sendFile，同样适用
+ */
+class SocketStream : public Stream {
+public:
+    typedef std::shared_ptr<SocketStream> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] sock Socket类
+     * @param[in] owner 是否完全控制(析构时关闭socket)
+     */
+    SocketStream(Socket::ptr sock, bool owner = true);
+
+    /**
+     * @brief 析构函数
+     * @details 如果m_owner = true，则close
+     */
+    ~SocketStream();
+
+    /**
+     * @brief 读数据
+     * @param[out] buffer 接收数据的内存
+     * @param[in] length 接收数据的内存大小
+     * @return
+     *      @retval > 0 返回实际接收到的数据长度
+     *      @retval = 0 socket被远端关闭
+     *      @retval < 0 socket错误
+     */
+    virtual int read(void* buffer, size_t length) override;
+
+    /**
+     * @brief 读数据
+     * @param[out] ba 接收数据的ByteArray，从当前位置(流模式为数据末尾)写入，写入后位置后移
+     * @param[in] length 接收数据的内存大小
+     * @return
+     *      @retval > 0 返回实际接收到的数据长度
+     *      @retval = 0 socket被远端关闭
+     *      @retval < 0 socket错误
+     */
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 写数据
+     * @param[in] buffer 待发送数据的内存
+     * @param[in] length 待发送数据的内存长度
+     * @return
+     *      @retval > 0 返回实际发送的数据长度
+     *      @retval = 0 socket被远端关闭
+     *      @retval < 0 socket错误
+     */
+    virtual int write(const void* buffer, size_t length) override;
+
+    /**
+     * @brief 写数据
+     * @param[in] ba 待发送数据的ByteArray，从当前位置读取，发送后位置后移
+     * @param[in] length 待发送数据的内存长度
+     * @return
+     *      @retval > 0 返回实际发送的数据长度
+     *      @retval = 0 socket被远端关闭
+     *      @retval < 0 socket错误
+     * @attention socket开启零拷贝时socket持有发送数据的ByteArray::Slice到内核发送完成，
+     *            之后修改ba(包括流模式)会写时复制，不影响正在发送的数据
+     */
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 发送文件内容，转发到Socket::sendFile(sendfile零拷贝)
+     */
+    virtual int64_t sendFile(int fd, off_t offset, size_t length) override;
+
+    /**
+     * @brief 关闭socket
+     */
+    virtual void close() override;
+
+    /**
+     * @brief 返回Socket类
+     */
+    Socket::ptr getSocket() const { return m_socket;}
+
+    /**
+     * @brief 返回是否连接
+     */
+    bool isConnected() const;
+
+    /**
+     * @brief 返回预读缓冲区中还未读取的数据长度
+     */
+    size_t getBufferedSize() const { return m_rend - m_rpos;}
+
+    Address::ptr getRemoteAddress();
+    Address::ptr getLocalAddress();
+    std::string getRemoteAddressString();
+    std::string getLocalAddressString();
+
+private:
+    /**
+     * @brief 从预读缓冲区拷贝数据
+     * @return 拷贝的长度
+     */
+    size_t readBuffered(void* buffer, size_t length);
+
+    /**
+     * @brief 预读一次数据到缓冲区
+     * @return recv的返回值
+     */
+    int fill();
+
+protected:
+    /// Socket类
+    Socket::ptr m_socket;
+    /// 是否主控
+    bool m_owner;
+    /// 预读缓冲区
+    std::vector<char> m_rbuf;
+    /// 预读缓冲区中未读数据的起始位置
+    size_t m_rpos;
+    /// 预读缓冲区中数据的结束位置
+    size_t m_rend;
+};
+
+}
+
+#endif
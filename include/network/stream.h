@@ -3,6 +3,7 @@
 
 
 #include <memory>
+#include <sys/types.h>
 #include "bytearray.h"
 
 
@@ -108,6 +109,31 @@ public:
      */
     virtual int writeFixSize(ByteArray::ptr ba, size_t length);
 
+    /**
+     * @brief 发送文件内容
+     * @details 默认实现读文件到用户态再write，Socket上的流可以重载为sendfile
+     * @param[in] fd 文件fd
+     * @param[in] offset 文件偏移
+     * @param[in] length 发送的长度
+     * @return
+     *      @retval > 0 返回发送的数据的实际大小
+     *      @retval = 0 被关闭或文件已读完
+     *      @retval < 0 出现流错误
+     */
+    virtual int64_t sendFile(int fd, off_t offset, size_t length);
+
+    /**
+     * @brief 发送固定长度的文件内容
+     * @param[in] fd 文件fd
+     * @param[in] offset 文件偏移
+     * @param[in] length 发送的长度
+     * @return
+     *      @retval > 0 返回发送的数据的实际大小
+     *      @retval = 0 被关闭或文件已读完
+     *      @retval < 0 出现流错误
+     */
+    virtual int64_t sendFileFixSize(int fd, off_t offset, size_t length);
+
     /**
      * @brief 关闭流
      */
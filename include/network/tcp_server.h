@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <unordered_map>
 #include "myaddress.h"
 #include "iomanager.h"
 #include "socket.h"
@@ -27,6 +29,20 @@ struct TcpServerConf {
     std::string accept_worker;
     std::string io_worker;
     std::string process_worker;
+    /// 执行TLS握手的调度器，为空时在io_worker上第一次读写时握手
+    std::string handshake_worker;
+    /// SO_REUSEPORT每个地址的监听socket数量，0不开启，-1每个io_worker线程一个
+    int reuse_port = 0;
+    /// 是否按收包CPU分配连接(SO_INCOMING_CPU + reuseport BPF)，需要reuse_port
+    int incoming_cpu = 0;
+    /// 每次唤醒最多accept的连接数，0使用tcp_server.accept_batch
+    int accept_batch = 0;
+    /// 最大并发连接数，达到后暂停accept，0不限制
+    int max_connections = 0;
+    /// 每个来源IP每秒允许的新连接数，0不限制
+    int per_ip_rate = 0;
+    /// 每个来源IP允许的突发连接数，0时等于per_ip_rate
+    int per_ip_burst = 0;
     std::map<std::string, std::string> args;
 
     bool isValid() const {
@@ -44,6 +60,13 @@ struct TcpServerConf {
             && accept_worker == oth.accept_worker
             && io_worker == oth.io_worker
             && process_worker == oth.process_worker
+            && handshake_worker == oth.handshake_worker
+            && reuse_port == oth.reuse_port
+            && incoming_cpu == oth.incoming_cpu
+            && accept_batch == oth.accept_batch
+            && max_connections == oth.max_connections
+            && per_ip_rate == oth.per_ip_rate
+            && per_ip_burst == oth.per_ip_burst
             && args == oth.args
             && id == oth.id
             && type == oth.type;
@@ -67,6 +90,13 @@ public:
         conf.accept_worker = node["accept_worker"].as<std::string>();
         conf.io_worker = node["io_worker"].as<std::string>();
         conf.process_worker = node["process_worker"].as<std::string>();
+        conf.handshake_worker = node["handshake_worker"].as<std::string>(conf.handshake_worker);
+        conf.reuse_port = node["reuse_port"].as<int>(conf.reuse_port);
+        conf.incoming_cpu = node["incoming_cpu"].as<int>(conf.incoming_cpu);
+        conf.accept_batch = node["accept_batch"].as<int>(conf.accept_batch);
+        conf.max_connections = node["max_connections"].as<int>(conf.max_connections);
+        conf.per_ip_rate = node["per_ip_rate"].as<int>(conf.per_ip_rate);
+        conf.per_ip_burst = node["per_ip_burst"].as<int>(conf.per_ip_burst);
         conf.args = LexicalCast<std::string
             ,std::map<std::string, std::string> >()(node["args"].as<std::string>(""));
         if(node["address"].IsDefined()) {
@@ -94,6 +124,13 @@ public:
         node["accept_worker"] = conf.accept_worker;
         node["io_worker"] = conf.io_worker;
         node["process_worker"] = conf.process_worker;
+        node["handshake_worker"] = conf.handshake_worker;
+        node["reuse_port"] = conf.reuse_port;
+        node["incoming_cpu"] = conf.incoming_cpu;
+        node["accept_batch"] = conf.accept_batch;
+        node["max_connections"] = conf.max_connections;
+        node["per_ip_rate"] = conf.per_ip_rate;
+        node["per_ip_burst"] = conf.per_ip_burst;
         node["args"] = YAML::Load(LexicalCast<std::map<std::string, std::string>
             , std::string>()(conf.args));
         for(auto& i : conf.address) {
@@ -142,9 +179,31 @@ public:
                         ,std::vector<Address::ptr>& fails
                         ,bool ssl = false);
 
-    
+    /**
+     * @brief 加载证书，所有监听socket共用同一个SSL_CTX
+     * @details 可以在运行中再次调用实现证书热加载，之后accept的连接使用新证书，
+     *          已建立的连接不受影响。在bind之前调用时bind会使用它
+     * @return 证书加载失败时返回false，继续使用原来的SSL_CTX
+     */
     bool loadCertificates(const std::string& cert_file, const std::string& key_file);
 
+    /**
+     * @brief 返回当前的服务端SSL_CTX
+     */
+    std::shared_ptr<SSL_CTX> getSSLContext() const { return std::atomic_load(&m_sslCtx);}
+
+    /**
+     * @brief 设置执行TLS握手的调度器
+     * @details 新的TLS连接先在该调度器上完成握手(证书签名、密钥交换)，成功后再交给io_worker，
+     *          避免握手计算占用IO线程。为nullptr时在io_worker上第一次读写时握手
+     */
+    void setHandshakeWorker(IOManager* v) { m_handshakeWorker = v;}
+
+    /**
+     * @brief 返回执行TLS握手的调度器
+     */
+    IOManager* getHandshakeWorker() const { return m_handshakeWorker;}
+
     /**
      * @brief 启动服务
      * @pre 需要bind成功后执行
@@ -181,8 +240,86 @@ public:
      */
     bool isStop() const { return m_isStop;}
 
+    /**
+     * @brief 设置每个地址的SO_REUSEPORT监听socket数量，需要在bind之前设置
+     * @param[in] v 0不开启，-1每个io_worker线程一个
+     * @details 开启后每个监听socket的accept循环固定在io_worker的一个线程上，
+     *          由内核在监听socket之间分配新连接。只对IP地址生效，Unix地址仍然只有一个监听socket
+     */
+    void setReusePort(int v) { m_reusePort = v;}
+
+    /**
+     * @brief 返回SO_REUSEPORT设置
+     */
+    int getReusePort() const { return m_reusePort;}
+
+    /**
+     * @brief 设置是否按收包CPU分配连接，需要在bind之前设置
+     */
+    void setIncomingCpu(bool v) { m_incomingCpu = v;}
+
+    /**
+     * @brief 是否按收包CPU分配连接
+     */
+    bool isIncomingCpu() const { return m_incomingCpu;}
+
+    /**
+     * @brief 设置每次唤醒最多accept的连接数
+     */
+    void setAcceptBatch(size_t v) { m_acceptBatch = v ? v : 1;}
+
+    /**
+     * @brief 返回每次唤醒最多accept的连接数
+     */
+    size_t getAcceptBatch() const { return m_acceptBatch;}
+
+    /**
+     * @brief 设置最大并发连接数，需要在start之前设置
+     * @param[in] v 0不限制
+     * @details 达到上限后accept循环挂起，直到有连接的handleClient返回，
+     *          新连接留在内核的监听队列中
+     */
+    void setMaxConnections(size_t v) { m_maxConnections = v;}
+
+    /**
+     * @brief 返回最大并发连接数
+     */
+    size_t getMaxConnections() const { return m_maxConnections;}
+
+    /**
+     * @brief 设置每个来源IP的新连接速率限制(令牌桶)
+     * @param[in] rate 每秒允许的新连接数，0不限制
+     * @param[in] burst 允许的突发连接数，0时等于rate
+     */
+    void setPerIpRate(uint32_t rate, uint32_t burst = 0);
+
+    /**
+     * @brief 返回当前连接数(handleClient未返回的连接)
+     */
+    uint64_t getConnectionCount() const { return m_connections;}
+
+    /**
+     * @brief 返回累计接收的连接数(不含被拒绝的)
+     */
+    uint64_t getAcceptCount() const { return m_acceptCount;}
+
+    /**
+     * @brief 返回累计因来源IP限速被拒绝的连接数
+     */
+    uint64_t getRejectCount() const { return m_rejectCount;}
+
+    /**
+     * @brief 返回累计因达到最大连接数暂停accept的次数
+     */
+    uint64_t getPauseCount() const { return m_pauseCount;}
+
+    /**
+     * @brief 返回累计在握手调度器上握手失败的连接数
+     */
+    uint64_t getHandshakeFailCount() const { return m_handshakeFailCount;}
+
     TcpServerConf::ptr getConf() const { return m_conf;}
-    void setConf(TcpServerConf::ptr v) { m_conf = v;}
+    void setConf(TcpServerConf::ptr v);
     void setConf(const TcpServerConf& v);
 
     virtual std::string toString(const std::string& prefix = "");
@@ -199,6 +336,35 @@ protected:
      * @brief 开始接受连接
      */
     virtual void startAccept(Socket::ptr sock);
+
+    /**
+     * @brief 判断新连接是否允许接入
+     * @details 默认按来源IP做令牌桶限速，返回false的连接会被直接关闭
+     */
+    virtual bool admit(Socket::ptr client);
+
+    /**
+     * @brief 同一地址的一组SO_REUSEPORT监听socket创建完成后调用，用于设置连接分配策略
+     * @details 默认在开启incoming_cpu时给第i个socket设置SO_INCOMING_CPU = i，
+     *          并挂载按 cpu % n 选择socket的reuseport BPF程序
+     * @param[in] group 按bind顺序排列的监听socket
+     */
+    virtual void attachSteering(const std::vector<Socket::ptr>& group);
+
+    /**
+     * @brief 返回每个IP地址需要创建的监听socket数量
+     */
+    size_t getListenerCount() const;
+
+    /**
+     * @brief 在io_worker上处理连接，handleClient返回后释放连接名额
+     */
+    void serveClient(Socket::ptr client, std::shared_ptr<FibreSemaphore> slots);
+
+    /**
+     * @brief 在握手调度器上完成TLS握手，成功后交给io_worker的thread线程处理
+     */
+    void handshakeClient(SSLSocket::ptr client, std::shared_ptr<FibreSemaphore> slots, int thread);
 protected:
     /// 监听Socket数组
     std::vector<Socket::ptr> m_socks;
@@ -207,6 +373,8 @@ protected:
     IOManager* m_ioWorker;
     /// 服务器Socket接收连接的调度器
     IOManager* m_acceptWorker;
+    /// TLS握手的调度器
+    IOManager* m_handshakeWorker = nullptr;
     /// 接收超时时间(毫秒)
     uint64_t m_recvTimeout;
     /// 服务器名称
@@ -217,6 +385,44 @@ protected:
     bool m_isStop;
 
     bool m_ssl = false;
+    /// 所有监听socket共用的服务端SSL_CTX
+    std::shared_ptr<SSL_CTX> m_sslCtx;
+    /// SO_REUSEPORT监听socket数量，0不开启，-1每个io_worker线程一个
+    int m_reusePort = 0;
+    /// 是否按收包CPU分配连接
+    bool m_incomingCpu = false;
+    /// 每次唤醒最多accept的连接数
+    size_t m_acceptBatch;
+    /// 最大并发连接数，0不限制
+    size_t m_maxConnections = 0;
+    /// 剩余连接名额，start时按m_maxConnections创建
+    std::shared_ptr<FibreSemaphore> m_slots;
+    /// 每个来源IP每秒允许的新连接数
+    uint32_t m_perIpRate = 0;
+    /// 每个来源IP允许的突发连接数
+    uint32_t m_perIpBurst = 0;
+
+    /**
+     * @brief 来源IP的令牌桶
+     */
+    struct IpBucket {
+        double tokens;
+        uint64_t last_ms;
+    };
+    /// 来源IP(端口置0的地址) -> 令牌桶
+    std::unordered_map<SockAddr, IpBucket> m_ipBuckets;
+    Mutex m_ipMutex;
+
+    /// 当前连接数
+    std::atomic<uint64_t> m_connections{0};
+    /// 累计接收的连接数
+    std::atomic<uint64_t> m_acceptCount{0};
+    /// 累计被限速拒绝的连接数
+    std::atomic<uint64_t> m_rejectCount{0};
+    /// 累计暂停accept的次数
+    std::atomic<uint64_t> m_pauseCount{0};
+    /// 累计握手失败的连接数
+    std::atomic<uint64_t> m_handshakeFailCount{0};
 
     TcpServerConf::ptr m_conf;
 };
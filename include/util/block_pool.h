@@ -0,0 +1,118 @@
+#ifndef __HPGS_BLOCK_POOL_H__
+#define __HPGS_BLOCK_POOL_H__
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include "noncopyable.h"
+
+
+namespace HPGS{
+
+struct BlockThreadCache;
+
+/**
+ * @brief 按大小分级的定长内存块池
+ * @details 请求大小向上取整到2的幂(32B ~ 1MB)，每一级是一组大小相同、按缓存行对齐的内存块。
+ *          每个线程有自己的缓存，分配和释放只在线程缓存为空或过多时才批量和全局缓存交换(加锁)。
+ *          全局缓存超过上限(配置block_pool.max_cached_bytes)的块归还给系统，突发流量过后内存可以回落。
+ *          超过1MB的请求直接向系统分配
+ */
+class BlockPool : Noncopyable {
+public:
+    /// 最小的块大小
+    static const size_t s_min_size = 32;
+    /// 最大的块大小，超过的直接向系统分配
+    static const size_t s_max_size = 1 << 20;
+    /// 分级数
+    static const size_t s_class_count = 16;
+
+    /**
+     * @brief 返回全局的内存块池
+     * @details 不析构，线程退出时线程缓存还可以归还
+     */
+    static BlockPool* GetInstance();
+
+    /**
+     * @brief 分配内存块
+     * @param[in] size 请求的大小，实际大小为RoundUp(size)
+     */
+    void* allocate(size_t size);
+
+    /**
+     * @brief 归还内存块
+     * @param[in] size 分配时请求的大小
+     */
+    void deallocate(void* ptr, size_t size);
+
+    /**
+     * @brief 返回size所在分级的块大小，超过最大分级时原样返回
+     */
+    static size_t RoundUp(size_t size);
+
+    /// 向系统分配的次数
+    uint64_t getAllocCount() const;
+    /// 从缓存复用的次数
+    uint64_t getReuseCount() const;
+    /// 归还给系统的次数
+    uint64_t getFreeCount() const;
+    /// 全局缓存中的字节数(不包括线程缓存)
+    uint64_t getCachedBytes() const { return m_cachedBytes;}
+
+    std::string toString() const;
+private:
+    BlockPool();
+
+    /**
+     * @brief 从全局缓存取出最多count个块到out
+     * @return 取出的个数
+     */
+    size_t fetch(size_t cls, void** out, size_t count);
+
+    /**
+     * @brief 把count个块放回全局缓存，超过上限的归还给系统
+     */
+    void release(size_t cls, void** blocks, size_t count);
+
+    /**
+     * @brief 向系统分配一个块
+     */
+    void* allocBlock(size_t cls);
+
+    /**
+     * @brief 把一个块归还给系统
+     */
+    void freeBlock(void* ptr);
+
+    /**
+     * @brief 计数加一，线程缓存还在时记在本线程上，否则记在retired上
+     */
+    static void Count(std::atomic<uint64_t> BlockThreadCache::* field, std::atomic<uint64_t>& retired);
+
+    /**
+     * @brief 汇总所有线程的计数
+     */
+    uint64_t sum(std::atomic<uint64_t> BlockThreadCache::* field, const std::atomic<uint64_t>& retired) const;
+
+    friend struct BlockThreadCache;
+private:
+    struct Central;
+    Central* m_centrals;
+    struct Threads;
+    /// 还在运行的线程的缓存，汇总计数用
+    Threads* m_threads;
+    /// 全局缓存的上限
+    std::atomic<uint64_t> m_maxCachedBytes{0};
+
+    /// 已退出线程和线程缓存析构后的计数，运行中线程的计数在各自的线程缓存里
+    std::atomic<uint64_t> m_allocs{0};
+    std::atomic<uint64_t> m_reuses{0};
+    std::atomic<uint64_t> m_frees{0};
+    std::atomic<uint64_t> m_cachedBytes{0};
+};
+
+}
+
+#endif
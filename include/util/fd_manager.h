@@ -3,7 +3,8 @@
 
 
 #include <memory>
-#include <vector>
+#include <atomic>
+#include <stdint.h>
 #include "thread.h"
 #include "singleton.h"
 
@@ -12,26 +13,78 @@ namespace HPGS{
 
 /**
  * @brief 文件fd上下文类
- * @details 管理fd类型(是否是socket)，是否阻塞，是否关闭，读写超时时间 
+ * @details 管理fd类型(socket, pipe, eventfd, 普通文件)，是否阻塞，是否关闭，读写超时时间 
+ *          FdCtx内联存放在FdManager的分块数组中，fd关闭后记录会被复用，
+ *          通过generation判断记录是否已经属于另一个同号的fd
  */
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class FdCtx {
+friend class FdManager;
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
 
-    //通过文件fd构造上下文类
-    FdCtx(int fd);
+    /**
+     * @brief fd类型
+     */
+    enum Type {
+        //未知类型(fstat失败)
+        UNKNOWN = 0,
+        //socket
+        SOCKET,
+        //管道(pipe, pipe2, FIFO)
+        PIPE,
+        //eventfd
+        EVENTFD,
+        //普通文件
+        FILE,
+        //其他类型(字符设备, epoll fd等)
+        OTHER
+    };
+
+    //空记录，由FdManager在fd创建时初始化
+    FdCtx();
 
     ~FdCtx();
 
+    /**
+     * @brief 返回fd
+     */
+    int getFd() const { return m_fd; }
+
+    /**
+     * @brief 返回记录的代数，每次初始化和删除时加1
+     * @details 等待IO前记下代数，唤醒后不相等说明fd已关闭(可能已被复用)
+     */
+    uint32_t getGeneration() const { return m_generation.load(std::memory_order_acquire); }
+
     /**
      * @brief 是否初始化完成
      */
     bool isInit() const { return m_isInit; }
 
+    /**
+     * @brief 返回fd类型
+     */
+    Type getType() const { return m_type; }
+
     /**
      * @brief 是否是socket
      */
-    bool isSocket() const { return m_isSocket; }
+    bool isSocket() const { return m_type == SOCKET; }
+
+    /**
+     * @brief 是否是管道
+     */
+    bool isPipe() const { return m_type == PIPE; }
+
+    /**
+     * @brief 是否是eventfd
+     */
+    bool isEventfd() const { return m_type == EVENTFD; }
+
+    /**
+     * @brief 是否可以由hook挂起协程等待IO(socket, pipe, eventfd)
+     * @details 这类fd会被设置为系统非阻塞，EAGAIN时通过IOManager等待事件
+     */
+    bool isPollable() const { return m_type == SOCKET || m_type == PIPE || m_type == EVENTFD; }
 
     /**
      * @brief 是否已关闭
@@ -75,48 +128,89 @@ public:
     uint64_t getTimeout(int type);
 
 private:
-    bool init();
+    /**
+     * @brief 初始化
+     * @param[in] type 已知的fd类型，UNKNOWN时通过fstat判断并设置系统非阻塞
+     */
+    bool init(Type type = UNKNOWN);
 
 private:
-    //声明带有位域的布尔型变量，表示这个变量将用1位来存储
+    /**
+     * @brief 记录状态
+     */
+    enum State {
+        //空闲
+        EMPTY = 0,
+        //正在初始化/删除
+        BUSY,
+        //已初始化，可以使用
+        LIVE
+    };
+    //记录状态
+    std::atomic<uint32_t> m_state;
+    //代数
+    std::atomic<uint32_t> m_generation;
+    //以下字段可能被多个线程同时读写(setsockopt/fcntl/close与等待IO的hook)，各自独立存放，
+    //不使用位域，避免修改一个标志时覆盖同一字节中的其他标志
     //是否初始化
-    bool m_isInit: 1;
-    //是否socket
-    bool m_isSocket: 1;
+    std::atomic<bool> m_isInit;
     //是否hook非阻塞
-    bool m_sysNonblock: 1;
+    std::atomic<bool> m_sysNonblock;
     //是否用户主动设置非阻塞
-    bool m_userNonblock: 1;
+    std::atomic<bool> m_userNonblock;
     //是否关闭
-    bool m_isClosed: 1;
+    std::atomic<bool> m_isClosed;
+    //fd类型
+    std::atomic<Type> m_type;
     //fd
     int m_fd;
     //读超时时间毫秒
-    uint64_t m_recvTimeout;
+    std::atomic<uint64_t> m_recvTimeout;
     //写超时时间毫秒
-    uint64_t m_sendTimeout;
+    std::atomic<uint64_t> m_sendTimeout;
 
 };
 
 /**
  * @brief fd管理类
+ * @details 两级无锁数组: 一级是固定大小的块指针数组，块在第一次用到时通过CAS分配，
+ *          块内直接存放FdCtx，块分配后不会释放和移动，查找只需要两次load
  */
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
+    enum {
+        //每块的FdCtx个数
+        CHUNK_SHIFT = 10,
+        CHUNK_SIZE = 1 << CHUNK_SHIFT,
+        //块的个数，最大可管理的fd为MAX_CHUNKS * CHUNK_SIZE
+        MAX_CHUNKS = 4096
+    };
 
     /**
      * @brief 无参构造函数
      */
     FdManager();
 
+    ~FdManager();
+
     /**
      * @brief 获取/创建文件fd类FdCtx
      * @param[in] fd 
      * @param[in] auto_create 是否自动创建
-     * @return 返回对应fd上下文类FdCtx::ptr
+     * @return 返回对应fd上下文，不存在或fd超出范围返回nullptr。
+     *         其他线程正在初始化或删除该记录时等待完成，不会因此返回nullptr
+     * @attention 返回的指针一直有效，但fd关闭后记录会被复用，需要用getGeneration()判断
      */
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    FdCtx* get(int fd, bool auto_create = false);
+
+    /**
+     * @brief 为类型已知且已经是系统非阻塞的fd创建上下文
+     * @details 用于accept4(SOCK_NONBLOCK)等场景，省去fstat和fcntl调用
+     * @param[in] fd
+     * @param[in] type fd类型
+     * @return 返回对应fd上下文，fd超出范围返回nullptr
+     */
+    FdCtx* add(int fd, FdCtx::Type type);
 
     /**
      * @brief 删除文件fd上下文类
@@ -125,8 +219,13 @@ public:
     void del(int fd);
 
 private:
-    RWMutexType m_mutex;
-    std::vector<FdCtx::ptr> m_datas;
+    FdCtx* lookup(int fd, bool auto_create, FdCtx::Type type);
+private:
+    struct Chunk {
+        FdCtx ctxs[CHUNK_SIZE];
+    };
+
+    std::atomic<Chunk*> m_chunks[MAX_CHUNKS];
 };
 
 //fd管理器单例
@@ -6,6 +6,11 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <poll.h>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
@@ -23,6 +28,32 @@ bool is_hook_enable();
  */
 void set_hook_enable(bool flag);
 
+/**
+ * @brief 获取当前协程的截止时间(GetCurrentMs()时钟，毫秒)，0表示没有截止时间
+ */
+uint64_t get_fibre_deadline();
+
+/**
+ * @brief 设置当前协程的截止时间
+ * @details hook的read/write/connect/accept/sleep/poll等最多等待到截止时间，
+ *          fd超时和剩余时间取较小值，截止时间已过则直接失败，errno = ETIMEDOUT
+ * @param[in] deadline_ms 绝对时间，0表示取消
+ */
+void set_fibre_deadline(uint64_t deadline_ms);
+
+/**
+ * @brief 协程截止时间RAII
+ * @details 构造时设置截止时间为now + timeout_ms，已有更早的截止时间时保持不变，析构时恢复
+ */
+class FibreDeadline {
+public:
+    FibreDeadline(uint64_t timeout_ms);
+    ~FibreDeadline();
+
+private:
+    uint64_t m_old;
+};
+
 }
 
 extern "C" {
@@ -47,6 +78,40 @@ extern "C" {
     typedef int (*accept_fun)(int s, struct sockaddr* addr, socklen_t* addrlen);
     extern accept_fun accept_f;
 
+    typedef int (*accept4_fun)(int s, struct sockaddr* addr, socklen_t* addrlen, int flags);
+    extern accept4_fun accept4_f;
+
+    //pipe, eventfd, dup, open
+    //hook的pipe/pipe2创建的fd会被设成系统非阻塞(O_NONBLOCK在打开的文件描述上，fork/exec后子进程共享)，
+    //要交给子进程做阻塞读写的管道用pipe_f创建。open打开的FIFO不登记，保持原来的阻塞方式
+    typedef int (*pipe_fun)(int pipefd[2]);
+    extern pipe_fun pipe_f;
+
+    typedef int (*pipe2_fun)(int pipefd[2], int flags);
+    extern pipe2_fun pipe2_f;
+
+    typedef int (*eventfd_fun)(unsigned int initval, int flags);
+    extern eventfd_fun eventfd_f;
+
+    typedef int (*dup_fun)(int oldfd);
+    extern dup_fun dup_f;
+
+    typedef int (*dup2_fun)(int oldfd, int newfd);
+    extern dup2_fun dup2_f;
+
+    typedef int (*open_fun)(const char* pathname, int flags, ...);
+    extern open_fun open_f;
+
+    //IO多路复用
+    typedef int (*poll_fun)(struct pollfd* fds, nfds_t nfds, int timeout);
+    extern poll_fun poll_f;
+
+    typedef int (*select_fun)(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds, struct timeval* timeout);
+    extern select_fun select_f;
+
+    typedef int (*epoll_wait_fun)(int epfd, struct epoll_event* events, int maxevents, int timeout);
+    extern epoll_wait_fun epoll_wait_f;
+
     //read
     typedef ssize_t (*read_fun)(int fd, void* buf, size_t count);
     extern read_fun read_f;
@@ -63,6 +128,10 @@ extern "C" {
     typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr* msg, int flags);
     extern recvmsg_fun recvmsg_f;
 
+    //一次接收多个报文，有报文时立即返回已收到的(不等待填满vlen)
+    typedef int (*recvmmsg_fun)(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags, struct timespec* timeout);
+    extern recvmmsg_fun recvmmsg_f;
+
     //write
     typedef ssize_t (*write_fun)(int fd, const void* buf, size_t count);
     extern write_fun write_f;
@@ -79,6 +148,19 @@ extern "C" {
     typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr* msg, int flags);
     extern sendmsg_fun sendmsg_f;
 
+    typedef int (*sendmmsg_fun)(int s, struct mmsghdr* msgvec, unsigned int vlen, int flags);
+    extern sendmmsg_fun sendmmsg_f;
+
+    //零拷贝
+    typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t* offset, size_t count);
+    extern sendfile_fun sendfile_f;
+
+    typedef ssize_t (*splice_fun)(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len, unsigned int flags);
+    extern splice_fun splice_f;
+
+    typedef ssize_t (*tee_fun)(int fd_in, int fd_out, size_t len, unsigned int flags);
+    extern tee_fun tee_f;
+
     typedef int (*close_fun)(int fd);
     extern close_fun close_f;
 
@@ -96,6 +178,13 @@ extern "C" {
     extern setsockopt_fun setsockopt_f;
 
     extern int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout);
+
+    /**
+     * @brief 不等待的accept，没有连接时返回-1，errno = EAGAIN
+     * @details 新连接和hook的accept4一样登记到FdManager，flags带SOCK_NONBLOCK时为用户非阻塞。
+     *          当前线程没有开启hook时等同于accept4，不登记新连接
+     */
+    extern int accept_nowait(int s, struct sockaddr* addr, socklen_t* addrlen, int flags);
     
 }
 
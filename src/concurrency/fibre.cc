@@ -119,6 +119,7 @@ void Fibre::reset(std::function<void()> cb){
 
     makecontext(&m_ctx, &Fibre::MainFunc, 0);
     m_state = INIT;
+    m_deadline = 0;
 }
 
 void Fibre::createMainFibre(){
@@ -146,13 +147,25 @@ void Fibre::back(){
     }
 }
 
-void Fibre::swapIn(){
+Fibre::State Fibre::swapIn(){
     SetThis(this);
     HPGS_ASSERT(m_state != EXEC);
     m_state = EXEC;
     if(swapcontext(&Scheduler::GetMainFibre()->m_ctx, &m_ctx)){
         HPGS_ASSERT2(false, "swapcontext");
     }
+    State state = m_state;
+    if(state == EXEC){
+        //YieldToHold切出，上下文已经保存完，设置HOLD之后其他线程才能切入
+        state = HOLD;
+        std::function<void()> parked;
+        parked.swap(m_parked);
+        m_state = HOLD;
+        if(parked){
+            parked();
+        }
+    }
+    return state;
     
     // if(swapcontext(&t_threadFibre->m_ctx, &m_ctx)){
     //     HPGS_ASSERT2(false, "swapcontext");
@@ -194,7 +207,15 @@ void Fibre::YieldToReady(){
 void Fibre::YieldToHold(){
     Fibre::ptr cur = GetThis();
     HPGS_ASSERT(cur->m_state == EXEC);
-    cur->m_state = HOLD;
+    //保持EXEC直到swapIn返回。切出前其他线程可能已经把它放回调度器(IO事件、定时器、信号量)，
+    //调度器取任务时跳过EXEC状态的协程，等它变成HOLD再执行
+    cur->swapOut();
+}
+
+void Fibre::YieldToHold(std::function<void()> cb){
+    Fibre::ptr cur = GetThis();
+    HPGS_ASSERT(cur->m_state == EXEC);
+    cur->m_parked.swap(cb);
     cur->swapOut();
 }
 
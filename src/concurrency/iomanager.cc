@@ -1,6 +1,7 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "hook.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -100,7 +101,8 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
     HPGS_ASSERT(m_epfd > 0);
 
     //创建管道，m_tickleFds[0]是读端，m_tickleFds[1]是写端
-    int rt = pipe(m_tickleFds);
+    //使用原始pipe，tickle管道不交给hook管理
+    int rt = pipe_f(m_tickleFds);
     HPGS_ASSERT(!rt);
 
     //注册pipe fd 可读事件，用与tickle调度携程，通过epoll_event.data.fd保存
@@ -384,8 +386,8 @@ void IOManager::idle(){
             else{
                 next_timeout = MAX_TIMEOUT;
             }
-            //阻塞在epoll_wait上，等待事件发生
-            rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
+            //阻塞在epoll_wait上，等待事件发生(idle运行在hook线程中，必须调用原始epoll_wait)
+            rt = epoll_wait_f(m_epfd, events, MAX_EVENTS, (int)next_timeout);
             if(rt < 0 && errno == EINTR){
                 //epoll_wait 发生错误
             }
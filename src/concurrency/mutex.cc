@@ -1,5 +1,6 @@
 #include "mutex.h"
 #include "macro.h"
+#include "scheduler.h"
 
 namespace HPGS{
 
@@ -25,5 +26,67 @@ void Semaphore::notify(){
     }
 }
 
+FibreSemaphore::FibreSemaphore(size_t initail_concurrency)
+    :m_concurrency(initail_concurrency){
+}
+
+FibreSemaphore::~FibreSemaphore(){
+    HPGS_ASSERT(m_waiters.empty());
+}
+
+bool FibreSemaphore::tryWait(){
+    MutexType::Lock lock(m_mutex);
+    if(m_concurrency > 0u){
+        --m_concurrency;
+        return true;
+    }
+    return false;
+}
+
+void FibreSemaphore::wait(){
+    HPGS_ASSERT(Scheduler::GetThis());
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_concurrency > 0u){
+            --m_concurrency;
+            return;
+        }
+    }
+    //切出完成后才加入等待队列，notify不会调度还在执行的协程
+    Fibre* fibre = Fibre::GetThis().get();
+    Fibre::YieldToHold([this, fibre](){
+        park(fibre);
+    });
+}
+
+void FibreSemaphore::park(Fibre* fibre){
+    //在协程原来的线程上执行，协程已经是HOLD
+    Scheduler* scheduler = Scheduler::GetThis();
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_concurrency == 0u){
+            m_waiters.push_back(std::make_pair(scheduler, fibre->shared_from_this()));
+            return;
+        }
+        //检查计数和切出之间有notify
+        --m_concurrency;
+    }
+    //解锁后再调度，协程醒来后可能立即销毁信号量
+    scheduler->schedule(fibre->shared_from_this());
+}
 
-}
\ No newline at end of file
+void FibreSemaphore::notify(){
+    std::pair<Scheduler*, Fibre::ptr> next;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_waiters.empty()){
+            ++m_concurrency;
+            return;
+        }
+        next = m_waiters.front();
+        m_waiters.pop_front();
+    }
+    next.first->schedule(next.second);
+}
+
+}
@@ -45,6 +45,13 @@ Scheduler::~Scheduler(){
     }
 }
 
+int Scheduler::getWorkerThreadId(size_t idx) const{
+    if(idx >= m_threads.size()){
+        return -1;
+    }
+    return m_threads[idx]->getId();
+}
+
 Scheduler* Scheduler::GetThis(){
     return t_scheduler;
 }
@@ -193,18 +200,16 @@ void Scheduler::run(){
         if(ft.fibre && (ft.fibre->getState() != Fibre::TERM 
                 && ft.fibre->getState() != Fibre::EXCEPT)){
             //协程可执行，swapin
-            ft.fibre->swapIn();
+            //HOLD的协程可能已经在其他线程上运行，只使用swapIn的返回值
+            Fibre::State state = ft.fibre->swapIn();
 
             //子协程执行完毕或被换出，yield到主协程，active--
             m_activeThreadCount--;
 
             //如果任务还没执行完毕，再次加入任务列表
-            if(ft.fibre->getState() == Fibre::READY){
+            if(state == Fibre::READY){
                 schedule(ft.fibre);
             }
-            else if(ft.fibre->getState() != Fibre::TERM && ft.fibre->getState() != Fibre::EXCEPT){
-                ft.fibre->setState(Fibre::HOLD);
-            }
             //重置ft，查找下一个需要执行的任务
             ft.reset();
         }
@@ -219,23 +224,23 @@ void Scheduler::run(){
 
             ft.reset();
             //创建的fibre开始执行
-            cb_fibre->swapIn();
+            Fibre::State state = cb_fibre->swapIn();
 
             //执行完毕或被换出
             m_activeThreadCount--;
 
             //任务还未执行完毕
-            if(cb_fibre->getState() == Fibre::READY){
+            if(state == Fibre::READY){
                 schedule(cb_fibre);
                 //指针放弃对象
                 cb_fibre.reset();
             }
             //任务执行完毕，重置fibre的函数
-            else if(cb_fibre->getState() == Fibre::EXCEPT || cb_fibre->getState() == Fibre::TERM){
+            else if(state == Fibre::EXCEPT || state == Fibre::TERM){
                 cb_fibre->reset(nullptr);
             }
             else{
-                cb_fibre->setState(Fibre::HOLD);
+                //HOLD，由唤醒它的一方重新调度
                 cb_fibre.reset();
             }
         }//end else if(ft.cb)
@@ -255,9 +260,6 @@ void Scheduler::run(){
 
             //stopping = true 或 idle被换出来了
             m_idleThreadCount--;
-            if(idle_fibre->getState() != Fibre::TERM && idle_fibre->getState() != Fibre::EXCEPT){
-                idle_fibre->setState(Fibre::HOLD);
-            }
         }//end else
     }//end while true
 }
@@ -1,6 +1,11 @@
 #include "HPmysql.h"
 #include "log.h"
 #include "config.h"
+#include "hook.h"
+#include "iomanager.h"
+#include "macro.h"
+#include <poll.h>
+#include <atomic>
 
 namespace HPGS{
 
@@ -37,6 +42,179 @@ bool time_t_to_mysql_time(const time_t& ts, MYSQL_TIME& mt){
     return true;
 }
 
+/**
+ * MariaDB Connector/C提供非阻塞接口(xxx_start/xxx_cont)，
+ * 返回值是需要等待的事件(MYSQL_WAIT_READ/WRITE/EXCEPT/TIMEOUT)，
+ * 由IOManager挂起协程等待socket事件，一个线程上可以同时有大量请求在执行。
+ * libmysqlclient没有这套接口时退化成阻塞调用。
+ */
+#ifdef MYSQL_WAIT_READ
+#define HPGS_MYSQL_ASYNC 1
+#endif
+
+#ifdef HPGS_MYSQL_ASYNC
+
+namespace{
+
+struct MySQLWaitInfo{
+    /// 先到的事件，0表示还没有唤醒
+    std::atomic<int> ready{0};
+    HPGS::IOManager* iom = nullptr;
+    HPGS::Fibre::ptr fibre;
+};
+
+/**
+ * @brief 读、写、超时中先到的一个唤醒协程，之后到的什么也不做
+ */
+void mysql_wake(std::shared_ptr<MySQLWaitInfo> winfo, int ready){
+    int expected = 0;
+    if(winfo->ready.compare_exchange_strong(expected, ready)){
+        winfo->iom->schedule(winfo->fibre);
+    }
+}
+
+}
+
+/**
+ * @brief 不在IOManager协程中时用poll阻塞等待
+ */
+static int mysql_wait_poll(int fd, int status, int timeout_ms){
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = 0;
+    pfd.revents = 0;
+    if(status & MYSQL_WAIT_READ){
+        pfd.events |= POLLIN;
+    }
+    if(status & MYSQL_WAIT_WRITE){
+        pfd.events |= POLLOUT;
+    }
+    if(status & MYSQL_WAIT_EXCEPT){
+        pfd.events |= POLLPRI;
+    }
+
+    int rt = 0;
+    do{
+        rt = poll_f(&pfd, 1, timeout_ms);
+    }while(rt < 0 && errno == EINTR);
+
+    if(rt <= 0){
+        return MYSQL_WAIT_TIMEOUT;
+    }
+    int ready = 0;
+    if(pfd.revents & (POLLIN | POLLERR | POLLHUP)){
+        ready |= MYSQL_WAIT_READ;
+    }
+    if(pfd.revents & POLLOUT){
+        ready |= MYSQL_WAIT_WRITE;
+    }
+    if(pfd.revents & POLLPRI){
+        ready |= MYSQL_WAIT_EXCEPT;
+    }
+    return ready;
+}
+
+/**
+ * @brief 等待驱动要求的事件
+ * @details 在IOManager中通过addEvent挂起当前协程，超时由条件定时器唤醒。
+ *          同时要求读写时先检查是否已就绪(socket发送缓冲区一般不满)，否则同时等待读和写，先到的返回
+ * @param[in] status 驱动返回的等待状态
+ * @return 已就绪的事件，作为xxx_cont的参数
+ */
+static int mysql_wait(MYSQL* mysql, int status){
+    int fd = mysql_get_socket(mysql);
+    int timeout_ms = -1;
+    if(status & MYSQL_WAIT_TIMEOUT){
+        timeout_ms = mysql_get_timeout_value_ms(mysql);
+    }
+
+    HPGS::IOManager* iom = HPGS::IOManager::GetThis();
+    if(!iom || !HPGS::is_hook_enable()){
+        return mysql_wait_poll(fd, status, timeout_ms);
+    }
+
+    //只要求超时(如驱动重试前的等待)，没有fd事件可等，hook的usleep挂起协程
+    if(!(status & (MYSQL_WAIT_READ | MYSQL_WAIT_WRITE | MYSQL_WAIT_EXCEPT))){
+        if(timeout_ms > 0){
+            usleep((useconds_t)timeout_ms * 1000);
+        }
+        return MYSQL_WAIT_TIMEOUT;
+    }
+
+    bool wait_write = status & MYSQL_WAIT_WRITE;
+    bool wait_read = status & (MYSQL_WAIT_READ | MYSQL_WAIT_EXCEPT);
+    if(wait_write){
+        int ready = mysql_wait_poll(fd, status, 0);
+        if(ready != MYSQL_WAIT_TIMEOUT){
+            return ready;
+        }
+    }
+
+    std::shared_ptr<MySQLWaitInfo> winfo(new MySQLWaitInfo);
+    winfo->iom = iom;
+    winfo->fibre = HPGS::Fibre::GetThis();
+    //记录实际注册成功的事件，返回前删除没有触发的
+    bool added_read = wait_read && !iom->addEvent(fd, HPGS::IOManager::READ
+                , std::bind(mysql_wake, winfo, MYSQL_WAIT_READ));
+    bool added_write = wait_write && (!wait_read || added_read)
+                && !iom->addEvent(fd, HPGS::IOManager::WRITE
+                , std::bind(mysql_wake, winfo, MYSQL_WAIT_WRITE));
+    bool fail = added_read != wait_read || added_write != wait_write;
+
+    HPGS::Timer::ptr timer;
+    if(fail){
+        HPGS_LOG_ERROR(g_logger) << "mysql addEvent(" << fd << ", " << status << ") error";
+        //已经注册的事件可能已经触发并调度了本协程，此时要先切出消化这次调度
+        int expected = 0;
+        if(!winfo->ready.compare_exchange_strong(expected, -1)){
+            HPGS::Fibre::YieldToHold();
+        }
+    }
+    else{
+        if(timeout_ms >= 0){
+            std::weak_ptr<MySQLWaitInfo> weak(winfo);
+            timer = iom->addConditionTimer(timeout_ms, [weak](){
+                auto t = weak.lock();
+                if(t){
+                    mysql_wake(t, MYSQL_WAIT_TIMEOUT);
+                }
+            }, weak);
+        }
+        HPGS::Fibre::YieldToHold();
+    }
+
+    if(timer){
+        timer->cancel();
+    }
+    //没有触发的事件直接删除，不再调度回调
+    if(added_read){
+        iom->delEvent(fd, HPGS::IOManager::READ);
+    }
+    if(added_write){
+        iom->delEvent(fd, HPGS::IOManager::WRITE);
+    }
+    if(fail){
+        return mysql_wait_poll(fd, status, timeout_ms);
+    }
+    return winfo->ready;
+}
+
+/**
+ * @brief 驱动非阻塞调用的公共循环
+ * @param[in] start 发起调用，返回等待状态，0表示已完成
+ * @param[in] cont 继续调用，参数为就绪的事件
+ */
+template<typename Start, typename Cont>
+static void mysql_async_run(MYSQL* mysql, Start start, Cont cont){
+    int status = start();
+    while(status){
+        status = mysql_wait(mysql, status);
+        status = cont(status);
+    }
+}
+
+#endif
+
 namespace{
 
 struct MySQLThreadIniter{
@@ -61,11 +239,18 @@ static MYSQL* mysql_init(std::map<std::string, std::string>& params, const int&
     }
 
     if(timeout > 0){
-        mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+        unsigned int t = timeout;
+        mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &t);
+        mysql_options(mysql, MYSQL_OPT_READ_TIMEOUT, &t);
+        mysql_options(mysql, MYSQL_OPT_WRITE_TIMEOUT, &t);
     }
     bool close = false;
     mysql_options(mysql, MYSQL_OPT_RECONNECT, &close);
     mysql_options(mysql, MYSQL_SET_CHARSET_NAME, "utf8mb4");
+#ifdef HPGS_MYSQL_ASYNC
+    //非阻塞模式下超时由驱动计算，通过MYSQL_WAIT_TIMEOUT交给mysql_wait
+    mysql_options(mysql, MYSQL_OPT_NONBLOCK, 0);
+#endif
 
     int port = HPGS::GetParamValue(params, "port", 0);
     std::string host = HPGS::GetParamValue<std::string>(params, "host");
@@ -73,7 +258,18 @@ static MYSQL* mysql_init(std::map<std::string, std::string>& params, const int&
     std::string passwd = HPGS::GetParamValue<std::string>(params, "passwd");
     std::string dbname = HPGS::GetParamValue<std::string>(params, "dbname");
 
-    if(mysql_real_connect(mysql, host.c_str(), user.c_str(), passwd.c_str(), dbname.c_str(), port, NULL, 0) == nullptr){
+    MYSQL* ret = nullptr;
+#ifdef HPGS_MYSQL_ASYNC
+    mysql_async_run(mysql, [&](){
+        return mysql_real_connect_start(&ret, mysql, host.c_str(), user.c_str()
+                        , passwd.c_str(), dbname.c_str(), port, NULL, 0);
+    }, [&](int ready){
+        return mysql_real_connect_cont(&ret, mysql, ready);
+    });
+#else
+    ret = mysql_real_connect(mysql, host.c_str(), user.c_str(), passwd.c_str(), dbname.c_str(), port, NULL, 0);
+#endif
+    if(ret == nullptr){
         HPGS_LOG_ERROR(g_logger) << "mysql_real_connect(" << host
                 << ", " << port << ", " << dbname << ") error: " << mysql_error(mysql);
         mysql_close(mysql);
@@ -92,7 +288,8 @@ bool MySQL::connect(){
         return true;
     }
 
-    MYSQL* m = mysql_init(m_params, 0);
+    //连接超时(秒)，同时作为读写超时
+    MYSQL* m = mysql_init(m_params, HPGS::GetParamValue(m_params, "timeout", 0));
     if(!m){
         m_hasError = true;
         return false;
@@ -128,7 +325,18 @@ bool MySQL::ping(){
         return false;
     }
 
-    if(mysql_ping(m_mysql.get())){
+    int rt = 0;
+#ifdef HPGS_MYSQL_ASYNC
+    MYSQL* mysql = m_mysql.get();
+    mysql_async_run(mysql, [&](){
+        return mysql_ping_start(&rt, mysql);
+    }, [&](int ready){
+        return mysql_ping_cont(&rt, mysql, ready);
+    });
+#else
+    rt = mysql_ping(m_mysql.get());
+#endif
+    if(rt){
         m_hasError = true;
         return false;
     }
@@ -146,7 +354,17 @@ int MySQL::execute(const char* format, ...){
 
 int MySQL::execute(const char* format, va_list ap){
     m_cmd = HPGS::StringUtil::Formatv(format, ap);
-    int r = ::mysql_query(m_mysql.get(), m_cmd.c_str());
+    int r = 0;
+#ifdef HPGS_MYSQL_ASYNC
+    MYSQL* mysql = m_mysql.get();
+    mysql_async_run(mysql, [&](){
+        return mysql_real_query_start(&r, mysql, m_cmd.c_str(), m_cmd.size());
+    }, [&](int ready){
+        return mysql_real_query_cont(&r, mysql, ready);
+    });
+#else
+    r = ::mysql_real_query(m_mysql.get(), m_cmd.c_str(), m_cmd.size());
+#endif
     if(r){
         HPGS_LOG_ERROR(g_logger) << "cmd = " << cmd()
                 << ", error: " << getErrStr();
@@ -543,8 +543,113 @@ std::ostream& UnknownAddress::insert(std::ostream& os) const {
     return os;
 }
 
+SockAddr::SockAddr()
+    :m_len(0) {
+    m_addr.ss_family = AF_UNSPEC;
+}
+
+SockAddr::SockAddr(const sockaddr* addr, socklen_t len)
+    :m_len(0) {
+    m_addr.ss_family = AF_UNSPEC;
+    if(addr && len <= Capacity()) {
+        memcpy(&m_addr, addr, len);
+        m_len = len;
+    }
+}
+
+SockAddr::SockAddr(const Address& addr)
+    :SockAddr(addr.getAddr(), addr.getAddrlen()) {
+}
+
+uint16_t SockAddr::getPort() const {
+    switch(getFamily()) {
+        case AF_INET:
+            return byteswapOnLittleEndian(((const sockaddr_in*)&m_addr)->sin_port);
+        case AF_INET6:
+            return byteswapOnLittleEndian(((const sockaddr_in6*)&m_addr)->sin6_port);
+        default:
+            return 0;
+    }
+}
+
+void SockAddr::setPort(uint16_t v) {
+    switch(getFamily()) {
+        case AF_INET:
+            ((sockaddr_in*)&m_addr)->sin_port = byteswapOnLittleEndian(v);
+            break;
+        case AF_INET6:
+            ((sockaddr_in6*)&m_addr)->sin6_port = byteswapOnLittleEndian(v);
+            break;
+        default:
+            break;
+    }
+}
+
+Address::ptr SockAddr::toAddress() const {
+    if(empty()) {
+        return nullptr;
+    }
+    switch(getFamily()) {
+        case AF_INET:
+        case AF_INET6:
+            return Address::Create(getAddr(), m_len);
+        case AF_UNIX: {
+            UnixAddress::ptr rt(new UnixAddress());
+            memcpy(rt->getAddr(), &m_addr, std::min((size_t)m_len, sizeof(sockaddr_un)));
+            rt->setAddrlen(m_len);
+            return rt;
+        }
+        default:
+            return Address::ptr(new UnknownAddress(*getAddr()));
+    }
+}
+
+std::string SockAddr::toString() const {
+    char buf[INET6_ADDRSTRLEN] = {0};
+    switch(getFamily()) {
+        case AF_INET:
+            inet_ntop(AF_INET, &((const sockaddr_in*)&m_addr)->sin_addr, buf, sizeof(buf));
+            return std::string(buf) + ":" + std::to_string(getPort());
+        case AF_INET6:
+            inet_ntop(AF_INET6, &((const sockaddr_in6*)&m_addr)->sin6_addr, buf, sizeof(buf));
+            return "[" + std::string(buf) + "]:" + std::to_string(getPort());
+        case AF_UNSPEC:
+            return "[SockAddr empty]";
+        default:
+            return toAddress()->toString();
+    }
+}
+
+size_t SockAddr::hash() const {
+    //FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    const uint8_t* p = (const uint8_t*)&m_addr;
+    for(socklen_t i = 0; i < m_len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+bool SockAddr::operator<(const SockAddr& rhs) const {
+    socklen_t minlen = std::min(m_len, rhs.m_len);
+    int result = memcmp(&m_addr, &rhs.m_addr, minlen);
+    if(result != 0) {
+        return result < 0;
+    }
+    return m_len < rhs.m_len;
+}
+
+bool SockAddr::operator==(const SockAddr& rhs) const {
+    return m_len == rhs.m_len && memcmp(&m_addr, &rhs.m_addr, m_len) == 0;
+}
+
 std::ostream& operator<<(std::ostream& os, const Address& addr) {
     return addr.insert(os);
 }
 
+std::ostream& operator<<(std::ostream& os, const SockAddr& addr) {
+    return os << addr.toString();
+}
+
 }
\ No newline at end of file
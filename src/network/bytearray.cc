@@ -2,29 +2,213 @@
 #include <sstream>
 #include <string.h>
 #include <iomanip>
+#include <algorithm>
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 
 #include "bytearray.h"
+#include "block_pool.h"
 #include "myendian.h"
 #include "log.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace HPGS {
 
 static HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
 
-ByteArray::Node::Node(size_t s) : ptr(new char[s]), next(nullptr), size(s){
+ByteArray::Block::Block(size_t s) : ptr((char*)BlockPool::GetInstance()->allocate(s)), size(s), refs(1)
+, type(POOL){
 }
 
-ByteArray::Node::Node() : ptr(nullptr), next(nullptr), size(0){
+ByteArray::Block::Block(char* p, size_t s, Type t) : ptr(p), size(s), refs(1), type(t){
+}
+
+ByteArray::Block::~Block(){
+    if(type == POOL){
+        BlockPool::GetInstance()->deallocate(ptr, size);
+    } else {
+        munmap(ptr, size);
+    }
+}
+
+void* ByteArray::Block::operator new(size_t size){
+    return BlockPool::GetInstance()->allocate(size);
+}
+
+void ByteArray::Block::operator delete(void* p, size_t size){
+    BlockPool::GetInstance()->deallocate(p, size);
+}
+
+void ByteArray::Block::unref(){
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        delete this;
+    }
+}
+
+ByteArray::Node::Node(size_t s) : block(new Block(s)), ptr(block->ptr), next(nullptr), size(s){
+}
+
+ByteArray::Node::Node() : block(nullptr), ptr(nullptr), next(nullptr), size(0){
+}
+
+ByteArray::Node::Node(Block* b) : block(b), ptr(b->ptr), next(nullptr), size(b->size){
 }
 
 ByteArray::Node::~Node(){
-    if(ptr){
-        delete[] ptr;
+    if(block){
+        block->unref();
     }
 }
 
+void* ByteArray::Node::operator new(size_t size){
+    return BlockPool::GetInstance()->allocate(size);
+}
+
+void ByteArray::Node::operator delete(void* p, size_t size){
+    BlockPool::GetInstance()->deallocate(p, size);
+}
+
+ByteArray::Slice::Slice() : m_size(0){
+}
+
+ByteArray::Slice::Slice(const Slice& other) : m_chunks(other.m_chunks), m_size(other.m_size){
+    for(auto& i : m_chunks){
+        i.block->ref();
+    }
+}
+
+ByteArray::Slice::Slice(Slice&& other) : m_chunks(std::move(other.m_chunks)), m_size(other.m_size){
+    other.m_chunks.clear();
+    other.m_size = 0;
+}
+
+ByteArray::Slice& ByteArray::Slice::operator=(const Slice& other){
+    if(this != &other){
+        Slice tmp(other);
+        *this = std::move(tmp);
+    }
+    return *this;
+}
+
+ByteArray::Slice& ByteArray::Slice::operator=(Slice&& other){
+    if(this != &other){
+        clear();
+        m_chunks.swap(other.m_chunks);
+        m_size = other.m_size;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+ByteArray::Slice::~Slice(){
+    clear();
+}
+
+void ByteArray::Slice::clear(){
+    for(auto& i : m_chunks){
+        i.block->unref();
+    }
+    m_chunks.clear();
+    m_size = 0;
+}
+
+void ByteArray::Slice::push(Block* block, size_t offset, size_t size){
+    if(size == 0){
+        return;
+    }
+    m_size += size;
+    if(!m_chunks.empty()){
+        Chunk& back = m_chunks.back();
+        if(back.block == block && back.offset + back.size == offset){
+            back.size += size;
+            return;
+        }
+    }
+    block->ref();
+    Chunk chunk = {block, offset, size};
+    m_chunks.push_back(chunk);
+}
+
+ByteArray::Span ByteArray::Slice::getSpan(size_t idx) const {
+    const Chunk& chunk = m_chunks.at(idx);
+    Span span = {chunk.block->ptr + chunk.offset, chunk.size};
+    return span;
+}
+
+ByteArray::Slice ByteArray::Slice::slice(size_t position, size_t len) const {
+    if(position > m_size || len > m_size - position){
+        throw std::out_of_range("slice out of range");
+    }
+    Slice s;
+    for(auto it = m_chunks.begin(); it != m_chunks.end() && len > 0; ++it){
+        if(position >= it->size){
+            position -= it->size;
+            continue;
+        }
+        size_t n = std::min(it->size - position, len);
+        s.push(it->block, it->offset + position, n);
+        position = 0;
+        len -= n;
+    }
+    return s;
+}
+
+void ByteArray::Slice::append(const Slice& other){
+    //other可能就是自己
+    size_t count = other.m_chunks.size();
+    for(size_t i = 0; i < count; ++i){
+        Chunk chunk = other.m_chunks[i];
+        push(chunk.block, chunk.offset, chunk.size);
+    }
+}
+
+void ByteArray::Slice::read(void* buf, size_t size, size_t position) const {
+    if(position > m_size || size > m_size - position){
+        throw std::out_of_range("not enough len");
+    }
+    size_t bpos = 0;
+    for(auto it = m_chunks.begin(); it != m_chunks.end() && size > 0; ++it){
+        if(position >= it->size){
+            position -= it->size;
+            continue;
+        }
+        size_t n = std::min(it->size - position, size);
+        memcpy((char*)buf + bpos, it->block->ptr + it->offset + position, n);
+        position = 0;
+        bpos += n;
+        size -= n;
+    }
+}
+
+std::string ByteArray::Slice::toString() const {
+    std::string str;
+    str.resize(m_size);
+    if(!str.empty()){
+        read(&str[0], str.size());
+    }
+    return str;
+}
+
+uint64_t ByteArray::Slice::getBuffers(std::vector<iovec>& buffers, uint64_t len) const {
+    uint64_t size = 0;
+    for(auto it = m_chunks.begin(); it != m_chunks.end() && size < len; ++it){
+        iovec iov;
+        iov.iov_base = it->block->ptr + it->offset;
+        iov.iov_len = std::min((uint64_t)it->size, len - size);
+        buffers.push_back(iov);
+        size += iov.iov_len;
+    }
+    return size;
+}
+
 ByteArray::ByteArray(size_t base_size) : m_baseSize(base_size), m_position(0), m_capacity(base_size)
-, m_size(0), m_endian(HPGS_BIG_ENDIAN), m_root(new Node(base_size)), m_cur(m_root){
+, m_size(0), m_origin(0), m_endian(HPGS_BIG_ENDIAN), m_streaming(false), m_root(new Node(base_size)), m_cur(m_root)
+, m_writeCur(m_root), m_fd(-1), m_mapWritable(false), m_mapFileSize(0){
+    m_nodes.push_back(m_root);
 }
 
 ByteArray::~ByteArray(){
@@ -34,6 +218,128 @@ ByteArray::~ByteArray(){
         tmp = tmp->next;
         delete m_cur;
     }
+    if(m_fd >= 0){
+        //去掉按节点大小扩展出来的部分
+        if(m_mapWritable && ftruncate(m_fd, m_size)){
+            HPGS_LOG_ERROR(g_logger) << "ftruncate fd=" << m_fd << " size=" << m_size
+                << " errno=" << errno << " errstr=" << strerror(errno);
+        }
+        close(m_fd);
+    }
+}
+
+ByteArray::ptr ByteArray::MapFile(const std::string& name, bool writable, size_t chunk_size){
+    int fd = open(name.c_str(), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if(fd < 0){
+        HPGS_LOG_ERROR(g_logger) << "MapFile open name=" << name
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    struct stat st;
+    if(fstat(fd, &st)){
+        HPGS_LOG_ERROR(g_logger) << "MapFile fstat name=" << name
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        close(fd);
+        return nullptr;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    chunk_size = std::max((chunk_size + page - 1) / page * page, page);
+
+    ByteArray::ptr ba(new ByteArray(chunk_size));
+    ba->m_fd = fd;
+    ba->m_mapWritable = writable;
+    ba->m_mapFileSize = st.st_size;
+    //先设置大小，映射失败析构时文件保持原来的大小
+    ba->m_size = st.st_size;
+    try{
+        //根节点换成文件开头的映射
+        Node* root = ba->mapNode(0);
+        delete ba->m_root;
+        ba->m_root = ba->m_cur = ba->m_writeCur = root;
+        ba->m_nodes[0] = root;
+        ba->addCapacity(st.st_size);
+    } catch(std::bad_alloc& e){
+        return nullptr;
+    }
+    return ba;
+}
+
+ByteArray::Node* ByteArray::newNode(){
+    if(m_fd < 0){
+        return new Node(m_baseSize);
+    }
+    return mapNode(m_nodes.size() * m_baseSize);
+}
+
+ByteArray::Node* ByteArray::mapNode(size_t offset){
+    char* ptr = NULL;
+    if(m_mapWritable){
+        //整个节点都在文件范围内，访问不会SIGBUS
+        if(m_mapFileSize < offset + m_baseSize){
+            if(ftruncate(m_fd, offset + m_baseSize)){
+                HPGS_LOG_ERROR(g_logger) << "ftruncate fd=" << m_fd << " size=" << offset + m_baseSize
+                    << " errno=" << errno << " errstr=" << strerror(errno);
+                throw std::bad_alloc();
+            }
+            m_mapFileSize = offset + m_baseSize;
+        }
+        ptr = (char*)mmap(NULL, m_baseSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+    } else {
+        //只读文件私有映射，超出文件末尾的部分用匿名内存填充
+        ptr = (char*)mmap(NULL, m_baseSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr != MAP_FAILED && m_mapFileSize > offset){
+            size_t len = std::min(m_mapFileSize - offset, m_baseSize);
+            if(mmap(ptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, m_fd, offset) == MAP_FAILED){
+                munmap(ptr, m_baseSize);
+                ptr = (char*)MAP_FAILED;
+            }
+        }
+    }
+    if(ptr == MAP_FAILED){
+        HPGS_LOG_ERROR(g_logger) << "mmap fd=" << m_fd << " offset=" << offset << " size=" << m_baseSize
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        throw std::bad_alloc();
+    }
+    return new Node(new Block(ptr, m_baseSize, m_mapWritable ? Block::MMAP_SHARED : Block::MMAP_PRIVATE));
+}
+
+bool ByteArray::sync(bool async){
+    if(!m_mapWritable){
+        return true;
+    }
+    bool rt = true;
+    for(size_t i = 0; i < m_nodes.size() && i * m_baseSize < m_size; ++i){
+        if(msync(m_nodes[i]->ptr, m_nodes[i]->size, async ? MS_ASYNC : MS_SYNC)){
+            HPGS_LOG_ERROR(g_logger) << "msync fd=" << m_fd << " node=" << i
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            rt = false;
+        }
+    }
+    return rt;
+}
+
+bool ByteArray::advise(int advice, size_t position, size_t len){
+    if(m_fd < 0 || position >= m_capacity){
+        return true;
+    }
+    len = std::min(len, m_capacity - position);
+    size_t page = sysconf(_SC_PAGESIZE);
+    bool rt = true;
+    while(len > 0){
+        Node* node = nodeAt(position);
+        size_t npos = position % m_baseSize;
+        size_t n = std::min(node->size - npos, len);
+        //起始地址按页对齐
+        size_t begin = npos / page * page;
+        if(madvise(node->ptr + begin, npos + n - begin, advice)){
+            HPGS_LOG_ERROR(g_logger) << "madvise fd=" << m_fd << " advice=" << advice
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            rt = false;
+        }
+        position += n;
+        len -= n;
+    }
+    return rt;
 }
 
 bool ByteArray::isLittleEndian() const {
@@ -125,19 +431,227 @@ static int64_t DecodeZigzag64(const uint64_t& v){
     return (v >> 1) ^ -(v & 1);
 }
 
+/**
+ * @brief 把value的低56位按7位一组展开到8个字节的低7位(PDEP)
+ */
+static inline uint64_t SpreadVarint(uint64_t value){
+#ifdef __BMI2__
+    return _pdep_u64(value, 0x7f7f7f7f7f7f7f7full);
+#else
+    return (value & 0x7full)
+         | ((value << 1) & (0x7full << 8))
+         | ((value << 2) & (0x7full << 16))
+         | ((value << 3) & (0x7full << 24))
+         | ((value << 4) & (0x7full << 32))
+         | ((value << 5) & (0x7full << 40))
+         | ((value << 6) & (0x7full << 48))
+         | ((value << 7) & (0x7full << 56));
+#endif
+}
+
+/**
+ * @brief 把8个字节的低7位收拢成56位整数(PEXT)
+ */
+static inline uint64_t GatherVarint(uint64_t x){
+#ifdef __BMI2__
+    return _pext_u64(x, 0x7f7f7f7f7f7f7f7full);
+#else
+    return (x & 0x7full)
+         | ((x >> 1) & (0x7full << 7))
+         | ((x >> 2) & (0x7full << 14))
+         | ((x >> 3) & (0x7full << 21))
+         | ((x >> 4) & (0x7full << 28))
+         | ((x >> 5) & (0x7full << 35))
+         | ((x >> 6) & (0x7full << 42))
+         | ((x >> 7) & (0x7full << 49));
+#endif
+}
+
+/**
+ * @brief 编码小于2^56的varint，不逐字节循环
+ * @param[out] buf 至少8字节
+ * @return 编码后的长度(1 ~ 8)
+ */
+static inline size_t EncodeVarintFast(uint64_t value, uint8_t* buf){
+    size_t bits = 64 - __builtin_clzll(value | 1);
+    size_t len = (bits + 6) / 7;
+    //除最后一个字节外都置上延续位
+    uint64_t x = SpreadVarint(value) | (0x8080808080808080ull & ((1ull << ((len - 1) * 8)) - 1));
+    x = byteswapOnBigEndian(x);
+    memcpy(buf, &x, sizeof(x));
+    return len;
+}
+
+/**
+ * @brief 从8个连续字节中解码varint
+ * @param[in] p 至少8个字节可以访问
+ * @param[out] value 解码结果
+ * @return 编码的长度，8个字节内没有结束字节时返回0
+ */
+static inline size_t DecodeVarintFast(const char* p, uint64_t& value){
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    x = byteswapOnBigEndian(x);
+    uint64_t stop = ~x & 0x8080808080808080ull;
+    if(!stop){
+        return 0;
+    }
+    size_t len = (__builtin_ctzll(stop) >> 3) + 1;
+    if(len < 8){
+        x &= (1ull << (len * 8)) - 1;
+    }
+    value = GatherVarint(x);
+    return len;
+}
+
 void ByteArray::writeInt32(int32_t value){
     writeUint32(EncodeZigzag32(value));
 }
 
 void ByteArray::writeUint32(uint32_t value){
-    uint8_t tmp[5];
-    uint8_t i = 0;
-    while(value >= 0x80){
-        tmp[i++] = (value & 0x7F) | 0x80;
-        value >>= 7;
+    uint8_t tmp[8];
+    write(tmp, EncodeVarintFast(value, tmp));
+}
+
+void ByteArray::writeUint32Array(const uint32_t* values, size_t count){
+    //编码到栈上的缓冲区，攒够一批再写入
+    uint8_t tmp[1024 + 8];
+    size_t n = 0;
+    for(size_t i = 0; i < count; ++i){
+        n += EncodeVarintFast(values[i], tmp + n);
+        if(n >= 1024){
+            write(tmp, n);
+            n = 0;
+        }
+    }
+    write(tmp, n);
+}
+
+/**
+ * @brief 转换count个元素的字节序，从src拷贝到dst
+ */
+static void SwapBlock(char* dst, const char* src, size_t count, size_t elem_size){
+    //定长的简单循环，-O3下可以被编译器向量化
+    switch(elem_size){
+        case 2:
+            for(size_t i = 0; i < count; ++i){
+                uint16_t v;
+                memcpy(&v, src + i * 2, 2);
+                v = bswap_16(v);
+                memcpy(dst + i * 2, &v, 2);
+            }
+            break;
+        case 4:
+            for(size_t i = 0; i < count; ++i){
+                uint32_t v;
+                memcpy(&v, src + i * 4, 4);
+                v = bswap_32(v);
+                memcpy(dst + i * 4, &v, 4);
+            }
+            break;
+        case 8:
+            for(size_t i = 0; i < count; ++i){
+                uint64_t v;
+                memcpy(&v, src + i * 8, 8);
+                v = bswap_64(v);
+                memcpy(dst + i * 8, &v, 8);
+            }
+            break;
+        default:
+            memcpy(dst, src, count * elem_size);
+            break;
+    }
+}
+
+/**
+ * @brief 把连续的元素转换字节序后分散写入iovec数组，跨越两段内存的元素经过临时缓冲
+ */
+static void SwapToBuffers(const std::vector<iovec>& iovs, const char* src, size_t elem_size){
+    size_t pos = 0;
+    char tmp[8];
+    for(auto& iov : iovs){
+        char* dst = (char*)iov.iov_base;
+        size_t n = iov.iov_len;
+        size_t off = 0;
+        //上一段内存末尾没写完的元素
+        size_t head = pos % elem_size;
+        if(head){
+            SwapBlock(tmp, src + pos - head, 1, elem_size);
+            off = std::min(elem_size - head, n);
+            memcpy(dst, tmp + head, off);
+        }
+        size_t whole = (n - off) / elem_size;
+        SwapBlock(dst + off, src + pos + off, whole, elem_size);
+        off += whole * elem_size;
+        //本段内存末尾放不下的元素
+        if(off < n){
+            SwapBlock(tmp, src + pos + off, 1, elem_size);
+            memcpy(dst + off, tmp, n - off);
+        }
+        pos += n;
+    }
+}
+
+/**
+ * @brief 从iovec数组中读取元素，转换字节序后连续保存到dst
+ */
+static void SwapFromBuffers(const std::vector<iovec>& iovs, char* dst, size_t elem_size){
+    size_t pos = 0;
+    char tmp[8];
+    for(auto& iov : iovs){
+        const char* src = (const char*)iov.iov_base;
+        size_t n = iov.iov_len;
+        size_t off = 0;
+        //拼完跨越两段内存的元素
+        size_t head = pos % elem_size;
+        if(head){
+            off = std::min(elem_size - head, n);
+            memcpy(tmp + head, src, off);
+            if(head + off == elem_size){
+                SwapBlock(dst + pos - head, tmp, 1, elem_size);
+            }
+        }
+        size_t whole = (n - off) / elem_size;
+        SwapBlock(dst + pos + off, src + off, whole, elem_size);
+        off += whole * elem_size;
+        if(off < n){
+            memcpy(tmp, src + off, n - off);
+        }
+        pos += n;
     }
-    tmp[i++] = value;
-    write(tmp, i);
+}
+
+void ByteArray::writeFixed(const void* values, size_t elem_size, size_t count){
+    size_t len = elem_size * count;
+    if(len == 0){
+        return;
+    }
+    if(elem_size == 1 || m_endian == HPGS_BYTE_ORDER){
+        write(values, len);
+        return;
+    }
+    std::vector<iovec> iovs;
+    getWriteBuffers(iovs, len);
+    SwapToBuffers(iovs, (const char*)values, elem_size);
+    commitWrite(len);
+}
+
+void ByteArray::readFixed(void* values, size_t elem_size, size_t count){
+    size_t len = elem_size * count;
+    if(len > getReadSize()){
+        throw std::out_of_range("not enough len");
+    }
+    if(len == 0){
+        return;
+    }
+    if(elem_size == 1 || m_endian == HPGS_BYTE_ORDER){
+        read(values, len);
+        return;
+    }
+    std::vector<iovec> iovs;
+    getReadBuffers(iovs, len);
+    SwapFromBuffers(iovs, (char*)values, elem_size);
+    consume(len);
 }
 
 void ByteArray::writeInt64(int64_t value){
@@ -146,6 +660,11 @@ void ByteArray::writeInt64(int64_t value){
 
 void ByteArray::writeUint64(uint64_t value){
     uint8_t tmp[10];
+    if(value < (1ull << 56)){
+        uint8_t fast[8];
+        write(fast, EncodeVarintFast(value, fast));
+        return;
+    }
     uint8_t i = 0;
     while(value >= 0x80){
         tmp[i++] = (value & 0x7F) | 0x80;
@@ -244,6 +763,11 @@ int32_t ByteArray::readInt32(){
 }
 
 uint32_t ByteArray::readUint32(){
+    uint64_t v = 0;
+    size_t len = readVarintFast(v, 5);
+    if(len){
+        return v;
+    }
     uint32_t result = 0;
     for(int i = 0; i < 32; i += 7){
         uint8_t v = readFint8();
@@ -258,12 +782,45 @@ uint32_t ByteArray::readUint32(){
     return result;
 }
 
+void ByteArray::readUint32Array(uint32_t* values, size_t count){
+    size_t i = 0;
+    while(i < count){
+        //在当前节点内连续解码，最后统一移动位置
+        size_t npos = m_position % m_baseSize;
+        if(m_cur){
+            const char* p = m_cur->ptr + npos;
+            size_t room = m_cur->size - npos;
+            size_t avail = std::min(room, getReadSize());
+            size_t off = 0;
+            while(i < count && room - off >= 8){
+                uint64_t v = 0;
+                size_t len = DecodeVarintFast(p + off, v);
+                if(len == 0 || len > 5 || off + len > avail){
+                    break;
+                }
+                values[i++] = v;
+                off += len;
+            }
+            if(off){
+                consume(off);
+            }
+        }
+        //节点末尾的值逐字节读取，数据不足时抛出异常
+        if(i < count){
+            values[i++] = readUint32();
+        }
+    }
+}
+
 int64_t ByteArray::readInt64(){
     return DecodeZigzag64(readUint64());
 }
 
 uint64_t ByteArray::readUint64(){
     uint64_t result = 0;
+    if(readVarintFast(result, 8)){
+        return result;
+    }
     for(int i = 0; i < 64; i += 7){
         uint8_t v = readFint8();
         if(v < 0x80){
@@ -324,7 +881,7 @@ std::string ByteArray::readStringVint(){
 }
 
 void ByteArray::clear(){
-    m_position = m_size = 0;
+    m_position = m_size = m_origin = 0;
     m_capacity = m_baseSize;
     Node* tmp = m_root->next;
     while(tmp){
@@ -333,7 +890,9 @@ void ByteArray::clear(){
         delete m_cur;
     }
     m_cur = m_root;
+    m_writeCur = m_root;
     m_root->next = NULL;
+    m_nodes.resize(1);
 }
 
 void ByteArray::write(const void* buf, size_t size){
@@ -342,33 +901,215 @@ void ByteArray::write(const void* buf, size_t size){
     }
     addCapacity(size);
 
-    size_t npos = m_position % m_baseSize;          //空缺的字节数
-    size_t ncap = m_cur->size - npos;
+    //流模式在数据末尾写入，读游标不动
+    if(m_streaming){
+        copyIn(m_writeCur, m_size, buf, size);
+        m_size += size;
+        return;
+    }
+
+    copyIn(m_cur, m_position, buf, size);
+    m_position += size;
+    if(m_position > m_size){
+        m_size = m_position;
+    }
+}
+
+void ByteArray::copyIn(Node*& cur, size_t position, const void* buf, size_t size){
+    size_t npos = position % m_baseSize;          //空缺的字节数
+    size_t ncap = cur->size - npos;
     size_t bpos = 0;
+    size_t start = position - npos;               //cur节点的起始位置
 
     while(size > 0){
+        unshare(cur, start);
         if(ncap >= size){
-            memcpy(m_cur->ptr + npos, (const char*)buf + bpos, size);
-            if(m_cur->size == (npos + size)){
-                m_cur = m_cur->next;
+            memcpy(cur->ptr + npos, (const char*)buf + bpos, size);
+            if(cur->size == (npos + size)){
+                cur = cur->next;
             }
-            m_position += size;
             bpos += size;
             size = 0;
         }
         else{
-            memcpy(m_cur->ptr + npos, (const char*)buf + bpos, ncap);
-            m_position += ncap;
+            memcpy(cur->ptr + npos, (const char*)buf + bpos, ncap);
             bpos += ncap;
             size -= ncap;
-            m_cur = m_cur->next;
-            ncap = m_cur->size;
+            start += cur->size;
+            cur = cur->next;
+            ncap = cur->size;
             npos = 0;
         }
     }
+}
 
-    if(m_position > m_size){
-        m_size = m_position;
+size_t ByteArray::readVarintFast(uint64_t& value, size_t max_len){
+    //当前节点剩余不足8字节时走逐字节的慢路径
+    size_t npos = m_position % m_baseSize;
+    if(!m_cur || m_cur->size - npos < 8){
+        return 0;
+    }
+    size_t len = DecodeVarintFast(m_cur->ptr + npos, value);
+    if(len == 0 || len > max_len || len > getReadSize()){
+        return 0;
+    }
+    consume(len);
+    return len;
+}
+
+void ByteArray::unshare(Node* node, size_t start){
+    //共享映射的写入就是要修改文件
+    if(!node->block->shared() || node->block->type == Block::MMAP_SHARED){
+        return;
+    }
+    Block* block = new Block(node->size);
+    if(m_size > start){
+        memcpy(block->ptr, node->ptr, std::min(m_size - start, node->size));
+    }
+    node->block->unref();
+    node->block = block;
+    node->ptr = block->ptr;
+}
+
+ByteArray::Slice ByteArray::slice(size_t position, size_t len) const {
+    position += m_origin;
+    if(position > m_size || len > m_size - position){
+        throw std::out_of_range("slice out of range");
+    }
+    Slice s;
+    if(len == 0){
+        return s;
+    }
+    size_t npos = position % m_baseSize;
+    Node* cur = nodeAt(position);
+    while(len > 0){
+        size_t n = std::min(cur->size - npos, len);
+        s.push(cur->block, npos, n);
+        len -= n;
+        cur = cur->next;
+        npos = 0;
+    }
+    return s;
+}
+
+ByteArray::Slice ByteArray::readSlice(size_t len){
+    Slice s = slice(getPosition(), len);
+    consume(len);
+    return s;
+}
+
+void ByteArray::writeSlice(const Slice& s){
+    for(size_t i = 0; i < s.getSpanCount(); ++i){
+        Span span = s.getSpan(i);
+        write(span.data, span.size);
+    }
+}
+
+ByteArray::ptr ByteArray::readShared(size_t len){
+    if(len > getReadSize()){
+        throw std::out_of_range("not enough len");
+    }
+    ByteArray::ptr rt(new ByteArray(m_baseSize));
+    rt->m_endian = m_endian;
+    if(m_mapWritable || len == 0){
+        rt->writeSlice(readSlice(len));
+        rt->setPosition(0);
+        return rt;
+    }
+    size_t npos = m_position % m_baseSize;
+    size_t count = (npos + len + m_baseSize - 1) / m_baseSize;
+    //换掉构造时分配的根节点，逐个引用数据所在的内存块。节点按位置定位，
+    //数据在第一个节点内的偏移记为起点，对外的位置从起点算起
+    delete rt->m_root;
+    rt->m_nodes.clear();
+    Node* cur = nodeAt(m_position);
+    Node* prev = NULL;
+    for(size_t i = 0; i < count; ++i){
+        cur->block->ref();
+        Node* node = new Node(cur->block);
+        if(prev){
+            prev->next = node;
+        }
+        rt->m_nodes.push_back(node);
+        prev = node;
+        cur = cur->next;
+    }
+    rt->m_root = rt->m_cur = rt->m_nodes[0];
+    rt->m_capacity = count * m_baseSize;
+    rt->m_size = npos + len;
+    rt->m_position = rt->m_origin = npos;
+    rt->m_writeCur = rt->nodeAt(rt->m_size);
+    consume(len);
+    return rt;
+}
+
+ByteArray::Node* ByteArray::nodeAt(size_t position) const {
+    size_t idx = position / m_baseSize;
+    return idx < m_nodes.size() ? m_nodes[idx] : NULL;
+}
+
+void ByteArray::setStreaming(bool v){
+    //流模式会轮转节点，节点和文件位置的对应关系会被打乱
+    if(v && m_fd >= 0){
+        HPGS_LOG_ERROR(g_logger) << "setStreaming on mapped ByteArray fd=" << m_fd;
+        return;
+    }
+    m_streaming = v;
+    if(v){
+        m_writeCur = nodeAt(m_size);
+        compact();
+    }
+}
+
+void ByteArray::commitWrite(size_t len){
+    if(!m_streaming){
+        setPosition(getPosition() + len);
+        return;
+    }
+    if(len > m_capacity - m_size){
+        throw std::out_of_range("commit_write out of range");
+    }
+    m_size += len;
+    m_writeCur = nodeAt(m_size);
+}
+
+void ByteArray::consume(size_t len){
+    if(len > getReadSize()){
+        throw std::out_of_range("not enough len");
+    }
+    m_position += len;
+    m_cur = nodeAt(m_position);
+    if(m_streaming){
+        compact();
+    }
+}
+
+void ByteArray::compact(){
+    //全部读完，两个游标回到开头，所有节点都可以重新写入
+    if(m_position == m_size){
+        m_position = m_size = m_origin = 0;
+        m_cur = m_writeCur = m_root;
+        return;
+    }
+    if(m_position < m_baseSize){
+        return;
+    }
+    //读完的头部节点移到末尾，位置整体前移
+    size_t count = m_position / m_baseSize;
+    Node* tail = m_nodes.back();
+    for(size_t i = 0; i < count; ++i){
+        Node* node = m_nodes[i];
+        tail->next = node;
+        tail = node;
+    }
+    tail->next = NULL;
+    m_root = m_nodes[count];
+    std::rotate(m_nodes.begin(), m_nodes.begin() + count, m_nodes.end());
+    m_position -= count * m_baseSize;
+    m_size -= count * m_baseSize;
+    m_origin = 0;
+    if(!m_writeCur){
+        m_writeCur = m_nodes[m_nodes.size() - count];
     }
 }
 
@@ -400,17 +1141,24 @@ void ByteArray::read(void* buf, size_t size){
             npos = 0;
         }
     }
+    if(m_streaming){
+        compact();
+    }
 }
 
 void ByteArray::read(void* buf, size_t size, size_t position) const {
-    if(size > (m_size - position)) {
+    position += m_origin;
+    if(position > m_size || size > (m_size - position)) {
         throw std::out_of_range("not enough len");
     }
+    if(size == 0) {
+        return;
+    }
 
     size_t npos = position % m_baseSize;
-    size_t ncap = m_cur->size - npos;
+    Node* cur = nodeAt(position);
+    size_t ncap = cur->size - npos;
     size_t bpos = 0;
-    Node* cur = m_cur;
     while(size > 0) {
         if(ncap >= size) {
             memcpy((char*)buf + bpos, cur->ptr + npos, size);
@@ -433,21 +1181,15 @@ void ByteArray::read(void* buf, size_t size, size_t position) const {
 }
 
 void ByteArray::setPosition(size_t v){
-    if(v > m_capacity){
+    v += m_origin;
+    if(v > m_capacity || (m_streaming && v > m_size)){
         throw std::out_of_range("set_position out of range");
     }
     m_position = v;
     if(m_position > m_size){
         m_size = m_position;
-    }   
-    m_cur = m_root;
-    while(v > m_cur->size){
-        v -= m_cur->size;
-        m_cur = m_cur->next;
-    }
-    if(v == m_cur->size){
-        m_cur = m_cur->next;
     }
+    m_cur = nodeAt(v);
 }
 
 bool ByteArray::writeToFile(const std::string& name) const {
@@ -496,31 +1238,34 @@ void ByteArray::addCapacity(size_t size){
         return;
     }
 
-    size_t old_cap = getCapacity();
+    size_t old_cap = m_streaming ? m_capacity - m_size : getCapacity();
     if(old_cap >= size){
         return;
     }
 
     size = size - old_cap;
     size_t count = ceil(1.0 * size / m_baseSize);
-    Node* tmp = m_root;
-    while(tmp->next){
-        tmp = tmp->next;
-    }
+    Node* tmp = m_nodes.back();
+    m_nodes.reserve(m_nodes.size() + count);
 
     Node* first = NULL;
     for(size_t i = 0; i < count; i++){
-        tmp->next = new Node(m_baseSize);
+        tmp->next = newNode();
         if(first == NULL){
             first = tmp->next;
         }
         tmp = tmp->next;
+        m_nodes.push_back(tmp);
         m_capacity += m_baseSize;
     }
 
-    if(old_cap == 0){
+    //游标停在容量末尾时指向空，指向第一个新节点
+    if(!m_cur){
         m_cur = first;
     }
+    if(m_streaming && !m_writeCur){
+        m_writeCur = first;
+    }
 }
 
 std::string ByteArray::toString() const {
@@ -529,7 +1274,7 @@ std::string ByteArray::toString() const {
     if(str.empty()){
         return str;
     }
-    read(&str[0], str.size(), m_position);
+    read(&str[0], str.size(), getPosition());
     return str;
 }
 
@@ -581,23 +1326,56 @@ uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers, uint64_t len) co
 }
 
 uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers, uint64_t len, uint64_t position) const {
-    len = len > getReadSize() ? getReadSize() : len;
+    position += m_origin;
+    if(position >= m_size){
+        return 0;
+    }
+    len = len > m_size - position ? m_size - position : len;
     if(len == 0){
         return 0;
     }
     uint64_t size = len;
 
     size_t npos = position % m_baseSize;
-    size_t count = position / m_baseSize;
-    Node* cur = m_root;
-    while(count > 0){
-        cur = cur->next;
-        --count;
+    Node* cur = nodeAt(position);
+
+    size_t ncap = cur->size - npos;
+    struct iovec iov;
+    while(len > 0){
+        if(ncap >= len){
+            iov.iov_base = cur->ptr + npos;
+            iov.iov_len = len;
+            len = 0;
+        }
+        else{
+            iov.iov_base = cur->ptr + npos;
+            iov.iov_len = ncap;
+            len -= ncap;
+            cur = cur->next;
+            ncap = cur->size;
+            npos = 0;
+        }
+        buffers.push_back(iov);
     }
+    return size;
+}
 
+uint64_t ByteArray::getWriteBuffers(std::vector<iovec>& buffers, uint64_t len){
+    if(len == 0){
+        return 0;
+    }
+    addCapacity(len);
+    uint64_t size = len;
+
+    //流模式从数据末尾开始写
+    size_t position = m_streaming ? m_size : m_position;
+    size_t npos = position % m_baseSize;
+    size_t start = position - npos;
+    Node* cur = m_streaming ? m_writeCur : m_cur;
     size_t ncap = cur->size - npos;
     struct iovec iov;
     while(len > 0){
+        unshare(cur, start);
         if(ncap >= len){
             iov.iov_base = cur->ptr + npos;
             iov.iov_len = len;
@@ -607,6 +1385,7 @@ uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers, uint64_t len, ui
             iov.iov_base = cur->ptr + npos;
             iov.iov_len = ncap;
             len -= ncap;
+            start += cur->size;
             cur = cur->next;
             ncap = cur->size;
             npos = 0;
@@ -616,4 +1395,4 @@ uint64_t ByteArray::getReadBuffers(std::vector<iovec>& buffers, uint64_t len, ui
     return size;
 }
 
-}
\ No newline at end of file
+}
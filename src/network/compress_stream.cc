@@ -0,0 +1,556 @@
+#include "compress_stream.h"
+#include "log.h"
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include <vector>
+#include <zlib.h>
+#ifdef HPGS_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HPGS_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+namespace HPGS {
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
+
+/// 每次向ByteArray申请的输出空间
+static const size_t s_out_chunk = 16 * 1024;
+/// CompressStream每次从内部的流读取的长度
+static const size_t s_read_chunk = 16 * 1024;
+
+/**
+ * @brief 返回out中下一段可写的连续内存
+ */
+static iovec NextOutput(ByteArray& out){
+    std::vector<iovec> iovs;
+    out.getWriteBuffers(iovs, s_out_chunk);
+    return iovs[0];
+}
+
+/**
+ * @brief zlib/gzip
+ */
+class ZlibCodec : public Codec {
+public:
+    ZlibCodec(Type type, bool compress, int level)
+        :Codec(type, compress)
+        ,m_level(level < 0 ? Z_DEFAULT_COMPRESSION : std::min(level, 9)) {
+        memset(&m_zs, 0, sizeof(m_zs));
+        //解压时自动识别zlib和gzip头
+        int window_bits = compress ? (type == GZIP ? 15 + 16 : 15) : 15 + 32;
+        m_ok = (compress ? deflateInit2(&m_zs, m_level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY)
+                         : inflateInit2(&m_zs, window_bits)) == Z_OK;
+    }
+
+    ~ZlibCodec(){
+        if(m_ok){
+            m_compress ? deflateEnd(&m_zs) : inflateEnd(&m_zs);
+        }
+    }
+
+    bool isOk() const { return m_ok;}
+
+    int process(const void* data, size_t len, ByteArray& out, Flush flush) override {
+        const char* p = (const char*)data;
+        //avail_in是32位的，超长的输入分段处理
+        do {
+            size_t n = std::min(len, (size_t)UINT_MAX);
+            len -= n;
+            int rt = m_compress ? deflateChunk(p, n, out, len ? NONE : flush)
+                                : inflateChunk(p, n, out);
+            if(rt){
+                return rt;
+            }
+            p += n;
+        } while(len > 0);
+        return 0;
+    }
+
+    void reset() override {
+        m_compress ? deflateReset(&m_zs) : inflateReset(&m_zs);
+        m_inStream = false;
+    }
+private:
+    int deflateChunk(const char* data, size_t len, ByteArray& out, Flush flush){
+        int zflush = flush == FINISH ? Z_FINISH : (flush == FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        m_zs.next_in = (Bytef*)data;
+        m_zs.avail_in = len;
+        while(true){
+            iovec iov = NextOutput(out);
+            m_zs.next_out = (Bytef*)iov.iov_base;
+            m_zs.avail_out = iov.iov_len;
+            int rt = deflate(&m_zs, zflush);
+            out.commitWrite(iov.iov_len - m_zs.avail_out);
+            if(rt == Z_STREAM_ERROR){
+                HPGS_LOG_ERROR(g_logger) << "deflate error: " << (m_zs.msg ? m_zs.msg : "");
+                return -1;
+            }
+            if(rt == Z_STREAM_END){
+                deflateReset(&m_zs);
+                return 0;
+            }
+            //输出空间没有用完说明已经输出了所有能输出的数据
+            if(m_zs.avail_in == 0 && m_zs.avail_out != 0 && zflush != Z_FINISH){
+                return 0;
+            }
+        }
+    }
+
+    int inflateChunk(const char* data, size_t len, ByteArray& out){
+        m_zs.next_in = (Bytef*)data;
+        m_zs.avail_in = len;
+        if(len){
+            m_inStream = true;
+        }
+        while(true){
+            iovec iov = NextOutput(out);
+            m_zs.next_out = (Bytef*)iov.iov_base;
+            m_zs.avail_out = iov.iov_len;
+            int rt = inflate(&m_zs, Z_NO_FLUSH);
+            out.commitWrite(iov.iov_len - m_zs.avail_out);
+            if(rt == Z_STREAM_END){
+                //后面可能还有下一个压缩流
+                inflateReset(&m_zs);
+                if(m_zs.avail_in == 0){
+                    m_inStream = false;
+                    return 0;
+                }
+                continue;
+            }
+            if(rt != Z_OK && rt != Z_BUF_ERROR){
+                HPGS_LOG_ERROR(g_logger) << "inflate error rt=" << rt
+                    << " msg=" << (m_zs.msg ? m_zs.msg : "");
+                return -1;
+            }
+            if(m_zs.avail_in == 0 && m_zs.avail_out != 0){
+                return 0;
+            }
+        }
+    }
+private:
+    z_stream m_zs;
+    int m_level;
+    bool m_ok;
+};
+
+#ifdef HPGS_HAVE_ZSTD
+/**
+ * @brief zstd
+ */
+class ZstdCodec : public Codec {
+public:
+    ZstdCodec(bool compress, int level)
+        :Codec(ZSTD, compress)
+        ,m_cctx(nullptr)
+        ,m_dctx(nullptr) {
+        if(compress){
+            m_cctx = ZSTD_createCCtx();
+            ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_compressionLevel
+                    ,level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+        } else {
+            m_dctx = ZSTD_createDCtx();
+        }
+    }
+
+    ~ZstdCodec(){
+        if(m_cctx){
+            ZSTD_freeCCtx(m_cctx);
+        }
+        if(m_dctx){
+            ZSTD_freeDCtx(m_dctx);
+        }
+    }
+
+    bool isOk() const { return m_cctx || m_dctx;}
+
+    int process(const void* data, size_t len, ByteArray& out, Flush flush) override {
+        ZSTD_inBuffer in = {data, len, 0};
+        ZSTD_EndDirective mode = flush == FINISH ? ZSTD_e_end
+                               : (flush == FLUSH ? ZSTD_e_flush : ZSTD_e_continue);
+        while(true){
+            iovec iov = NextOutput(out);
+            ZSTD_outBuffer output = {iov.iov_base, iov.iov_len, 0};
+            size_t rt = m_compress ? ZSTD_compressStream2(m_cctx, &output, &in, mode)
+                                   : ZSTD_decompressStream(m_dctx, &output, &in);
+            out.commitWrite(output.pos);
+            if(ZSTD_isError(rt)){
+                HPGS_LOG_ERROR(g_logger) << (m_compress ? "ZSTD_compressStream2" : "ZSTD_decompressStream")
+                    << " error: " << ZSTD_getErrorName(rt);
+                return -1;
+            }
+            if(m_compress){
+                //continue时输入用完即可，flush/end时返回0表示全部输出
+                if(mode == ZSTD_e_continue ? in.pos == in.size : rt == 0){
+                    return 0;
+                }
+            } else if(in.pos == in.size && output.pos < output.size){
+                //返回0表示一帧已经完整解出
+                if(in.size){
+                    m_inStream = rt != 0;
+                }
+                return 0;
+            }
+        }
+    }
+
+    void reset() override {
+        if(m_cctx){
+            ZSTD_CCtx_reset(m_cctx, ZSTD_reset_session_only);
+        }
+        if(m_dctx){
+            ZSTD_DCtx_reset(m_dctx, ZSTD_reset_session_only);
+        }
+        m_inStream = false;
+    }
+private:
+    ZSTD_CCtx* m_cctx;
+    ZSTD_DCtx* m_dctx;
+};
+#endif
+
+#ifdef HPGS_HAVE_LZ4
+/**
+ * @brief lz4帧格式
+ * @details LZ4F_compressUpdate要求输出空间不小于LZ4F_compressBound，压缩时经过一块临时缓冲；
+ *          解压直接写入节点内存
+ */
+class Lz4Codec : public Codec {
+public:
+    Lz4Codec(bool compress, int level)
+        :Codec(LZ4, compress)
+        ,m_cctx(nullptr)
+        ,m_dctx(nullptr)
+        ,m_begun(false) {
+        memset(&m_prefs, 0, sizeof(m_prefs));
+        m_prefs.compressionLevel = level < 0 ? 0 : level;
+        if(compress){
+            if(LZ4F_isError(LZ4F_createCompressionContext(&m_cctx, LZ4F_VERSION))){
+                m_cctx = nullptr;
+            }
+        } else {
+            if(LZ4F_isError(LZ4F_createDecompressionContext(&m_dctx, LZ4F_VERSION))){
+                m_dctx = nullptr;
+            }
+        }
+    }
+
+    ~Lz4Codec(){
+        if(m_cctx){
+            LZ4F_freeCompressionContext(m_cctx);
+        }
+        if(m_dctx){
+            LZ4F_freeDecompressionContext(m_dctx);
+        }
+    }
+
+    bool isOk() const { return m_cctx || m_dctx;}
+
+    int process(const void* data, size_t len, ByteArray& out, Flush flush) override {
+        return m_compress ? compress((const char*)data, len, out, flush)
+                          : decompress((const char*)data, len, out);
+    }
+
+    void reset() override {
+        if(m_dctx){
+            LZ4F_resetDecompressionContext(m_dctx);
+        }
+        m_begun = false;
+        m_inStream = false;
+    }
+private:
+    /**
+     * @brief 检查LZ4F的返回值，成功时把临时缓冲中的n字节写入out
+     */
+    int output(size_t n, ByteArray& out, const char* fun){
+        if(LZ4F_isError(n)){
+            HPGS_LOG_ERROR(g_logger) << fun << " error: " << LZ4F_getErrorName(n);
+            return -1;
+        }
+        out.write(&m_tmp[0], n);
+        return 0;
+    }
+
+    int compress(const char* data, size_t len, ByteArray& out, Flush flush){
+        if(!m_begun){
+            m_tmp.resize(std::max(m_tmp.size(), (size_t)LZ4F_HEADER_SIZE_MAX));
+            if(output(LZ4F_compressBegin(m_cctx, &m_tmp[0], m_tmp.size(), &m_prefs), out, "LZ4F_compressBegin")){
+                return -1;
+            }
+            m_begun = true;
+        }
+        while(len > 0){
+            size_t n = std::min(len, (size_t)64 * 1024);
+            m_tmp.resize(std::max(m_tmp.size(), LZ4F_compressBound(n, &m_prefs)));
+            if(output(LZ4F_compressUpdate(m_cctx, &m_tmp[0], m_tmp.size(), data, n, NULL), out, "LZ4F_compressUpdate")){
+                return -1;
+            }
+            data += n;
+            len -= n;
+        }
+        if(flush != NONE){
+            m_tmp.resize(std::max(m_tmp.size(), LZ4F_compressBound(0, &m_prefs)));
+            size_t rt = flush == FINISH ? LZ4F_compressEnd(m_cctx, &m_tmp[0], m_tmp.size(), NULL)
+                                        : LZ4F_flush(m_cctx, &m_tmp[0], m_tmp.size(), NULL);
+            if(output(rt, out, flush == FINISH ? "LZ4F_compressEnd" : "LZ4F_flush")){
+                return -1;
+            }
+            if(flush == FINISH){
+                m_begun = false;
+            }
+        }
+        return 0;
+    }
+
+    int decompress(const char* data, size_t len, ByteArray& out){
+        while(true){
+            iovec iov = NextOutput(out);
+            size_t dst_len = iov.iov_len;
+            size_t src_len = len;
+            size_t rt = LZ4F_decompress(m_dctx, iov.iov_base, &dst_len, data, &src_len, NULL);
+            out.commitWrite(dst_len);
+            if(LZ4F_isError(rt)){
+                HPGS_LOG_ERROR(g_logger) << "LZ4F_decompress error: " << LZ4F_getErrorName(rt);
+                return -1;
+            }
+            data += src_len;
+            len -= src_len;
+            //返回0表示一帧已经完整解出
+            if(src_len){
+                m_inStream = rt != 0;
+            }
+            if(len == 0 && dst_len < iov.iov_len){
+                return 0;
+            }
+        }
+    }
+private:
+    LZ4F_cctx* m_cctx;
+    LZ4F_dctx* m_dctx;
+    LZ4F_preferences_t m_prefs;
+    /// 帧头是否已经输出
+    bool m_begun;
+    std::vector<char> m_tmp;
+};
+#endif
+
+bool Codec::IsSupported(Type type){
+    switch(type){
+        case ZLIB:
+        case GZIP:
+            return true;
+#ifdef HPGS_HAVE_ZSTD
+        case ZSTD:
+            return true;
+#endif
+#ifdef HPGS_HAVE_LZ4
+        case LZ4:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+Codec::ptr Codec::Create(Type type, bool compress, int level){
+    switch(type){
+        case ZLIB:
+        case GZIP: {
+            std::shared_ptr<ZlibCodec> codec(new ZlibCodec(type, compress, level));
+            return codec->isOk() ? codec : nullptr;
+        }
+#ifdef HPGS_HAVE_ZSTD
+        case ZSTD: {
+            std::shared_ptr<ZstdCodec> codec(new ZstdCodec(compress, level));
+            return codec->isOk() ? codec : nullptr;
+        }
+#endif
+#ifdef HPGS_HAVE_LZ4
+        case LZ4: {
+            std::shared_ptr<Lz4Codec> codec(new Lz4Codec(compress, level));
+            return codec->isOk() ? codec : nullptr;
+        }
+#endif
+        default:
+            HPGS_LOG_ERROR(g_logger) << "Codec type=" << type << " not supported";
+            return nullptr;
+    }
+}
+
+int Codec::process(const ByteArray& in, size_t len, ByteArray& out, Flush flush){
+    std::vector<iovec> iovs;
+    in.getReadBuffers(iovs, len);
+    if(iovs.empty()){
+        return process(NULL, 0, out, flush);
+    }
+    //按节点逐段处理，最后一段才输出
+    for(size_t i = 0; i < iovs.size(); ++i){
+        int rt = process(iovs[i].iov_base, iovs[i].iov_len, out
+                         ,i + 1 == iovs.size() ? flush : NONE);
+        if(rt){
+            return rt;
+        }
+    }
+    return 0;
+}
+
+ByteArray::ptr Codec::Compress(Type type, const ByteArray& src, int level){
+    Codec::ptr codec = Create(type, true, level);
+    if(!codec){
+        return nullptr;
+    }
+    ByteArray::ptr out(new ByteArray(src.getBaseSize()));
+    if(codec->process(src, src.getReadSize(), *out, FINISH)){
+        return nullptr;
+    }
+    out->setPosition(0);
+    return out;
+}
+
+ByteArray::ptr Codec::Decompress(Type type, const ByteArray& src){
+    Codec::ptr codec = Create(type, false);
+    if(!codec){
+        return nullptr;
+    }
+    ByteArray::ptr out(new ByteArray(src.getBaseSize()));
+    if(codec->process(src, src.getReadSize(), *out)){
+        return nullptr;
+    }
+    if(codec->isInStream()){
+        HPGS_LOG_ERROR(g_logger) << "Codec::Decompress type=" << type << " truncated input";
+        return nullptr;
+    }
+    out->setPosition(0);
+    return out;
+}
+
+CompressStream::CompressStream(Stream::ptr stream, Codec::Type type, int level)
+    :m_stream(stream)
+    ,m_compressor(Codec::Create(type, true, level))
+    ,m_decompressor(Codec::Create(type, false))
+    ,m_wbuf(new ByteArray)
+    ,m_cbuf(new ByteArray)
+    ,m_rbuf(new ByteArray)
+    ,m_rawWritten(0)
+    ,m_compressedWritten(0) {
+    //收发缓冲区读完的节点循环使用
+    m_wbuf->setStreaming(true);
+    m_cbuf->setStreaming(true);
+    m_rbuf->setStreaming(true);
+}
+
+int CompressStream::fill(){
+    while(m_rbuf->getReadSize() == 0){
+        int rt = m_stream->read(m_cbuf, s_read_chunk);
+        if(rt == 0 && m_decompressor->isInStream()){
+            HPGS_LOG_ERROR(g_logger) << "CompressStream inner stream ended in the middle of a compressed stream";
+            return -1;
+        }
+        if(rt <= 0){
+            return rt;
+        }
+        if(m_decompressor->process(*m_cbuf, m_cbuf->getReadSize(), *m_rbuf)){
+            return -1;
+        }
+        m_cbuf->consume(m_cbuf->getReadSize());
+    }
+    return m_rbuf->getReadSize();
+}
+
+int CompressStream::read(void* buffer, size_t length){
+    if(!isValid()){
+        return -1;
+    }
+    int rt = fill();
+    if(rt <= 0){
+        return rt;
+    }
+    size_t n = std::min(length, m_rbuf->getReadSize());
+    m_rbuf->read(buffer, n);
+    return n;
+}
+
+int CompressStream::read(ByteArray::ptr ba, size_t length){
+    if(!isValid()){
+        return -1;
+    }
+    int rt = fill();
+    if(rt <= 0){
+        return rt;
+    }
+    std::vector<iovec> iovs;
+    size_t n = m_rbuf->getReadBuffers(iovs, length);
+    for(auto& i : iovs){
+        ba->write(i.iov_base, i.iov_len);
+    }
+    m_rbuf->consume(n);
+    return n;
+}
+
+int CompressStream::sendOut(){
+    size_t n = m_wbuf->getReadSize();
+    if(n == 0){
+        return 0;
+    }
+    int rt = m_stream->writeFixSize(m_wbuf, n);
+    if(rt <= 0){
+        return rt < 0 ? rt : -1;
+    }
+    m_compressedWritten += n;
+    return 0;
+}
+
+int CompressStream::write(const void* buffer, size_t length){
+    if(!isValid()){
+        return -1;
+    }
+    if(m_compressor->process(buffer, length, *m_wbuf)){
+        return -1;
+    }
+    int rt = sendOut();
+    if(rt){
+        return rt;
+    }
+    m_rawWritten += length;
+    return length;
+}
+
+int CompressStream::write(ByteArray::ptr ba, size_t length){
+    if(!isValid()){
+        return -1;
+    }
+    length = std::min(length, ba->getReadSize());
+    if(m_compressor->process(*ba, length, *m_wbuf)){
+        return -1;
+    }
+    ba->consume(length);
+    int rt = sendOut();
+    if(rt){
+        return rt;
+    }
+    m_rawWritten += length;
+    return length;
+}
+
+int CompressStream::flush(){
+    if(!isValid()){
+        return -1;
+    }
+    if(m_compressor->process(NULL, 0, *m_wbuf, Codec::FLUSH)){
+        return -1;
+    }
+    return sendOut();
+}
+
+void CompressStream::close(){
+    if(isValid()){
+        if(m_compressor->process(NULL, 0, *m_wbuf, Codec::FINISH) == 0){
+            sendOut();
+        }
+    }
+    m_stream->close();
+}
+
+}
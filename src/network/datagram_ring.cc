@@ -0,0 +1,123 @@
+#include "datagram_ring.h"
+#include "macro.h"
+#include <string.h>
+#include <algorithm>
+
+namespace HPGS{
+
+//每个报文的控制信息只有一个int(UDP_GRO)或uint16_t(UDP_SEGMENT)
+static const size_t s_control_size = CMSG_SPACE(sizeof(int));
+
+DatagramRing::DatagramRing(size_t count, size_t slot_size)
+    :m_slotSize(slot_size)
+    ,m_size(0)
+    ,m_buffer(slot_size)
+    ,m_iovs(count)
+    ,m_names(count)
+    ,m_control(count * s_control_size)
+    ,m_segments(count)
+    ,m_msgs(count) {
+    HPGS_ASSERT(count > 0 && slot_size > 0);
+    //节点大小等于槽位大小，从位置0取得的每个iovec正好是一个节点
+    m_buffer.getWriteBuffers(m_slots, count * slot_size);
+    HPGS_ASSERT(m_slots.size() == count);
+    for(size_t i = 0; i < count; ++i) {
+        resetHeader(i);
+    }
+}
+
+void DatagramRing::resetHeader(size_t i) {
+    m_iovs[i] = m_slots[i];
+    m_segments[i] = 0;
+    msghdr& hdr = m_msgs[i].msg_hdr;
+    hdr.msg_name = &m_names[i];
+    hdr.msg_namelen = sizeof(sockaddr_storage);
+    hdr.msg_iov = &m_iovs[i];
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = &m_control[i * s_control_size];
+    hdr.msg_controllen = s_control_size;
+    hdr.msg_flags = 0;
+    m_msgs[i].msg_len = 0;
+}
+
+Address::ptr DatagramRing::getAddress(size_t i) const {
+    return Address::Create(getAddr(i), getAddrLen(i));
+}
+
+bool DatagramRing::push(const void* data, size_t len, Address::ptr to, uint16_t segment_size) {
+    if(to) {
+        return push(data, len, to->getAddr(), to->getAddrlen(), segment_size);
+    }
+    return push(data, len, nullptr, 0, segment_size);
+}
+
+bool DatagramRing::push(const void* data, size_t len, const sockaddr* to, socklen_t to_len, uint16_t segment_size) {
+    if(full() || len > m_slotSize || to_len > sizeof(sockaddr_storage)) {
+        return false;
+    }
+    size_t i = m_size++;
+    memcpy(m_slots[i].iov_base, data, len);
+    m_iovs[i].iov_base = m_slots[i].iov_base;
+    m_iovs[i].iov_len = len;
+    m_segments[i] = segment_size;
+
+    msghdr& hdr = m_msgs[i].msg_hdr;
+    hdr.msg_iov = &m_iovs[i];
+    hdr.msg_iovlen = 1;
+    if(to) {
+        memcpy(&m_names[i], to, to_len);
+        hdr.msg_name = &m_names[i];
+        hdr.msg_namelen = to_len;
+    } else {
+        hdr.msg_name = nullptr;
+        hdr.msg_namelen = 0;
+    }
+    setSegmentControl(i, segment_size);
+    hdr.msg_flags = 0;
+    m_msgs[i].msg_len = 0;
+    return true;
+}
+
+void DatagramRing::setSegmentControl(size_t i, uint16_t segment_size) {
+    msghdr& hdr = m_msgs[i].msg_hdr;
+    if(!segment_size) {
+        hdr.msg_control = nullptr;
+        hdr.msg_controllen = 0;
+        return;
+    }
+    hdr.msg_control = &m_control[i * s_control_size];
+    hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+    cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+}
+
+mmsghdr* DatagramRing::prepareRecv() {
+    m_size = 0;
+    for(size_t i = 0; i < m_msgs.size(); ++i) {
+        resetHeader(i);
+    }
+    return &m_msgs[0];
+}
+
+void DatagramRing::commitRecv(size_t n) {
+    m_size = std::min(n, m_msgs.size());
+    for(size_t i = 0; i < m_size; ++i) {
+        msghdr& hdr = m_msgs[i].msg_hdr;
+        m_iovs[i].iov_len = m_msgs[i].msg_len;
+        for(cmsghdr* cm = CMSG_FIRSTHDR(&hdr); cm; cm = CMSG_NXTHDR(&hdr, cm)) {
+            if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+                int seg = 0;
+                memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+                m_segments[i] = seg;
+            }
+        }
+        //收到的报文可以直接原路发回，GRO合并的报文发送时按原来的大小重新切分
+        setSegmentControl(i, m_segments[i] < m_iovs[i].iov_len ? m_segments[i] : 0);
+        hdr.msg_flags = 0;
+    }
+}
+
+}
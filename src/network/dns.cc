@@ -0,0 +1,665 @@
+#include "dns.h"
+#include "socket.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+#include "myendian.h"
+#include <string.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+
+namespace HPGS{
+
+static HPGS::ConfigVar<std::vector<std::string> >::ptr g_dns_servers =
+        HPGS::Config::Lookup("dns.servers", std::vector<std::string>(),
+                "dns servers ip[:port], empty means /etc/resolv.conf");
+
+static HPGS::ConfigVar<uint64_t>::ptr g_dns_timeout =
+        HPGS::Config::Lookup("dns.timeout", (uint64_t)2000,
+                "dns query timeout per server(ms)");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_dns_attempts =
+        HPGS::Config::Lookup("dns.attempts", (uint32_t)2,
+                "dns query rounds over all servers");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_dns_max_ttl =
+        HPGS::Config::Lookup("dns.max_ttl", (uint32_t)3600,
+                "dns cache max ttl(s)");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_dns_negative_ttl =
+        HPGS::Config::Lookup("dns.negative_ttl", (uint32_t)30,
+                "dns negative cache ttl(s) when the response has no SOA");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_dns_cache_size =
+        HPGS::Config::Lookup("dns.cache_size", (uint32_t)10000,
+                "dns cache max entries");
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
+
+static const uint16_t s_class_in = 1;
+static const uint16_t s_type_cname = 5;
+static const uint16_t s_type_soa = 6;
+//RFC 1035 UDP报文不超过512字节，留出EDNS的余量
+static const size_t s_max_packet = 4096;
+
+namespace {
+
+/**
+ * @brief DNS报文读取，越界时置错误标志
+ */
+class DnsReader {
+public:
+    DnsReader(const uint8_t* data, size_t size)
+        :m_data(data), m_size(size), m_pos(0), m_error(false) {
+    }
+
+    uint16_t read16() {
+        uint16_t v = 0;
+        read(&v, sizeof(v));
+        return byteswapOnLittleEndian(v);
+    }
+
+    uint32_t read32() {
+        uint32_t v = 0;
+        read(&v, sizeof(v));
+        return byteswapOnLittleEndian(v);
+    }
+
+    void read(void* buf, size_t len) {
+        if(m_error || m_size - m_pos < len) {
+            m_error = true;
+            return;
+        }
+        memcpy(buf, m_data + m_pos, len);
+        m_pos += len;
+    }
+
+    void skip(size_t len) {
+        if(m_error || m_size - m_pos < len) {
+            m_error = true;
+            return;
+        }
+        m_pos += len;
+    }
+
+    /**
+     * @brief 读取域名(小写，不带末尾的点)，处理压缩指针
+     */
+    std::string readName() {
+        std::string name;
+        size_t pos = m_pos;
+        bool jumped = false;
+        //压缩指针最多跳转的次数，防止构造的报文死循环
+        int jumps = 0;
+        while(!m_error) {
+            if(pos >= m_size) {
+                m_error = true;
+                break;
+            }
+            uint8_t len = m_data[pos];
+            if((len & 0xc0) == 0xc0) {
+                if(pos + 1 >= m_size || ++jumps > 16) {
+                    m_error = true;
+                    break;
+                }
+                if(!jumped) {
+                    m_pos = pos + 2;
+                    jumped = true;
+                }
+                pos = ((len & 0x3f) << 8) | m_data[pos + 1];
+                continue;
+            }
+            if(len & 0xc0) {
+                m_error = true;
+                break;
+            }
+            ++pos;
+            if(len == 0) {
+                break;
+            }
+            if(pos + len > m_size) {
+                m_error = true;
+                break;
+            }
+            if(!name.empty()) {
+                name.append(1, '.');
+            }
+            for(size_t i = 0; i < len; ++i) {
+                name.append(1, tolower(m_data[pos + i]));
+            }
+            pos += len;
+        }
+        if(!jumped) {
+            m_pos = pos;
+        }
+        return name;
+    }
+
+    size_t getPosition() const { return m_pos;}
+    void setPosition(size_t v) { m_pos = v;}
+    bool isError() const { return m_error;}
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_pos;
+    bool m_error;
+};
+
+void Write16(std::string& out, uint16_t v) {
+    v = byteswapOnLittleEndian(v);
+    out.append((const char*)&v, sizeof(v));
+}
+
+/**
+ * @brief 生成查询报文
+ */
+bool EncodeQuery(std::string& out, uint16_t id, const std::string& name, uint16_t type) {
+    out.clear();
+    Write16(out, id);
+    //RD: 要求递归查询
+    Write16(out, 0x0100);
+    Write16(out, 1);
+    Write16(out, 0);
+    Write16(out, 0);
+    Write16(out, 0);
+    size_t begin = 0;
+    while(begin < name.size()) {
+        size_t end = name.find('.', begin);
+        if(end == std::string::npos) {
+            end = name.size();
+        }
+        size_t len = end - begin;
+        if(len == 0 || len > 63) {
+            return false;
+        }
+        out.append(1, (char)len);
+        out.append(name, begin, len);
+        begin = end + 1;
+    }
+    out.append(1, '\0');
+    Write16(out, type);
+    Write16(out, s_class_in);
+    return name.size() <= 253;
+}
+
+uint16_t RandomId() {
+    static thread_local std::mt19937 s_rng(std::random_device{}());
+    return s_rng() & 0xffff;
+}
+
+/**
+ * @brief TCP上读满len字节
+ */
+bool RecvFull(Socket::ptr sock, void* buf, size_t len) {
+    size_t offset = 0;
+    while(offset < len) {
+        int rt = sock->recv((char*)buf + offset, len - offset);
+        if(rt <= 0) {
+            return false;
+        }
+        offset += rt;
+    }
+    return true;
+}
+
+/**
+ * @brief 复制地址并设置端口，缓存中的地址对象是共享的
+ */
+IPAddress::ptr CopyWithPort(IPAddress::ptr addr, uint16_t port) {
+    IPAddress::ptr rt = std::dynamic_pointer_cast<IPAddress>(
+            Address::Create(addr->getAddr(), addr->getAddrlen()));
+    if(rt) {
+        rt->setPort(port);
+    }
+    return rt;
+}
+
+/**
+ * @brief 解析ip[:port]或[ipv6]:port，默认端口53
+ */
+IPAddress::ptr ParseServer(const std::string& str) {
+    std::string ip = str;
+    uint16_t port = 53;
+    if(!str.empty() && str[0] == '[') {
+        size_t pos = str.find(']');
+        if(pos == std::string::npos) {
+            return nullptr;
+        }
+        ip = str.substr(1, pos - 1);
+        if(pos + 1 < str.size() && str[pos + 1] == ':') {
+            port = atoi(str.c_str() + pos + 2);
+        }
+    } else if(std::count(str.begin(), str.end(), ':') == 1) {
+        size_t pos = str.find(':');
+        ip = str.substr(0, pos);
+        port = atoi(str.c_str() + pos + 1);
+    }
+    return IPAddress::Create(ip.c_str(), port);
+}
+
+std::vector<Address::ptr> ParseServers(const std::vector<std::string>& v) {
+    std::vector<Address::ptr> rt;
+    for(auto& i : v) {
+        IPAddress::ptr addr = ParseServer(i);
+        if(addr) {
+            rt.push_back(addr);
+        } else {
+            HPGS_LOG_WARNING(g_logger) << "invalid dns server: " << i;
+        }
+    }
+    return rt;
+}
+
+std::string NormalizeName(const std::string& host) {
+    std::string name = host;
+    while(!name.empty() && name.back() == '.') {
+        name.pop_back();
+    }
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    return name;
+}
+
+std::string CacheKey(const std::string& name, uint16_t type) {
+    return name + "/" + std::to_string(type);
+}
+
+}
+
+DnsResolver::DnsResolver() {
+    loadHosts();
+    m_defaultServers = g_dns_servers->getValue().empty()
+            ? LoadResolvConf() : ParseServers(g_dns_servers->getValue());
+    m_listenerId = g_dns_servers->addListener([this](const std::vector<std::string>& old_value
+                                      ,const std::vector<std::string>& new_value){
+        std::vector<Address::ptr> servers = new_value.empty()
+                ? LoadResolvConf() : ParseServers(new_value);
+        RWMutexType::WriteLock lock(m_mutex);
+        m_defaultServers.swap(servers);
+    });
+}
+
+DnsResolver::~DnsResolver() {
+    g_dns_servers->delListener(m_listenerId);
+}
+
+std::vector<Address::ptr> DnsResolver::LoadResolvConf() {
+    std::vector<Address::ptr> rt;
+    std::ifstream ifs("/etc/resolv.conf");
+    std::string line;
+    while(std::getline(ifs, line)) {
+        std::stringstream ss(line);
+        std::string key, value;
+        ss >> key >> value;
+        if(key != "nameserver" || value.empty()) {
+            continue;
+        }
+        //去掉IPv6的网卡后缀 fe80::1%eth0
+        value = value.substr(0, value.find('%'));
+        IPAddress::ptr addr = IPAddress::Create(value.c_str(), 53);
+        if(addr) {
+            rt.push_back(addr);
+        }
+    }
+    if(rt.empty()) {
+        rt.push_back(IPAddress::Create("127.0.0.1", 53));
+    }
+    return rt;
+}
+
+void DnsResolver::loadHosts() {
+    std::ifstream ifs("/etc/hosts");
+    std::string line;
+    while(std::getline(ifs, line)) {
+        line = line.substr(0, line.find('#'));
+        std::stringstream ss(line);
+        std::string ip, name;
+        if(!(ss >> ip)) {
+            continue;
+        }
+        IPAddress::ptr addr = IPAddress::Create(ip.c_str());
+        if(!addr) {
+            continue;
+        }
+        while(ss >> name) {
+            m_hosts[NormalizeName(name)].push_back(addr);
+        }
+    }
+}
+
+void DnsResolver::setServers(const std::vector<Address::ptr>& v) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_servers = v;
+}
+
+std::vector<Address::ptr> DnsResolver::getServers() {
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_servers.empty() ? m_defaultServers : m_servers;
+}
+
+bool DnsResolver::findCache(const std::string& key, Entry& entry) {
+    RWMutexType::ReadLock lock(m_mutex);
+    auto it = m_cache.find(key);
+    if(it == m_cache.end() || it->second.expire_ms <= GetCurrentMs()) {
+        return false;
+    }
+    entry = it->second;
+    return true;
+}
+
+void DnsResolver::putCache(const std::string& key, const Entry& entry) {
+    uint64_t now_ms = GetCurrentMs();
+    if(entry.expire_ms <= now_ms) {
+        return;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    if(m_cache.size() >= g_dns_cache_size->getValue()) {
+        for(auto it = m_cache.begin(); it != m_cache.end();) {
+            if(it->second.expire_ms <= now_ms) {
+                it = m_cache.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if(m_cache.size() >= g_dns_cache_size->getValue()) {
+            m_cache.clear();
+        }
+    }
+    m_cache[key] = entry;
+}
+
+void DnsResolver::clearCache() {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_cache.clear();
+}
+
+size_t DnsResolver::getCacheSize() {
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_cache.size();
+}
+
+bool DnsResolver::lookup(std::vector<Address::ptr>& result, const std::string& host, int family) {
+    std::string node;
+    uint16_t port = 0;
+    if(!host.empty() && host[0] == '[') {
+        size_t pos = host.find(']');
+        if(pos == std::string::npos) {
+            return false;
+        }
+        node = host.substr(1, pos - 1);
+        if(pos + 1 < host.size() && host[pos + 1] == ':') {
+            port = atoi(host.c_str() + pos + 2);
+        }
+    } else if(std::count(host.begin(), host.end(), ':') == 1) {
+        size_t pos = host.find(':');
+        node = host.substr(0, pos);
+        port = atoi(host.c_str() + pos + 1);
+    } else {
+        node = host;
+    }
+
+    //IP字面量不需要查询
+    IPAddress::ptr literal = IPAddress::Create(node.c_str(), port);
+    if(literal) {
+        if(family == AF_UNSPEC || literal->getFamily() == family) {
+            result.push_back(literal);
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<uint16_t> types;
+    if(family == AF_INET || family == AF_UNSPEC) {
+        types.push_back(A);
+    }
+    if(family == AF_INET6 || family == AF_UNSPEC) {
+        types.push_back(AAAA);
+    }
+    if(types.empty()) {
+        return false;
+    }
+
+    std::string name = NormalizeName(node);
+    auto hit = m_hosts.find(name);
+    if(hit != m_hosts.end()) {
+        size_t size = result.size();
+        for(auto& i : hit->second) {
+            if(family == AF_UNSPEC || i->getFamily() == family) {
+                result.push_back(CopyWithPort(i, port));
+            }
+        }
+        if(result.size() > size) {
+            return true;
+        }
+    }
+
+    std::map<uint16_t, Entry> entries;
+    std::vector<uint16_t> missing;
+    for(auto type : types) {
+        Entry entry;
+        if(findCache(CacheKey(name, type), entry)) {
+            ++m_cacheHits;
+            if(entry.addrs.empty()) {
+                ++m_negativeHits;
+            }
+            entries[type] = entry;
+        } else {
+            missing.push_back(type);
+        }
+    }
+
+    if(!missing.empty()) {
+        std::map<uint16_t, Entry> answers;
+        if(!query(name, missing, answers)) {
+            ++m_fails;
+        }
+        for(auto& i : answers) {
+            putCache(CacheKey(name, i.first), i.second);
+            entries[i.first] = i.second;
+        }
+    }
+
+    size_t size = result.size();
+    for(auto type : types) {
+        for(auto& i : entries[type].addrs) {
+            result.push_back(CopyWithPort(i, port));
+        }
+    }
+    return result.size() > size;
+}
+
+IPAddress::ptr DnsResolver::lookupAny(const std::string& host, int family) {
+    std::vector<Address::ptr> result;
+    if(lookup(result, host, family)) {
+        return std::dynamic_pointer_cast<IPAddress>(result[0]);
+    }
+    return nullptr;
+}
+
+bool DnsResolver::query(const std::string& name, const std::vector<uint16_t>& types
+                        ,std::map<uint16_t, Entry>& result) {
+    std::vector<Address::ptr> servers = getServers();
+    std::vector<uint16_t> pending = types;
+    uint32_t attempts = std::max(g_dns_attempts->getValue(), (uint32_t)1);
+    for(uint32_t i = 0; i < attempts && !pending.empty(); ++i) {
+        for(auto& server : servers) {
+            if(pending.empty()) {
+                break;
+            }
+            queryServer(server, name, pending, result);
+        }
+    }
+    if(!pending.empty()) {
+        HPGS_LOG_WARNING(g_logger) << "dns query " << name << " fail, no answer from "
+            << servers.size() << " servers";
+    }
+    return pending.empty();
+}
+
+void DnsResolver::queryServer(Address::ptr server, const std::string& name
+                              ,std::vector<uint16_t>& types, std::map<uint16_t, Entry>& result
+                              ,bool tcp) {
+    //每次查询使用新的socket，源端口随机；connect后内核丢弃其他来源的报文
+    Socket::ptr sock = tcp ? Socket::CreateTcp(server) : Socket::CreateUdp(server);
+    if(!sock->connect(server, g_dns_timeout->getValue())) {
+        HPGS_LOG_DEBUG(g_logger) << "dns connect " << *server << " fail errno="
+            << errno << " errstr=" << strerror(errno);
+        return;
+    }
+
+    //id -> 类型，所有类型的查询同时发出
+    std::map<uint16_t, uint16_t> ids;
+    std::string packet;
+    for(auto type : types) {
+        uint16_t id = RandomId();
+        while(ids.count(id)) {
+            ++id;
+        }
+        if(!EncodeQuery(packet, id, name, type)) {
+            HPGS_LOG_DEBUG(g_logger) << "dns invalid name " << name;
+            types.clear();
+            return;
+        }
+        //TCP报文前面是两字节的长度(RFC 1035 4.2.2)
+        if(tcp) {
+            std::string len;
+            Write16(len, packet.size());
+            packet.insert(0, len);
+        }
+        if(sock->send(packet.c_str(), packet.size()) != (int)packet.size()) {
+            continue;
+        }
+        ++m_queries;
+        ids[id] = type;
+    }
+
+    std::string buf(s_max_packet, '\0');
+    //应答被截断的类型，UDP收完后改用TCP查询
+    std::vector<uint16_t> truncated;
+    uint64_t deadline = GetCurrentMs() + g_dns_timeout->getValue();
+    while(!ids.empty()) {
+        uint64_t now_ms = GetCurrentMs();
+        if(now_ms >= deadline) {
+            break;
+        }
+        sock->setRecvTimeout(deadline - now_ms);
+        int rt = 0;
+        if(tcp) {
+            uint16_t len = 0;
+            if(!RecvFull(sock, &len, sizeof(len))) {
+                break;
+            }
+            rt = byteswapOnLittleEndian(len);
+            if(buf.size() < (size_t)rt) {
+                buf.resize(rt);
+            }
+            if(!RecvFull(sock, &buf[0], rt)) {
+                break;
+            }
+        } else {
+            rt = sock->recv(&buf[0], buf.size());
+            if(rt <= 0) {
+                break;
+            }
+        }
+
+        DnsReader reader((const uint8_t*)buf.c_str(), rt);
+        uint16_t id = reader.read16();
+        uint16_t flags = reader.read16();
+        uint16_t qdcount = reader.read16();
+        uint16_t ancount = reader.read16();
+        uint16_t nscount = reader.read16();
+        reader.read16();
+        auto it = ids.find(id);
+        //不是应答或者不是本次的查询
+        if(reader.isError() || !(flags & 0x8000) || it == ids.end() || qdcount != 1) {
+            continue;
+        }
+        uint16_t type = it->second;
+        if(reader.readName() != name || reader.read16() != type
+                || reader.read16() != s_class_in || reader.isError()) {
+            continue;
+        }
+        ids.erase(it);
+
+        //TC: 应答不完整，不能缓存
+        if(flags & 0x0200) {
+            if(!tcp) {
+                truncated.push_back(type);
+            }
+            continue;
+        }
+
+        int rcode = flags & 0x0f;
+        //SERVFAIL、REFUSED等换下一个服务器
+        if(rcode != 0 && rcode != 3) {
+            HPGS_LOG_DEBUG(g_logger) << "dns " << *server << " " << name
+                << " type=" << type << " rcode=" << rcode;
+            continue;
+        }
+
+        Entry entry;
+        uint32_t ttl = g_dns_max_ttl->getValue();
+        //否定应答的TTL取SOA记录的TTL和minimum中较小的一个(RFC 2308)
+        uint32_t negative_ttl = g_dns_negative_ttl->getValue();
+        for(uint32_t i = 0; i < (uint32_t)ancount + nscount && !reader.isError(); ++i) {
+            reader.readName();
+            uint16_t rtype = reader.read16();
+            uint16_t rclass = reader.read16();
+            uint32_t rttl = reader.read32();
+            uint16_t rdlen = reader.read16();
+            size_t rdata = reader.getPosition();
+            if(reader.isError()) {
+                break;
+            }
+            if(i < ancount && rclass == s_class_in) {
+                if(rtype == A && rdlen == 4) {
+                    sockaddr_in addr;
+                    memset(&addr, 0, sizeof(addr));
+                    addr.sin_family = AF_INET;
+                    reader.read(&addr.sin_addr, 4);
+                    entry.addrs.push_back(IPAddress::ptr(new IPv4Address(addr)));
+                    ttl = std::min(ttl, rttl);
+                } else if(rtype == AAAA && rdlen == 16) {
+                    uint8_t addr[16];
+                    reader.read(addr, 16);
+                    entry.addrs.push_back(IPAddress::ptr(new IPv6Address(addr)));
+                    ttl = std::min(ttl, rttl);
+                } else if(rtype == s_type_cname) {
+                    ttl = std::min(ttl, rttl);
+                }
+            } else if(i >= ancount && rtype == s_type_soa) {
+                reader.readName();
+                reader.readName();
+                reader.skip(16);
+                uint32_t minimum = reader.read32();
+                if(!reader.isError()) {
+                    negative_ttl = std::min(rttl, minimum);
+                }
+            }
+            reader.setPosition(rdata);
+            reader.skip(rdlen);
+        }
+        if(reader.isError() && entry.addrs.empty() && rcode == 0) {
+            continue;
+        }
+        entry.expire_ms = GetCurrentMs()
+                + (uint64_t)(entry.addrs.empty() ? negative_ttl : ttl) * 1000;
+        result[type] = entry;
+        types.erase(std::remove(types.begin(), types.end(), type), types.end());
+    }
+
+    if(!truncated.empty()) {
+        sock->close();
+        HPGS_LOG_DEBUG(g_logger) << "dns " << *server << " " << name
+            << " truncated, retry over tcp";
+        queryServer(server, name, truncated, result, true);
+        for(auto& i : result) {
+            types.erase(std::remove(types.begin(), types.end(), i.first), types.end());
+        }
+    }
+}
+
+}
@@ -0,0 +1,82 @@
+#include "frame.h"
+#include "config.h"
+#include "log.h"
+#include "myendian.h"
+#include <string.h>
+#include <sstream>
+
+namespace HPGS {
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_frame_max_body_size =
+        HPGS::Config::Lookup("frame.max_body_size", (uint32_t)(64 * 1024 * 1024),
+                "frame max body size");
+
+Frame::Frame(uint32_t id, uint8_t flags, ByteArray::ptr body)
+    :m_id(id)
+    ,m_flags(flags)
+    ,m_body(body ? body : ByteArray::ptr(new ByteArray)) {
+}
+
+std::string Frame::toString() const {
+    std::stringstream ss;
+    ss << "[Frame id=" << m_id
+       << " flags=" << (int)m_flags
+       << " body_size=" << m_body->getReadSize()
+       << "]";
+    return ss.str();
+}
+
+void FrameCodec::Encode(ByteArray& out, const Frame& frame){
+    //帧头总是网络字节序，和out的字节序设置无关
+    ByteArray::ptr body = frame.getBody();
+    uint16_t magic = byteswapOnLittleEndian(Frame::MAGIC);
+    uint32_t id = byteswapOnLittleEndian(frame.getId());
+    uint32_t length = byteswapOnLittleEndian((uint32_t)body->getReadSize());
+    char header[Frame::HEADER_SIZE];
+    memcpy(header, &magic, 2);
+    header[2] = Frame::VERSION;
+    header[3] = frame.getFlags();
+    memcpy(header + 4, &id, 4);
+    memcpy(header + 8, &length, 4);
+    out.write(header, sizeof(header));
+
+    std::vector<iovec> iovs;
+    body->getReadBuffers(iovs);
+    for(auto& i : iovs){
+        out.write(i.iov_base, i.iov_len);
+    }
+}
+
+int FrameCodec::Decode(ByteArray& in, Frame::ptr& frame){
+    if(in.getReadSize() < Frame::HEADER_SIZE){
+        return 0;
+    }
+    char header[Frame::HEADER_SIZE];
+    in.read(header, sizeof(header), in.getPosition());
+    uint16_t magic;
+    uint32_t id;
+    uint32_t length;
+    memcpy(&magic, header, 2);
+    memcpy(&id, header + 4, 4);
+    memcpy(&length, header + 8, 4);
+    magic = byteswapOnLittleEndian(magic);
+    id = byteswapOnLittleEndian(id);
+    length = byteswapOnLittleEndian(length);
+    if(magic != Frame::MAGIC || (uint8_t)header[2] != Frame::VERSION
+            || length > g_frame_max_body_size->getValue()){
+        HPGS_LOG_ERROR(g_logger) << "invalid frame header magic=" << magic
+            << " version=" << (int)(uint8_t)header[2] << " length=" << length;
+        return -1;
+    }
+    if(in.getReadSize() < Frame::HEADER_SIZE + length){
+        return 0;
+    }
+    in.consume(Frame::HEADER_SIZE);
+    //消息体直接引用in的内存块，in之后再写入这些块时写时复制
+    frame.reset(new Frame(id, header[3], in.readShared(length)));
+    return 1;
+}
+
+}
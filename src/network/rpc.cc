@@ -0,0 +1,316 @@
+#include "rpc.h"
+#include "log.h"
+#include <vector>
+
+namespace HPGS {
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
+
+/// recvFrame每次从socket读取的长度，不小于socket_stream.read_buffer_size时直接读入节点内存
+static const size_t s_read_size = 64 * 1024;
+
+RpcSession::RpcSession(Socket::ptr sock)
+    :m_stream(new SocketStream(sock))
+    ,m_rbuf(new ByteArray)
+    ,m_wbuf(new ByteArray)
+    ,m_writing(false)
+    ,m_closed(false) {
+    m_rbuf->setStreaming(true);
+}
+
+int RpcSession::recvFrame(Frame::ptr& frame){
+    while(true){
+        int rt = FrameCodec::Decode(*m_rbuf, frame);
+        if(rt){
+            return rt;
+        }
+        rt = m_stream->read(m_rbuf, s_read_size);
+        if(rt <= 0){
+            return rt;
+        }
+    }
+}
+
+int RpcSession::sendFrame(const Frame& frame){
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_closed){
+            return -1;
+        }
+        FrameCodec::Encode(*m_wbuf, frame);
+        if(m_writing){
+            return 0;
+        }
+        m_writing = true;
+    }
+    //发送期间其他协程编码进来的帧在下一轮一起发出
+    while(true){
+        ByteArray::ptr out;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_wbuf->getSize() == 0){
+                m_writing = false;
+                return 0;
+            }
+            out.swap(m_wbuf);
+            if(m_spare){
+                m_wbuf.swap(m_spare);
+            } else {
+                m_wbuf.reset(new ByteArray);
+            }
+        }
+        out->setPosition(0);
+        int rt = m_stream->writeFixSize(out, out->getSize());
+        out->clear();
+        MutexType::Lock lock(m_mutex);
+        m_spare = out;
+        if(rt <= 0){
+            HPGS_LOG_ERROR(g_logger) << "RpcSession send fail rt=" << rt
+                << " " << *m_stream->getSocket();
+            m_writing = false;
+            m_wbuf->clear();
+            m_closed = true;
+            lock.unlock();
+            //关闭连接让接收协程返回，等待响应的调用随之结束
+            m_stream->close();
+            return -1;
+        }
+    }
+}
+
+void RpcSession::close(){
+    m_closed = true;
+    m_stream->close();
+}
+
+RpcServer::RpcServer(HPGS::IOManager* worker
+                     ,HPGS::IOManager* io_worker
+                     ,HPGS::IOManager* accept_worker)
+    :TcpServer(worker, io_worker, accept_worker) {
+    m_type = "rpc";
+}
+
+void RpcServer::addMethod(const std::string& name, Handler handler){
+    RWMutexType::WriteLock lock(m_mutex);
+    m_methods[name] = handler;
+}
+
+void RpcServer::delMethod(const std::string& name){
+    RWMutexType::WriteLock lock(m_mutex);
+    m_methods.erase(name);
+}
+
+void RpcServer::handleClient(Socket::ptr client){
+    RpcSession::ptr session(new RpcSession(client));
+    RpcServer::ptr self = std::static_pointer_cast<RpcServer>(shared_from_this());
+    Frame::ptr frame;
+    while(session->recvFrame(frame) > 0){
+        if(frame->hasFlag(Frame::RESPONSE)){
+            HPGS_LOG_ERROR(g_logger) << "RpcServer unexpected " << frame->toString()
+                << " from " << *client;
+            break;
+        }
+        //每个请求一个协程，同一连接上的请求并发处理
+        m_worker->schedule(std::bind(&RpcServer::handleRequest, self, session, frame));
+    }
+    session->close();
+}
+
+void RpcServer::handleRequest(RpcSession::ptr session, Frame::ptr request){
+    ++m_requestCount;
+    ByteArray::ptr body = request->getBody();
+    std::string method;
+    try {
+        method = body->readStringVint();
+    } catch(std::out_of_range& e) {
+        HPGS_LOG_ERROR(g_logger) << "RpcServer invalid request " << request->toString();
+        session->close();
+        return;
+    }
+
+    Handler handler;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        auto it = m_methods.find(method);
+        if(it != m_methods.end()){
+            handler = it->second;
+        }
+    }
+
+    ByteArray::ptr response(new ByteArray);
+    int rt = RPC_NOT_FOUND;
+    if(handler){
+        rt = handler(body, response);
+    } else {
+        HPGS_LOG_ERROR(g_logger) << "RpcServer method not found: " << method;
+    }
+    if(request->hasFlag(Frame::ONEWAY)){
+        return;
+    }
+
+    Frame frame(request->getId(), Frame::RESPONSE, response);
+    if(rt != RPC_OK){
+        //错误响应: 错误码 + 处理函数写入的错误信息
+        ByteArray::ptr error(new ByteArray);
+        error->writeFint32(rt);
+        std::vector<iovec> iovs;
+        response->setPosition(0);
+        response->getReadBuffers(iovs);
+        for(auto& i : iovs){
+            error->write(i.iov_base, i.iov_len);
+        }
+        error->setPosition(0);
+        frame.setFlags(Frame::RESPONSE | Frame::ERROR);
+        frame.setBody(error);
+    } else {
+        response->setPosition(0);
+    }
+    session->sendFrame(frame);
+}
+
+RpcClient::RpcClient(IOManager* iom)
+    :m_iom(iom) {
+}
+
+RpcClient::~RpcClient(){
+    if(m_session){
+        m_session->close();
+    }
+}
+
+bool RpcClient::connect(Address::ptr addr, uint64_t timeout_ms){
+    Socket::ptr sock = Socket::CreateTcp(addr);
+    if(!sock->connect(addr, timeout_ms)){
+        HPGS_LOG_ERROR(g_logger) << "RpcClient connect " << *addr << " fail";
+        return false;
+    }
+    m_session.reset(new RpcSession(sock));
+    //接收协程不持有客户端，最后一个引用释放时析构函数关闭连接
+    std::weak_ptr<RpcClient> weak_self(shared_from_this());
+    m_iom->schedule(std::bind(&RpcClient::DoRecv, weak_self, m_session));
+    return true;
+}
+
+int RpcClient::send(const std::string& method, ByteArray::ptr request
+                    ,uint32_t id, uint8_t flags){
+    ByteArray::ptr body(new ByteArray);
+    body->writeStringVint(method);
+    if(request){
+        std::vector<iovec> iovs;
+        request->getReadBuffers(iovs);
+        for(auto& i : iovs){
+            body->write(i.iov_base, i.iov_len);
+        }
+    }
+    body->setPosition(0);
+    return m_session->sendFrame(Frame(id, flags, body)) == 0 ? RPC_OK : RPC_CLOSED;
+}
+
+int RpcClient::call(const std::string& method, ByteArray::ptr request
+                    ,ByteArray::ptr& response, uint64_t timeout_ms){
+    if(!m_session){
+        return RPC_CLOSED;
+    }
+    Call::ptr call(new Call);
+    uint32_t id = ++m_nextId;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_closed){
+            return RPC_CLOSED;
+        }
+        m_calls[id] = call;
+    }
+
+    Timer::ptr timer;
+    if(timeout_ms != (uint64_t)-1){
+        std::weak_ptr<RpcClient> weak_self(shared_from_this());
+        timer = m_iom->addTimer(timeout_ms, [weak_self, id](){
+            RpcClient::ptr self = weak_self.lock();
+            if(self){
+                self->finish(id, RPC_TIMEOUT, nullptr);
+            }
+        });
+    }
+    if(send(method, request, id, 0) != RPC_OK){
+        finish(id, RPC_CLOSED, nullptr);
+    }
+    //响应、超时、连接关闭三者中先到的一个唤醒
+    call->sem.wait();
+    if(timer){
+        timer->cancel();
+    }
+    response = call->response;
+    return call->result;
+}
+
+int RpcClient::notify(const std::string& method, ByteArray::ptr request){
+    if(!m_session){
+        return RPC_CLOSED;
+    }
+    return send(method, request, ++m_nextId, Frame::ONEWAY);
+}
+
+void RpcClient::close(){
+    if(m_session){
+        m_session->close();
+    }
+}
+
+size_t RpcClient::getPendingCount(){
+    MutexType::Lock lock(m_mutex);
+    return m_calls.size();
+}
+
+void RpcClient::finish(uint32_t id, int result, ByteArray::ptr response){
+    Call::ptr call;
+    {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_calls.find(id);
+        if(it == m_calls.end()){
+            return;
+        }
+        call = it->second;
+        m_calls.erase(it);
+    }
+    call->result = result;
+    call->response = response;
+    call->sem.notify();
+}
+
+void RpcClient::DoRecv(std::weak_ptr<RpcClient> weak_self, RpcSession::ptr session){
+    Frame::ptr frame;
+    while(session->recvFrame(frame) > 0){
+        if(!frame->hasFlag(Frame::RESPONSE)){
+            HPGS_LOG_ERROR(g_logger) << "RpcClient unexpected " << frame->toString();
+            continue;
+        }
+        RpcClient::ptr self = weak_self.lock();
+        if(!self){
+            break;
+        }
+        int result = RPC_OK;
+        ByteArray::ptr body = frame->getBody();
+        if(frame->hasFlag(Frame::ERROR)){
+            result = body->getReadSize() >= 4 ? body->readFint32() : RPC_CLOSED;
+        }
+        self->finish(frame->getId(), result, body);
+    }
+    session->close();
+
+    RpcClient::ptr self = weak_self.lock();
+    if(!self){
+        return;
+    }
+    std::unordered_map<uint32_t, Call::ptr> calls;
+    {
+        MutexType::Lock lock(self->m_mutex);
+        self->m_closed = true;
+        calls.swap(self->m_calls);
+    }
+    for(auto& i : calls){
+        i.second->result = RPC_CLOSED;
+        i.second->sem.notify();
+    }
+}
+
+}
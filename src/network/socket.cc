@@ -4,12 +4,148 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include "util.h"
 #include <limits>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <linux/errqueue.h>
+
+//旧版本头文件没有定义
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
 
 namespace HPGS {
 
 static HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
 
+static HPGS::ConfigVar<uint32_t>::ptr g_socket_zerocopy_threshold =
+    HPGS::Config::Lookup("socket.zerocopy_threshold", (uint32_t)(16 * 1024),
+            "min bytes per send to use MSG_ZEROCOPY");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_socket_zerocopy_close_timeout =
+    HPGS::Config::Lookup("socket.zerocopy_close_timeout", (uint32_t)100,
+            "ms close() waits for MSG_ZEROCOPY completions before deferring");
+
+typedef std::deque<std::pair<uint32_t, std::shared_ptr<void> > > ZeroCopyPending;
+
+/**
+ * @brief 读取fd错误队列中的零拷贝完成通知，删除已完成的发送
+ * @param[out] copied 累加内核回退为拷贝的次数，可以为nullptr
+ */
+static void ReapZeroCopy(int fd, ZeroCopyPending& pending, uint64_t* copied) {
+    char control[128];
+    while(!pending.empty()) {
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        //直接调用原始recvmsg，错误队列为空时立即返回
+        if(recvmsg_f(fd, &msg, MSG_ERRQUEUE) < 0) {
+            break;
+        }
+        for(cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            const sock_extended_err* serr = (const sock_extended_err*)CMSG_DATA(cm);
+            if(serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            //[ee_info, ee_data]范围内的发送已完成
+            uint32_t lo = serr->ee_info;
+            uint32_t hi = serr->ee_data;
+            if(copied && (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)) {
+                *copied += hi - lo + 1;
+            }
+            for(auto it = pending.begin(); it != pending.end();) {
+                if(it->first - lo <= hi - lo) {
+                    it = pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+}
+
+namespace {
+
+/**
+ * @brief close时还有零拷贝发送没有完成的socket
+ * @details 内核发送队列和重传队列中的skb直接引用holder的内存，holder释放后块回到BlockPool被复用，
+ *          新数据会被当作旧数据发出。这里保留fd(只shutdown)和holder，
+ *          等错误队列报告全部完成(数据已确认，或连接出错时skb被释放)后再关闭fd、释放holder
+ */
+struct ZeroCopyLinger {
+    int fd;
+    ZeroCopyPending pending;
+};
+
+Mutex s_lingerMutex;
+std::list<ZeroCopyLinger> s_lingers;
+/// 正在定时清理的IOManager，没有时为nullptr
+IOManager* s_lingerIom = nullptr;
+
+/**
+ * @brief 取走已完成的通知，关闭全部完成的fd
+ */
+void SweepZeroCopyLingers() {
+    std::vector<int> done;
+    {
+        Mutex::Lock lock(s_lingerMutex);
+        for(auto it = s_lingers.begin(); it != s_lingers.end();) {
+            ReapZeroCopy(it->fd, it->pending, nullptr);
+            if(it->pending.empty()) {
+                done.push_back(it->fd);
+                it = s_lingers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for(int fd : done) {
+        ::close(fd);
+    }
+}
+
+/**
+ * @brief 定时清理，还有未完成的socket时重新设置定时器
+ */
+void ArmZeroCopyLingerTimer() {
+    IOManager* iom = IOManager::GetThis();
+    if(!iom) {
+        return;
+    }
+    {
+        Mutex::Lock lock(s_lingerMutex);
+        if(s_lingerIom || s_lingers.empty()) {
+            return;
+        }
+        s_lingerIom = iom;
+    }
+    iom->addTimer(100, [](){
+        SweepZeroCopyLingers();
+        {
+            Mutex::Lock lock(s_lingerMutex);
+            s_lingerIom = nullptr;
+        }
+        ArmZeroCopyLingerTimer();
+    });
+}
+
+}
+
 Socket::ptr Socket::CreateTcp(HPGS::Address::ptr address){
     Socket::ptr sock(new Socket(address->getFamily(), TCP, 0));
     return sock;
@@ -64,7 +200,7 @@ Socket::~Socket(){
 }
 
 int64_t Socket::getSendTimeout(){
-    FdCtx::ptr ctx = fdMgr::GetInstance()->get(m_sock);
+    FdCtx* ctx = fdMgr::GetInstance()->get(m_sock);
     if(ctx){
         return ctx->getTimeout(SO_SNDTIMEO);
     }
@@ -77,7 +213,7 @@ void Socket::setSendTimeout(int64_t v){
 }
 
 int64_t Socket::getRecvTimeout(){
-    FdCtx::ptr ctx = fdMgr::GetInstance()->get(m_sock);
+    FdCtx* ctx = fdMgr::GetInstance()->get(m_sock);
     if(ctx){
         return ctx->getTimeout(SO_RCVTIMEO);
     }
@@ -112,27 +248,71 @@ bool Socket::setOption(int level, int option, const void* result, socklen_t len)
 }
 
 Socket::ptr Socket::accept(){
-    Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
-    int newsock = ::accept(m_sock, nullptr, nullptr);
+    //hook的accept4以系统非阻塞创建新连接，这里只需要CLOEXEC
+    SockAddr peer;
+    socklen_t len = SockAddr::Capacity();
+    int newsock = ::accept4(m_sock, peer.getAddr(), &len, SOCK_CLOEXEC);
     if(newsock == -1){
         HPGS_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno"
                                  << errno << " errstr = " << strerror(errno);
         return nullptr;
     }
-    if(sock->init(newsock)){
-        return sock;
+    peer.setAddrLen(len);
+    return newAccepted(newsock, peer);
+}
+
+Socket::ptr Socket::tryAccept(){
+    SockAddr peer;
+    socklen_t len = SockAddr::Capacity();
+    int newsock = accept_nowait(m_sock, peer.getAddr(), &len, SOCK_CLOEXEC);
+    if(newsock == -1){
+        if(errno != EAGAIN && errno != EWOULDBLOCK){
+            HPGS_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno"
+                                     << errno << " errstr = " << strerror(errno);
+        }
+        return nullptr;
+    }
+    peer.setAddrLen(len);
+    return newAccepted(newsock, peer);
+}
+
+size_t Socket::acceptBatch(std::vector<Socket::ptr>& socks, size_t max){
+    if(max == 0){
+        return 0;
+    }
+    Socket::ptr sock = accept();
+    if(!sock){
+        return 0;
+    }
+    socks.push_back(sock);
+    size_t n = 1;
+    while(n < max && (sock = tryAccept())){
+        socks.push_back(sock);
+        ++n;
+    }
+    return n;
+}
+
+Socket::ptr Socket::newAccepted(int sock, const SockAddr& peer){
+    Socket::ptr rt(new Socket(m_family, m_type, m_protocol));
+    if(rt->init(sock)){
+        rt->m_remoteSockAddr = peer;
+        return rt;
+    }
+    //init成功接管fd后失败的由析构关闭
+    if(!rt->isValid()){
+        ::close(sock);
     }
     return nullptr;
 }
 
 bool Socket::init(int sock){
-    FdCtx::ptr ctx = fdMgr::GetInstance()->get(sock);
+    FdCtx* ctx = fdMgr::GetInstance()->get(sock);
     if(ctx && ctx->isSocket() && !ctx->isClose()){
         m_sock = sock;
         m_isConnected = true;
         initSock();
-        getLocalAddress();
-        getRemoteAddress();
+        //地址在第一次使用时获取
         return true;
     }
     return false;
@@ -169,21 +349,36 @@ bool Socket::bind(const Address::ptr addr){
                                  << " errstr = " << strerror(errno);
         return false;
     }
-    getLocalAddress();
+    Mutex::Lock lock(m_addrMutex);
+    m_localAddress.reset();
+    m_localSockAddr.clear();
     return true;
 }
 
 bool Socket::reconnect(uint64_t timeout_ms){
-    if(!m_remoteAddress){
-        HPGS_LOG_ERROR(g_logger) << "reconnect m_remoteAddress is null";
-        return false;
+    Address::ptr addr;
+    {
+        Mutex::Lock lock(m_addrMutex);
+        if(!m_remoteAddress){
+            if(m_remoteSockAddr.empty()){
+                HPGS_LOG_ERROR(g_logger) << "reconnect m_remoteAddress is null";
+                return false;
+            }
+            m_remoteAddress = m_remoteSockAddr.toAddress();
+        }
+        addr = m_remoteAddress;
     }
-    m_localAddress.reset();
-    return connect(m_remoteAddress, timeout_ms);
+    return connect(addr, timeout_ms);
 }
 
 bool Socket::connect(const HPGS::Address::ptr addr, uint64_t timeout_ms){
-    m_remoteAddress = addr;
+    {
+        Mutex::Lock lock(m_addrMutex);
+        m_remoteAddress = addr;
+        m_remoteSockAddr = SockAddr(*addr);
+        m_localAddress.reset();
+        m_localSockAddr.clear();
+    }
     if(!isValid()){
         newSock();
         if(HPGS_UNLIKELY(!isValid())){
@@ -216,8 +411,6 @@ bool Socket::connect(const HPGS::Address::ptr addr, uint64_t timeout_ms){
         }
     }
     m_isConnected = true;
-    getRemoteAddress();
-    getLocalAddress();
     return true;
 }
 
@@ -239,10 +432,31 @@ bool Socket::close() {
         return true;
     }
     m_isConnected = false;
+    //fd关闭后收不到完成通知。内核只是固定了页，holder释放后内存会被分配器复用，
+    //发送队列或重传队列里还没发出的数据就变成了新内容。先有限等待完成，超时交给延迟关闭
+    ZeroCopyPending pending;
+    if(m_sock != -1 && m_zeroCopy) {
+        flushZeroCopy(g_socket_zerocopy_close_timeout->getValue());
+        Mutex::Lock lock(m_zcMutex);
+        pending.swap(m_zcPending);
+    }
     if(m_sock != -1) {
-        ::close(m_sock);
+        if(!pending.empty()) {
+            ::shutdown(m_sock, SHUT_RDWR);
+            {
+                Mutex::Lock lock(s_lingerMutex);
+                s_lingers.push_back(ZeroCopyLinger{m_sock, ZeroCopyPending()});
+                s_lingers.back().pending.swap(pending);
+            }
+            ArmZeroCopyLingerTimer();
+        } else {
+            ::close(m_sock);
+        }
         m_sock = -1;
     }
+    if(m_zeroCopy) {
+        SweepZeroCopyLingers();
+    }
     return false;
 }
 
@@ -284,8 +498,20 @@ int Socket::sendTo(const iovec* buffers, size_t length, const Address::ptr to, i
     return -1;
 }
 
+int64_t Socket::sendFile(int fd, off_t offset, size_t length){
+    if(isConnected()){
+        return ::sendfile(m_sock, fd, &offset, length);
+    }
+    return -1;
+}
+
 int Socket::recv(void* buffer, size_t length, int flags) {
     if(isConnected()) {
+        if(m_zeroCopy) {
+            return recvReapZeroCopy([this, buffer, length](int f){
+                return recv_f(m_sock, buffer, length, f);
+            }, flags);
+        }
         return ::recv(m_sock, buffer, length, flags);
     }
     return -1;
@@ -297,6 +523,11 @@ int Socket::recv(iovec* buffers, size_t length, int flags) {
         memset(&msg, 0, sizeof(msg));
         msg.msg_iov = (iovec*)buffers;
         msg.msg_iovlen = length;
+        if(m_zeroCopy) {
+            return recvReapZeroCopy([this, &msg](int f){
+                return recvmsg_f(m_sock, &msg, f);
+            }, flags);
+        }
         return ::recvmsg(m_sock, &msg, flags);
     }
     return -1;
@@ -323,74 +554,224 @@ int Socket::recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags
     return -1;
 }
 
-Address::ptr Socket::getRemoteAddress() {
-    if(m_remoteAddress) {
-        return m_remoteAddress;
+bool Socket::setZeroCopy(bool v) {
+    int val = v ? 1 : 0;
+    if(!setOption(SOL_SOCKET, SO_ZEROCOPY, val)) {
+        return false;
     }
+    m_zeroCopy = v;
+    return true;
+}
 
-    Address::ptr result;
-    switch(m_family) {
-        case AF_INET:
-            result.reset(new IPv4Address());
-            break;
-        case AF_INET6:
-            result.reset(new IPv6Address());
-            break;
-        case AF_UNIX:
-            result.reset(new UnixAddress());
-            break;
-        default:
-            result.reset(new UnknownAddress(m_family));
+int Socket::sendZeroCopy(const iovec* buffers, size_t length, std::shared_ptr<void> holder, int flags) {
+    if(!isConnected()) {
+        return -1;
+    }
+    reapZeroCopy();
+    size_t total = 0;
+    for(size_t i = 0; i < length; ++i) {
+        total += buffers[i].iov_len;
+    }
+    if(!m_zeroCopy || total < g_socket_zerocopy_threshold->getValue()) {
+        return send(buffers, length, flags);
+    }
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec*)buffers;
+    msg.msg_iovlen = length;
+    //先登记再发送，接收协程可能在sendmsg返回前就取走了这次的完成通知
+    uint32_t seq;
+    {
+        Mutex::Lock lock(m_zcMutex);
+        seq = m_zcNext++;
+        m_zcPending.push_back(std::make_pair(seq, holder));
+    }
+    int rt = ::sendmsg(m_sock, &msg, flags | MSG_ZEROCOPY);
+    if(rt < 0) {
+        //发送失败内核不分配序号
+        int err = errno;
+        {
+            Mutex::Lock lock(m_zcMutex);
+            --m_zcNext;
+            for(auto it = m_zcPending.begin(); it != m_zcPending.end(); ++it) {
+                if(it->first == seq) {
+                    m_zcPending.erase(it);
+                    break;
+                }
+            }
+        }
+        errno = err;
+        if(errno == ENOBUFS) {
+            //超过optmem限制，本次退化为拷贝发送
+            return send(buffers, length, flags);
+        }
+    }
+    return rt;
+}
+
+size_t Socket::getZeroCopyPending() const {
+    Mutex::Lock lock(m_zcMutex);
+    return m_zcPending.size();
+}
+
+int Socket::recvReapZeroCopy(const std::function<int(int)>& fn, int flags) {
+    FdCtx* ctx = fdMgr::GetInstance()->get(m_sock);
+    if(!is_hook_enable() || !ctx || ctx->getUserNonblock() || (flags & MSG_DONTWAIT)) {
+        reapZeroCopy();
+        return fn(flags);
+    }
+    uint64_t timeout_ms = ctx->getTimeout(SO_RCVTIMEO);
+    uint64_t start = HPGS::GetCurrentMs();
+    while(true) {
+        reapZeroCopy();
+        int rt = fn(flags | MSG_DONTWAIT);
+        if(rt >= 0 || (errno != EAGAIN && errno != EINTR)) {
+            return rt;
+        }
+        int wait = -1;
+        if(timeout_ms != (uint64_t)-1) {
+            uint64_t elapsed = HPGS::GetCurrentMs() - start;
+            if(elapsed >= timeout_ms) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            wait = timeout_ms - elapsed;
+        }
+        //可读或有新的完成通知(POLLERR)时返回，hook的poll挂起协程
+        pollfd pfd;
+        pfd.fd = m_sock;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        rt = ::poll(&pfd, 1, wait);
+        if(rt < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+void Socket::reapZeroCopy() {
+    Mutex::Lock lock(m_zcMutex);
+    ReapZeroCopy(m_sock, m_zcPending, &m_zcCopied);
+}
+
+bool Socket::flushZeroCopy(uint64_t timeout_ms) {
+    uint64_t start = HPGS::GetCurrentMs();
+    reapZeroCopy();
+    while(getZeroCopyPending()) {
+        int wait = -1;
+        if(timeout_ms != (uint64_t)-1) {
+            uint64_t elapsed = HPGS::GetCurrentMs() - start;
+            if(elapsed >= timeout_ms) {
+                return false;
+            }
+            wait = timeout_ms - elapsed;
+        }
+        //只等待错误队列: POLLERR不需要请求也总会返回，这里写出来表明意图，不关心读写。
+        //hook的poll把fd挂到epoll上挂起协程，EPOLLERR唤醒
+        pollfd pfd;
+        pfd.fd = m_sock;
+        pfd.events = POLLERR;
+        pfd.revents = 0;
+        if(::poll(&pfd, 1, wait) < 0 && errno != EINTR) {
+            return false;
+        }
+        reapZeroCopy();
+    }
+    return true;
+}
+
+int Socket::recvBatch(DatagramRing& ring, int flags) {
+    if(!isValid()) {
+        return -1;
+    }
+    int rt = ::recvmmsg(m_sock, ring.prepareRecv(), ring.getCount(), flags, nullptr);
+    if(rt < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    ring.commitRecv(rt);
+    return rt;
+}
+
+int Socket::sendBatch(DatagramRing& ring, int flags) {
+    if(!isValid()) {
+        return -1;
+    }
+    size_t sent = 0;
+    while(sent < ring.size()) {
+        int rt = ::sendmmsg(m_sock, ring.sendHeaders(sent), ring.size() - sent, flags);
+        if(rt <= 0) {
+            if(sent == 0) {
+                return -1;
+            }
             break;
+        }
+        sent += rt;
     }
-    socklen_t addrlen = result->getAddrlen();
-    if(getpeername(m_sock, result->getAddr(), &addrlen)) {
-        //HPGS_LOG_ERROR(g_logger) << "getpeername error sock=" << m_sock
-        //    << " errno=" << errno << " errstr=" << strerror(errno);
-        return Address::ptr(new UnknownAddress(m_family));
+    return sent;
+}
+
+bool Socket::setUdpSegment(uint16_t size) {
+    int val = size;
+    return setOption(SOL_UDP, UDP_SEGMENT, val);
+}
+
+bool Socket::setUdpGro(bool v) {
+    int val = v ? 1 : 0;
+    return setOption(SOL_UDP, UDP_GRO, val);
+}
+
+Address::ptr Socket::getRemoteAddress() {
+    SockAddr addr = getRemoteSockAddr();
+    Mutex::Lock lock(m_addrMutex);
+    if(m_remoteAddress) {
+        return m_remoteAddress;
     }
-    if(m_family == AF_UNIX) {
-        UnixAddress::ptr addr = std::dynamic_pointer_cast<UnixAddress>(result);
-        addr->setAddrlen(addrlen);
+    if(addr.empty()) {
+        return Address::ptr(new UnknownAddress(m_family));
     }
-    m_remoteAddress = result;
+    m_remoteAddress = addr.toAddress();
     return m_remoteAddress;
 }
 
 Address::ptr Socket::getLocalAddress() {
+    SockAddr addr = getLocalSockAddr();
+    Mutex::Lock lock(m_addrMutex);
     if(m_localAddress) {
         return m_localAddress;
     }
-
-    Address::ptr result;
-    switch(m_family) {
-        case AF_INET:
-            result.reset(new IPv4Address());
-            break;
-        case AF_INET6:
-            result.reset(new IPv6Address());
-            break;
-        case AF_UNIX:
-            result.reset(new UnixAddress());
-            break;
-        default:
-            result.reset(new UnknownAddress(m_family));
-            break;
-    }
-    socklen_t addrlen = result->getAddrlen();
-    if(getsockname(m_sock, result->getAddr(), &addrlen)) {
-        HPGS_LOG_ERROR(g_logger) << "getsockname error sock=" << m_sock
-            << " errno=" << errno << " errstr=" << strerror(errno);
+    if(addr.empty()) {
         return Address::ptr(new UnknownAddress(m_family));
     }
-    if(m_family == AF_UNIX) {
-        UnixAddress::ptr addr = std::dynamic_pointer_cast<UnixAddress>(result);
-        addr->setAddrlen(addrlen);
-    }
-    m_localAddress = result;
+    m_localAddress = addr.toAddress();
     return m_localAddress;
 }
 
+SockAddr Socket::getRemoteSockAddr() {
+    Mutex::Lock lock(m_addrMutex);
+    if(m_remoteSockAddr.empty() && isValid()) {
+        socklen_t addrlen = SockAddr::Capacity();
+        if(getpeername(m_sock, m_remoteSockAddr.getAddr(), &addrlen) == 0) {
+            m_remoteSockAddr.setAddrLen(addrlen);
+        }
+    }
+    return m_remoteSockAddr;
+}
+
+SockAddr Socket::getLocalSockAddr() {
+    Mutex::Lock lock(m_addrMutex);
+    if(m_localSockAddr.empty() && isValid()) {
+        socklen_t addrlen = SockAddr::Capacity();
+        if(getsockname(m_sock, m_localSockAddr.getAddr(), &addrlen)) {
+            HPGS_LOG_ERROR(g_logger) << "getsockname error sock=" << m_sock
+                << " errno=" << errno << " errstr=" << strerror(errno);
+        } else {
+            m_localSockAddr.setAddrLen(addrlen);
+        }
+    }
+    return m_localSockAddr;
+}
+
 bool Socket::isValid() const {
     return m_sock != -1;
 }
@@ -410,14 +791,23 @@ std::ostream& Socket::dump(std::ostream& os) const {
        << " family=" << m_family
        << " type=" << m_type
        << " protocol=" << m_protocol;
-    if(m_localAddress) {
+    dumpAddress(os);
+    os << "]";
+    return os;
+}
+
+void Socket::dumpAddress(std::ostream& os) const {
+    Mutex::Lock lock(m_addrMutex);
+    if(!m_localSockAddr.empty()) {
+        os << " local_address=" << m_localSockAddr;
+    } else if(m_localAddress) {
         os << " local_address=" << m_localAddress->toString();
     }
-    if(m_remoteAddress) {
+    if(!m_remoteSockAddr.empty()) {
+        os << " remote_address=" << m_remoteSockAddr;
+    } else if(m_remoteAddress) {
         os << " remote_address=" << m_remoteAddress->toString();
     }
-    os << "]";
-    return os;
 }
 
 std::string Socket::toString() const {
@@ -442,9 +832,20 @@ bool Socket::cancelAll() {
     return IOManager::GetThis()->cancelAll(m_sock);
 }
 
+void Socket::setReusePort(bool v) {
+    m_reusePort = v;
+    if(isValid()) {
+        int val = v ? 1 : 0;
+        setOption(SOL_SOCKET, SO_REUSEPORT, val);
+    }
+}
+
 void Socket::initSock() {
     int val = 1;
     setOption(SOL_SOCKET, SO_REUSEADDR, val);
+    if(m_reusePort) {
+        setOption(SOL_SOCKET, SO_REUSEPORT, val);
+    }
     if(m_type == SOCK_STREAM) {
         setOption(IPPROTO_TCP, TCP_NODELAY, val);
     }
@@ -473,23 +874,231 @@ struct _SSLInit {
 
 static _SSLInit s_init;
 
+static HPGS::ConfigVar<uint32_t>::ptr g_ssl_server_session_cache_size =
+    HPGS::Config::Lookup("ssl.server_session_cache_size", (uint32_t)20480,
+            "ssl server session cache size");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_ssl_client_session_cache_size =
+    HPGS::Config::Lookup("ssl.client_session_cache_size", (uint32_t)1024,
+            "ssl client session cache size(remote addresses)");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_ssl_session_timeout =
+    HPGS::Config::Lookup("ssl.session_timeout", (uint32_t)300,
+            "ssl session timeout(s)");
+
+static HPGS::ConfigVar<bool>::ptr g_ssl_ktls =
+    HPGS::Config::Lookup("ssl.ktls", true,
+            "enable kernel tls offload when supported by kernel and openssl");
+
+/// TLS单个记录的最大明文长度
+static const size_t s_tls_record_size = 16 * 1024;
+
+/**
+ * @brief 允许OpenSSL在握手后把加密交给内核(需要内核tls模块和支持的加密套件)
+ */
+static void EnableKtls(SSL_CTX* ctx) {
+#ifdef SSL_OP_ENABLE_KTLS
+    if(g_ssl_ktls->getValue()) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+}
+
+/**
+ * @brief 客户端会话缓存，远端地址 -> 最近一次的会话，超过容量时淘汰最早加入的
+ */
+class SSLSessionCache {
+public:
+    typedef Mutex MutexType;
+
+    ~SSLSessionCache() {
+        for(auto& i : m_sessions) {
+            SSL_SESSION_free(i.second.first);
+        }
+    }
+
+    /**
+     * @brief 放入会话，接管引用
+     */
+    void put(const std::string& key, SSL_SESSION* sess) {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_sessions.find(key);
+        if(it != m_sessions.end()) {
+            SSL_SESSION_free(it->second.first);
+            it->second.first = sess;
+            return;
+        }
+        size_t cap = g_ssl_client_session_cache_size->getValue();
+        while(!m_order.empty() && m_sessions.size() >= cap) {
+            auto old = m_sessions.find(m_order.front());
+            SSL_SESSION_free(old->second.first);
+            m_sessions.erase(old);
+            m_order.pop_front();
+        }
+        if(cap == 0) {
+            SSL_SESSION_free(sess);
+            return;
+        }
+        m_order.push_back(key);
+        m_sessions[key] = std::make_pair(sess, --m_order.end());
+    }
+
+    /**
+     * @brief 把缓存的会话设置到ssl上
+     * @return 是否找到可用的会话
+     */
+    bool apply(const std::string& key, SSL* ssl) {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_sessions.find(key);
+        if(it == m_sessions.end()) {
+            return false;
+        }
+        if(!SSL_SESSION_is_resumable(it->second.first)) {
+            SSL_SESSION_free(it->second.first);
+            m_order.erase(it->second.second);
+            m_sessions.erase(it);
+            return false;
+        }
+        return SSL_set_session(ssl, it->second.first) == 1;
+    }
+
+    static SSLSessionCache* GetInstance() {
+        static SSLSessionCache s_cache;
+        return &s_cache;
+    }
+private:
+    MutexType m_mutex;
+    std::list<std::string> m_order;
+    std::unordered_map<std::string, std::pair<SSL_SESSION*
+        ,std::list<std::string>::iterator> > m_sessions;
+};
+
+/**
+ * @brief 握手完成或TLS1.3收到新ticket时回调，key在connect时通过app data设置
+ */
+static int OnNewClientSession(SSL* ssl, SSL_SESSION* sess) {
+    const std::string* key = (const std::string*)SSL_get_app_data(ssl);
+    if(!key || key->empty()) {
+        return 0;
+    }
+    SSLSessionCache::GetInstance()->put(*key, sess);
+    return 1;
+}
+
+/**
+ * @brief 所有客户端连接共用的SSL_CTX，只使用外部会话缓存
+ */
+static std::shared_ptr<SSL_CTX> GetClientContext() {
+    static std::shared_ptr<SSL_CTX> s_ctx = [](){
+        std::shared_ptr<SSL_CTX> ctx(SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free);
+        if(ctx) {
+            SSL_CTX_set_session_cache_mode(ctx.get()
+                    , SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+            SSL_CTX_sess_set_new_cb(ctx.get(), OnNewClientSession);
+            EnableKtls(ctx.get());
+        }
+        return ctx;
+    }();
+    return s_ctx;
+}
+
 }
 
 SSLSocket::SSLSocket(int family, int type, int protocol)
     :Socket(family, type, protocol) {
 }
 
-Socket::ptr SSLSocket::accept() {
-    SSLSocket::ptr sock(new SSLSocket(m_family, m_type, m_protocol));
-    int newsock = ::accept(m_sock, nullptr, nullptr);
-    if(newsock == -1) {
-        HPGS_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno="
-            << errno << " errstr=" << strerror(errno);
+std::shared_ptr<SSL_CTX> SSLSocket::CreateServerContext(const std::string& cert_file
+                                                        ,const std::string& key_file) {
+    std::shared_ptr<SSL_CTX> ctx(SSL_CTX_new(SSLv23_server_method()), SSL_CTX_free);
+    if(!ctx) {
+        HPGS_LOG_ERROR(g_logger) << "SSL_CTX_new error";
         return nullptr;
     }
-    sock->m_ctx = m_ctx;
-    if(sock->init(newsock)) {
-        return sock;
+    if(SSL_CTX_use_certificate_chain_file(ctx.get(), cert_file.c_str()) != 1) {
+        HPGS_LOG_ERROR(g_logger) << "SSL_CTX_use_certificate_chain_file("
+            << cert_file << ") error";
+        return nullptr;
+    }
+    if(SSL_CTX_use_PrivateKey_file(ctx.get(), key_file.c_str(), SSL_FILETYPE_PEM) != 1) {
+        HPGS_LOG_ERROR(g_logger) << "SSL_CTX_use_PrivateKey_file("
+            << key_file << ") error";
+        return nullptr;
+    }
+    if(SSL_CTX_check_private_key(ctx.get()) != 1) {
+        HPGS_LOG_ERROR(g_logger) << "SSL_CTX_check_private_key cert_file="
+            << cert_file << " key_file=" << key_file;
+        return nullptr;
+    }
+    //会话缓存(session id)和ticket都打开，ticket密钥随SSL_CTX生成，重新加载证书后旧ticket失效
+    static const unsigned char s_sid_ctx[] = "HPGS";
+    SSL_CTX_set_session_id_context(ctx.get(), s_sid_ctx, sizeof(s_sid_ctx) - 1);
+    SSL_CTX_set_session_cache_mode(ctx.get(), SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx.get(), g_ssl_server_session_cache_size->getValue());
+    SSL_CTX_set_timeout(ctx.get(), g_ssl_session_timeout->getValue());
+    SSL_CTX_clear_options(ctx.get(), SSL_OP_NO_TICKET);
+    EnableKtls(ctx.get());
+    return ctx;
+}
+
+void SSLSocket::setContext(std::shared_ptr<SSL_CTX> ctx) {
+    std::atomic_store(&m_ctx, ctx);
+}
+
+std::shared_ptr<SSL_CTX> SSLSocket::getContext() const {
+    return std::atomic_load(&m_ctx);
+}
+
+bool SSLSocket::handshake() {
+    if(m_handshaked) {
+        return true;
+    }
+    if(!m_ssl) {
+        return false;
+    }
+    //握手可能已经在SSL_read/SSL_write中隐式完成
+    if(!SSL_is_init_finished(m_ssl.get())) {
+        int rt = SSL_do_handshake(m_ssl.get());
+        if(rt != 1) {
+            HPGS_LOG_DEBUG(g_logger) << "SSL_do_handshake fail sock=" << m_sock
+                << " rt=" << rt << " error=" << SSL_get_error(m_ssl.get(), rt);
+            return false;
+        }
+    }
+    onHandshaked();
+    return true;
+}
+
+void SSLSocket::onHandshaked() {
+    m_handshaked = true;
+    //发送方向由内核加密时，明文可以直接走send/sendfile。
+    //OpenSSL 1.1.x没有kTLS，也没有BIO_get_ktls_send，和EnableKtls使用同一个条件
+#ifdef SSL_OP_ENABLE_KTLS
+    m_ktlsSend = BIO_get_ktls_send(SSL_get_wbio(m_ssl.get()));
+#else
+    m_ktlsSend = false;
+#endif
+}
+
+void SSLSocket::checkHandshaked() {
+    if(!m_handshaked && m_ssl && SSL_is_init_finished(m_ssl.get())) {
+        onHandshaked();
+    }
+}
+
+bool SSLSocket::isSessionReused() const {
+    return m_ssl && SSL_session_reused(m_ssl.get());
+}
+
+Socket::ptr SSLSocket::newAccepted(int sock, const SockAddr& peer) {
+    SSLSocket::ptr rt(new SSLSocket(m_family, m_type, m_protocol));
+    rt->m_ctx = getContext();
+    if(rt->init(sock)) {
+        rt->m_remoteSockAddr = peer;
+        return rt;
+    }
+    if(!rt->isValid()) {
+        ::close(sock);
     }
     return nullptr;
 }
@@ -501,10 +1110,15 @@ bool SSLSocket::bind(const Address::ptr addr) {
 bool SSLSocket::connect(const Address::ptr addr, uint64_t timeout_ms) {
     bool v = Socket::connect(addr, timeout_ms);
     if(v) {
-        m_ctx.reset(SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free);
+        m_ctx = GetClientContext();
         m_ssl.reset(SSL_new(m_ctx.get()),  SSL_free);
         SSL_set_fd(m_ssl.get(), m_sock);
-        v = (SSL_connect(m_ssl.get()) == 1);
+        //同一远端地址复用上次的会话
+        m_sessionKey = addr->toString();
+        SSL_set_app_data(m_ssl.get(), &m_sessionKey);
+        SSLSessionCache::GetInstance()->apply(m_sessionKey, m_ssl.get());
+        SSL_set_connect_state(m_ssl.get());
+        v = handshake();
     }
     return v;
 }
@@ -514,30 +1128,71 @@ bool SSLSocket::listen(int backlog) {
 }
 
 bool SSLSocket::close() {
+    //发送close_notify，未正常关闭的会话会被OpenSSL标记为不可复用
+    checkHandshaked();
+    if(m_ssl && m_handshaked && isConnected()) {
+        SSL_shutdown(m_ssl.get());
+    }
     return Socket::close();
 }
 
 int SSLSocket::send(const void* buffer, size_t length, int flags) {
-    if(m_ssl) {
-        return SSL_write(m_ssl.get(), buffer, length);
+    if(!handshake()) {
+        return -1;
     }
-    return -1;
+    if(m_ktlsSend) {
+        return Socket::send(buffer, length, flags);
+    }
+    return SSL_write(m_ssl.get(), buffer, length);
 }
 
 int SSLSocket::send(const iovec* buffers, size_t length, int flags) {
-    if(!m_ssl) {
+    if(!handshake()) {
         return -1;
     }
+    if(m_ktlsSend) {
+        return Socket::send(buffers, length, flags);
+    }
+    //小块合并成完整的TLS记录再SSL_write，避免每个iovec一个记录和一次系统调用
     int total = 0;
-    for(size_t i = 0; i < length; ++i) {
-        int tmp = SSL_write(m_ssl.get(), buffers[i].iov_base, buffers[i].iov_len);
+    size_t i = 0;
+    size_t off = 0;
+    while(i < length) {
+        size_t left = buffers[i].iov_len - off;
+        if(left == 0) {
+            ++i;
+            off = 0;
+            continue;
+        }
+        const char* data = nullptr;
+        size_t len = 0;
+        if(left >= s_tls_record_size) {
+            //大块直接写，由OpenSSL切分记录
+            data = (const char*)buffers[i].iov_base + off;
+            len = left;
+            ++i;
+            off = 0;
+        } else {
+            if(m_wbuf.empty()) {
+                m_wbuf.resize(s_tls_record_size);
+            }
+            while(i < length && len < s_tls_record_size) {
+                size_t n = std::min(buffers[i].iov_len - off, s_tls_record_size - len);
+                memcpy(&m_wbuf[len], (const char*)buffers[i].iov_base + off, n);
+                len += n;
+                off += n;
+                if(off == buffers[i].iov_len) {
+                    ++i;
+                    off = 0;
+                }
+            }
+            data = &m_wbuf[0];
+        }
+        int tmp = SSL_write(m_ssl.get(), data, len);
         if(tmp <= 0) {
-            return tmp;
+            return total ? total : tmp;
         }
         total += tmp;
-        if(tmp != (int)buffers[i].iov_len) {
-            break;
-        }
     }
     return total;
 }
@@ -552,15 +1207,44 @@ int SSLSocket::sendTo(const iovec* buffers, size_t length, const Address::ptr to
     return -1;
 }
 
+int64_t SSLSocket::sendFile(int fd, off_t offset, size_t length){
+    if(!handshake()){
+        return -1;
+    }
+    //内核加密时直接sendfile，数据不经过用户态
+    if(m_ktlsSend){
+        return Socket::sendFile(fd, offset, length);
+    }
+    //需要在用户态加密，读一块文件数据再SSL_write
+    if(length == 0){
+        return 0;
+    }
+    //和send共用写缓冲区，不必每次调用分配
+    static const size_t s_block_size = 64 * 1024;
+    if(m_wbuf.size() < s_block_size){
+        m_wbuf.resize(s_block_size);
+    }
+    ssize_t n = pread(fd, &m_wbuf[0], std::min(length, s_block_size), offset);
+    if(n <= 0){
+        return n;
+    }
+    return SSL_write(m_ssl.get(), &m_wbuf[0], n);
+}
+
+int SSLSocket::sendZeroCopy(const iovec* buffers, size_t length, std::shared_ptr<void> holder, int flags) {
+    //数据需要在用户态加密，不能零拷贝
+    return send(buffers, length, flags);
+}
+
 int SSLSocket::recv(void* buffer, size_t length, int flags) {
-    if(m_ssl) {
-        return SSL_read(m_ssl.get(), buffer, length);
+    if(!handshake()) {
+        return -1;
     }
-    return -1;
+    return SSL_read(m_ssl.get(), buffer, length);
 }
 
 int SSLSocket::recv(iovec* buffers, size_t length, int flags) {
-    if(!m_ssl) {
+    if(!handshake()) {
         return -1;
     }
     int total = 0;
@@ -590,30 +1274,24 @@ int SSLSocket::recvFrom(iovec* buffers, size_t length, Address::ptr from, int fl
 bool SSLSocket::init(int sock) {
     bool v = Socket::init(sock);
     if(v) {
+        if(!m_ctx) {
+            HPGS_LOG_ERROR(g_logger) << "SSLSocket init without SSL_CTX sock=" << sock;
+            return false;
+        }
+        //握手推迟到handshake()或第一次读写
         m_ssl.reset(SSL_new(m_ctx.get()),  SSL_free);
         SSL_set_fd(m_ssl.get(), m_sock);
-        v = (SSL_accept(m_ssl.get()) == 1);
+        SSL_set_accept_state(m_ssl.get());
     }
     return v;
 }
 
 bool SSLSocket::loadCertificates(const std::string& cert_file, const std::string& key_file) {
-    m_ctx.reset(SSL_CTX_new(SSLv23_server_method()), SSL_CTX_free);
-    if(SSL_CTX_use_certificate_chain_file(m_ctx.get(), cert_file.c_str()) != 1) {
-        HPGS_LOG_ERROR(g_logger) << "SSL_CTX_use_certificate_chain_file("
-            << cert_file << ") error";
-        return false;
-    }
-    if(SSL_CTX_use_PrivateKey_file(m_ctx.get(), key_file.c_str(), SSL_FILETYPE_PEM) != 1) {
-        HPGS_LOG_ERROR(g_logger) << "SSL_CTX_use_PrivateKey_file("
-            << key_file << ") error";
-        return false;
-    }
-    if(SSL_CTX_check_private_key(m_ctx.get()) != 1) {
-        HPGS_LOG_ERROR(g_logger) << "SSL_CTX_check_private_key cert_file="
-            << cert_file << " key_file=" << key_file;
+    std::shared_ptr<SSL_CTX> ctx = CreateServerContext(cert_file, key_file);
+    if(!ctx) {
         return false;
     }
+    setContext(ctx);
     return true;
 }
 
@@ -638,12 +1316,7 @@ std::ostream& SSLSocket::dump(std::ostream& os) const {
        << " family=" << m_family
        << " type=" << m_type
        << " protocol=" << m_protocol;
-    if(m_localAddress) {
-        os << " local_address=" << m_localAddress->toString();
-    }
-    if(m_remoteAddress) {
-        os << " remote_address=" << m_remoteAddress->toString();
-    }
+    dumpAddress(os);
     os << "]";
     return os;
 }
@@ -0,0 +1,440 @@
+#include "socket_pool.h"
+#include "config.h"
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+#include "hook.h"
+#include <sstream>
+#include <algorithm>
+
+namespace HPGS{
+
+static HPGS::ConfigVar<uint32_t>::ptr g_socket_pool_max_total =
+        HPGS::Config::Lookup("socket_pool.max_total", (uint32_t)64,
+                "socket pool max connections per destination");
+
+static HPGS::ConfigVar<uint32_t>::ptr g_socket_pool_min_idle =
+        HPGS::Config::Lookup("socket_pool.min_idle", (uint32_t)0,
+                "socket pool min idle connections per destination");
+
+static HPGS::ConfigVar<uint64_t>::ptr g_socket_pool_idle_timeout =
+        HPGS::Config::Lookup("socket_pool.idle_timeout", (uint64_t)(60 * 1000),
+                "socket pool idle connection timeout(ms)");
+
+static HPGS::ConfigVar<uint64_t>::ptr g_socket_pool_connect_timeout =
+        HPGS::Config::Lookup("socket_pool.connect_timeout", (uint64_t)(3 * 1000),
+                "socket pool connect timeout(ms)");
+
+static HPGS::ConfigVar<uint64_t>::ptr g_socket_pool_check_interval =
+        HPGS::Config::Lookup("socket_pool.check_interval", (uint64_t)(5 * 1000),
+                "socket pool idle check interval(ms)");
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
+
+SocketPool::SocketPool(Address::ptr addr, bool ssl, uint32_t max_total
+                       ,uint32_t min_idle, IOManager* iom)
+    :m_addr(addr)
+    ,m_ssl(ssl)
+    ,m_maxTotal(max_total)
+    ,m_minIdle(std::min(min_idle, max_total))
+    ,m_iom(iom)
+    ,m_idleTimeout(g_socket_pool_idle_timeout->getValue())
+    ,m_connectTimeout(g_socket_pool_connect_timeout->getValue()) {
+    HPGS_ASSERT(addr && max_total > 0);
+}
+
+SocketPool::~SocketPool() {
+    if(m_timer) {
+        m_timer->cancel();
+    }
+    for(auto& i : m_idles) {
+        i.sock->close();
+    }
+}
+
+Socket::ptr SocketPool::get(uint64_t timeout_ms) {
+    uint64_t wait_start = 0;
+    bool have_slot = false;
+    while(!have_slot) {
+        Socket::ptr idle;
+        Waiter::ptr w;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_stop) {
+                break;
+            }
+            if(!m_idles.empty()) {
+                //后进先出，最近归还的连接最可能还活着
+                idle = m_idles.back().sock;
+                m_idles.pop_back();
+            } else if(m_total < m_maxTotal) {
+                ++m_total;
+                have_slot = true;
+            } else {
+                w.reset(new Waiter);
+                m_waiters.push_back(w);
+                IOManager* iom = m_iom ? m_iom : IOManager::GetThis();
+                if(timeout_ms != (uint64_t)-1 && iom) {
+                    std::weak_ptr<Waiter> weak_w(w);
+                    SocketPool::ptr self = shared_from_this();
+                    w->timer = iom->addTimer(timeout_ms, [weak_w, self](){
+                        Waiter::ptr w = weak_w.lock();
+                        if(!w) {
+                            return;
+                        }
+                        MutexType::Lock lock(self->m_mutex);
+                        if(w->done) {
+                            return;
+                        }
+                        auto it = std::find(self->m_waiters.begin(), self->m_waiters.end(), w);
+                        if(it != self->m_waiters.end()) {
+                            self->m_waiters.erase(it);
+                        }
+                        w->timeout = true;
+                        self->wakeup(w);
+                    });
+                }
+            }
+        }
+
+        if(idle) {
+            if(isAlive(idle)) {
+                ++m_hits;
+                if(wait_start) {
+                    m_waitUs += GetCurrentUs() - wait_start;
+                }
+                return wrap(idle);
+            }
+            HPGS_LOG_DEBUG(g_logger) << "socket pool evict dead idle " << *idle;
+            ++m_evicts;
+            idle->close();
+            releaseSlot();
+            continue;
+        }
+        if(have_slot) {
+            break;
+        }
+
+        if(!wait_start) {
+            wait_start = GetCurrentUs();
+            ++m_waits;
+        }
+        w->sem.wait();
+        if(w->timer) {
+            w->timer->cancel();
+        }
+        if(w->timeout) {
+            ++m_timeouts;
+            m_waitUs += GetCurrentUs() - wait_start;
+            return nullptr;
+        }
+        if(w->sock) {
+            ++m_hits;
+            m_waitUs += GetCurrentUs() - wait_start;
+            return wrap(w->sock);
+        }
+        have_slot = w->slot;
+    }
+
+    if(wait_start) {
+        m_waitUs += GetCurrentUs() - wait_start;
+    }
+    if(!have_slot) {
+        return nullptr;
+    }
+    Socket::ptr sock = connect();
+    return sock ? wrap(sock) : nullptr;
+}
+
+Socket::ptr SocketPool::connect() {
+    Socket::ptr sock = m_ssl ? SSLSocket::CreateTcp(m_addr) : Socket::CreateTcp(m_addr);
+    if(!sock->connect(m_addr, m_connectTimeout)) {
+        HPGS_LOG_WARNING(g_logger) << "socket pool connect " << *m_addr << " fail errno="
+            << errno << " errstr=" << strerror(errno);
+        ++m_connectFails;
+        releaseSlot();
+        return nullptr;
+    }
+    ++m_misses;
+    return sock;
+}
+
+Socket::ptr SocketPool::wrap(Socket::ptr sock) {
+    //借出的是同一个Socket对象的别名，引用计数归零时归还，连接池已析构时随sock一起关闭
+    std::weak_ptr<SocketPool> weak_pool(shared_from_this());
+    return Socket::ptr(sock.get(), [weak_pool, sock](Socket*){
+        SocketPool::ptr pool = weak_pool.lock();
+        if(pool) {
+            pool->release(sock);
+        } else {
+            sock->close();
+        }
+    });
+}
+
+void SocketPool::release(Socket::ptr sock) {
+    if(sock->isConnected()) {
+        MutexType::Lock lock(m_mutex);
+        if(!m_stop) {
+            putIdle(sock, GetCurrentMs());
+            return;
+        }
+    }
+    sock->close();
+    releaseSlot();
+}
+
+void SocketPool::putIdle(Socket::ptr sock, uint64_t last_ms) {
+    if(!m_waiters.empty()) {
+        Waiter::ptr w = m_waiters.front();
+        m_waiters.pop_front();
+        w->sock = sock;
+        wakeup(w);
+        return;
+    }
+    m_idles.push_back({sock, last_ms});
+}
+
+void SocketPool::releaseSlot() {
+    MutexType::Lock lock(m_mutex);
+    releaseSlotLocked();
+}
+
+void SocketPool::releaseSlotLocked() {
+    if(!m_stop && !m_waiters.empty()) {
+        //名额直接交给等待的协程，连接总数不变
+        Waiter::ptr w = m_waiters.front();
+        m_waiters.pop_front();
+        w->slot = true;
+        wakeup(w);
+        return;
+    }
+    --m_total;
+}
+
+void SocketPool::wakeup(Waiter::ptr w) {
+    w->done = true;
+    w->sem.notify();
+}
+
+bool SocketPool::isAlive(Socket::ptr sock) {
+    if(!sock->isConnected()) {
+        return false;
+    }
+    //空闲连接上不应该有数据，可读时要么对端已关闭要么协议出错；
+    //TLS连接上可能有服务端在握手后发送的会话票据，不算出错
+    char c;
+    ssize_t rt = recv_f(sock->getSocket(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if(rt == 0) {
+        return false;
+    }
+    if(rt > 0) {
+        return m_ssl;
+    }
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void SocketPool::onTimer() {
+    std::vector<Socket::ptr> evicts;
+    std::list<Idle> checks;
+    uint64_t now_ms = GetCurrentMs();
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_stop) {
+            return;
+        }
+        //最早归还的在前面，保留min_idle个
+        while(m_idles.size() > m_minIdle
+                && now_ms - m_idles.front().last_ms >= m_idleTimeout) {
+            evicts.push_back(m_idles.front().sock);
+            m_idles.pop_front();
+        }
+        //检查期间get()看不到这些连接，会新建或等待
+        checks.swap(m_idles);
+    }
+
+    for(auto& i : evicts) {
+        i->close();
+    }
+    for(auto it = checks.begin(); it != checks.end();) {
+        bool ok = isAlive(it->sock) && (!m_healthCheck || m_healthCheck(it->sock));
+        if(ok) {
+            ++it;
+            continue;
+        }
+        HPGS_LOG_DEBUG(g_logger) << "socket pool health check fail " << *it->sock;
+        it->sock->close();
+        evicts.push_back(it->sock);
+        it = checks.erase(it);
+    }
+
+    uint32_t fill = 0;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_evicts += evicts.size();
+        for(size_t i = 0; i < evicts.size(); ++i) {
+            releaseSlotLocked();
+        }
+        for(auto& i : checks) {
+            if(m_stop) {
+                i.sock->close();
+                --m_total;
+            } else {
+                putIdle(i.sock, i.last_ms);
+            }
+        }
+        if(!m_stop && m_idles.size() < m_minIdle && m_total < m_maxTotal) {
+            fill = std::min((uint32_t)(m_minIdle - m_idles.size()), m_maxTotal - m_total);
+            m_total += fill;
+        }
+    }
+
+    if(fill && m_iom) {
+        SocketPool::ptr self = shared_from_this();
+        for(uint32_t i = 0; i < fill; ++i) {
+            m_iom->schedule([self](){
+                Socket::ptr sock = self->connect();
+                if(sock) {
+                    self->release(sock);
+                }
+            });
+        }
+    }
+}
+
+void SocketPool::start() {
+    if(!m_iom) {
+        HPGS_LOG_WARNING(g_logger) << "socket pool " << *m_addr << " start without IOManager";
+        return;
+    }
+    {
+        MutexType::Lock lock(m_mutex);
+        m_stop = false;
+        if(m_timer) {
+            return;
+        }
+        std::weak_ptr<SocketPool> weak_pool(shared_from_this());
+        m_timer = m_iom->addTimer(g_socket_pool_check_interval->getValue(), [weak_pool](){
+            SocketPool::ptr pool = weak_pool.lock();
+            if(pool) {
+                pool->onTimer();
+            }
+        }, true);
+    }
+    //立即补足最少空闲连接
+    if(m_minIdle) {
+        m_iom->schedule(std::bind(&SocketPool::onTimer, shared_from_this()));
+    }
+}
+
+void SocketPool::stop() {
+    std::list<Idle> idles;
+    std::deque<Waiter::ptr> waiters;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_stop = true;
+        if(m_timer) {
+            m_timer->cancel();
+            m_timer.reset();
+        }
+        idles.swap(m_idles);
+        waiters.swap(m_waiters);
+        m_total -= idles.size();
+        for(auto& i : waiters) {
+            wakeup(i);
+        }
+    }
+    for(auto& i : idles) {
+        i.sock->close();
+    }
+}
+
+size_t SocketPool::getIdleCount() {
+    MutexType::Lock lock(m_mutex);
+    return m_idles.size();
+}
+
+uint32_t SocketPool::getTotalCount() {
+    MutexType::Lock lock(m_mutex);
+    return m_total;
+}
+
+size_t SocketPool::getWaiterCount() {
+    MutexType::Lock lock(m_mutex);
+    return m_waiters.size();
+}
+
+double SocketPool::getHitRate() const {
+    uint64_t hits = m_hits;
+    uint64_t total = hits + m_misses;
+    return total ? (double)hits / total : 0;
+}
+
+std::string SocketPool::toString() {
+    std::stringstream ss;
+    ss << "[SocketPool addr=" << *m_addr
+       << " ssl=" << m_ssl
+       << " total=" << getTotalCount()
+       << " max_total=" << m_maxTotal
+       << " idle=" << getIdleCount()
+       << " min_idle=" << m_minIdle
+       << " waiters=" << getWaiterCount()
+       << " hits=" << m_hits
+       << " misses=" << m_misses
+       << " hit_rate=" << getHitRate()
+       << " waits=" << m_waits
+       << " wait_us=" << m_waitUs
+       << " timeouts=" << m_timeouts
+       << " connect_fails=" << m_connectFails
+       << " evicts=" << m_evicts
+       << "]";
+    return ss.str();
+}
+
+SocketPool::ptr SocketPoolManager::get(Address::ptr addr, bool ssl) {
+    std::string key = (ssl ? "ssl://" : "") + addr->toString();
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        auto it = m_pools.find(key);
+        if(it != m_pools.end()) {
+            return it->second;
+        }
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    auto it = m_pools.find(key);
+    if(it != m_pools.end()) {
+        return it->second;
+    }
+    SocketPool::ptr pool(new SocketPool(addr, ssl, g_socket_pool_max_total->getValue()
+                            ,g_socket_pool_min_idle->getValue()));
+    m_pools[key] = pool;
+    lock.unlock();
+    pool->start();
+    return pool;
+}
+
+Socket::ptr SocketPoolManager::getSocket(Address::ptr addr, bool ssl, uint64_t timeout_ms) {
+    return get(addr, ssl)->get(timeout_ms);
+}
+
+void SocketPoolManager::clear() {
+    std::map<std::string, SocketPool::ptr> pools;
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        pools.swap(m_pools);
+    }
+    for(auto& i : pools) {
+        i.second->stop();
+    }
+}
+
+std::string SocketPoolManager::toString() {
+    std::stringstream ss;
+    RWMutexType::ReadLock lock(m_mutex);
+    for(auto& i : m_pools) {
+        ss << i.second->toString() << std::endl;
+    }
+    return ss.str();
+}
+
+}
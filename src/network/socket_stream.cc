@@ -0,0 +1,166 @@
+#include "socket_stream.h"
+#include "config.h"
+#include <string.h>
+#include <algorithm>
+
+namespace HPGS {
+
+static HPGS::ConfigVar<uint32_t>::ptr g_socket_stream_buffer_size = 
+        HPGS::Config::Lookup("socket_stream.read_buffer_size", (uint32_t)(16 * 1024),
+                "socket stream read-ahead buffer size");
+
+SocketStream::SocketStream(Socket::ptr sock, bool owner)
+: m_socket(sock), m_owner(owner), m_rpos(0), m_rend(0) {
+}
+
+SocketStream::~SocketStream() {
+    if(m_owner && m_socket) {
+        m_socket->close();
+    }
+}
+
+bool SocketStream::isConnected() const {
+    return m_socket && m_socket->isConnected();
+}
+
+size_t SocketStream::readBuffered(void* buffer, size_t length) {
+    size_t n = std::min(length, m_rend - m_rpos);
+    memcpy(buffer, &m_rbuf[m_rpos], n);
+    m_rpos += n;
+    return n;
+}
+
+int SocketStream::fill() {
+    if(m_rbuf.empty()) {
+        m_rbuf.resize(g_socket_stream_buffer_size->getValue());
+    }
+    m_rpos = 0;
+    m_rend = 0;
+    int rt = m_socket->recv(&m_rbuf[0], m_rbuf.size());
+    if(rt > 0) {
+        m_rend = rt;
+    }
+    return rt;
+}
+
+int SocketStream::read(void* buffer, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    if(m_rpos < m_rend) {
+        return readBuffered(buffer, length);
+    }
+    //大块读直接读到用户内存，不经过缓冲区
+    if(length >= g_socket_stream_buffer_size->getValue()) {
+        return m_socket->recv(buffer, length);
+    }
+    int rt = fill();
+    if(rt <= 0) {
+        return rt;
+    }
+    return readBuffered(buffer, length);
+}
+
+int SocketStream::read(ByteArray::ptr ba, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    if(m_rpos < m_rend || length < g_socket_stream_buffer_size->getValue()) {
+        if(m_rpos >= m_rend) {
+            int rt = fill();
+            if(rt <= 0) {
+                return rt;
+            }
+        }
+        size_t n = std::min(length, m_rend - m_rpos);
+        ba->write(&m_rbuf[m_rpos], n);
+        m_rpos += n;
+        return n;
+    }
+
+    std::vector<iovec> iovs;
+    ba->getWriteBuffers(iovs, length);
+    int rt = m_socket->recv(&iovs[0], iovs.size());
+    if(rt > 0) {
+        ba->commitWrite(rt);
+    }
+    return rt;
+}
+
+int SocketStream::write(const void* buffer, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    return m_socket->send(buffer, length);
+}
+
+int SocketStream::write(ByteArray::ptr ba, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    length = std::min(length, ba->getReadSize());
+    if(length == 0) {
+        return 0;
+    }
+    //所有节点一次sendmsg发出；socket开启零拷贝时由socket持有这段数据的Slice直到内核发送完成，
+    //之后对ba的写入(包括流模式回收节点)会写时复制，不会改动正在发送的内存
+    std::vector<iovec> iovs;
+    int rt = 0;
+    if(m_socket->isZeroCopy()) {
+        std::shared_ptr<ByteArray::Slice> holder(new ByteArray::Slice(ba->slice(ba->getPosition(), length)));
+        holder->getBuffers(iovs);
+        rt = m_socket->sendZeroCopy(&iovs[0], iovs.size(), holder);
+    } else {
+        ba->getReadBuffers(iovs, length);
+        rt = m_socket->send(&iovs[0], iovs.size());
+    }
+    if(rt > 0) {
+        ba->consume(rt);
+    }
+    return rt;
+}
+
+int64_t SocketStream::sendFile(int fd, off_t offset, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    return m_socket->sendFile(fd, offset, length);
+}
+
+void SocketStream::close() {
+    if(m_socket) {
+        m_socket->close();
+    }
+}
+
+Address::ptr SocketStream::getRemoteAddress() {
+    if(m_socket) {
+        return m_socket->getRemoteAddress();
+    }
+    return nullptr;
+}
+
+Address::ptr SocketStream::getLocalAddress() {
+    if(m_socket) {
+        return m_socket->getLocalAddress();
+    }
+    return nullptr;
+}
+
+std::string SocketStream::getRemoteAddressString() {
+    auto addr = getRemoteAddress();
+    if(addr) {
+        return addr->toString();
+    }
+    return "";
+}
+
+std::string SocketStream::getLocalAddressString() {
+    auto addr = getLocalAddress();
+    if(addr) {
+        return addr->toString();
+    }
+    return "";
+}
+
+}
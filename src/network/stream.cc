@@ -1,4 +1,7 @@
 #include "stream.h"
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
 
 namespace HPGS {
 
@@ -55,4 +58,30 @@ int Stream::writeFixSize(ByteArray::ptr ba, size_t length) {
     return length;
 }
 
-}
\ No newline at end of file
+int64_t Stream::sendFile(int fd, off_t offset, size_t length) {
+    if(length == 0) {
+        return 0;
+    }
+    static const size_t s_block_size = 64 * 1024;
+    std::vector<char> buf(std::min(length, s_block_size));
+    ssize_t n = pread(fd, &buf[0], buf.size(), offset);
+    if(n <= 0) {
+        return n;
+    }
+    return writeFixSize(&buf[0], n);
+}
+
+int64_t Stream::sendFileFixSize(int fd, off_t offset, size_t length) {
+    int64_t left = length;
+    while(left > 0) {
+        int64_t len = sendFile(fd, offset, left);
+        if(len <= 0) {
+            return len;
+        }
+        offset += len;
+        left -= len;
+    }
+    return length;
+}
+
+}
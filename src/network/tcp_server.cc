@@ -1,6 +1,10 @@
 #include "tcp_server.h"
 #include "config.h"
 #include "log.h"
+#include "util.h"
+#include "macro.h"
+#include <algorithm>
+#include <linux/filter.h>
 
 namespace HPGS {
 
@@ -8,11 +12,22 @@ static HPGS::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
         HPGS::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
                 "tcp server read timeout");
 
+static HPGS::ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch =
+        HPGS::Config::Lookup("tcp_server.accept_batch", (uint32_t)16,
+                "tcp server max connections accepted per wakeup");
+
+//来源IP令牌桶的最大数量，超过时清理已经回满的桶
+static const size_t s_max_ip_buckets = 65536;
+
 static HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
 
 TcpServer::TcpServer(IOManager* worker, IOManager* io_worker, IOManager* accept_worker)
 : m_worker(worker), m_ioWorker(io_worker), m_acceptWorker(accept_worker)
-, m_recvTimeout(g_tcp_server_read_timeout->getValue()), m_name("HPGS/1.0.0"), m_isStop(true){
+, m_recvTimeout(g_tcp_server_read_timeout->getValue()), m_name("HPGS/1.0.0"), m_isStop(true)
+, m_acceptBatch(g_tcp_server_accept_batch->getValue()){
+    if(m_acceptBatch == 0){
+        m_acceptBatch = 1;
+    }
 }
 
 TcpServer::~TcpServer(){
@@ -22,8 +37,40 @@ TcpServer::~TcpServer(){
     m_socks.clear();
 }
 
+void TcpServer::setConf(TcpServerConf::ptr v){
+    m_conf = v;
+    if(v){
+        m_reusePort = v->reuse_port;
+        m_incomingCpu = v->incoming_cpu;
+        if(v->accept_batch > 0){
+            m_acceptBatch = v->accept_batch;
+        }
+        m_maxConnections = v->max_connections > 0 ? v->max_connections : 0;
+        setPerIpRate(v->per_ip_rate > 0 ? v->per_ip_rate : 0
+                , v->per_ip_burst > 0 ? v->per_ip_burst : 0);
+    }
+}
+
+void TcpServer::setPerIpRate(uint32_t rate, uint32_t burst){
+    Mutex::Lock lock(m_ipMutex);
+    m_perIpRate = rate;
+    m_perIpBurst = burst ? burst : rate;
+    m_ipBuckets.clear();
+}
+
 void TcpServer::setConf(const TcpServerConf& v){
-    m_conf.reset(new TcpServerConf(v));
+    setConf(std::make_shared<TcpServerConf>(v));
+}
+
+size_t TcpServer::getListenerCount() const {
+    if(m_reusePort == 0){
+        return 1;
+    }
+    if(m_reusePort < 0){
+        size_t n = m_ioWorker ? m_ioWorker->getThreadCount() : 1;
+        return n ? n : 1;
+    }
+    return m_reusePort;
 }
 
 bool TcpServer::bind(HPGS::Address::ptr addr, bool ssl){
@@ -36,22 +83,52 @@ bool TcpServer::bind(HPGS::Address::ptr addr, bool ssl){
 bool TcpServer::bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails, bool ssl){
     m_ssl = ssl;
     for(auto& addr : addrs){
-        Socket::ptr sock = ssl ? SSLSocket::CreateTcp(addr) : Socket::CreateTcp(addr);
-        if(!sock->bind(addr)){
-            HPGS_LOG_ERROR(g_logger) << "bind fail errno = "
-                    << errno << " errstr = " << strerror(errno)
-                    << " addr = [" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        std::vector<Socket::ptr> group;
+        Address::ptr bind_addr = addr;
+        //SO_REUSEPORT只对IP地址有效，Unix地址第二次bind会失败，只创建一个监听socket
+        IPAddress::ptr ip = std::dynamic_pointer_cast<IPAddress>(addr);
+        bool reuse_port = m_reusePort && ip;
+        size_t count = reuse_port ? getListenerCount() : 1;
+        for(size_t i = 0; i < count; ++i){
+            Socket::ptr sock;
+            if(ssl){
+                SSLSocket::ptr ssl_sock = SSLSocket::CreateTcp(addr);
+                ssl_sock->setContext(getSSLContext());
+                sock = ssl_sock;
+            }
+            else{
+                sock = Socket::CreateTcp(addr);
+            }
+            if(reuse_port){
+                sock->setReusePort(true);
+            }
+            if(!sock->bind(bind_addr)){
+                HPGS_LOG_ERROR(g_logger) << "bind fail errno = "
+                        << errno << " errstr = " << strerror(errno)
+                        << " addr = [" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->listen()){
+                HPGS_LOG_ERROR(g_logger) << "listen fail errno = " 
+                        << errno << " errstr = " << strerror(errno)
+                        << " addr = [" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            group.push_back(sock);
+            //端口为0时每次bind得到不同的临时端口，组内其余socket绑定第一个分到的端口
+            if(i == 0 && count > 1 && ip && ip->getPort() == 0){
+                bind_addr = sock->getLocalAddress();
+            }
         }
-        if(!sock->listen()){
-            HPGS_LOG_ERROR(g_logger) << "listen fail errno = " 
-                    << errno << " errstr = " << strerror(errno)
-                    << " addr = [" << addr->toString() << "]";
-            fails.push_back(addr);
+        if(group.size() != count){
             continue;
         }
-        m_socks.push_back(sock);
+        if(reuse_port){
+            attachSteering(group);
+        }
+        m_socks.insert(m_socks.end(), group.begin(), group.end());
     } // end for
 
     if(!fails.empty()){
@@ -69,17 +146,143 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs, std::vector<Address
 }
 
 void TcpServer::startAccept(Socket::ptr sock){
+    //SO_REUSEPORT的accept循环固定在io_worker的线程上，新连接留在本线程处理
+    int thread = sock->isReusePort() ? HPGS::GetThreadId() : -1;
+    std::shared_ptr<FibreSemaphore> slots = m_slots;
+    std::vector<Socket::ptr> clients;
+    clients.reserve(m_acceptBatch);
     while(!m_isStop){
-        Socket::ptr client = sock->accept();
-        if(client){
-            client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+        if(!slots){
+            if(!sock->acceptBatch(clients, m_acceptBatch)){
+                HPGS_LOG_ERROR(g_logger) << "accept errno = " << errno
+                        << " errstr = " << strerror(errno);
+                continue;
+            }
         }
         else{
-            HPGS_LOG_ERROR(g_logger) << "accept errno = " << errno
-                    << " errstr = " << strerror(errno);
+            //没有连接名额时挂起，新连接留在内核的监听队列中
+            if(!slots->tryWait()){
+                ++m_pauseCount;
+                slots->wait();
+            }
+            if(m_isStop){
+                slots->notify();
+                break;
+            }
+            Socket::ptr client = sock->accept();
+            if(!client){
+                slots->notify();
+                HPGS_LOG_ERROR(g_logger) << "accept errno = " << errno
+                        << " errstr = " << strerror(errno);
+                continue;
+            }
+            clients.push_back(client);
+            //有名额时继续取走已完成握手的连接
+            while(clients.size() < m_acceptBatch && slots->tryWait()){
+                client = sock->tryAccept();
+                if(!client){
+                    slots->notify();
+                    break;
+                }
+                clients.push_back(client);
+            }
+        }
+
+        for(auto& client : clients){
+            if(!admit(client)){
+                ++m_rejectCount;
+                client->close();
+                if(slots){
+                    slots->notify();
+                }
+                continue;
+            }
+            ++m_acceptCount;
+            ++m_connections;
+            client->setRecvTimeout(m_recvTimeout);
+            if(m_handshakeWorker){
+                SSLSocket::ptr ssl_client = std::dynamic_pointer_cast<SSLSocket>(client);
+                if(ssl_client){
+                    m_handshakeWorker->schedule(std::bind(&TcpServer::handshakeClient
+                                , shared_from_this(), ssl_client, slots, thread));
+                    continue;
+                }
+            }
+            m_ioWorker->schedule(std::bind(&TcpServer::serveClient
+                        , shared_from_this(), client, slots), thread);
+        }
+        clients.clear();
+    }
+}
+
+void TcpServer::serveClient(Socket::ptr client, std::shared_ptr<FibreSemaphore> slots){
+    handleClient(client);
+    --m_connections;
+    if(slots){
+        slots->notify();
+    }
+}
+
+void TcpServer::handshakeClient(SSLSocket::ptr client, std::shared_ptr<FibreSemaphore> slots, int thread){
+    if(!client->handshake()){
+        ++m_handshakeFailCount;
+        client->close();
+        --m_connections;
+        if(slots){
+            slots->notify();
         }
+        return;
     }
+    m_ioWorker->schedule(std::bind(&TcpServer::serveClient
+                , shared_from_this(), Socket::ptr(client), slots), thread);
+}
+
+bool TcpServer::admit(Socket::ptr client){
+    if(!m_perIpRate){
+        return true;
+    }
+    SockAddr key = client->getRemoteSockAddr();
+    if(key.getFamily() != AF_INET && key.getFamily() != AF_INET6){
+        return true;
+    }
+    key.setPort(0);
+
+    uint64_t now = HPGS::GetCurrentMs();
+    Mutex::Lock lock(m_ipMutex);
+    double rate = m_perIpRate;
+    double burst = m_perIpBurst;
+    if(HPGS_UNLIKELY(m_ipBuckets.size() >= s_max_ip_buckets)){
+        for(auto it = m_ipBuckets.begin(); it != m_ipBuckets.end();){
+            if(it->second.tokens + (now - it->second.last_ms) * rate / 1000 >= burst){
+                it = m_ipBuckets.erase(it);
+            }
+            else{
+                ++it;
+            }
+        }
+        //都在限速中说明来源过于分散，放弃记录避免每次都全量清理
+        if(m_ipBuckets.size() >= s_max_ip_buckets){
+            m_ipBuckets.clear();
+        }
+    }
+
+    auto it = m_ipBuckets.find(key);
+    if(it == m_ipBuckets.end()){
+        IpBucket& b = m_ipBuckets[key];
+        b.tokens = burst - 1;
+        b.last_ms = now;
+        return true;
+    }
+    IpBucket& b = it->second;
+    if(now > b.last_ms){
+        b.tokens = std::min(burst, b.tokens + (now - b.last_ms) * rate / 1000);
+        b.last_ms = now;
+    }
+    if(b.tokens < 1){
+        return false;
+    }
+    b.tokens -= 1;
+    return true;
 }
 
 bool TcpServer::start(){
@@ -88,14 +291,36 @@ bool TcpServer::start(){
     }
 
     m_isStop = false;
+    if(m_maxConnections){
+        uint64_t used = m_connections;
+        m_slots.reset(new FibreSemaphore(m_maxConnections > used ? m_maxConnections - used : 0));
+    }
+    else{
+        m_slots.reset();
+    }
+    size_t idx = 0;
     for(auto& sock : m_socks){
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+        if(sock->isReusePort()){
+            //同一地址的第i个监听socket由io_worker的第i个线程accept
+            size_t n = m_ioWorker->getThreadCount();
+            int thread = n ? m_ioWorker->getWorkerThreadId(idx++ % n) : -1;
+            m_ioWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock), thread);
+        }
+        else{
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+        }
     }
     return true;
 }
 
 void TcpServer::stop(){
     m_isStop = true;
+    //唤醒因连接名额不足挂起的accept循环
+    if(m_slots){
+        for(size_t i = 0; i < m_socks.size(); ++i){
+            m_slots->notify();
+        }
+    }
     auto self = shared_from_this();
     m_acceptWorker->schedule([this, self](){
         for(auto& sock : m_socks){
@@ -106,19 +331,54 @@ void TcpServer::stop(){
     });
 }
 
+void TcpServer::attachSteering(const std::vector<Socket::ptr>& group){
+    if(!m_incomingCpu || group.empty()){
+        return;
+    }
+#ifdef SO_INCOMING_CPU
+    for(size_t i = 0; i < group.size(); ++i){
+        int cpu = i;
+        if(!group[i]->setOption(SOL_SOCKET, SO_INCOMING_CPU, cpu)){
+            HPGS_LOG_WARNING(g_logger) << "setsockopt SO_INCOMING_CPU fail errno = " << errno
+                    << " errstr = " << strerror(errno) << " sock = " << *group[i];
+        }
+    }
+#endif
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    //A = 收包的cpu; A = A % n; return A，返回值是reuseport组内socket的下标
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)group.size() },
+        { BPF_RET | BPF_A, 0, 0, 0 }
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+    if(!group[0]->setOption(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, prog)){
+        HPGS_LOG_WARNING(g_logger) << "setsockopt SO_ATTACH_REUSEPORT_CBPF fail errno = " << errno
+                << " errstr = " << strerror(errno) << " sock = " << *group[0];
+    }
+#endif
+}
+
 void TcpServer::handleClient(Socket::ptr client){
     HPGS_LOG_INFO(g_logger) << "handleClient: " << *client;
 }
 
 bool TcpServer::loadCertificates(const std::string& cert_file, const std::string& key_file){
+    std::shared_ptr<SSL_CTX> ctx = SSLSocket::CreateServerContext(cert_file, key_file);
+    if(!ctx){
+        return false;
+    }
+    std::atomic_store(&m_sslCtx, ctx);
     for(auto& i : m_socks){
         auto ssl_socket = std::dynamic_pointer_cast<SSLSocket>(i);
         if(ssl_socket){
-            if(!ssl_socket->loadCertificates(cert_file, key_file)){
-                return false;
-            }
+            ssl_socket->setContext(ctx);
         }
     }
+    HPGS_LOG_INFO(g_logger) << "server " << m_name << " load certificates cert_file = "
+            << cert_file << " key_file = " << key_file;
     return true;
 }
 
@@ -128,7 +388,14 @@ std::string TcpServer::toString(const std::string& prefix){
        << " name = " << m_name << " ssl = " << m_ssl
        << " worker = " << (m_worker ? m_worker->getName() : "")
        << " accept = " << (m_acceptWorker ? m_acceptWorker->getName() : "")
-       << " recv_timeout = " << m_recvTimeout << "]\n";
+       << " recv_timeout = " << m_recvTimeout
+       << " reuse_port = " << m_reusePort
+       << " accept_batch = " << m_acceptBatch
+       << " max_connections = " << m_maxConnections
+       << " per_ip_rate = " << m_perIpRate
+       << " connections = " << m_connections
+       << " accepted = " << m_acceptCount
+       << " rejected = " << m_rejectCount << "]\n";
     std::string pfx = prefix.empty() ? "    " : prefix;
     for(auto& i : m_socks){
         ss << pfx << pfx << *i << std::endl;
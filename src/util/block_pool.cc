@@ -0,0 +1,276 @@
+#include "block_pool.h"
+#include "config.h"
+#include "mutex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+namespace HPGS{
+
+/// 缓存行大小
+static const size_t s_align = 64;
+/// 每个线程每一级最多缓存的字节数
+static const size_t s_thread_cache_bytes = 256 * 1024;
+
+/**
+ * @brief 全局缓存的一级
+ */
+struct BlockPool::Central {
+    Mutex mutex;
+    std::vector<void*> blocks;
+};
+
+/**
+ * @brief 运行中线程的缓存列表
+ */
+struct BlockPool::Threads {
+    Mutex mutex;
+    std::vector<BlockThreadCache*> caches;
+};
+
+/**
+ * @brief 返回size所在的分级
+ */
+static size_t SizeClass(size_t size) {
+    size_t cls = 0;
+    size_t cls_size = BlockPool::s_min_size;
+    while(cls_size < size) {
+        cls_size <<= 1;
+        ++cls;
+    }
+    return cls;
+}
+
+static size_t ClassSize(size_t cls) {
+    return BlockPool::s_min_size << cls;
+}
+
+/**
+ * @brief 线程缓存每一级最多缓存的块数
+ */
+static size_t ThreadCacheCount(size_t cls) {
+    return std::min(std::max(s_thread_cache_bytes / ClassSize(cls), (size_t)2), (size_t)256);
+}
+
+/**
+ * @brief 线程缓存和全局缓存之间一次交换的块数
+ */
+static size_t BatchCount(size_t cls) {
+    return std::max(ThreadCacheCount(cls) / 2, (size_t)1);
+}
+
+/**
+ * @brief 线程缓存，线程退出时归还全局缓存
+ */
+struct BlockThreadCache {
+    std::vector<void*> lists[BlockPool::s_class_count];
+    /// 本线程的计数，只有本线程写，汇总时其他线程读
+    std::atomic<uint64_t> allocs{0};
+    std::atomic<uint64_t> reuses{0};
+    std::atomic<uint64_t> frees{0};
+
+    BlockThreadCache();
+    ~BlockThreadCache();
+};
+
+//线程缓存析构后(主线程退出时静态对象还会释放ByteArray)直接使用全局缓存
+static thread_local bool t_cache_dead = false;
+static thread_local BlockThreadCache t_cache;
+
+BlockThreadCache::BlockThreadCache() {
+    BlockPool::Threads* threads = BlockPool::GetInstance()->m_threads;
+    Mutex::Lock lock(threads->mutex);
+    threads->caches.push_back(this);
+}
+
+BlockThreadCache::~BlockThreadCache() {
+    t_cache_dead = true;
+    BlockPool* pool = BlockPool::GetInstance();
+    for(size_t i = 0; i < BlockPool::s_class_count; ++i) {
+        if(!lists[i].empty()) {
+            pool->release(i, &lists[i][0], lists[i].size());
+        }
+    }
+    //计数并入全局并移出列表，在同一把锁内完成，汇总时不会重复或遗漏
+    Mutex::Lock lock(pool->m_threads->mutex);
+    pool->m_allocs += allocs;
+    pool->m_reuses += reuses;
+    pool->m_frees += frees;
+    auto& caches = pool->m_threads->caches;
+    caches.erase(std::find(caches.begin(), caches.end(), this));
+}
+
+BlockPool* BlockPool::GetInstance() {
+    static BlockPool* s_pool = new BlockPool;
+    return s_pool;
+}
+
+BlockPool::BlockPool()
+    :m_centrals(new Central[s_class_count])
+    ,m_threads(new Threads) {
+    //可能在其他编译单元的静态初始化中第一次调用，配置在这里查找
+    ConfigVar<uint64_t>::ptr max_cached = Config::Lookup("block_pool.max_cached_bytes"
+            ,(uint64_t)(64 * 1024 * 1024), "block pool max bytes cached globally");
+    m_maxCachedBytes = max_cached->getValue();
+    max_cached->addListener([this](const uint64_t& old_value, const uint64_t& new_value){
+        m_maxCachedBytes = new_value;
+    });
+}
+
+size_t BlockPool::RoundUp(size_t size) {
+    if(size > s_max_size) {
+        return size;
+    }
+    return ClassSize(SizeClass(size));
+}
+
+void BlockPool::Count(std::atomic<uint64_t> BlockThreadCache::* field, std::atomic<uint64_t>& retired) {
+    if(t_cache_dead) {
+        ++retired;
+        return;
+    }
+    //只有本线程写，不需要原子的读改写
+    std::atomic<uint64_t>& v = t_cache.*field;
+    v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+uint64_t BlockPool::sum(std::atomic<uint64_t> BlockThreadCache::* field
+                        ,const std::atomic<uint64_t>& retired) const {
+    Mutex::Lock lock(m_threads->mutex);
+    uint64_t total = retired;
+    for(auto& i : m_threads->caches) {
+        total += (i->*field).load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t BlockPool::getAllocCount() const {
+    return sum(&BlockThreadCache::allocs, m_allocs);
+}
+
+uint64_t BlockPool::getReuseCount() const {
+    return sum(&BlockThreadCache::reuses, m_reuses);
+}
+
+uint64_t BlockPool::getFreeCount() const {
+    return sum(&BlockThreadCache::frees, m_frees);
+}
+
+void* BlockPool::allocate(size_t size) {
+    if(size > s_max_size) {
+        Count(&BlockThreadCache::allocs, m_allocs);
+        void* ptr = malloc(size);
+        if(!ptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+    size_t cls = SizeClass(size);
+    if(!t_cache_dead) {
+        std::vector<void*>& list = t_cache.lists[cls];
+        if(list.empty()) {
+            size_t batch = BatchCount(cls);
+            list.reserve(ThreadCacheCount(cls) + 1);
+            list.resize(batch);
+            list.resize(fetch(cls, &list[0], batch));
+        }
+        if(!list.empty()) {
+            void* ptr = list.back();
+            list.pop_back();
+            Count(&BlockThreadCache::reuses, m_reuses);
+            return ptr;
+        }
+    } else {
+        void* ptr = nullptr;
+        if(fetch(cls, &ptr, 1)) {
+            ++m_reuses;
+            return ptr;
+        }
+    }
+    return allocBlock(cls);
+}
+
+void BlockPool::deallocate(void* ptr, size_t size) {
+    if(!ptr) {
+        return;
+    }
+    if(size > s_max_size) {
+        freeBlock(ptr);
+        return;
+    }
+    size_t cls = SizeClass(size);
+    if(t_cache_dead) {
+        release(cls, &ptr, 1);
+        return;
+    }
+    std::vector<void*>& list = t_cache.lists[cls];
+    list.push_back(ptr);
+    if(list.size() > ThreadCacheCount(cls)) {
+        size_t batch = BatchCount(cls);
+        release(cls, &list[list.size() - batch], batch);
+        list.resize(list.size() - batch);
+    }
+}
+
+size_t BlockPool::fetch(size_t cls, void** out, size_t count) {
+    Central& central = m_centrals[cls];
+    Mutex::Lock lock(central.mutex);
+    size_t n = std::min(count, central.blocks.size());
+    if(n) {
+        std::copy(central.blocks.end() - n, central.blocks.end(), out);
+        central.blocks.resize(central.blocks.size() - n);
+        m_cachedBytes -= n * ClassSize(cls);
+    }
+    return n;
+}
+
+void BlockPool::release(size_t cls, void** blocks, size_t count) {
+    size_t size = ClassSize(cls);
+    size_t keep = 0;
+    uint64_t cached = m_cachedBytes;
+    uint64_t max_cached = m_maxCachedBytes;
+    if(cached < max_cached) {
+        keep = std::min(count, (size_t)((max_cached - cached) / size));
+    }
+    if(keep) {
+        Central& central = m_centrals[cls];
+        Mutex::Lock lock(central.mutex);
+        central.blocks.insert(central.blocks.end(), blocks, blocks + keep);
+        m_cachedBytes += keep * size;
+    }
+    //超过上限的归还给系统
+    for(size_t i = keep; i < count; ++i) {
+        freeBlock(blocks[i]);
+    }
+}
+
+void* BlockPool::allocBlock(size_t cls) {
+    size_t size = ClassSize(cls);
+    void* ptr = nullptr;
+    if(posix_memalign(&ptr, std::min(size, s_align), size)) {
+        throw std::bad_alloc();
+    }
+    Count(&BlockThreadCache::allocs, m_allocs);
+    return ptr;
+}
+
+void BlockPool::freeBlock(void* ptr) {
+    Count(&BlockThreadCache::frees, m_frees);
+    free(ptr);
+}
+
+std::string BlockPool::toString() const {
+    std::stringstream ss;
+    ss << "[BlockPool allocs=" << getAllocCount()
+       << " reuses=" << getReuseCount()
+       << " frees=" << getFreeCount()
+       << " cached_bytes=" << m_cachedBytes
+       << " max_cached_bytes=" << m_maxCachedBytes
+       << "]";
+    return ss.str();
+}
+
+}
@@ -1,39 +1,81 @@
 #include "fd_manager.h"
 #include "hook.h"
+#include "macro.h"
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
 
 namespace HPGS{
 
-FdCtx::FdCtx(int fd) : m_isInit(false), m_isSocket(false), m_sysNonblock(false)
-, m_userNonblock(false), m_isClosed(false), m_fd(fd), m_recvTimeout(-1), m_sendTimeout(-1) {
-    init();
+FdCtx::FdCtx() : m_state(EMPTY), m_generation(0), m_isInit(false), m_sysNonblock(false)
+, m_userNonblock(false), m_isClosed(false), m_type(UNKNOWN), m_fd(-1), m_recvTimeout(-1), m_sendTimeout(-1) {
 }
 
 FdCtx::~FdCtx(){
 
 }
 
-bool FdCtx::init(){
+/**
+ * @brief eventfd, timerfd等没有文件类型位的匿名inode，通过/proc/self/fd的链接名区分
+ */
+static bool IsEventfd(int fd){
+    char path[64];
+    char link[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    ssize_t n = readlink(path, link, sizeof(link) - 1);
+    if(n <= 0){
+        return false;
+    }
+    link[n] = '\0';
+    return strcmp(link, "anon_inode:[eventfd]") == 0;
+}
+
+bool FdCtx::init(Type type){
     if(m_isInit){
         return true;
     }
     m_recvTimeout = -1;
     m_sendTimeout = -1;
+    m_userNonblock = false;
+    m_isClosed = false;
+
+    //调用方已知类型(如accept4(SOCK_NONBLOCK)返回的socket)，fd已经是系统非阻塞
+    if(type != UNKNOWN){
+        m_isInit = true;
+        m_type = type;
+        m_sysNonblock = isPollable();
+        return true;
+    }
 
     struct stat fd_stat;
     if(-1 == fstat(m_fd, &fd_stat)){
         m_isInit = false;
-        m_isSocket = false;
+        m_type = UNKNOWN;
     }
     else{
         m_isInit = true;
-        m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        if(S_ISSOCK(fd_stat.st_mode)){
+            m_type = SOCKET;
+        }
+        else if(S_ISFIFO(fd_stat.st_mode)){
+            m_type = PIPE;
+        }
+        else if(S_ISREG(fd_stat.st_mode)){
+            m_type = FILE;
+        }
+        else if(IsEventfd(m_fd)){
+            m_type = EVENTFD;
+        }
+        else{
+            m_type = OTHER;
+        }
     }
 
-    //是socket就给设置成非阻塞
-    if(m_isSocket){
+    //socket, pipe, eventfd 设置成非阻塞，由hook负责阻塞语义
+    if(isPollable()){
         int flags = fcntl_f(m_fd, F_GETFL, 0);
         if(!(flags & O_NONBLOCK)){
             fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
@@ -43,9 +85,6 @@ bool FdCtx::init(){
     else{
         m_sysNonblock = false;
     }
-
-    m_userNonblock = false;
-    m_isClosed = false;
     return m_isInit;
 }
 
@@ -68,44 +107,98 @@ uint64_t FdCtx::getTimeout(int type){
 }
 
 FdManager::FdManager(){
-    m_datas.resize(64);
+    for(int i = 0; i < MAX_CHUNKS; ++i){
+        m_chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+FdManager::~FdManager(){
+    for(int i = 0; i < MAX_CHUNKS; ++i){
+        delete m_chunks[i].exchange(nullptr, std::memory_order_acq_rel);
+    }
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create){
-    if(fd == -1){
+FdCtx* FdManager::get(int fd, bool auto_create){
+    return lookup(fd, auto_create, FdCtx::UNKNOWN);
+}
+
+FdCtx* FdManager::add(int fd, FdCtx::Type type){
+    return lookup(fd, true, type);
+}
+
+FdCtx* FdManager::lookup(int fd, bool auto_create, FdCtx::Type type){
+    if(HPGS_UNLIKELY(fd < 0 || fd >= MAX_CHUNKS * CHUNK_SIZE)){
         return nullptr;
     }
 
-    RWMutexType::ReadLock lock(m_mutex);
-    //没存那么多
-    if((int)m_datas.size() <= fd){
-        //不自动扩容
-        if(auto_create == false){
+    std::atomic<Chunk*>& slot = m_chunks[fd >> CHUNK_SHIFT];
+    Chunk* chunk = slot.load(std::memory_order_acquire);
+    if(HPGS_UNLIKELY(!chunk)){
+        if(!auto_create){
             return nullptr;
         }
-    }
-    else{
-        if(m_datas[fd] || !auto_create){
-            return m_datas[fd];
+        //竞争分配块，失败的一方释放自己的块
+        Chunk* c = new Chunk;
+        if(slot.compare_exchange_strong(chunk, c, std::memory_order_acq_rel)){
+            chunk = c;
+        }
+        else{
+            delete c;
         }
     }
-    lock.unlock();
 
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_datas.size()){
-        m_datas.resize(fd * 1.5);
+    FdCtx* ctx = &chunk->ctxs[fd & (CHUNK_SIZE - 1)];
+    uint32_t state = ctx->m_state.load(std::memory_order_acquire);
+    if(HPGS_LIKELY(state == FdCtx::LIVE)){
+        return ctx;
+    }
+    //其他线程正在初始化或删除，时间很短。
+    //等它完成再判断，否则hook会把正在初始化的socket当成普通fd，得到EAGAIN
+    while(state == FdCtx::BUSY){
+        sched_yield();
+        state = ctx->m_state.load(std::memory_order_acquire);
+    }
+    if(state == FdCtx::LIVE){
+        return ctx;
+    }
+    if(!auto_create){
+        return nullptr;
+    }
+
+    while(true){
+        state = FdCtx::EMPTY;
+        if(ctx->m_state.compare_exchange_strong(state, FdCtx::BUSY, std::memory_order_acquire)){
+            ctx->m_fd = fd;
+            ctx->m_isInit = false;
+            ctx->init(type);
+            ctx->m_generation.fetch_add(1, std::memory_order_relaxed);
+            ctx->m_state.store(FdCtx::LIVE, std::memory_order_release);
+            return ctx;
+        }
+        if(state == FdCtx::LIVE){
+            return ctx;
+        }
+        //其他线程正在初始化或删除，时间很短
+        sched_yield();
     }
-    m_datas[fd] = ctx;
-    return ctx;
 }
 
 void FdManager::del(int fd){
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd){
+    if(fd < 0 || fd >= MAX_CHUNKS * CHUNK_SIZE){
         return;
     }
-    m_datas[fd].reset();
+    Chunk* chunk = m_chunks[fd >> CHUNK_SHIFT].load(std::memory_order_acquire);
+    if(!chunk){
+        return;
+    }
+    FdCtx* ctx = &chunk->ctxs[fd & (CHUNK_SIZE - 1)];
+    uint32_t state = FdCtx::LIVE;
+    if(!ctx->m_state.compare_exchange_strong(state, FdCtx::BUSY, std::memory_order_acquire)){
+        return;
+    }
+    ctx->m_isClosed = true;
+    ctx->m_generation.fetch_add(1, std::memory_order_release);
+    ctx->m_state.store(FdCtx::EMPTY, std::memory_order_release);
 }
 
-}
\ No newline at end of file
+}
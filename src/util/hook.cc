@@ -1,5 +1,9 @@
 #include "hook.h"
 #include <dlfcn.h>
+#include <stdarg.h>
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "config.h"
 #include "log.h"
@@ -7,6 +11,7 @@
 #include "iomanager.h"
 #include "fd_manager.h"
 #include "macro.h"
+#include "util.h"
 
 HPGS::Logger::ptr g_logger = HPGS_LOG_NAME("system");
 
@@ -25,16 +30,31 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
+    XX(pipe) \
+    XX(pipe2) \
+    XX(eventfd) \
+    XX(dup) \
+    XX(dup2) \
+    XX(open) \
+    XX(poll) \
+    XX(select) \
+    XX(epoll_wait) \
     XX(read) \
     XX(readv) \
     XX(recv) \
     XX(recvfrom) \
     XX(recvmsg) \
+    XX(recvmmsg) \
     XX(write) \
     XX(writev) \
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendmmsg) \
+    XX(sendfile) \
+    XX(splice) \
+    XX(tee) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
@@ -82,6 +102,39 @@ void set_hook_enable(bool flag){
     t_hook_enable = flag;
 }
 
+uint64_t get_fibre_deadline(){
+    return Fibre::GetThis()->getDeadline();
+}
+
+void set_fibre_deadline(uint64_t deadline_ms){
+    Fibre::GetThis()->setDeadline(deadline_ms);
+}
+
+FibreDeadline::FibreDeadline(uint64_t timeout_ms){
+    m_old = get_fibre_deadline();
+    uint64_t deadline = GetCurrentMs() + timeout_ms;
+    if(m_old == 0 || deadline < m_old){
+        set_fibre_deadline(deadline);
+    }
+}
+
+FibreDeadline::~FibreDeadline(){
+    set_fibre_deadline(m_old);
+}
+
+}
+
+/**
+ * @brief 当前协程距截止时间的剩余毫秒数
+ * @return 没有截止时间返回-1，已过期返回0
+ */
+static uint64_t deadline_left(){
+    uint64_t deadline = HPGS::get_fibre_deadline();
+    if(deadline == 0){
+        return (uint64_t)-1;
+    }
+    uint64_t now = HPGS::GetCurrentMs();
+    return now >= deadline ? 0 : deadline - now;
 }
 
 struct timer_info{
@@ -98,7 +151,7 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    HPGS::FdCtx::ptr ctx = HPGS::fdMgr::GetInstance()->get(fd);
+    HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(fd);
     if(!ctx){
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -109,12 +162,15 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name
     }
 
     //系统fd都是非阻塞的，或则用户fd支持非阻塞
-    if(!ctx->isSocket() || ctx->getUserNonblock()){
+    if(!ctx->isPollable() || ctx->getUserNonblock()){
         return fun(fd, std::forward<Args>(args)...);
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    //记下代数，唤醒后用来判断fd是否在等待期间被关闭(记录可能已被同号的新fd复用)
+    uint32_t gen = ctx->getGeneration();
+    //只有需要等待时才分配
+    std::shared_ptr<timer_info> tinfo;
 
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
@@ -122,12 +178,23 @@ retry:
         n = fun(fd, std::forward<Args>(args)...);
     }
     if(n == -1 && errno == EAGAIN){
+        //等待时间取fd超时和协程剩余截止时间中较小的
+        uint64_t left = deadline_left();
+        if(left == 0){
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        uint64_t wait_ms = std::min(to, left);
+        if(!tinfo){
+            tinfo.reset(new timer_info);
+        }
+
         HPGS::IOManager* iom = HPGS::IOManager::GetThis();
         HPGS::Timer::ptr timer;
         std::weak_ptr<timer_info> winfo(tinfo);
 
-        if(to != (uint64_t)-1){
-            timer = iom->addConditionTimer(to, [winfo, fd, iom, event](){
+        if(wait_ms != (uint64_t)-1){
+            timer = iom->addConditionTimer(wait_ms, [winfo, fd, iom, event](){
                 auto t = winfo.lock();
                 if(!t || t->cancelled){
                     return;
@@ -155,6 +222,10 @@ retry:
                 errno = tinfo->cancelled;
                 return -1;
             }
+            if(HPGS_UNLIKELY(ctx->getGeneration() != gen)){
+                errno = EBADF;
+                return -1;
+            }
             goto retry;
         }
     }
@@ -162,6 +233,231 @@ retry:
     return n;
 }
 
+/**
+ * @brief 把sleep时间限制在协程截止时间内
+ * @return 是否被截止时间截断
+ */
+static bool clamp_to_deadline(uint64_t& ms){
+    uint64_t left = deadline_left();
+    if(left < ms){
+        ms = left;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 挂起当前协程，等待fd上的事件或超时
+ * @param[in] timeout_ms 超时时间(毫秒)，-1表示一直等待
+ * @return 事件就绪返回0，超时返回-1且errno=ETIMEDOUT，注册事件失败返回-1且errno=EINVAL
+ */
+static int wait_event(int fd, HPGS::IOManager::Event event, uint64_t timeout_ms, const char* hook_fun_name){
+    HPGS::IOManager* iom = HPGS::IOManager::GetThis();
+    HPGS::Timer::ptr timer;
+    std::shared_ptr<timer_info> tinfo(new timer_info);
+    std::weak_ptr<timer_info> winfo(tinfo);
+
+    if(timeout_ms != (uint64_t)-1){
+        timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom, event](){
+            auto t = winfo.lock();
+            if(!t || t->cancelled){
+                return;
+            }
+            t->cancelled = ETIMEDOUT;
+            iom->cancelEvent(fd, event);
+        }, winfo);
+    }
+
+    int rt = iom->addEvent(fd, event);
+    if(HPGS_UNLIKELY(rt)){
+        HPGS_LOG_ERROR(g_logger) << hook_fun_name << " addEvent(" 
+                                 << fd << ", " << event << ")";
+        if(timer){
+            timer->cancel();
+        }
+        errno = EINVAL;
+        return -1;
+    }
+
+    HPGS::Fibre::YieldToHold();
+    if(timer){
+        timer->cancel();
+    }
+    if(tinfo->cancelled){
+        errno = tinfo->cancelled;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief poll, select, epoll_wait的公共等待逻辑
+ * @details epfd可读表示被监听的fd中有事件就绪，唤醒后调用check做一次零超时的检查，
+ *          check返回0说明是伪唤醒(事件已被别人消费)，继续等待剩余时间
+ * @param[in] epfd 被监听的epoll fd
+ * @param[in] timeout_ms 超时时间(毫秒)，小于0表示一直等待，同时受协程截止时间限制
+ * @param[in] check 零超时检查，返回值即hook函数的返回值
+ * @param[in] block 注册事件失败时退化成阻塞调用，参数为剩余超时时间
+ */
+template<typename Check, typename Block>
+static int wait_ready(int epfd, int timeout_ms, const char* hook_fun_name, Check check, Block block){
+    uint64_t start = HPGS::GetCurrentMs();
+    while(true){
+        uint64_t to = (uint64_t)-1;
+        if(timeout_ms >= 0){
+            uint64_t elapsed = HPGS::GetCurrentMs() - start;
+            if(elapsed >= (uint64_t)timeout_ms){
+                return 0;
+            }
+            to = timeout_ms - elapsed;
+        }
+        //超过协程截止时间返回错误，而不是普通的超时
+        uint64_t left = deadline_left();
+        if(left == 0){
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        to = std::min(to, left);
+
+        if(wait_event(epfd, HPGS::IOManager::READ, to, hook_fun_name)){
+            if(errno == ETIMEDOUT){
+                if(deadline_left() == 0){
+                    errno = ETIMEDOUT;
+                    return -1;
+                }
+                return 0;
+            }
+            return block(to == (uint64_t)-1 ? -1 : (int)to);
+        }
+
+        int n = check();
+        if(n != 0){
+            return n;
+        }
+    }
+}
+
+/**
+ * @brief 把poll/select监听的fd注册到临时的epoll fd上，水平触发
+ * @details 重复出现的fd合并事件；普通文件不支持epoll(EPERM)，但它们总是就绪的，零超时检查时已经返回
+ */
+static void epoll_add_merge(int epfd, int fd, uint32_t events){
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0 || errno != EEXIST){
+        return;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/**
+ * @brief splice, tee两端的fd都可能阻塞
+ * @details EAGAIN时用零超时的poll检查哪一端没有就绪，在那一端上挂起协程，
+ *          读端没数据等READ(读超时)，否则等写端WRITE(写超时)
+ * @param[in] call 原始调用
+ */
+template<typename Call>
+static ssize_t do_io_pair(int fd_in, int fd_out, const char* hook_fun_name, Call call){
+    if(!HPGS::t_hook_enable){
+        return call();
+    }
+
+    HPGS::FdCtx* ctx_in = HPGS::fdMgr::GetInstance()->get(fd_in);
+    HPGS::FdCtx* ctx_out = HPGS::fdMgr::GetInstance()->get(fd_out);
+    if((ctx_in && ctx_in->isClose()) || (ctx_out && ctx_out->isClose())){
+        errno = EBADF;
+        return -1;
+    }
+    bool in_block = ctx_in && ctx_in->isPollable() && !ctx_in->getUserNonblock();
+    bool out_block = ctx_out && ctx_out->isPollable() && !ctx_out->getUserNonblock();
+    if(!in_block && !out_block){
+        return call();
+    }
+    uint32_t gen_in = ctx_in ? ctx_in->getGeneration() : 0;
+    uint32_t gen_out = ctx_out ? ctx_out->getGeneration() : 0;
+
+    while(true){
+        ssize_t n = call();
+        while(n == -1 && errno == EINTR){
+            n = call();
+        }
+        if(n != -1 || errno != EAGAIN){
+            return n;
+        }
+
+        pollfd pfds[2];
+        pfds[0].fd = fd_in;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = fd_out;
+        pfds[1].events = POLLOUT;
+        pfds[1].revents = 0;
+        poll_f(pfds, 2, 0);
+
+        int fd = -1;
+        HPGS::IOManager::Event event = HPGS::IOManager::NONE;
+        uint64_t to = (uint64_t)-1;
+        if(in_block && !(pfds[0].revents & (POLLIN | POLLHUP | POLLERR))){
+            fd = fd_in;
+            event = HPGS::IOManager::READ;
+            to = ctx_in->getTimeout(SO_RCVTIMEO);
+        }
+        else if(out_block && !(pfds[1].revents & (POLLOUT | POLLHUP | POLLERR))){
+            fd = fd_out;
+            event = HPGS::IOManager::WRITE;
+            to = ctx_out->getTimeout(SO_SNDTIMEO);
+        }
+        else{
+            //没就绪的是用户设置了非阻塞的一端
+            errno = EAGAIN;
+            return -1;
+        }
+
+        uint64_t left = deadline_left();
+        if(left == 0){
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if(wait_event(fd, event, std::min(to, left), hook_fun_name)){
+            return -1;
+        }
+        if(HPGS_UNLIKELY((ctx_in && ctx_in->getGeneration() != gen_in)
+                    || (ctx_out && ctx_out->getGeneration() != gen_out))){
+            errno = EBADF;
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief dup出来的fd继承原fd的上下文(用户非阻塞标志和超时时间)
+ */
+static void dup_fd_ctx(int oldfd, int newfd){
+    HPGS::FdCtx* octx = HPGS::fdMgr::GetInstance()->get(oldfd);
+    if(!octx || octx->isClose()){
+        return;
+    }
+    HPGS::FdCtx* nctx = HPGS::fdMgr::GetInstance()->get(newfd, true);
+    if(!nctx){
+        return;
+    }
+    nctx->setUserNonblock(octx->getUserNonblock());
+    nctx->setTimeout(SO_RCVTIMEO, octx->getTimeout(SO_RCVTIMEO));
+    nctx->setTimeout(SO_SNDTIMEO, octx->getTimeout(SO_SNDTIMEO));
+}
+
+/**
+ * @brief 注册新创建的fd，nonblock表示用户创建时就要求非阻塞(SOCK_NONBLOCK, O_NONBLOCK等)
+ */
+static void new_fd_ctx(int fd, bool nonblock){
+    HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(fd, true);
+    if(ctx && nonblock){
+        ctx->setUserNonblock(true);
+    }
+}
+
 extern "C" {
 #define XX(name) name ## _fun name ## _f = nullptr;
     HOOK_FUN(XX);
@@ -172,14 +468,21 @@ unsigned int sleep(unsigned int seconds){
         return sleep_f(seconds);
     }
 
+    uint64_t ms = seconds * 1000ul;
+    bool cut = clamp_to_deadline(ms);
     HPGS::Fibre::ptr fibre = HPGS::Fibre::GetThis();
     HPGS::IOManager* iom = HPGS::IOManager::GetThis();
-    iom->addTimer(seconds * 1000, std::bind(
+    iom->addTimer(ms, std::bind(
         //定义了一个成员函数指针类型，该成员函数属于Scheduler类，接受Fibre::ptr类型的指针和int型参数，返回类型为void
         (void(HPGS::Scheduler::*)(HPGS::Fibre::ptr, int thread))&HPGS::IOManager::schedule, iom, fibre, -1
         
     ));
     HPGS::Fibre::YieldToHold();
+    if(cut){
+        //被截止时间打断，和被信号打断一样返回未睡完的秒数
+        errno = ETIMEDOUT;
+        return seconds - ms / 1000;
+    }
     return 0;
 }
 
@@ -188,12 +491,18 @@ int usleep(useconds_t usec){
         return usleep_f(usec);
     }
 
+    uint64_t ms = usec / 1000;
+    bool cut = clamp_to_deadline(ms);
     HPGS::Fibre::ptr fibre = HPGS::Fibre::GetThis();
     HPGS::IOManager* iom = HPGS::IOManager::GetThis();
-    iom->addTimer(usec / 1000, std::bind(
+    iom->addTimer(ms, std::bind(
         (void(HPGS::Scheduler::*)(HPGS::Fibre::ptr, int))&HPGS::IOManager::schedule, iom, fibre, -1
     ));
     HPGS::Fibre::YieldToHold();
+    if(cut){
+        errno = ETIMEDOUT;
+        return -1;
+    }
     return 0;
 }
 
@@ -202,13 +511,24 @@ int nanosleep(const struct timespec* req, struct timespec* rem){
         return nanosleep_f(req, rem);
     }
 
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
+    uint64_t timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
+    uint64_t ms = timeout_ms;
+    bool cut = clamp_to_deadline(ms);
     HPGS::Fibre::ptr fibre = HPGS::Fibre::GetThis();
     HPGS::IOManager* iom = HPGS::IOManager::GetThis();
-    iom->addTimer(timeout_ms, std::bind(
+    iom->addTimer(ms, std::bind(
         (void(HPGS::Scheduler::*)(HPGS::Fibre::ptr, int))&HPGS::IOManager::schedule, iom, fibre, -1
     ));
     HPGS::Fibre::YieldToHold();
+    if(cut){
+        if(rem){
+            uint64_t left = timeout_ms - ms;
+            rem->tv_sec = left / 1000;
+            rem->tv_nsec = (left % 1000) * 1000 * 1000;
+        }
+        errno = ETIMEDOUT;
+        return -1;
+    }
     return 0;
 }
 
@@ -220,7 +540,7 @@ int socket(int domain, int type, int protocol){
     if(fd == -1){
         return fd;
     }
-    HPGS::fdMgr::GetInstance()->get(fd, true);
+    new_fd_ctx(fd, type & SOCK_NONBLOCK);
     return fd;
 }
 
@@ -228,7 +548,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(!HPGS::t_hook_enable){
         return connect_f(fd, addr, addrlen);
     }
-    HPGS::FdCtx::ptr ctx = HPGS::fdMgr::GetInstance()->get(fd);
+    HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(fd);
     if(!ctx || ctx->isClose()){
         errno = EBADF;
         return -1;
@@ -253,6 +573,14 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return n;
     }
 
+    //连接超时和协程剩余截止时间取较小的
+    uint64_t left = deadline_left();
+    if(left == 0){
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    timeout_ms = std::min(timeout_ms, left);
+
     HPGS::IOManager* iom = HPGS::IOManager::GetThis();
     HPGS::Timer::ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
@@ -311,13 +639,276 @@ int connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen){
 }
 
 int accept(int s, struct sockaddr* addr, socklen_t* addrlen){
-    int fd = do_io(s, accept_f, "accept", HPGS::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    if(!HPGS::t_hook_enable){
+        return accept_f(s, addr, addrlen);
+    }
+    return accept4(s, addr, addrlen, 0);
+}
+
+/**
+ * @brief 登记以系统非阻塞创建的新连接，flags带SOCK_NONBLOCK时记为用户非阻塞
+ */
+static int on_accepted(int fd, int flags){
+    if(fd >= 0){
+        HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->add(fd, HPGS::FdCtx::SOCKET);
+        if(ctx && (flags & SOCK_NONBLOCK)){
+            ctx->setUserNonblock(true);
+        }
+    }
+    return fd;
+}
+
+int accept4(int s, struct sockaddr* addr, socklen_t* addrlen, int flags){
+    if(!HPGS::t_hook_enable){
+        return accept4_f(s, addr, addrlen, flags);
+    }
+    //新连接直接以系统非阻塞创建，省去上下文初始化时的fstat和fcntl
+    int fd = do_io(s, accept4_f, "accept4", HPGS::IOManager::READ, SO_RCVTIMEO
+                , addr, addrlen, flags | SOCK_NONBLOCK);
+    return on_accepted(fd, flags);
+}
+
+int accept_nowait(int s, struct sockaddr* addr, socklen_t* addrlen, int flags){
+    if(!HPGS::t_hook_enable){
+        return accept4_f(s, addr, addrlen, flags);
+    }
+    //监听socket是系统非阻塞的，没有连接时立即返回EAGAIN
+    int fd = accept4_f(s, addr, addrlen, flags | SOCK_NONBLOCK);
+    return on_accepted(fd, flags);
+}
+
+int pipe(int pipefd[2]){
+    int rt = pipe_f(pipefd);
+    if(rt == 0 && HPGS::t_hook_enable){
+        new_fd_ctx(pipefd[0], false);
+        new_fd_ctx(pipefd[1], false);
+    }
+    return rt;
+}
+
+int pipe2(int pipefd[2], int flags){
+    int rt = pipe2_f(pipefd, flags);
+    if(rt == 0 && HPGS::t_hook_enable){
+        new_fd_ctx(pipefd[0], flags & O_NONBLOCK);
+        new_fd_ctx(pipefd[1], flags & O_NONBLOCK);
+    }
+    return rt;
+}
+
+int eventfd(unsigned int initval, int flags){
+    int fd = eventfd_f(initval, flags);
+    if(fd >= 0 && HPGS::t_hook_enable){
+        new_fd_ctx(fd, flags & EFD_NONBLOCK);
+    }
+    return fd;
+}
+
+int dup(int oldfd){
+    int fd = dup_f(oldfd);
+    if(fd >= 0 && HPGS::t_hook_enable){
+        dup_fd_ctx(oldfd, fd);
+    }
+    return fd;
+}
+
+int dup2(int oldfd, int newfd){
+    if(!HPGS::t_hook_enable || oldfd == newfd){
+        return dup2_f(oldfd, newfd);
+    }
+    //newfd会被隐式关闭，先清理它的事件和上下文
+    HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(newfd);
+    if(ctx){
+        HPGS::fdMgr::GetInstance()->del(newfd);
+        auto iom = HPGS::IOManager::GetThis();
+        if(iom){
+            iom->cancelAll(newfd);
+        }
+    }
+    int fd = dup2_f(oldfd, newfd);
     if(fd >= 0){
-        HPGS::fdMgr::GetInstance()->get(fd, true);
+        dup_fd_ctx(oldfd, fd);
     }
     return fd;
 }
 
+int open(const char* pathname, int flags, ...){
+    mode_t mode = 0;
+#ifdef O_TMPFILE
+    if((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE){
+#else
+    if(flags & O_CREAT){
+#endif
+        va_list va;
+        va_start(va, flags);
+        mode = va_arg(va, int);
+        va_end(va);
+    }
+    //阻塞打开FIFO会等待对端打开，这一步无法挂起协程
+    int fd = open_f(pathname, flags, mode);
+    if(fd >= 0 && HPGS::t_hook_enable){
+        //FIFO常交给子进程或按路径和其他程序共用，登记后会被设成系统非阻塞，
+        //使用者看到的阻塞语义会变化，所以不登记，读写按原样阻塞
+        struct stat st;
+        if(fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)){
+            return fd;
+        }
+        new_fd_ctx(fd, flags & O_NONBLOCK);
+    }
+    return fd;
+}
+
+int poll(struct pollfd* fds, nfds_t nfds, int timeout){
+    if(!HPGS::t_hook_enable || timeout == 0){
+        return poll_f(fds, nfds, timeout);
+    }
+
+    int n = poll_f(fds, nfds, 0);
+    if(n != 0){
+        return n;
+    }
+
+    //把所有fd挂到一个临时epoll fd上，只需要在IOManager上等待这一个fd可读
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd == -1){
+        return poll_f(fds, nfds, timeout);
+    }
+    for(nfds_t i = 0; i < nfds; ++i){
+        if(fds[i].fd < 0){
+            continue;
+        }
+        //POLL*和EPOLL*的取值相同
+        uint32_t events = fds[i].events & (POLLIN | POLLPRI | POLLOUT | POLLRDHUP);
+        for(nfds_t j = 0; j < i; ++j){
+            if(fds[j].fd == fds[i].fd){
+                events |= fds[j].events & (POLLIN | POLLPRI | POLLOUT | POLLRDHUP);
+            }
+        }
+        epoll_add_merge(epfd, fds[i].fd, events);
+    }
+
+    n = wait_ready(epfd, timeout, "poll", [fds, nfds](){
+        return poll_f(fds, nfds, 0);
+    }, [fds, nfds](int to){
+        return poll_f(fds, nfds, to);
+    });
+
+    int err = errno;
+    close_f(epfd);
+    errno = err;
+    return n;
+}
+
+int select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds, struct timeval* timeout){
+    int timeout_ms = timeout ? timeout->tv_sec * 1000 + timeout->tv_usec / 1000 : -1;
+    if(!HPGS::t_hook_enable || timeout_ms == 0 || nfds <= 0 || nfds > FD_SETSIZE){
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+
+    //select会修改传入的fd_set，保存一份用于每次重新检查
+    fd_set rs, ws, es;
+    FD_ZERO(&rs);
+    FD_ZERO(&ws);
+    FD_ZERO(&es);
+    if(readfds){
+        rs = *readfds;
+    }
+    if(writefds){
+        ws = *writefds;
+    }
+    if(exceptfds){
+        es = *exceptfds;
+    }
+
+    auto check = [=, &rs, &ws, &es](){
+        if(readfds){
+            *readfds = rs;
+        }
+        if(writefds){
+            *writefds = ws;
+        }
+        if(exceptfds){
+            *exceptfds = es;
+        }
+        struct timeval zero = {0, 0};
+        return select_f(nfds, readfds, writefds, exceptfds, &zero);
+    };
+
+    int n = check();
+    if(n != 0){
+        return n;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd == -1){
+        check();
+        return select_f(nfds, readfds, writefds, exceptfds, timeout);
+    }
+    for(int fd = 0; fd < nfds; ++fd){
+        uint32_t events = 0;
+        if(readfds && FD_ISSET(fd, &rs)){
+            events |= EPOLLIN;
+        }
+        if(writefds && FD_ISSET(fd, &ws)){
+            events |= EPOLLOUT;
+        }
+        if(exceptfds && FD_ISSET(fd, &es)){
+            events |= EPOLLPRI;
+        }
+        if(events){
+            epoll_add_merge(epfd, fd, events);
+        }
+    }
+
+    uint64_t start = HPGS::GetCurrentMs();
+    n = wait_ready(epfd, timeout_ms, "select", check, [&check, nfds, readfds, writefds, exceptfds](int to){
+        check();
+        struct timeval tv = {to / 1000, (to % 1000) * 1000};
+        return select_f(nfds, readfds, writefds, exceptfds, to < 0 ? nullptr : &tv);
+    });
+    int err = errno;
+    close_f(epfd);
+
+    //超时返回时清空fd_set
+    if(n == 0){
+        if(readfds){
+            FD_ZERO(readfds);
+        }
+        if(writefds){
+            FD_ZERO(writefds);
+        }
+        if(exceptfds){
+            FD_ZERO(exceptfds);
+        }
+    }
+    //和linux的select一样，timeout中返回剩余时间
+    if(timeout){
+        uint64_t elapsed = HPGS::GetCurrentMs() - start;
+        uint64_t left = elapsed >= (uint64_t)timeout_ms ? 0 : timeout_ms - elapsed;
+        timeout->tv_sec = left / 1000;
+        timeout->tv_usec = (left % 1000) * 1000;
+    }
+    errno = err;
+    return n;
+}
+
+int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout){
+    if(!HPGS::t_hook_enable || timeout == 0){
+        return epoll_wait_f(epfd, events, maxevents, timeout);
+    }
+
+    int n = epoll_wait_f(epfd, events, maxevents, 0);
+    if(n != 0){
+        return n;
+    }
+
+    //epoll fd本身可以被epoll监听，有就绪事件时可读
+    return wait_ready(epfd, timeout, "epoll_wait", [epfd, events, maxevents](){
+        return epoll_wait_f(epfd, events, maxevents, 0);
+    }, [epfd, events, maxevents](int to){
+        return epoll_wait_f(epfd, events, maxevents, to);
+    });
+}
+
 ssize_t read(int fd, void* buf, size_t count){
     return do_io(fd, read_f, "read", HPGS::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
@@ -338,8 +929,12 @@ ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags){
     return do_io(sockfd, recvmsg_f, "recvmsg", HPGS::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+int recvmmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags, struct timespec* timeout){
+    return do_io(sockfd, recvmmsg_f, "recvmmsg", HPGS::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
 ssize_t write(int fd, const void* buf, size_t count){
-    return do_io(fd, write_f, "write", HPGS::IOManager::WRITE, SO_RCVTIMEO, buf, count);
+    return do_io(fd, write_f, "write", HPGS::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
@@ -358,18 +953,39 @@ ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
     return do_io(s, sendmsg_f, "sendmsg", HPGS::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+int sendmmsg(int s, struct mmsghdr* msgvec, unsigned int vlen, int flags){
+    return do_io(s, sendmmsg_f, "sendmmsg", HPGS::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count){
+    return do_io(out_fd, sendfile_f, "sendfile", HPGS::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+ssize_t splice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out, size_t len, unsigned int flags){
+    return do_io_pair(fd_in, fd_out, "splice", [=](){
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    });
+}
+
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags){
+    return do_io_pair(fd_in, fd_out, "tee", [=](){
+        return tee_f(fd_in, fd_out, len, flags);
+    });
+}
+
 int close(int fd){
     if(!HPGS::t_hook_enable){
         return close_f(fd);
     }
 
-    HPGS::FdCtx::ptr ctx = HPGS::fdMgr::GetInstance()->get(fd);
+    HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(fd);
     if(ctx){
+        //先删除上下文(代数改变)，再唤醒等待的协程，它们醒来后返回EBADF
+        HPGS::fdMgr::GetInstance()->del(fd);
         auto iom = HPGS::IOManager::GetThis();
         if(iom){
             iom->cancelAll(fd);
         }
-        HPGS::fdMgr::GetInstance()->del(fd);
     }
     return close_f(fd);
 }
@@ -382,8 +998,8 @@ int fcntl(int fd, int cmd, ...){
             {
                 int arg = va_arg(va, int);
                 va_end(va);
-                HPGS::FdCtx::ptr ctx = HPGS::fdMgr::GetInstance()->get(fd);
-                if(!ctx || ctx->isClose() || !ctx->isSocket()){
+                HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(fd);
+                if(!ctx || ctx->isClose() || !ctx->isPollable()){
                     return fcntl_f(fd, cmd, arg);
                 }
                 ctx->setUserNonblock(arg & O_NONBLOCK);
@@ -400,8 +1016,8 @@ int fcntl(int fd, int cmd, ...){
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                HPGS::FdCtx::ptr ctx = HPGS::fdMgr::GetInstance()->get(fd);
-                if(!ctx || ctx->isClose() || !ctx->isSocket()){
+                HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(fd);
+                if(!ctx || ctx->isClose() || !ctx->isPollable()){
                     return arg;
                 }
                 if(ctx->getUserNonblock()){
@@ -463,8 +1079,8 @@ int ioctl(int d, unsigned long int request, ...){
 
     if(FIONBIO == request){
         bool user_nonblock = !!*(int*)arg;
-        HPGS::FdCtx::ptr ctx = HPGS::fdMgr::GetInstance()->get(d);
-        if(!ctx || ctx->isClose() || !ctx->isSocket()){
+        HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(d);
+        if(!ctx || ctx->isClose() || !ctx->isPollable()){
             return ioctl_f(d, request, arg);
         }
         ctx->setUserNonblock(user_nonblock);
@@ -482,7 +1098,7 @@ int setsockopt(int sockfd, int level, int optname, const void* optval, socklen_t
     }
     if(level == SOL_SOCKET){
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO){
-            HPGS::FdCtx::ptr ctx = HPGS::fdMgr::GetInstance()->get(sockfd);
+            HPGS::FdCtx* ctx = HPGS::fdMgr::GetInstance()->get(sockfd);
             if(ctx){
                 const timeval* v = (const timeval*)optval;
                 ctx->setTimeout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
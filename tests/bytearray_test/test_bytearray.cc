@@ -1,4 +1,13 @@
 #include "bytearray.h"
+#include "block_pool.h"
+#include "util.h"
+#include "myendian.h"
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "log.h"
 #include "macro.h"
 
@@ -86,7 +95,464 @@ void test(){
 #undef XX
 }
 
+void test_pool(){
+    HPGS::BlockPool* pool = HPGS::BlockPool::GetInstance();
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(4096));
+    std::string data(1024 * 1024, 'x');
+    ba->write(data.c_str(), data.size());
+    ba->clear();
+
+    //clear归还的节点被再次使用，不再向系统分配
+    uint64_t allocs = pool->getAllocCount();
+    uint64_t reuses = pool->getReuseCount();
+    ba->write(data.c_str(), data.size());
+    HPGS_ASSERT(pool->getAllocCount() == allocs);
+    HPGS_ASSERT(pool->getReuseCount() - reuses >= data.size() / 4096);
+    ba->setPosition(0);
+    HPGS_ASSERT(ba->toString() == data);
+
+    //计数记在各线程上，线程退出后仍然计入总数
+    reuses = pool->getReuseCount();
+    std::thread t([pool](){
+        for(int i = 0; i < 1000; ++i){
+            pool->deallocate(pool->allocate(4096), 4096);
+        }
+    });
+    t.join();
+    HPGS_ASSERT(pool->getReuseCount() - reuses >= 999);
+
+    uint64_t start = HPGS::GetCurrentUs();
+    for(int i = 0; i < 1000; ++i){
+        HPGS::ByteArray tmp(4096);
+        tmp.write(data.c_str(), 64 * 1024);
+    }
+    HPGS_LOG_INFO(g_logger) << "1000 x 64KB ByteArray used " << (HPGS::GetCurrentUs() - start)
+                            << "us " << pool->toString();
+}
+
+void test_streaming(){
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(16));
+    ba->setStreaming(true);
+    std::string expect;
+    uint64_t allocs = 0;
+    for(int i = 0; i < 10000; ++i){
+        //写入: 交替使用write和getWriteBuffers/commitWrite
+        std::string data(rand() % 40, 'a' + i % 26);
+        if(i % 2){
+            ba->write(data.c_str(), data.size());
+        } else {
+            std::vector<iovec> iovs;
+            ba->getWriteBuffers(iovs, data.size());
+            size_t off = 0;
+            for(auto& iov : iovs){
+                memcpy(iov.iov_base, data.c_str() + off, iov.iov_len);
+                off += iov.iov_len;
+            }
+            ba->commitWrite(data.size());
+        }
+        expect += data;
+
+        //读取: 交替使用read和getReadBuffers/consume，不需要setPosition
+        size_t n = std::min(expect.size(), (size_t)(rand() % 40));
+        std::string out(n, '\0');
+        if(i % 3){
+            ba->read(&out[0], n);
+        } else {
+            std::vector<iovec> iovs;
+            ba->getReadBuffers(iovs, n);
+            size_t off = 0;
+            for(auto& iov : iovs){
+                memcpy(&out[off], iov.iov_base, iov.iov_len);
+                off += iov.iov_len;
+            }
+            ba->consume(n);
+        }
+        HPGS_ASSERT(out == expect.substr(0, n));
+        expect.erase(0, n);
+        HPGS_ASSERT(ba->getReadSize() == expect.size());
+        //读完的节点被回收，数据末尾不会一直增长
+        HPGS_ASSERT(ba->getSize() < expect.size() + 16);
+        if(i == 1000){
+            allocs = HPGS::BlockPool::GetInstance()->getAllocCount();
+        }
+    }
+    HPGS_ASSERT(ba->toString() == expect);
+    HPGS_LOG_INFO(g_logger) << "streaming remain = " << expect.size() << " allocs after warmup = "
+                            << HPGS::BlockPool::GetInstance()->getAllocCount() - allocs;
+}
+
+void test_random_access(){
+    const size_t size = 16 * 1024 * 1024;
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(4096));
+    for(size_t i = 0; i < size / 4; ++i){
+        ba->writeFuint32(i);
+    }
+
+    //按位置读取不依赖当前位置
+    ba->setPosition(0);
+    uint32_t v = 0;
+    ba->read(&v, sizeof(v), 4 * 12345);
+    HPGS_ASSERT(HPGS::byteswapOnLittleEndian(v) == 12345);
+    std::vector<iovec> iovs;
+    HPGS_ASSERT(ba->getReadBuffers(iovs, 8192, size - 4096) == 4096);
+
+    const int count = 1000000;
+    std::vector<size_t> positions;
+    for(int i = 0; i < count; ++i){
+        positions.push_back((rand() % (size / 4)) * 4);
+    }
+    uint64_t start = HPGS::GetCurrentUs();
+    for(auto pos : positions){
+        ba->setPosition(pos);
+        HPGS_ASSERT(ba->readFuint32() == pos / 4);
+    }
+    uint64_t seek_us = HPGS::GetCurrentUs() - start;
+
+    start = HPGS::GetCurrentUs();
+    for(auto pos : positions){
+        ba->read(&v, sizeof(v), pos);
+    }
+    uint64_t read_us = HPGS::GetCurrentUs() - start;
+    HPGS_LOG_INFO(g_logger) << "16MB ByteArray " << count << " random setPosition+read "
+                            << seek_us << "us, positional read " << read_us << "us";
+}
+
+void test_slice(){
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(64));
+    std::string data;
+    for(int i = 0; i < 300; ++i){
+        data.append(1, (char)('a' + i % 26));
+    }
+    ba->writeStringWithoutLength(data);
+
+    //跨节点的视图不拷贝
+    HPGS::ByteArray::Slice s = ba->slice(50, 100);
+    HPGS_ASSERT(s.size() == 100 && s.getSpanCount() == 3);
+    HPGS_ASSERT(s.toString() == data.substr(50, 100));
+    HPGS::ByteArray::Slice sub = s.slice(20, 30);
+    HPGS_ASSERT(sub.isContiguous() && sub.getSpan(0).toString() == data.substr(70, 30));
+
+    //写时复制，覆盖和clear都不影响已经取出的视图
+    ba->setPosition(60);
+    ba->writeStringWithoutLength(std::string(100, 'x'));
+    HPGS_ASSERT(s.toString() == data.substr(50, 100));
+    HPGS_ASSERT(ba->slice(60, 100).toString() == std::string(100, 'x'));
+    ba->clear();
+    ba->writeStringWithoutLength(std::string(200, 'y'));
+    HPGS_ASSERT(s.toString() == data.substr(50, 100) && sub.toString() == data.substr(70, 30));
+
+    //拼接和写入其他ByteArray
+    HPGS::ByteArray::Slice joined = sub;
+    joined.append(s);
+    HPGS_ASSERT(joined.toString() == data.substr(70, 30) + data.substr(50, 100));
+    HPGS::ByteArray::ptr other(new HPGS::ByteArray(4096));
+    other->writeSlice(joined);
+    other->setPosition(0);
+    HPGS_ASSERT(other->toString() == joined.toString());
+    std::vector<iovec> iovs;
+    HPGS_ASSERT(joined.getBuffers(iovs) == 130);
+
+    //流模式下按帧读取负载，回收的节点写时复制
+    HPGS::ByteArray::ptr stream(new HPGS::ByteArray(64));
+    stream->setStreaming(true);
+    std::vector<HPGS::ByteArray::Slice> frames;
+    for(int i = 0; i < 100; ++i){
+        std::string payload(37 + i, (char)('0' + i % 10));
+        stream->writeFuint32(payload.size());
+        stream->writeStringWithoutLength(payload);
+        uint32_t len = stream->readFuint32();
+        frames.push_back(stream->readSlice(len));
+    }
+    for(int i = 0; i < 100; ++i){
+        HPGS_ASSERT(frames[i].toString() == std::string(37 + i, (char)('0' + i % 10)));
+    }
+
+    //readShared返回引用同一组内存块的ByteArray，可以按基本类型读取
+    std::vector<HPGS::ByteArray::ptr> bodies;
+    for(int i = 0; i < 100; ++i){
+        stream->writeFuint32(4 + 37 + i);
+        stream->writeFuint32(i);
+        stream->writeStringWithoutLength(std::string(37 + i, (char)('a' + i % 26)));
+        bodies.push_back(stream->readShared(stream->readFuint32()));
+    }
+    for(int i = 0; i < 100; ++i){
+        HPGS::ByteArray::ptr body = bodies[i];
+        HPGS_ASSERT(body->getPosition() == 0 && body->getSize() == (size_t)(4 + 37 + i));
+        HPGS_ASSERT(body->readFuint32() == (uint32_t)i);
+        HPGS_ASSERT(body->toString() == std::string(37 + i, (char)('a' + i % 26)));
+        //写入共享的内存块时复制，不影响其他帧
+        body->setPosition(body->getSize());
+        body->writeStringWithoutLength(std::string(100, '#'));
+    }
+    for(int i = 0; i < 100; ++i){
+        bodies[i]->setPosition(4);
+        HPGS_ASSERT(bodies[i]->toString() == std::string(37 + i, (char)('a' + i % 26)) + std::string(100, '#'));
+    }
+
+    //拷贝解析 vs 视图解析
+    HPGS::ByteArray::ptr frame(new HPGS::ByteArray(4096));
+    const int count = 10000;
+    for(int i = 0; i < count; ++i){
+        frame->writeStringF32(std::string(16 * 1024, 'z'));
+    }
+    frame->setPosition(0);
+    uint64_t start = HPGS::GetCurrentUs();
+    for(int i = 0; i < count; ++i){
+        std::string payload = frame->readStringF32();
+    }
+    uint64_t copy_us = HPGS::GetCurrentUs() - start;
+    frame->setPosition(0);
+    start = HPGS::GetCurrentUs();
+    for(int i = 0; i < count; ++i){
+        HPGS::ByteArray::Slice payload = frame->readSlice(frame->readFuint32());
+    }
+    uint64_t slice_us = HPGS::GetCurrentUs() - start;
+    HPGS_LOG_INFO(g_logger) << count << " 16KB payloads readStringF32 " << copy_us
+                            << "us, readSlice " << slice_us << "us";
+}
+
+/**
+ * @brief 原来逐字节的varint解码，作为对比
+ */
+static uint32_t ReadUint32Bytewise(HPGS::ByteArray::ptr ba){
+    uint32_t result = 0;
+    for(int i = 0; i < 32; i += 7){
+        uint8_t v = ba->readFuint8();
+        if(v < 0x80){
+            result |= ((uint32_t)v) << i;
+            break;
+        }
+        result |= (((uint32_t)(v & 0x7F)) << i);
+    }
+    return result;
+}
+
+void test_varint(){
+    const size_t count = 1000000;
+    std::vector<uint32_t> values;
+    std::vector<uint64_t> values64;
+    for(size_t i = 0; i < count; ++i){
+        //1 ~ 5字节的编码长度均匀分布
+        values.push_back((uint32_t)rand() >> (rand() % 32));
+        values64.push_back(((uint64_t)rand() << 32 | rand()) >> (rand() % 64));
+    }
+
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(4096));
+    uint64_t start = HPGS::GetCurrentUs();
+    for(auto v : values){
+        ba->writeUint32(v);
+    }
+    uint64_t write_us = HPGS::GetCurrentUs() - start;
+    size_t size = ba->getSize();
+
+    HPGS::ByteArray::ptr bulk(new HPGS::ByteArray(4096));
+    start = HPGS::GetCurrentUs();
+    bulk->writeUint32Array(&values[0], count);
+    uint64_t write_array_us = HPGS::GetCurrentUs() - start;
+    HPGS_ASSERT(bulk->getSize() == size);
+
+    ba->setPosition(0);
+    start = HPGS::GetCurrentUs();
+    for(size_t i = 0; i < count; ++i){
+        HPGS_ASSERT(ReadUint32Bytewise(ba) == values[i]);
+    }
+    uint64_t bytewise_us = HPGS::GetCurrentUs() - start;
+
+    ba->setPosition(0);
+    start = HPGS::GetCurrentUs();
+    for(size_t i = 0; i < count; ++i){
+        HPGS_ASSERT(ba->readUint32() == values[i]);
+    }
+    uint64_t read_us = HPGS::GetCurrentUs() - start;
+
+    std::vector<uint32_t> out(count);
+    bulk->setPosition(0);
+    start = HPGS::GetCurrentUs();
+    bulk->readUint32Array(&out[0], count);
+    uint64_t read_array_us = HPGS::GetCurrentUs() - start;
+    HPGS_ASSERT(out == values && bulk->getReadSize() == 0);
+
+    HPGS_LOG_INFO(g_logger) << count << " varint32 write " << write_us << "us, writeUint32Array "
+        << write_array_us << "us, bytewise read " << bytewise_us << "us, readUint32 " << read_us
+        << "us, readUint32Array " << read_array_us << "us";
+
+    //64位，包括超过8字节的编码
+    ba->clear();
+    for(auto v : values64){
+        ba->writeUint64(v);
+        ba->writeInt64(-(int64_t)v);
+    }
+    ba->setPosition(0);
+    for(auto v : values64){
+        HPGS_ASSERT(ba->readUint64() == v);
+        HPGS_ASSERT(ba->readInt64() == -(int64_t)v);
+    }
+
+    //数据不足时抛出异常
+    ba->clear();
+    ba->writeUint32Array(&values[0], 10);
+    ba->setPosition(0);
+    bool thrown = false;
+    try{
+        ba->readUint32Array(&out[0], 11);
+    } catch(std::out_of_range& e){
+        thrown = true;
+    }
+    HPGS_ASSERT(thrown);
+}
+
+template<class T>
+static void check_fixed_array(size_t base_size, bool little_endian){
+    std::vector<T> values;
+    for(int i = 0; i < 1000; ++i){
+        values.push_back((T)(rand() * 1.1));
+    }
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(base_size));
+    ba->setIsLittleEndian(little_endian);
+    //先写一个字节，元素跨越节点边界
+    ba->writeFuint8(7);
+    ba->writeFixedArray(&values[0], values.size());
+    HPGS_ASSERT(ba->getSize() == 1 + sizeof(T) * values.size());
+
+    //和逐个写入的编码一致
+    HPGS::ByteArray::ptr ref(new HPGS::ByteArray(base_size));
+    ref->setIsLittleEndian(little_endian);
+    ref->writeFuint8(7);
+    for(auto v : values){
+        T tmp = v;
+        if(sizeof(T) > 1 && ref->isLittleEndian() != (HPGS_BYTE_ORDER == HPGS_LITTLE_ENDIAN)){
+            std::reverse((char*)&tmp, (char*)&tmp + sizeof(T));
+        }
+        ref->write(&tmp, sizeof(T));
+    }
+    ba->setPosition(0);
+    ref->setPosition(0);
+    HPGS_ASSERT(ba->toString() == ref->toString());
+
+    std::vector<T> out(values.size());
+    HPGS_ASSERT(ba->readFuint8() == 7);
+    ba->readFixedArray(&out[0], out.size());
+    HPGS_ASSERT(out == values && ba->getReadSize() == 0);
+}
+
+void test_fixed_array(){
+    size_t base_sizes[] = {1, 3, 7, 64, 4096};
+    for(auto base_size : base_sizes){
+        for(int le = 0; le < 2; ++le){
+            check_fixed_array<int8_t>(base_size, le);
+            check_fixed_array<int16_t>(base_size, le);
+            check_fixed_array<uint32_t>(base_size, le);
+            check_fixed_array<int64_t>(base_size, le);
+            check_fixed_array<float>(base_size, le);
+            check_fixed_array<double>(base_size, le);
+        }
+    }
+
+    //10k个double的指标向量
+    std::vector<double> metrics;
+    for(int i = 0; i < 10000; ++i){
+        metrics.push_back(rand() / 3.0);
+    }
+    std::vector<double> out(metrics.size());
+    const int count = 1000;
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(4096));
+    uint64_t start = HPGS::GetCurrentUs();
+    for(int i = 0; i < count; ++i){
+        ba->clear();
+        for(auto v : metrics){
+            ba->writeDouble(v);
+        }
+        ba->setPosition(0);
+        for(auto& v : out){
+            v = ba->readDouble();
+        }
+    }
+    uint64_t scalar_us = HPGS::GetCurrentUs() - start;
+    HPGS_ASSERT(out == metrics);
+
+    start = HPGS::GetCurrentUs();
+    for(int i = 0; i < count; ++i){
+        ba->clear();
+        ba->writeFixedArray(&metrics[0], metrics.size());
+        ba->setPosition(0);
+        ba->readFixedArray(&out[0], out.size());
+    }
+    uint64_t array_us = HPGS::GetCurrentUs() - start;
+    HPGS_ASSERT(out == metrics);
+    HPGS_LOG_INFO(g_logger) << count << " x 10k doubles write+read: writeDouble/readDouble "
+        << scalar_us << "us, writeFixedArray/readFixedArray " << array_us << "us";
+}
+
+void test_mmap(){
+    const std::string name = "/tmp/test_bytearray_mmap.dat";
+    unlink(name.c_str());
+    const uint32_t count = 3 * 1024 * 1024 + 7;
+    {
+        //可写映射，文件按节点增长
+        HPGS::ByteArray::ptr ba = HPGS::ByteArray::MapFile(name, true, 1024 * 1024);
+        HPGS_ASSERT(ba && ba->isMapped() && ba->getSize() == 0);
+        ba->writeStringWithoutLength("HPGS");
+        for(uint32_t i = 0; i < count; ++i){
+            ba->writeFuint32(i);
+        }
+        HPGS_ASSERT(ba->sync());
+    }
+    struct stat st;
+    HPGS_ASSERT(stat(name.c_str(), &st) == 0 && (size_t)st.st_size == 4 + 4ull * count);
+
+    //追加写入
+    {
+        HPGS::ByteArray::ptr ba = HPGS::ByteArray::MapFile(name, true, 1024 * 1024);
+        ba->setPosition(ba->getSize());
+        ba->writeFuint32(count);
+    }
+
+    //只读映射顺序扫描
+    HPGS::ByteArray::ptr ba = HPGS::ByteArray::MapFile(name, false, 1024 * 1024);
+    HPGS_ASSERT(ba && ba->getSize() == 4 + 4ull * (count + 1));
+    HPGS_ASSERT(ba->advise(MADV_SEQUENTIAL));
+    uint64_t start = HPGS::GetCurrentUs();
+    HPGS::ByteArray::Slice magic = ba->readSlice(4);
+    HPGS_ASSERT(magic.toString() == "HPGS");
+    for(uint32_t i = 0; i <= count; ++i){
+        HPGS_ASSERT(ba->readFuint32() == i);
+    }
+    uint64_t scan_us = HPGS::GetCurrentUs() - start;
+    HPGS_ASSERT(ba->getReadSize() == 0);
+
+    //视图直接指向映射的内存，写入只读映射不会修改文件
+    std::vector<iovec> iovs;
+    ba->getReadBuffers(iovs, 4, 0);
+    HPGS_ASSERT(iovs[0].iov_base == magic.getSpan(0).data);
+    ba->setPosition(0);
+    ba->writeStringWithoutLength("XXXX");
+    HPGS_ASSERT(magic.toString() == "HPGS");
+    ba.reset();
+    HPGS_ASSERT(magic.toString() == "HPGS");
+
+    //映射和readFromFile的对比
+    start = HPGS::GetCurrentUs();
+    HPGS::ByteArray::ptr copy(new HPGS::ByteArray(4096));
+    HPGS_ASSERT(copy->readFromFile(name));
+    copy->setPosition(0);
+    uint64_t read_us = HPGS::GetCurrentUs() - start;
+    start = HPGS::GetCurrentUs();
+    ba = HPGS::ByteArray::MapFile(name);
+    uint64_t map_us = HPGS::GetCurrentUs() - start;
+    HPGS_ASSERT(ba->toString() == copy->toString());
+    HPGS_LOG_INFO(g_logger) << "mmap " << ba->getSize() << " bytes: scan " << scan_us
+        << "us, readFromFile " << read_us << "us, MapFile " << map_us << "us";
+    unlink(name.c_str());
+}
+
 int main(int argc, char* argv[]){
     test();
+    test_pool();
+    test_streaming();
+    test_random_access();
+    test_slice();
+    test_varint();
+    test_fixed_array();
+    test_mmap();
     return 0; 
 }
\ No newline at end of file
@@ -0,0 +1,211 @@
+#include "compress_stream.h"
+#include "util.h"
+#include "log.h"
+#include "macro.h"
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
+
+static const HPGS::Codec::Type s_types[] = {
+    HPGS::Codec::ZLIB, HPGS::Codec::GZIP, HPGS::Codec::ZSTD, HPGS::Codec::LZ4
+};
+
+/**
+ * @brief 内存中的流，写入的数据可以再读出来
+ */
+class MemoryStream : public HPGS::Stream {
+public:
+    typedef std::shared_ptr<MemoryStream> ptr;
+
+    MemoryStream()
+        :m_data(new HPGS::ByteArray(1024))
+        ,m_writeCount(0)
+        ,m_closed(false) {
+        m_data->setStreaming(true);
+    }
+
+    int read(void* buffer, size_t length) override {
+        length = std::min(length, m_data->getReadSize());
+        m_data->read(buffer, length);
+        return length;
+    }
+
+    int read(HPGS::ByteArray::ptr ba, size_t length) override {
+        std::string buf(std::min(length, m_data->getReadSize()), '\0');
+        m_data->read(&buf[0], buf.size());
+        ba->write(buf.c_str(), buf.size());
+        return buf.size();
+    }
+
+    int write(const void* buffer, size_t length) override {
+        ++m_writeCount;
+        m_data->write(buffer, length);
+        return length;
+    }
+
+    int write(HPGS::ByteArray::ptr ba, size_t length) override {
+        std::string buf(length, '\0');
+        ba->read(&buf[0], length);
+        return write(buf.c_str(), length);
+    }
+
+    void close() override { m_closed = true;}
+
+    size_t getWriteCount() const { return m_writeCount;}
+    bool isClosed() const { return m_closed;}
+private:
+    HPGS::ByteArray::ptr m_data;
+    size_t m_writeCount;
+    bool m_closed;
+};
+
+/**
+ * @brief 可压缩的测试数据
+ */
+static std::string make_data(size_t size){
+    std::string data;
+    while(data.size() < size){
+        data += "GET /index.html?id=" + std::to_string(rand() % 1000)
+              + " HTTP/1.1\r\nHost: www.example.com\r\n\r\n";
+    }
+    data.resize(size);
+    return data;
+}
+
+void test_codec(){
+    std::string data = make_data(1024 * 1024);
+    //小节点，压缩的输入和输出都跨很多节点
+    HPGS::ByteArray src(1000);
+    src.write(data.c_str(), data.size());
+    src.setPosition(0);
+
+    for(auto type : s_types){
+        if(!HPGS::Codec::IsSupported(type)){
+            HPGS_ASSERT(!HPGS::Codec::Create(type, true));
+            HPGS_LOG_INFO(g_logger) << "codec type=" << type << " not supported";
+            continue;
+        }
+        uint64_t start = HPGS::GetCurrentUs();
+        HPGS::ByteArray::ptr zipped = HPGS::Codec::Compress(type, src);
+        uint64_t compress_us = HPGS::GetCurrentUs() - start;
+        HPGS_ASSERT(zipped && src.getPosition() == 0);
+
+        start = HPGS::GetCurrentUs();
+        HPGS::ByteArray::ptr unzipped = HPGS::Codec::Decompress(type, *zipped);
+        uint64_t decompress_us = HPGS::GetCurrentUs() - start;
+        HPGS_ASSERT(unzipped && unzipped->toString() == data);
+
+        //截断的数据
+        HPGS::ByteArray half;
+        std::string z = zipped->toString();
+        half.write(z.c_str(), z.size() / 2);
+        half.setPosition(0);
+        HPGS_ASSERT(!HPGS::Codec::Decompress(type, half));
+        //只少结尾几个字节
+        HPGS::ByteArray tail;
+        tail.write(z.c_str(), z.size() - 4);
+        tail.setPosition(0);
+        HPGS_ASSERT(!HPGS::Codec::Decompress(type, tail));
+
+        //损坏的数据
+        HPGS::ByteArray bad;
+        bad.write("not compressed data", 19);
+        bad.setPosition(0);
+        HPGS_ASSERT(!HPGS::Codec::Decompress(type, bad));
+
+        HPGS_LOG_INFO(g_logger) << "codec type=" << type << " " << data.size()
+            << " -> " << zipped->getSize() << " bytes, compress " << compress_us
+            << "us, decompress " << decompress_us << "us";
+    }
+}
+
+void test_chunked(){
+    //压缩器可以分多次输入，解压器可以按任意边界分段输入
+    std::string data = make_data(200 * 1000);
+    for(auto type : s_types){
+        HPGS::Codec::ptr compressor = HPGS::Codec::Create(type, true);
+        if(!compressor){
+            continue;
+        }
+        HPGS::ByteArray zipped;
+        for(size_t i = 0; i < data.size(); i += 7777){
+            size_t n = std::min((size_t)7777, data.size() - i);
+            HPGS_ASSERT(compressor->process(&data[i], n, zipped) == 0);
+        }
+        HPGS_ASSERT(compressor->process(NULL, 0, zipped, HPGS::Codec::FINISH) == 0);
+        zipped.setPosition(0);
+        std::string z = zipped.toString();
+
+        HPGS::Codec::ptr decompressor = HPGS::Codec::Create(type, false);
+        HPGS::ByteArray out;
+        for(size_t i = 0; i < z.size(); i += 13){
+            size_t n = std::min((size_t)13, z.size() - i);
+            HPGS_ASSERT(decompressor->process(&z[i], n, out) == 0);
+        }
+        out.setPosition(0);
+        HPGS_ASSERT(out.toString() == data);
+    }
+}
+
+void test_stream(){
+    for(auto type : s_types){
+        if(!HPGS::Codec::IsSupported(type)){
+            continue;
+        }
+        MemoryStream::ptr mem(new MemoryStream);
+        HPGS::CompressStream::ptr cs(new HPGS::CompressStream(mem, type));
+        HPGS_ASSERT(cs->isValid());
+
+        //flush之后对端可以读到已写入的所有数据
+        HPGS_ASSERT(cs->write("hello ", 6) == 6);
+        HPGS_ASSERT(cs->flush() == 0);
+        char buf[64];
+        HPGS_ASSERT(cs->readFixSize(buf, 6) == 6 && memcmp(buf, "hello ", 6) == 0);
+
+        std::string data = make_data(300 * 1000);
+        HPGS::ByteArray::ptr ba(new HPGS::ByteArray(512));
+        ba->write(data.c_str(), data.size());
+        ba->setPosition(0);
+        HPGS_ASSERT(cs->writeFixSize(ba, data.size()) == (int)data.size());
+        HPGS_ASSERT(ba->getReadSize() == 0);
+        cs->close();
+        HPGS_ASSERT(mem->isClosed());
+
+        HPGS::ByteArray::ptr out(new HPGS::ByteArray);
+        HPGS_ASSERT(cs->readFixSize(out, data.size()) == (int)data.size());
+        HPGS_ASSERT(cs->read(buf, sizeof(buf)) == 0);
+        out->setPosition(0);
+        HPGS_ASSERT(out->toString() == data);
+        HPGS_LOG_INFO(g_logger) << "stream type=" << type << " raw=" << cs->getRawWritten()
+            << " compressed=" << cs->getCompressedWritten() << " writes=" << mem->getWriteCount();
+    }
+}
+
+void test_stream_truncated(){
+    //内部的流在压缩流中间结束，读到的是错误而不是EOF
+    std::string data = make_data(100 * 1000);
+    for(auto type : s_types){
+        if(!HPGS::Codec::IsSupported(type)){
+            continue;
+        }
+        HPGS::ByteArray src;
+        src.write(data.c_str(), data.size());
+        src.setPosition(0);
+        std::string z = HPGS::Codec::Compress(type, src)->toString();
+
+        MemoryStream::ptr mem(new MemoryStream);
+        mem->write(z.c_str(), z.size() / 2);
+        HPGS::CompressStream::ptr cs(new HPGS::CompressStream(mem, type));
+        char buf[4096];
+        int rt = 0;
+        while((rt = cs->read(buf, sizeof(buf))) > 0);
+        HPGS_ASSERT(rt == -1);
+    }
+}
+
+int main(int argc, char* argv[]){
+    test_codec();
+    test_chunked();
+    test_stream();
+    test_stream_truncated();
+    return 0;
+}
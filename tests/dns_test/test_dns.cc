@@ -0,0 +1,243 @@
+#include "dns.h"
+#include "socket.h"
+#include "config.h"
+#include "iomanager.h"
+#include "log.h"
+#include "macro.h"
+#include <string.h>
+#include <arpa/inet.h>
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
+
+static int s_queries = 0;
+
+static void append16(std::string& out, uint16_t v){
+    v = htons(v);
+    out.append((const char*)&v, 2);
+}
+
+static void append32(std::string& out, uint32_t v){
+    v = htonl(v);
+    out.append((const char*)&v, 4);
+}
+
+/**
+ * @brief 测试用的域名服务器的应答
+ *        a.test: A 10.0.0.1 10.0.0.2, AAAA ::1
+ *        cname.test: CNAME a.test, A 10.0.0.1
+ *        none.test: NXDOMAIN, SOA minimum 5
+ *        slow.test: 不应答
+ *        big.test: UDP应答截断(TC)，TCP应答A 10.0.0.9
+ * @return 不应答时返回空
+ */
+static std::string stub_response(const char* buf, int rt, bool tcp){
+    //解析问题中的域名和类型
+    std::string name;
+    size_t pos = 12;
+    while(pos < (size_t)rt && buf[pos]){
+        if(!name.empty()){
+            name.append(1, '.');
+        }
+        name.append(buf + pos + 1, (uint8_t)buf[pos]);
+        pos += (uint8_t)buf[pos] + 1;
+    }
+    size_t qend = pos + 5;
+    uint16_t type = ((uint8_t)buf[pos + 1] << 8) | (uint8_t)buf[pos + 2];
+    if(name == "slow.test"){
+        return "";
+    }
+
+    std::string answers;
+    uint16_t ancount = 0;
+    uint16_t nscount = 0;
+    int rcode = 0;
+    //0xc00c 指向问题中的域名
+    if(name == "cname.test"){
+        append16(answers, 0xc00c);
+        append16(answers, 5);
+        append16(answers, 1);
+        append32(answers, 30);
+        append16(answers, 8);
+        answers.append("\x01" "a" "\x04" "test", 7);
+        answers.append(1, '\0');
+        ++ancount;
+    }
+    if((name == "a.test" || name == "cname.test") && type == 1){
+        for(int i = 1; i <= (name == "a.test" ? 2 : 1); ++i){
+            append16(answers, 0xc00c);
+            append16(answers, 1);
+            append16(answers, 1);
+            append32(answers, 60);
+            append16(answers, 4);
+            answers.append("\x0a\x00\x00", 3);
+            answers.append(1, (char)i);
+            ++ancount;
+        }
+    } else if(name == "a.test" && type == 28){
+        append16(answers, 0xc00c);
+        append16(answers, 28);
+        append16(answers, 1);
+        append32(answers, 60);
+        append16(answers, 16);
+        answers.append(15, '\0');
+        answers.append(1, '\x01');
+        ++ancount;
+    } else if(name == "big.test" && type == 1 && tcp){
+        append16(answers, 0xc00c);
+        append16(answers, 1);
+        append16(answers, 1);
+        append32(answers, 60);
+        append16(answers, 4);
+        answers.append("\x0a\x00\x00\x09", 4);
+        ++ancount;
+    } else if(name == "none.test"){
+        rcode = 3;
+        std::string rdata;
+        rdata.append("\x02" "ns" "\xc0\x0c", 5);
+        rdata.append("\x04" "root" "\xc0\x0c", 7);
+        append32(rdata, 1);
+        append32(rdata, 3600);
+        append32(rdata, 600);
+        append32(rdata, 86400);
+        append32(rdata, 5);
+        append16(answers, 0xc00c);
+        append16(answers, 6);
+        append16(answers, 1);
+        append32(answers, 60);
+        append16(answers, rdata.size());
+        answers += rdata;
+        ++nscount;
+    }
+
+    uint16_t flags = 0x8180 | rcode;
+    if(name == "big.test" && !tcp){
+        flags |= 0x0200;
+    }
+    std::string rsp(buf, 2);
+    append16(rsp, flags);
+    append16(rsp, 1);
+    append16(rsp, ancount);
+    append16(rsp, nscount);
+    append16(rsp, 0);
+    rsp.append(buf + 12, qend - 12);
+    rsp += answers;
+    return rsp;
+}
+
+static void stub_server(HPGS::Socket::ptr sock){
+    char buf[512];
+    HPGS::Address::ptr from(new HPGS::IPv4Address);
+    int rt = 0;
+    while((rt = sock->recvFrom(buf, sizeof(buf), from)) > 12){
+        ++s_queries;
+        std::string rsp = stub_response(buf, rt, false);
+        if(!rsp.empty()){
+            sock->sendTo(rsp.c_str(), rsp.size(), from);
+        }
+    }
+}
+
+static int s_tcp_queries = 0;
+
+/**
+ * @brief TCP上的域名服务器，报文前是两字节长度
+ */
+static void stub_tcp_server(HPGS::Socket::ptr sock){
+    HPGS::Socket::ptr client;
+    while((client = sock->accept())){
+        char buf[512];
+        uint16_t len = 0;
+        while(client->recv(&len, 2, MSG_WAITALL) == 2){
+            len = ntohs(len);
+            if(len > sizeof(buf) || client->recv(buf, len, MSG_WAITALL) != len){
+                break;
+            }
+            ++s_tcp_queries;
+            std::string rsp = stub_response(buf, len, true);
+            if(rsp.empty()){
+                continue;
+            }
+            std::string out;
+            append16(out, rsp.size());
+            out += rsp;
+            client->send(out.c_str(), out.size());
+        }
+        client->close();
+    }
+}
+
+void test_resolver(){
+    HPGS::Config::Lookup<uint64_t>("dns.timeout")->setValue(100);
+    HPGS::Config::Lookup<uint32_t>("dns.attempts")->setValue(1);
+
+    auto addr = HPGS::Address::LookupAnyIPAddress("127.0.0.1:0");
+    HPGS::Socket::ptr server = HPGS::Socket::CreateUdp(addr);
+    HPGS_ASSERT(server->bind(addr));
+    HPGS::IOManager::GetThis()->schedule(std::bind(stub_server, server));
+
+    //同一端口上的TCP服务
+    HPGS::Socket::ptr tcp_server = HPGS::Socket::CreateTcp(addr);
+    HPGS_ASSERT(tcp_server->bind(server->getLocalAddress()) && tcp_server->listen());
+    HPGS::IOManager::GetThis()->schedule(std::bind(stub_tcp_server, tcp_server));
+
+    HPGS::DnsResolver resolver;
+    resolver.setServers({server->getLocalAddress()});
+
+    //A和AAAA同时查询
+    std::vector<HPGS::Address::ptr> result;
+    HPGS_ASSERT(resolver.lookup(result, "a.test:80", AF_UNSPEC));
+    HPGS_ASSERT(result.size() == 3 && s_queries == 2);
+    for(auto& i : result){
+        HPGS_LOG_INFO(g_logger) << "a.test -> " << *i;
+    }
+    HPGS_ASSERT(result[0]->toString() == "10.0.0.1:80");
+
+    //命中缓存，不再查询
+    result.clear();
+    HPGS_ASSERT(resolver.lookup(result, "A.Test."));
+    HPGS_ASSERT(result.size() == 2 && s_queries == 2 && resolver.getCacheHitCount() == 1);
+
+    //CNAME
+    HPGS::IPAddress::ptr ip = resolver.lookupAny("cname.test");
+    HPGS_ASSERT(ip && ip->toString() == "10.0.0.1:0");
+
+    //否定缓存
+    HPGS_ASSERT(!resolver.lookupAny("none.test"));
+    int queries = s_queries;
+    HPGS_ASSERT(!resolver.lookupAny("none.test"));
+    HPGS_ASSERT(s_queries == queries && resolver.getNegativeHitCount() == 1);
+
+    //超时不缓存
+    HPGS_ASSERT(!resolver.lookupAny("slow.test"));
+    HPGS_ASSERT(resolver.getFailCount() == 1);
+
+    //UDP应答截断，改用TCP
+    ip = resolver.lookupAny("big.test");
+    HPGS_ASSERT(ip && ip->toString() == "10.0.0.9:0" && s_tcp_queries == 1);
+
+    //IP字面量不查询
+    queries = s_queries;
+    ip = resolver.lookupAny("127.0.0.1:8080");
+    HPGS_ASSERT(ip && ip->getPort() == 8080 && s_queries == queries);
+
+    HPGS_LOG_INFO(g_logger) << "queries=" << resolver.getQueryCount()
+        << " cache_size=" << resolver.getCacheSize();
+    server->close();
+    tcp_server->close();
+}
+
+void test_system(){
+    std::vector<HPGS::Address::ptr> result;
+    if(HPGS::DnsResolverMgr::GetInstance()->lookup(result, "www.baidu.com:80", AF_UNSPEC)){
+        for(auto& i : result){
+            HPGS_LOG_INFO(g_logger) << *i;
+        }
+    }
+}
+
+int main(int argc, char* argv[]){
+    HPGS::IOManager iom;
+    iom.schedule(test_resolver);
+    //iom.schedule(test_system);
+    return 0;
+}
@@ -1,11 +1,18 @@
 #include "hook.h"
 #include "log.h"
 #include "iomanager.h"
+#include "macro.h"
+#include "util.h"
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "fd_manager.h"
 
 
 HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
@@ -63,8 +70,123 @@ void test_sock(){
     HPGS_LOG_INFO(g_logger) << buff;
 }
 
+void test_pipe_poll(){
+    HPGS::IOManager iom(2);
+    iom.schedule([](){
+        int fds[2];
+        int rt = pipe(fds);
+        HPGS_ASSERT(rt == 0);
+        int efd = eventfd(0, 0);
+        HPGS_ASSERT(efd >= 0);
+
+        HPGS::IOManager::GetThis()->schedule([fds, efd](){
+            sleep(1);
+            HPGS_LOG_INFO(g_logger) << "write pipe";
+            HPGS_ASSERT(write(fds[1], "x", 1) == 1);
+            sleep(1);
+            uint64_t v = 1;
+            HPGS_LOG_INFO(g_logger) << "write eventfd";
+            HPGS_ASSERT(write(efd, &v, sizeof(v)) == sizeof(v));
+        });
+
+        //poll只挂起当前协程，写协程仍然可以执行
+        pollfd pfd;
+        pfd.fd = fds[0];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        rt = poll(&pfd, 1, 100);
+        HPGS_LOG_INFO(g_logger) << "poll timeout rt = " << rt;
+        HPGS_ASSERT(rt == 0);
+
+        uint64_t now = HPGS::GetCurrentMs();
+        rt = poll(&pfd, 1, 5000);
+        HPGS_LOG_INFO(g_logger) << "poll rt = " << rt << " revents = " << pfd.revents
+                                << " used = " << HPGS::GetCurrentMs() - now << "ms";
+        HPGS_ASSERT(rt == 1 && (pfd.revents & POLLIN));
+
+        char c;
+        HPGS_ASSERT(read(fds[0], &c, 1) == 1);
+
+        //eventfd上的read挂起协程直到计数器非0
+        uint64_t v = 0;
+        HPGS_ASSERT(read(efd, &v, sizeof(v)) == sizeof(v));
+        HPGS_LOG_INFO(g_logger) << "eventfd read v = " << v;
+        HPGS_ASSERT(v == 1);
+
+        close(fds[0]);
+        close(fds[1]);
+        close(efd);
+    });
+}
+
+void test_fifo_open(){
+    HPGS::IOManager iom(1);
+    iom.schedule([](){
+        char path[] = "/tmp/hpgs_fifo_XXXXXX";
+        int tmp = mkstemp(path);
+        HPGS_ASSERT(tmp >= 0);
+        close(tmp);
+        unlink(path);
+        HPGS_ASSERT(mkfifo(path, 0600) == 0);
+
+        //open打开的FIFO不登记，保持阻塞
+        int fd = open(path, O_RDWR);
+        HPGS_ASSERT(fd >= 0);
+        HPGS_ASSERT(!HPGS::fdMgr::GetInstance()->get(fd));
+        HPGS_ASSERT(!(fcntl(fd, F_GETFL) & O_NONBLOCK));
+        HPGS_ASSERT(write(fd, "x", 1) == 1);
+        char c;
+        HPGS_ASSERT(read(fd, &c, 1) == 1 && c == 'x');
+        close(fd);
+        unlink(path);
+
+        //hook的pipe是系统非阻塞的
+        int fds[2];
+        HPGS_ASSERT(pipe(fds) == 0);
+        HPGS_ASSERT(fcntl_f(fds[0], F_GETFL) & O_NONBLOCK);
+        HPGS_ASSERT(!(fcntl(fds[0], F_GETFL) & O_NONBLOCK));
+        close(fds[0]);
+        close(fds[1]);
+    });
+}
+
+void test_deadline(){
+    HPGS::IOManager iom(1);
+    iom.schedule([](){
+        int fds[2];
+        int rt = pipe(fds);
+        HPGS_ASSERT(rt == 0);
+
+        //整个请求200ms的截止时间，多次调用共享剩余时间
+        HPGS::FibreDeadline deadline(200);
+        uint64_t now = HPGS::GetCurrentMs();
+        rt = usleep(100 * 1000);
+        HPGS_LOG_INFO(g_logger) << "usleep rt = " << rt << " used = " << HPGS::GetCurrentMs() - now << "ms";
+        HPGS_ASSERT(rt == 0);
+
+        char c;
+        rt = read(fds[0], &c, 1);
+        uint64_t used = HPGS::GetCurrentMs() - now;
+        HPGS_LOG_INFO(g_logger) << "read rt = " << rt << " errno = " << errno << " used = " << used << "ms";
+        HPGS_ASSERT(rt == -1 && errno == ETIMEDOUT);
+        HPGS_ASSERT(used < 500);
+
+        //截止时间已过，不再等待
+        rt = read(fds[0], &c, 1);
+        HPGS_ASSERT(rt == -1 && errno == ETIMEDOUT);
+        rt = usleep(100 * 1000);
+        HPGS_ASSERT(rt == -1 && errno == ETIMEDOUT);
+
+        close(fds[0]);
+        close(fds[1]);
+    });
+}
+
 int main(int argc, char* argv[]){
     //test_sleep();
+    test_pipe_poll();
+    test_fifo_open();
+    test_deadline();
 
     HPGS::IOManager iom;
     iom.schedule(test_sock);
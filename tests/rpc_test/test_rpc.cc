@@ -0,0 +1,199 @@
+#include "rpc.h"
+#include "iomanager.h"
+#include "util.h"
+#include "log.h"
+#include "macro.h"
+#include <unistd.h>
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
+
+void test_frame(){
+    //小节点，帧跨节点
+    HPGS::ByteArray stream(64);
+    stream.setStreaming(true);
+    std::string encoded;
+    {
+        HPGS::ByteArray out(64);
+        for(uint32_t i = 0; i < 100; ++i){
+            HPGS::Frame frame(i, i % 2 ? HPGS::Frame::RESPONSE : 0);
+            frame.getBody()->writeStringVint(std::string(i * 3, 'a' + i % 26));
+            frame.getBody()->setPosition(0);
+            HPGS::FrameCodec::Encode(out, frame);
+            HPGS_ASSERT(frame.getBody()->getPosition() == 0);
+        }
+        out.setPosition(0);
+        encoded = out.toString();
+    }
+
+    //逐字节输入，数据不完整时不取走
+    uint32_t next = 0;
+    for(size_t i = 0; i < encoded.size(); ++i){
+        stream.write(&encoded[i], 1);
+        HPGS::Frame::ptr frame;
+        int rt = HPGS::FrameCodec::Decode(stream, frame);
+        HPGS_ASSERT(rt >= 0);
+        if(rt == 1){
+            HPGS_ASSERT(frame->getId() == next);
+            HPGS_ASSERT(frame->hasFlag(HPGS::Frame::RESPONSE) == (next % 2 == 1));
+            HPGS_ASSERT(frame->getBody()->readStringVint() == std::string(next * 3, 'a' + next % 26));
+            ++next;
+        }
+    }
+    HPGS_ASSERT(next == 100 && stream.getReadSize() == 0);
+
+    //魔数错误
+    stream.write("XX\x01\x00\x00\x00\x00\x01\x00\x00\x00\x00", HPGS::Frame::HEADER_SIZE);
+    HPGS::Frame::ptr frame;
+    HPGS_ASSERT(HPGS::FrameCodec::Decode(stream, frame) == -1);
+}
+
+static HPGS::ByteArray::ptr make_request(const std::string& data){
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray);
+    ba->write(data.c_str(), data.size());
+    ba->setPosition(0);
+    return ba;
+}
+
+static HPGS::RpcServer::ptr start_server(){
+    HPGS::RpcServer::ptr server(new HPGS::RpcServer);
+    server->addMethod("echo", [](HPGS::ByteArray::ptr req, HPGS::ByteArray::ptr rsp){
+        std::vector<iovec> iovs;
+        req->getReadBuffers(iovs);
+        for(auto& i : iovs){
+            rsp->write(i.iov_base, i.iov_len);
+        }
+        return 0;
+    });
+    server->addMethod("add", [](HPGS::ByteArray::ptr req, HPGS::ByteArray::ptr rsp){
+        int32_t a = req->readInt32();
+        int32_t b = req->readInt32();
+        rsp->writeInt32(a + b);
+        return 0;
+    });
+    server->addMethod("fail", [](HPGS::ByteArray::ptr req, HPGS::ByteArray::ptr rsp){
+        rsp->writeStringVint("bad argument");
+        return 7;
+    });
+    server->addMethod("sleep", [](HPGS::ByteArray::ptr req, HPGS::ByteArray::ptr rsp){
+        usleep(req->readUint32() * 1000);
+        return 0;
+    });
+    HPGS::Address::ptr addr = HPGS::Address::LookupAny("127.0.0.1:0");
+    HPGS_ASSERT(server->bind(addr));
+    server->start();
+    return server;
+}
+
+static HPGS::Address::ptr server_address(HPGS::RpcServer::ptr server){
+    return server->getSocks()[0]->getLocalAddress();
+}
+
+void test_call(HPGS::RpcServer::ptr server){
+    HPGS::RpcClient::ptr client(new HPGS::RpcClient);
+    HPGS_ASSERT(client->connect(server_address(server)));
+
+    HPGS::ByteArray::ptr rsp;
+    HPGS_ASSERT(client->call("echo", make_request("hello"), rsp) == HPGS::RPC_OK);
+    HPGS_ASSERT(rsp->toString() == "hello");
+
+    HPGS::ByteArray::ptr req(new HPGS::ByteArray);
+    req->writeInt32(-40);
+    req->writeInt32(42);
+    req->setPosition(0);
+    HPGS_ASSERT(client->call("add", req, rsp) == HPGS::RPC_OK);
+    HPGS_ASSERT(rsp->readInt32() == 2);
+
+    HPGS_ASSERT(client->call("fail", nullptr, rsp) == 7);
+    HPGS_ASSERT(rsp->readStringVint() == "bad argument");
+    HPGS_ASSERT(client->call("nothing", nullptr, rsp) == HPGS::RPC_NOT_FOUND);
+
+    //慢请求超时，不影响同一连接上之后的请求
+    req.reset(new HPGS::ByteArray);
+    req->writeUint32(200);
+    req->setPosition(0);
+    HPGS_ASSERT(client->call("sleep", req, rsp, 50) == HPGS::RPC_TIMEOUT);
+    HPGS_ASSERT(client->call("echo", make_request("after timeout"), rsp, 1000) == HPGS::RPC_OK);
+    HPGS_ASSERT(rsp->toString() == "after timeout");
+
+    //慢请求在前，快请求先返回
+    req->setPosition(0);
+    //信号量由协程共同持有，notify返回前等待方可能已经醒来
+    std::shared_ptr<HPGS::FibreSemaphore> done(new HPGS::FibreSemaphore);
+    uint64_t slow_done = 0;
+    HPGS::IOManager::GetThis()->schedule([client, req, done, &slow_done](){
+        HPGS::ByteArray::ptr rsp;
+        HPGS_ASSERT(client->call("sleep", req, rsp) == HPGS::RPC_OK);
+        slow_done = HPGS::GetCurrentMs();
+        done->notify();
+    });
+    usleep(20 * 1000);
+    HPGS_ASSERT(client->call("echo", make_request("fast"), rsp) == HPGS::RPC_OK);
+    uint64_t fast_done = HPGS::GetCurrentMs();
+    done->wait();
+    HPGS_ASSERT(fast_done < slow_done);
+
+    client->close();
+    HPGS_ASSERT(client->call("echo", make_request("closed"), rsp) == HPGS::RPC_CLOSED);
+
+    //接收协程不持有客户端，释放最后一个引用即析构
+    client.reset(new HPGS::RpcClient);
+    HPGS_ASSERT(client->connect(server_address(server)));
+    HPGS_ASSERT(client->call("echo", make_request("drop"), rsp) == HPGS::RPC_OK);
+    std::weak_ptr<HPGS::RpcClient> weak_client(client);
+    client.reset();
+    HPGS_ASSERT(weak_client.expired());
+}
+
+void test_benchmark(HPGS::RpcServer::ptr server){
+    HPGS::RpcClient::ptr client(new HPGS::RpcClient);
+    HPGS_ASSERT(client->connect(server_address(server)));
+    std::string payload(64, 'x');
+    const int total = 100000;
+
+    //每次只有一个请求在途
+    uint64_t start = HPGS::GetCurrentUs();
+    for(int i = 0; i < total / 10; ++i){
+        HPGS::ByteArray::ptr rsp;
+        HPGS_ASSERT(client->call("echo", make_request(payload), rsp) == HPGS::RPC_OK);
+    }
+    uint64_t serial_us = HPGS::GetCurrentUs() - start;
+
+    //多个协程共用一条连接，请求流水线发出
+    const int fibres = 100;
+    std::shared_ptr<HPGS::FibreSemaphore> done(new HPGS::FibreSemaphore);
+    start = HPGS::GetCurrentUs();
+    for(int f = 0; f < fibres; ++f){
+        HPGS::IOManager::GetThis()->schedule([client, payload, done](){
+            for(int i = 0; i < total / fibres; ++i){
+                HPGS::ByteArray::ptr rsp;
+                HPGS_ASSERT(client->call("echo", make_request(payload), rsp) == HPGS::RPC_OK);
+                HPGS_ASSERT(rsp->getSize() == payload.size());
+            }
+            done->notify();
+        });
+    }
+    for(int f = 0; f < fibres; ++f){
+        done->wait();
+    }
+    uint64_t pipeline_us = HPGS::GetCurrentUs() - start;
+    client->close();
+
+    HPGS_LOG_INFO(g_logger) << "serial: " << total / 10 << " calls " << serial_us << "us, "
+        << (total / 10) * 1000000ull / serial_us << " qps";
+    HPGS_LOG_INFO(g_logger) << "pipelined(" << fibres << " fibres, 1 connection): " << total
+        << " calls " << pipeline_us << "us, " << total * 1000000ull / pipeline_us << " qps";
+}
+
+void run(){
+    test_frame();
+    HPGS::RpcServer::ptr server = start_server();
+    test_call(server);
+    test_benchmark(server);
+    server->stop();
+}
+
+int main(int argc, char* argv[]){
+    HPGS::IOManager iom(2);
+    iom.schedule(run);
+    return 0;
+}
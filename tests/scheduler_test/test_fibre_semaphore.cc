@@ -0,0 +1,80 @@
+#include "scheduler.h"
+#include "mutex.h"
+#include "log.h"
+#include "macro.h"
+#include <atomic>
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
+
+//多个线程上的协程交替notify/wait，等待方切出和notify同时发生
+
+static const int s_threads = 8;
+static const int s_pairs = 8;
+static const int s_rounds = 20000;
+
+struct PingPong {
+    HPGS::FibreSemaphore ping;
+    HPGS::FibreSemaphore pong;
+};
+
+static PingPong s_pingpong[s_pairs];
+static HPGS::FibreSemaphore s_counter;
+static std::atomic<uint64_t> s_pinged{0};
+static std::atomic<uint64_t> s_consumed{0};
+
+void ping(PingPong* pp){
+    for(int i = 0; i < s_rounds; ++i){
+        pp->ping.notify();
+        pp->pong.wait();
+    }
+}
+
+void pong(PingPong* pp){
+    for(int i = 0; i < s_rounds; ++i){
+        pp->ping.wait();
+        ++s_pinged;
+        pp->pong.notify();
+    }
+}
+
+//多个生产者对一个消费者
+void produce(){
+    for(int i = 0; i < s_rounds; ++i){
+        s_counter.notify();
+        if(i % 64 == 0){
+            HPGS::Fibre::YieldToReady();
+        }
+    }
+}
+
+void consume(){
+    for(int i = 0; i < s_rounds * s_threads; ++i){
+        s_counter.wait();
+        ++s_consumed;
+    }
+}
+
+int main(int argc, char* argv[]){
+    HPGS::Scheduler sc(s_threads, false, "fibre_semaphore");
+    sc.start();
+    for(int i = 0; i < s_pairs; ++i){
+        sc.schedule(std::bind(&ping, &s_pingpong[i]));
+        sc.schedule(std::bind(&pong, &s_pingpong[i]));
+    }
+    sc.schedule(&consume);
+    for(int i = 0; i < s_threads; ++i){
+        sc.schedule(&produce);
+    }
+    sc.stop();
+
+    HPGS_ASSERT(s_pinged == (uint64_t)s_pairs * s_rounds);
+    HPGS_ASSERT(s_consumed == (uint64_t)s_threads * s_rounds);
+    for(int i = 0; i < s_pairs; ++i){
+        HPGS_ASSERT(s_pingpong[i].ping.getConcurrency() == 0);
+        HPGS_ASSERT(s_pingpong[i].pong.getConcurrency() == 0);
+    }
+    HPGS_ASSERT(s_counter.getConcurrency() == 0);
+    HPGS_LOG_INFO(g_logger) << "fibre_semaphore over pinged=" << s_pinged
+        << " consumed=" << s_consumed;
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "scheduler.h"
+#include "fibre.h"
+#include "mutex.h"
+#include "log.h"
+#include "macro.h"
+#include <vector>
+#include <atomic>
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
+
+//协程在YieldToHold切出前就被其他线程放回调度器，不能在两个线程上同时执行
+
+static const int s_fibres = 16;
+static const int s_rounds = 20000;
+
+static HPGS::Spinlock s_mutex;
+static std::vector<HPGS::Fibre::ptr> s_parked;
+static int s_active = s_fibres;
+static std::atomic<uint64_t> s_total{0};
+
+void ping_pong(){
+    HPGS::Fibre::ptr self = HPGS::Fibre::GetThis();
+    for(int i = 0; i < s_rounds; ++i){
+        HPGS::Fibre::ptr next;
+        {
+            HPGS::Spinlock::Lock lock(s_mutex);
+            if(s_active == 1){
+                //只剩自己，没有协程能唤醒它
+                ++s_total;
+                continue;
+            }
+            if(!s_parked.empty()){
+                next = s_parked.back();
+                s_parked.pop_back();
+            }
+            s_parked.push_back(self);
+        }
+        //挂起之前唤醒其他协程，自己随时可能被别的线程取走
+        if(next){
+            HPGS::Scheduler::GetThis()->schedule(next);
+        }
+        HPGS::Fibre::YieldToHold();
+        HPGS_ASSERT(HPGS::Fibre::GetThis() == self);
+        HPGS_ASSERT(self->getState() == HPGS::Fibre::EXEC);
+        ++s_total;
+    }
+
+    std::vector<HPGS::Fibre::ptr> parked;
+    {
+        HPGS::Spinlock::Lock lock(s_mutex);
+        --s_active;
+        parked.swap(s_parked);
+    }
+    HPGS::Scheduler::GetThis()->schedule(parked.begin(), parked.end());
+}
+
+int main(int argc, char* argv[]){
+    HPGS::Scheduler sc(4, false, "yield_hold");
+    sc.start();
+    for(int i = 0; i < s_fibres; ++i){
+        sc.schedule(&ping_pong);
+    }
+    sc.stop();
+    HPGS_ASSERT(s_total == (uint64_t)s_fibres * s_rounds);
+    HPGS_LOG_INFO(g_logger) << "yield_hold over total=" << s_total;
+    return 0;
+}
@@ -0,0 +1,296 @@
+#include "serialize.h"
+#include "util.h"
+#include "log.h"
+#include "macro.h"
+
+static HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
+
+namespace test {
+
+enum Status {
+    OK = 0,
+    DOWN = -1
+};
+
+struct Point {
+    int32_t x = 0;
+    int32_t y = 0;
+};
+HPGS_SERIALIZE(Point, x, y)
+
+static bool operator==(const Point& a, const Point& b){
+    return a.x == b.x && a.y == b.y;
+}
+
+struct Message {
+    uint32_t id = 0;
+    int64_t timestamp = 0;
+    Status status = OK;
+    bool alive = false;
+    std::string name;
+    Point pos;
+    std::vector<double> metrics;
+    std::vector<uint32_t> counters;
+    std::vector<Point> path;
+    std::map<std::string, int32_t> tags;
+    std::unordered_map<uint64_t, std::list<std::string> > groups;
+    std::set<int16_t> flags;
+};
+HPGS_SERIALIZE(Message, id, timestamp, status, alive, name, pos, metrics
+               ,counters, path, tags, groups, flags)
+
+/**
+ * @brief 同一个结构体的两个版本，V2在末尾追加了字段
+ */
+struct UserV1 {
+    uint64_t uid = 0;
+    std::string nick;
+};
+HPGS_SERIALIZE_VERSIONED(UserV1, uid, nick)
+
+struct UserV2 {
+    uint64_t uid = 0;
+    std::string nick;
+    int32_t level = 1;
+    std::vector<std::string> roles;
+};
+HPGS_SERIALIZE_VERSIONED(UserV2, uid, nick, level, roles)
+
+struct Room {
+    std::vector<UserV1> users;
+    uint32_t tail = 0;
+};
+HPGS_SERIALIZE(Room, users, tail)
+
+struct RoomV2 {
+    std::vector<UserV2> users;
+    uint32_t tail = 0;
+};
+HPGS_SERIALIZE(RoomV2, users, tail)
+
+}
+
+static test::Message make_message(int i){
+    test::Message msg;
+    msg.id = i;
+    msg.timestamp = -1000000007ll * i;
+    msg.status = i % 2 ? test::DOWN : test::OK;
+    msg.alive = i % 3;
+    msg.name = "message-" + std::to_string(i);
+    msg.pos.x = -i;
+    msg.pos.y = i * 7;
+    for(int j = 0; j < 64; ++j){
+        msg.metrics.push_back(j * 0.5 + i);
+        msg.counters.push_back(j * 1000 + i);
+    }
+    for(int j = 0; j < 4; ++j){
+        test::Point p;
+        p.x = j;
+        p.y = -j;
+        msg.path.push_back(p);
+        msg.tags["tag" + std::to_string(j)] = j - i;
+    }
+    msg.groups[i].push_back("a");
+    msg.groups[i].push_back("b");
+    msg.flags.insert(-1);
+    msg.flags.insert(i % 100);
+    return msg;
+}
+
+static bool equal(const test::Message& a, const test::Message& b){
+    return a.id == b.id && a.timestamp == b.timestamp && a.status == b.status
+        && a.alive == b.alive && a.name == b.name && a.pos == b.pos
+        && a.metrics == b.metrics && a.counters == b.counters && a.path == b.path
+        && a.tags == b.tags && a.groups == b.groups && a.flags == b.flags;
+}
+
+/**
+ * @brief 手写的编码，和HPGS_SERIALIZE(Message)的格式相同
+ */
+static void manual_write(HPGS::ByteArray& ba, const test::Message& msg){
+    ba.writeUint32(msg.id);
+    ba.writeInt64(msg.timestamp);
+    ba.writeInt64(msg.status);
+    ba.writeFuint8(msg.alive);
+    ba.writeStringVint(msg.name);
+    ba.writeInt32(msg.pos.x);
+    ba.writeInt32(msg.pos.y);
+    ba.writeUint64(msg.metrics.size());
+    for(auto& i : msg.metrics){
+        ba.writeDouble(i);
+    }
+    ba.writeUint64(msg.counters.size());
+    for(auto& i : msg.counters){
+        ba.writeUint32(i);
+    }
+    ba.writeUint64(msg.path.size());
+    for(auto& i : msg.path){
+        ba.writeInt32(i.x);
+        ba.writeInt32(i.y);
+    }
+    ba.writeUint64(msg.tags.size());
+    for(auto& i : msg.tags){
+        ba.writeStringVint(i.first);
+        ba.writeInt32(i.second);
+    }
+    ba.writeUint64(msg.groups.size());
+    for(auto& i : msg.groups){
+        ba.writeUint64(i.first);
+        ba.writeUint64(i.second.size());
+        for(auto& n : i.second){
+            ba.writeStringVint(n);
+        }
+    }
+    ba.writeUint64(msg.flags.size());
+    for(auto& i : msg.flags){
+        ba.writeFint16(i);
+    }
+}
+
+static void manual_read(HPGS::ByteArray& ba, test::Message& msg){
+    msg.id = ba.readUint32();
+    msg.timestamp = ba.readInt64();
+    msg.status = (test::Status)ba.readInt64();
+    msg.alive = ba.readFuint8();
+    msg.name = ba.readStringVint();
+    msg.pos.x = ba.readInt32();
+    msg.pos.y = ba.readInt32();
+    msg.metrics.resize(ba.readUint64());
+    for(auto& i : msg.metrics){
+        i = ba.readDouble();
+    }
+    msg.counters.resize(ba.readUint64());
+    for(auto& i : msg.counters){
+        i = ba.readUint32();
+    }
+    msg.path.resize(ba.readUint64());
+    for(auto& i : msg.path){
+        i.x = ba.readInt32();
+        i.y = ba.readInt32();
+    }
+    msg.tags.clear();
+    for(uint64_t n = ba.readUint64(); n > 0; --n){
+        std::string key = ba.readStringVint();
+        msg.tags[key] = ba.readInt32();
+    }
+    msg.groups.clear();
+    for(uint64_t n = ba.readUint64(); n > 0; --n){
+        std::list<std::string>& names = msg.groups[ba.readUint64()];
+        for(uint64_t m = ba.readUint64(); m > 0; --m){
+            names.push_back(ba.readStringVint());
+        }
+    }
+    msg.flags.clear();
+    for(uint64_t n = ba.readUint64(); n > 0; --n){
+        msg.flags.insert(ba.readFint16());
+    }
+}
+
+void test_roundtrip(){
+    test::Message msg = make_message(42);
+    HPGS::ByteArray ba;
+    HPGS::Serialize(ba, msg);
+    HPGS_ASSERT(ba.getSize() == HPGS::SerializedSize(msg));
+
+    //和手写的编码逐字节相同
+    HPGS::ByteArray manual;
+    manual_write(manual, msg);
+    ba.setPosition(0);
+    manual.setPosition(0);
+    HPGS_ASSERT(ba.toString() == manual.toString());
+
+    test::Message out;
+    HPGS::Deserialize(ba, out);
+    HPGS_ASSERT(equal(msg, out) && ba.getReadSize() == 0);
+
+    //数据不完整
+    HPGS::ByteArray half;
+    half.write(manual.toString().c_str(), manual.getSize() / 2);
+    half.setPosition(0);
+    bool thrown = false;
+    try{
+        HPGS::Deserialize(half, out);
+    } catch(std::out_of_range& e){
+        thrown = true;
+    }
+    HPGS_ASSERT(thrown);
+}
+
+void test_versioned(){
+    test::Room room;
+    test::UserV1 u1;
+    u1.uid = 1;
+    u1.nick = "old";
+    room.users.push_back(u1);
+    room.users.push_back(u1);
+    room.tail = 99;
+
+    //新版本读旧数据，追加的字段保持默认值
+    HPGS::ByteArray ba;
+    HPGS::Serialize(ba, room);
+    HPGS_ASSERT(ba.getSize() == HPGS::SerializedSize(room));
+    ba.setPosition(0);
+    test::RoomV2 room2;
+    HPGS::Deserialize(ba, room2);
+    HPGS_ASSERT(room2.users.size() == 2 && room2.users[1].nick == "old"
+                && room2.users[1].level == 1 && room2.users[1].roles.empty() && room2.tail == 99);
+
+    //旧版本读新数据，跳过不认识的字段
+    room2.users[0].level = 5;
+    room2.users[0].roles.push_back("admin");
+    room2.tail = 100;
+    ba.clear();
+    HPGS::Serialize(ba, room2);
+    ba.setPosition(0);
+    HPGS::Deserialize(ba, room);
+    HPGS_ASSERT(room.users.size() == 2 && room.users[0].uid == 1 && room.tail == 100);
+    HPGS_ASSERT(ba.getReadSize() == 0);
+}
+
+void test_benchmark(){
+    std::vector<test::Message> msgs;
+    for(int i = 0; i < 1000; ++i){
+        msgs.push_back(make_message(i));
+    }
+    const int rounds = 100;
+    HPGS::ByteArray ba;
+    test::Message out;
+
+    uint64_t start = HPGS::GetCurrentUs();
+    for(int r = 0; r < rounds; ++r){
+        ba.clear();
+        for(auto& i : msgs){
+            manual_write(ba, i);
+        }
+        ba.setPosition(0);
+        for(size_t i = 0; i < msgs.size(); ++i){
+            manual_read(ba, out);
+        }
+    }
+    uint64_t manual_us = HPGS::GetCurrentUs() - start;
+    HPGS_ASSERT(equal(out, msgs.back()));
+
+    start = HPGS::GetCurrentUs();
+    for(int r = 0; r < rounds; ++r){
+        ba.clear();
+        for(auto& i : msgs){
+            HPGS::Serialize(ba, i);
+        }
+        ba.setPosition(0);
+        for(size_t i = 0; i < msgs.size(); ++i){
+            HPGS::Deserialize(ba, out);
+        }
+    }
+    uint64_t reflect_us = HPGS::GetCurrentUs() - start;
+    HPGS_ASSERT(equal(out, msgs.back()));
+
+    HPGS_LOG_INFO(g_logger) << rounds * msgs.size() << " messages (" << ba.getSize() / msgs.size()
+        << " bytes) encode+decode: manual " << manual_us << "us, HPGS_SERIALIZE " << reflect_us << "us";
+}
+
+int main(int argc, char* argv[]){
+    test_roundtrip();
+    test_versioned();
+    test_benchmark();
+    return 0;
+}
@@ -1,7 +1,16 @@
 #include "myaddress.h"
 #include "log.h"
 #include "socket.h"
+#include "socket_stream.h"
+#include "socket_pool.h"
+#include "myendian.h"
 #include "iomanager.h"
+#include "macro.h"
+#include "util.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unordered_map>
+#include <unistd.h>
 
 HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
 
@@ -54,6 +63,30 @@ void test_ipv4(){
     }
 }
 
+void test_sockaddr(){
+    auto addr = HPGS::IPAddress::Create("192.168.1.1", 80);
+    HPGS::SockAddr sa(*addr);
+    HPGS_ASSERT(sa.getFamily() == AF_INET && sa.getPort() == 80);
+    HPGS_ASSERT(sa.toString() == addr->toString());
+    HPGS_ASSERT(*sa.toAddress() == *addr);
+
+    //作为map的key，端口置0后同一主机的地址相同
+    std::unordered_map<HPGS::SockAddr, int> m;
+    ++m[sa];
+    sa.setPort(8080);
+    ++m[sa];
+    HPGS_ASSERT(m.size() == 2);
+    sa.setPort(0);
+    HPGS::SockAddr sa2(*HPGS::IPAddress::Create("192.168.1.1", 443));
+    sa2.setPort(0);
+    HPGS_ASSERT(sa == sa2 && sa.hash() == sa2.hash());
+
+    auto addr6 = HPGS::IPAddress::Create("fe80::1", 53);
+    HPGS::SockAddr sa6(*addr6);
+    HPGS_LOG_INFO(g_logger) << sa6 << " " << *addr6;
+    HPGS_ASSERT(sa6.getPort() == 53 && sa6 != sa);
+}
+
 void test_socket(){
     //std::vector<HPGS::Address::ptr> addr;
     //HPGS::Address::Lookup(addrs, "www.baidu.com", AF_INET);
@@ -150,14 +183,321 @@ void test2(){
     }
 }
 
+/**
+ * @brief 在127.0.0.1的随机端口上创建服务端socket(TCP时listen)，在新协程中执行serve
+ * @return 服务端socket，getLocalAddress()是实际绑定的地址
+ */
+static HPGS::Socket::ptr start_server(bool udp, std::function<void(HPGS::Socket::ptr)> serve){
+    auto addr = HPGS::Address::LookupAnyIPAddress("127.0.0.1:0");
+    HPGS::Socket::ptr server = udp ? HPGS::Socket::CreateUdp(addr) : HPGS::Socket::CreateTcp(addr);
+    HPGS_ASSERT(server->bind(addr));
+    HPGS_ASSERT(udp || server->listen());
+    HPGS::IOManager::GetThis()->schedule(std::bind(serve, server));
+    return server;
+}
+
+void test_sendfile(){
+    //准备一个4MB的文件
+    const size_t file_size = 4 * 1024 * 1024;
+    char path[] = "/tmp/hpgs_sendfile_XXXXXX";
+    int fd = mkstemp(path);
+    HPGS_ASSERT(fd >= 0);
+    unlink(path);
+    std::string data(file_size, 0);
+    for(size_t i = 0; i < file_size; ++i){
+        data[i] = 'a' + i % 26;
+    }
+    HPGS_ASSERT(write(fd, &data[0], data.size()) == (ssize_t)data.size());
+
+    auto local = start_server(false, [fd, file_size](HPGS::Socket::ptr server){
+        HPGS::Socket::ptr client = server->accept();
+        HPGS_ASSERT(client);
+        uint64_t ts = HPGS::GetCurrentUs();
+        off_t offset = 0;
+        while(offset < (off_t)file_size){
+            int64_t n = client->sendFile(fd, offset, file_size - offset);
+            HPGS_ASSERT(n > 0);
+            offset += n;
+        }
+        HPGS_LOG_INFO(g_logger) << "sendFile " << file_size << " bytes used "
+                                << (HPGS::GetCurrentUs() - ts) << "us";
+        client->close();
+        close(fd);
+    })->getLocalAddress();
+
+    HPGS::Socket::ptr sock = HPGS::Socket::CreateTcp(local);
+    HPGS_ASSERT(sock->connect(local));
+    std::string buf(file_size, 0);
+    size_t offset = 0;
+    while(true){
+        int rt = sock->recv(&buf[offset], buf.size() - offset);
+        if(rt <= 0){
+            break;
+        }
+        offset += rt;
+    }
+    HPGS_LOG_INFO(g_logger) << "recv " << offset << " bytes";
+    HPGS_ASSERT(offset == file_size && buf == data);
+}
+
+void test_socket_stream(){
+    const int count = 10000;
+    auto local = start_server(false, [](HPGS::Socket::ptr server){
+        HPGS::SocketStream::ptr ss(new HPGS::SocketStream(server->accept()));
+        //多个小节点的ByteArray，一次sendmsg写出
+        HPGS::ByteArray::ptr ba(new HPGS::ByteArray(64));
+        for(int i = 0; i < count; ++i){
+            ba->writeFuint32(i);
+        }
+        ba->setPosition(0);
+        HPGS_ASSERT(ss->writeFixSize(ba, ba->getReadSize()) == count * 4);
+    })->getLocalAddress();
+
+    HPGS::Socket::ptr sock = HPGS::Socket::CreateTcp(local);
+    HPGS_ASSERT(sock->connect(local));
+    HPGS::SocketStream::ptr ss(new HPGS::SocketStream(sock));
+    uint64_t ts = HPGS::GetCurrentUs();
+    //小数据量读取走预读缓冲区
+    for(int i = 0; i < count / 2; ++i){
+        uint32_t v = 0;
+        HPGS_ASSERT(ss->readFixSize(&v, sizeof(v)) == sizeof(v));
+        HPGS_ASSERT(HPGS::byteswapOnLittleEndian(v) == (uint32_t)i);
+    }
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(64));
+    HPGS_ASSERT(ss->readFixSize(ba, count * 2) == count * 2);
+    ba->setPosition(0);
+    for(int i = count / 2; i < count; ++i){
+        HPGS_ASSERT(ba->readFuint32() == (uint32_t)i);
+    }
+    HPGS_LOG_INFO(g_logger) << "socket stream read " << count << " ints used "
+                            << (HPGS::GetCurrentUs() - ts) << "us";
+}
+
+void test_udp_batch(){
+    const int count = 100;
+    //最后一个报文由内核按100字节切成10个
+    const int total = count - 1 + 10;
+    auto local = start_server(true, [](HPGS::Socket::ptr server){
+        //收到一批就原路发回
+        HPGS::DatagramRing ring(64);
+        int n = 0;
+        while(n < total){
+            int rt = server->recvBatch(ring);
+            HPGS_ASSERT(rt > 0);
+            HPGS_ASSERT(server->sendBatch(ring) == rt);
+            n += rt;
+        }
+    })->getLocalAddress();
+
+    HPGS::Socket::ptr sock = HPGS::Socket::CreateUdp(local);
+    HPGS::DatagramRing out(count);
+    char buf[1000];
+    for(size_t i = 0; i < sizeof(buf); ++i){
+        buf[i] = i;
+    }
+    for(int i = 0; i < count - 1; ++i){
+        HPGS_ASSERT(out.push(buf, 10 + i, local));
+    }
+    HPGS_ASSERT(out.push(buf, sizeof(buf), local, 100));
+    HPGS_ASSERT(sock->sendBatch(out) == count);
+
+    HPGS::DatagramRing in(64);
+    int n = 0;
+    uint64_t bytes = 0;
+    while(n < total){
+        int rt = sock->recvBatch(in);
+        HPGS_ASSERT(rt > 0);
+        for(int i = 0; i < rt; ++i){
+            bytes += in.length(i);
+        }
+        n += rt;
+    }
+    HPGS_LOG_INFO(g_logger) << "udp batch echo " << n << " datagrams " << bytes << " bytes";
+}
+
+void test_zerocopy(){
+    const size_t size = 4 * 1024 * 1024;
+    auto local = start_server(false, [](HPGS::Socket::ptr server){
+        HPGS::Socket::ptr client = server->accept();
+        std::vector<char> buf(64 * 1024);
+        size_t n = 0;
+        int rt = 0;
+        while((rt = client->recv(&buf[0], buf.size())) > 0){
+            n += rt;
+        }
+        HPGS_ASSERT(n == size);
+    })->getLocalAddress();
+
+    HPGS::Socket::ptr sock = HPGS::Socket::CreateTcp(local);
+    HPGS_ASSERT(sock->connect(local));
+    if(!sock->setZeroCopy(true)){
+        HPGS_LOG_INFO(g_logger) << "SO_ZEROCOPY not supported";
+    }
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(64 * 1024));
+    for(size_t i = 0; i < size; ++i){
+        ba->writeFuint8(i);
+    }
+    ba->setPosition(0);
+    HPGS::SocketStream::ptr ss(new HPGS::SocketStream(sock));
+    HPGS_ASSERT(ss->writeFixSize(ba, size) == (int)size);
+    //回环网卡上内核会回退为拷贝发送
+    HPGS_ASSERT(sock->flushZeroCopy(1000));
+    HPGS_LOG_INFO(g_logger) << "zerocopy copied = " << sock->getZeroCopyCopied();
+}
+
+static uint64_t cpu_time_us(){
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ull
+        + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+void test_zerocopy_parked_recv(){
+    //对端收完数据后过一段时间才回复，期间发送方有协程挂起在recv上，完成通知陆续到达
+    const size_t size = 4 * 1024 * 1024;
+    const int reply_delay_ms = 500;
+    auto local = start_server(false, [](HPGS::Socket::ptr server){
+        HPGS::Socket::ptr client = server->accept();
+        std::vector<char> buf(64 * 1024);
+        size_t n = 0;
+        while(n < size){
+            int rt = client->recv(&buf[0], buf.size());
+            HPGS_ASSERT(rt > 0);
+            n += rt;
+        }
+        usleep(reply_delay_ms * 1000);
+        HPGS_ASSERT(client->send("done", 4) == 4);
+    })->getLocalAddress();
+
+    HPGS::Socket::ptr sock = HPGS::Socket::CreateTcp(local);
+    HPGS_ASSERT(sock->connect(local));
+    if(!sock->setZeroCopy(true)){
+        HPGS_LOG_INFO(g_logger) << "SO_ZEROCOPY not supported";
+        return;
+    }
+    HPGS::ByteArray::ptr ba(new HPGS::ByteArray(64 * 1024));
+    std::string chunk(64 * 1024, 'z');
+    for(size_t i = 0; i < size / chunk.size(); ++i){
+        ba->write(chunk.c_str(), chunk.size());
+    }
+    ba->setPosition(0);
+
+    auto replied = std::make_shared<bool>(false);
+    HPGS::IOManager::GetThis()->schedule([sock, replied](){
+        char buf[16];
+        HPGS_ASSERT(sock->recv(buf, sizeof(buf)) == 4);
+        *replied = true;
+    });
+    uint64_t cpu = cpu_time_us();
+    HPGS::SocketStream::ptr ss(new HPGS::SocketStream(sock));
+    HPGS_ASSERT(ss->writeFixSize(ba, size) == (int)size);
+    while(!*replied){
+        usleep(10 * 1000);
+    }
+    cpu = cpu_time_us() - cpu;
+    HPGS_LOG_INFO(g_logger) << "zerocopy parked recv cpu = " << cpu << "us";
+    //完成通知由等待中的recv取走，不需要flush；协程不能在EPOLLERR上空转
+    HPGS_ASSERT(sock->getZeroCopyPending() == 0);
+    HPGS_ASSERT(cpu < reply_delay_ms * 1000 / 2);
+}
+
+void test_zerocopy_close(){
+    //对端不读，发送队列里积压零拷贝数据时close，内存要保留到内核发送完成
+    auto start_read = std::make_shared<bool>(false);
+    auto local = start_server(false, [start_read](HPGS::Socket::ptr server){
+        HPGS::Socket::ptr client = server->accept();
+        while(!*start_read){
+            usleep(10 * 1000);
+        }
+        char buf[64 * 1024];
+        while(client->recv(buf, sizeof(buf)) > 0);
+    })->getLocalAddress();
+
+    HPGS::Socket::ptr sock = HPGS::Socket::CreateTcp(local);
+    HPGS_ASSERT(sock->connect(local));
+    if(!sock->setZeroCopy(true)){
+        HPGS_LOG_INFO(g_logger) << "SO_ZEROCOPY not supported";
+        return;
+    }
+    sock->setSendTimeout(100);
+    std::shared_ptr<std::string> data(new std::string(64 * 1024, 'c'));
+    std::weak_ptr<std::string> weak(data);
+    iovec iov;
+    iov.iov_base = &(*data)[0];
+    iov.iov_len = data->size();
+    while(sock->sendZeroCopy(&iov, 1, data) > 0);
+    data.reset();
+    HPGS_ASSERT(sock->getZeroCopyPending() > 0);
+
+    sock->close();
+    //超时后延迟关闭，holder仍然保留
+    HPGS_ASSERT(!weak.expired());
+    *start_read = true;
+    for(int i = 0; i < 100 && !weak.expired(); ++i){
+        usleep(50 * 1000);
+    }
+    HPGS_ASSERT(weak.expired());
+}
+
+void test_socket_pool(){
+    HPGS::Socket::ptr server = start_server(false, [](HPGS::Socket::ptr server){
+        while(HPGS::Socket::ptr client = server->accept()){
+            HPGS::IOManager::GetThis()->schedule([client](){
+                char buf[64];
+                while(client->recv(buf, sizeof(buf)) > 0);
+            });
+        }
+    });
+    auto local = server->getLocalAddress();
+
+    HPGS::SocketPool::ptr pool(new HPGS::SocketPool(local, false, 2));
+    pool->start();
+    //5个协程抢2个连接，多出来的等待归还
+    auto done = std::make_shared<int>(0);
+    for(int i = 0; i < 5; ++i){
+        HPGS::IOManager::GetThis()->schedule([pool, done](){
+            HPGS::Socket::ptr sock = pool->get();
+            HPGS_ASSERT(sock && sock->send("ping", 4) == 4);
+            usleep(50 * 1000);
+            sock.reset();
+            ++*done;
+        });
+    }
+    while(*done < 5){
+        usleep(10 * 1000);
+    }
+    HPGS_ASSERT(pool->getTotalCount() == 2 && pool->getIdleCount() == 2);
+    HPGS_ASSERT(pool->getMissCount() == 2 && pool->getHitCount() == 3);
+
+    //池满时等待超时
+    HPGS::Socket::ptr s1 = pool->get();
+    HPGS::Socket::ptr s2 = pool->get();
+    HPGS_ASSERT(s1 && s2 && !pool->get(20));
+    //关闭的连接归还时丢弃
+    s1->close();
+    s1.reset();
+    HPGS_ASSERT(pool->getTotalCount() == 1);
+    HPGS_LOG_INFO(g_logger) << pool->toString();
+    pool->stop();
+    server->close();
+}
+
 int main(int argc, char* argv[]){
     //test_ipv4();
+    test_sockaddr();
     //test_iface();
     //test();
 
     //socket
     HPGS::IOManager iom;
     iom.schedule(test_socket);
+    iom.schedule(test_sendfile);
+    iom.schedule(test_socket_stream);
+    iom.schedule(test_udp_batch);
+    iom.schedule(test_zerocopy);
+    iom.schedule(test_zerocopy_parked_recv);
+    iom.schedule(test_zerocopy_close);
+    iom.schedule(test_socket_pool);
     //iom.schedule(&test2);
     return 0;
 }
\ No newline at end of file
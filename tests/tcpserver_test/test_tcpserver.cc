@@ -1,6 +1,12 @@
 #include "tcp_server.h"
 #include "iomanager.h"
 #include "log.h"
+#include "macro.h"
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
 
 HPGS::Logger::ptr g_logger = HPGS_LOG_ROOT();
 
@@ -19,8 +25,300 @@ void run(){
     tcp_server->start();
 }
 
+void run_reuse_port(){
+    auto addr = HPGS::Address::LookupAny("0.0.0.0:8034");
+    HPGS::TcpServer::ptr tcp_server(new HPGS::TcpServer);
+    //每个io线程一个SO_REUSEPORT监听socket，按收包CPU分配连接
+    tcp_server->setReusePort(-1);
+    tcp_server->setIncomingCpu(true);
+    while(!tcp_server->bind(addr)){
+        sleep(2);
+    }
+    tcp_server->start();
+    HPGS_LOG_INFO(g_logger) << tcp_server->toString();
+}
+
+void run_reuse_port_any(){
+    //端口为0时组内所有监听socket共用同一个临时端口
+    auto addr = HPGS::Address::LookupAny("127.0.0.1:0");
+    HPGS::TcpServer::ptr tcp_server(new HPGS::TcpServer);
+    tcp_server->setReusePort(4);
+    HPGS_ASSERT(tcp_server->bind(addr));
+    auto socks = tcp_server->getSocks();
+    HPGS_ASSERT(socks.size() == 4);
+    uint32_t port = std::dynamic_pointer_cast<HPGS::IPAddress>(socks[0]->getLocalAddress())->getPort();
+    HPGS_ASSERT(port != 0);
+    for(auto& i : socks){
+        HPGS_ASSERT(std::dynamic_pointer_cast<HPGS::IPAddress>(i->getLocalAddress())->getPort() == port);
+    }
+    HPGS_LOG_INFO(g_logger) << "reuse_port_any port = " << port;
+
+    //Unix地址不能重复bind，只创建一个监听socket
+    std::string path = "/tmp/hpgs_reuse_port_" + std::to_string(getpid());
+    unlink(path.c_str());
+    HPGS::TcpServer::ptr unix_server(new HPGS::TcpServer);
+    unix_server->setReusePort(4);
+    std::vector<HPGS::Address::ptr> addrs = {addr, HPGS::Address::ptr(new HPGS::UnixAddress(path))};
+    std::vector<HPGS::Address::ptr> fails;
+    HPGS_ASSERT(unix_server->bind(addrs, fails));
+    HPGS_ASSERT(unix_server->getSocks().size() == 5);
+    HPGS_ASSERT(!unix_server->getSocks()[4]->isReusePort());
+    unlink(path.c_str());
+}
+
+//连接保持到客户端关闭
+class HoldServer : public HPGS::TcpServer {
+protected:
+    void handleClient(HPGS::Socket::ptr client) override {
+        char c;
+        while(client->recv(&c, 1) > 0);
+        client->close();
+    }
+};
+
+//等待条件成立，最多等待timeout_ms
+template<class Pred>
+static bool wait_for(Pred pred, uint64_t timeout_ms = 2000){
+    uint64_t end = HPGS::GetCurrentMs() + timeout_ms;
+    while(!pred()){
+        if(HPGS::GetCurrentMs() > end){
+            return false;
+        }
+        usleep(10 * 1000);
+    }
+    return true;
+}
+
+static std::vector<HPGS::Socket::ptr> connect_clients(HPGS::TcpServer::ptr server, size_t n){
+    HPGS::Address::ptr local = server->getSocks()[0]->getLocalAddress();
+    std::vector<HPGS::Socket::ptr> clients;
+    for(size_t i = 0; i < n; ++i){
+        HPGS::Socket::ptr sock = HPGS::Socket::CreateTcp(local);
+        HPGS_ASSERT(sock->connect(local));
+        clients.push_back(sock);
+    }
+    return clients;
+}
+
+void run_admission(){
+    auto addr = HPGS::Address::LookupAny("127.0.0.1:0");
+
+    //批量accept不丢连接
+    {
+        HPGS::TcpServer::ptr server(new HoldServer);
+        server->setAcceptBatch(4);
+        HPGS_ASSERT(server->bind(addr));
+        server->start();
+        auto clients = connect_clients(server, 20);
+        HPGS_ASSERT(wait_for([server](){ return server->getAcceptCount() == 20;}));
+        HPGS_ASSERT(server->getRejectCount() == 0);
+        HPGS_ASSERT(server->getConnectionCount() == 20);
+        for(auto& i : clients){
+            i->close();
+        }
+        HPGS_ASSERT(wait_for([server](){ return server->getConnectionCount() == 0;}));
+        server->stop();
+    }
+
+    //最多3个并发连接，其余留在监听队列中，有连接结束后再accept
+    {
+        HPGS::TcpServer::ptr server(new HoldServer);
+        server->setMaxConnections(3);
+        HPGS_ASSERT(server->bind(addr));
+        server->start();
+        auto clients = connect_clients(server, 5);
+        HPGS_ASSERT(wait_for([server](){ return server->getAcceptCount() == 3;}));
+        HPGS_ASSERT(wait_for([server](){ return server->getPauseCount() >= 1;}));
+        usleep(100 * 1000);
+        HPGS_ASSERT(server->getAcceptCount() == 3);
+        HPGS_ASSERT(server->getConnectionCount() == 3);
+
+        clients[0]->close();
+        HPGS_ASSERT(wait_for([server](){ return server->getAcceptCount() == 4;}));
+        HPGS_ASSERT(server->getConnectionCount() == 3);
+        for(auto& i : clients){
+            i->close();
+        }
+        HPGS_ASSERT(wait_for([server](){ return server->getAcceptCount() == 5
+                    && server->getConnectionCount() == 0;}));
+        HPGS_ASSERT(server->getRejectCount() == 0);
+        server->stop();
+    }
+
+    //同一个IP每秒1个新连接，突发5个，超出的连接被关闭
+    {
+        HPGS::TcpServer::ptr server(new HoldServer);
+        server->setPerIpRate(1, 5);
+        HPGS_ASSERT(server->bind(addr));
+        server->start();
+        auto clients = connect_clients(server, 10);
+        HPGS_ASSERT(wait_for([server](){
+                    return server->getAcceptCount() + server->getRejectCount() == 10;}));
+        HPGS_ASSERT(server->getAcceptCount() == 5);
+        HPGS_ASSERT(server->getRejectCount() == 5);
+        //被拒绝的连接读到EOF
+        size_t closed = 0;
+        for(auto& i : clients){
+            i->setRecvTimeout(100);
+            char c;
+            if(i->recv(&c, 1) == 0){
+                ++closed;
+            }
+            i->close();
+        }
+        HPGS_ASSERT(closed == 5);
+        HPGS_ASSERT(wait_for([server](){ return server->getConnectionCount() == 0;}));
+        server->stop();
+    }
+    HPGS_LOG_INFO(g_logger) << "run_admission ok";
+}
+
+//生成自签名证书，写入临时文件
+static void make_cert(const std::string& cn, std::string& cert_file, std::string& key_file){
+    EVP_PKEY* pkey = nullptr;
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    HPGS_ASSERT(pctx && EVP_PKEY_keygen_init(pctx) == 1);
+    HPGS_ASSERT(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) == 1);
+    HPGS_ASSERT(EVP_PKEY_keygen(pctx, &pkey) == 1);
+    EVP_PKEY_CTX_free(pctx);
+
+    X509* x509 = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+    X509_set_pubkey(x509, pkey);
+    X509_NAME* name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)cn.c_str(), -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    HPGS_ASSERT(X509_sign(x509, pkey, EVP_sha256()) > 0);
+
+    char cert_path[] = "/tmp/hpgs_cert_XXXXXX";
+    char key_path[] = "/tmp/hpgs_key_XXXXXX";
+    FILE* fp = fdopen(mkstemp(cert_path), "w");
+    HPGS_ASSERT(fp && PEM_write_X509(fp, x509) == 1);
+    fclose(fp);
+    fp = fdopen(mkstemp(key_path), "w");
+    HPGS_ASSERT(fp && PEM_write_PrivateKey(fp, pkey, nullptr, nullptr, 0, nullptr, nullptr) == 1);
+    fclose(fp);
+    cert_file = cert_path;
+    key_file = key_path;
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+}
+
+static std::string cert_cn(std::shared_ptr<SSL_CTX> ctx){
+    char buf[64] = {0};
+    X509_NAME_get_text_by_NID(X509_get_subject_name(SSL_CTX_get0_certificate(ctx.get()))
+            , NID_commonName, buf, sizeof(buf));
+    return buf;
+}
+
+//记录handleClient看到的连接状态
+class SslServer : public HPGS::TcpServer {
+public:
+    typedef std::shared_ptr<SslServer> ptr;
+    struct Seen {
+        bool handshaked;
+        bool reused;
+        HPGS::IOManager* iom;
+        std::shared_ptr<SSL_CTX> ctx;
+    };
+
+    std::vector<Seen> getSeen() {
+        HPGS::Mutex::Lock lock(m_seenMutex);
+        return m_seen;
+    }
+protected:
+    void handleClient(HPGS::Socket::ptr client) override {
+        HPGS::SSLSocket::ptr ssl = std::dynamic_pointer_cast<HPGS::SSLSocket>(client);
+        HPGS_ASSERT(ssl);
+        Seen seen = {ssl->isHandshaked(), ssl->isSessionReused()
+                    , HPGS::IOManager::GetThis(), ssl->getContext()};
+        client->send("hello", 5);
+        char c;
+        while(client->recv(&c, 1) > 0);
+        client->close();
+        HPGS::Mutex::Lock lock(m_seenMutex);
+        m_seen.push_back(seen);
+    }
+private:
+    HPGS::Mutex m_seenMutex;
+    std::vector<Seen> m_seen;
+};
+
+//TLS客户端连接一次，返回是否复用了会话
+static bool ssl_connect(HPGS::Address::ptr local){
+    HPGS::SSLSocket::ptr sock = HPGS::SSLSocket::CreateTcp(local);
+    HPGS_ASSERT(sock->connect(local));
+    //读到数据时TLS1.3的会话ticket也已经收到
+    char buf[5];
+    HPGS_ASSERT(sock->recv(buf, 5) == 5 && memcmp(buf, "hello", 5) == 0);
+    bool reused = sock->isSessionReused();
+    sock->close();
+    return reused;
+}
+
+void run_ssl(){
+    std::string cert1, key1, cert2, key2;
+    make_cert("first", cert1, key1);
+    make_cert("reload", cert2, key2);
+
+    //TLS握手放到单独的调度器，完成后再交给io线程
+    static HPGS::IOManager handshake_worker(1, false, "handshake");
+    auto addr = HPGS::Address::LookupAny("127.0.0.1:0");
+    SslServer::ptr server(new SslServer);
+    server->setHandshakeWorker(&handshake_worker);
+    HPGS_ASSERT(server->loadCertificates(cert1, key1));
+    HPGS_ASSERT(server->bind(addr, true));
+    server->start();
+    HPGS::Address::ptr local = server->getSocks()[0]->getLocalAddress();
+    auto first_ctx = server->getSSLContext();
+    HPGS_ASSERT(cert_cn(first_ctx) == "first");
+
+    //第二次连接复用第一次的会话
+    HPGS_ASSERT(!ssl_connect(local));
+    HPGS_ASSERT(ssl_connect(local));
+
+    //重新加载证书，之后的连接使用新证书，旧ticket失效
+    HPGS_ASSERT(!server->loadCertificates("/nonexistent.crt", key2));
+    HPGS_ASSERT(server->getSSLContext() == first_ctx);
+    HPGS_ASSERT(server->loadCertificates(cert2, key2));
+    auto reload_ctx = server->getSSLContext();
+    HPGS_ASSERT(reload_ctx != first_ctx);
+    HPGS_ASSERT(cert_cn(reload_ctx) == "reload");
+    HPGS_ASSERT(!ssl_connect(local));
+    HPGS_ASSERT(ssl_connect(local));
+
+    //握手失败的连接不会交给handleClient
+    HPGS::Socket::ptr plain = HPGS::Socket::CreateTcp(local);
+    HPGS_ASSERT(plain->connect(local));
+    plain->send("not a tls client\r\n", 18);
+    plain->close();
+    HPGS_ASSERT(wait_for([server](){ return server->getHandshakeFailCount() == 1;}));
+
+    HPGS_ASSERT(wait_for([server](){ return server->getSeen().size() == 4;}));
+    auto seen = server->getSeen();
+    for(size_t i = 0; i < seen.size(); ++i){
+        //handleClient开始时握手已经在握手调度器上完成
+        HPGS_ASSERT(seen[i].handshaked);
+        HPGS_ASSERT(seen[i].iom == HPGS::IOManager::GetThis());
+        HPGS_ASSERT(seen[i].ctx == (i < 2 ? first_ctx : reload_ctx));
+    }
+    server->stop();
+
+    unlink(cert1.c_str());
+    unlink(key1.c_str());
+    unlink(cert2.c_str());
+    unlink(key2.c_str());
+    HPGS_LOG_INFO(g_logger) << "run_ssl ok";
+}
+
 int main(int argc, char* argv[]){
     HPGS::IOManager iom(2);
+    iom.schedule(run_reuse_port_any);
+    iom.schedule(run_admission);
     iom.schedule(run);
+    //iom.schedule(run_reuse_port);
+    iom.schedule(run_ssl);
     return 0;
 }
\ No newline at end of file